@@ -140,8 +140,8 @@ int rs_repair_ti8x_app(RSProgram* app,	   /* app to repair */
   if (hdrsize > 128)
     hdrsize = 128;
 
-  if (rs_find_app_field(0x8080, hdr, hdrsize,
-			NULL, &fieldstart, &fieldsize)) {
+  if (rs_program_find_field(app, 0x8080, hdr, hdrsize,
+			    NULL, &fieldstart, &fieldsize)) {
     if (flags & RS_IGNORE_ALL_WARNINGS)
       rs_warning(NULL, app, "application has no page count field");
     else {
@@ -188,7 +188,7 @@ int rs_repair_ti8x_app(RSProgram* app,	   /* app to repair */
      integer, but to be more precise, they're really treated as a
      binary string.) */
 
-  if (rs_find_app_field(0x8010, hdr, hdrsize, NULL, NULL, NULL)) {
+  if (rs_program_find_field(app, 0x8010, hdr, hdrsize, NULL, NULL, NULL)) {
     if (flags & RS_IGNORE_ALL_WARNINGS)
       rs_warning(NULL, app, "application has no key ID");
     else {
@@ -204,8 +204,8 @@ int rs_repair_ti8x_app(RSProgram* app,	   /* app to repair */
      (The contents of the latter only matter if the date stamp is
      "new.") */
 
-  if (rs_find_app_field(0x0320, hdr, hdrsize,
-			NULL, &fieldstart, &fieldsize)) {
+  if (rs_program_find_field(app, 0x0320, hdr, hdrsize,
+			    NULL, &fieldstart, &fieldsize)) {
     if (flags & RS_IGNORE_ALL_WARNINGS)
       rs_warning(NULL, app, "application has no date stamp");
     else {
@@ -239,8 +239,8 @@ int rs_repair_ti8x_app(RSProgram* app,	   /* app to repair */
      should always be written as 80 7F followed by four length bytes.
      The length bytes may be anything you like -- they're ignored. */
 
-  if (rs_find_app_field(0x8070, hdr, hdrsize,
-			NULL, NULL, NULL)) {
+  if (rs_program_find_field(app, 0x8070, hdr, hdrsize,
+			    NULL, NULL, NULL)) {
     if (rs_find_app_field(0x8170, hdr, hdrsize+0x40,
 		      NULL, NULL, NULL)) {
       if (flags & RS_IGNORE_ALL_WARNINGS)
@@ -281,16 +281,12 @@ int rs_repair_ti8x_app(RSProgram* app,	   /* app to repair */
  * There are four equally valid Rabin signatures for any application;
  * rootnum determines which of the four should be used.
  */
-int rs_sign_ti8x_app(RSProgram* app, /* app to sign */
-		     RSKey* key,     /* signing key */
+int rs_sign_ti8x_app(RSProgram* app,  /* app to sign */
+		     const RSKey* key, /* signing key */
 		     int rootnum)    /* signature number */
 {
-  md5_uint32 hash[4];
-  mpz_t hashv, sigv;
-  int f;
-  unsigned int lastpagelength;
-  unsigned char sigdata[512];
-  size_t siglength;
+  RSDigest digest;
+  RSSignature sig;
   int e;
 
   /* Check if app length is risky */
@@ -302,19 +298,26 @@ int rs_sign_ti8x_app(RSProgram* app, /* app to sign */
 
   /* Compute signature */
 
-  md5_buffer((char*) app->data, app->length, hash);
-
-  mpz_init(hashv);
-  mpz_init(sigv);
+  rs_program_make_digest(app, key, RS_SIG_RABIN, RS_KEY_MD5, 0, &digest);
 
-  mpz_import(hashv, 16, -1, 1, 0, 0, hash);
-  rs_message(2, NULL, app, "hash = %ZX", hashv);
+  rs_signature_init(&sig);
+  if (!(e = rs_sign_digest_with_context(rs_get_context(key, app), &digest,
+					  key, rootnum, &sig)))
+    e = rs_ti8x_app_add_signature(app, sig.value, sig.f);
+  rs_signature_clear(&sig);
+  return e;
+}
 
-  if ((e = rs_sign_rabin(sigv, &f, hashv, rootnum, key))) {
-    mpz_clear(hashv);
-    mpz_clear(sigv);
-    return e;
-  }
+/*
+ * Append a Rabin signature to a Flash app.
+ */
+int rs_ti8x_app_add_signature(RSProgram* app,	 /* app to sign */
+			      const mpz_t sigv, /* square root value */
+			      int f)		 /* f value */
+{
+  unsigned int lastpagelength;
+  unsigned char sigdata[512];
+  size_t siglength;
 
   rs_message(2, NULL, app, "sig = %ZX", sigv);
   rs_message(2, NULL, app, "f = %d", f);
@@ -329,9 +332,6 @@ int rs_sign_ti8x_app(RSProgram* app, /* app to sign */
   sigdata[3] = siglength & 0xff;
   siglength += 4;
 
-  mpz_clear(hashv);
-  mpz_clear(sigv);
-
   /* ...and append the f value as a big integer */
 
   if (f == 0) {
@@ -382,16 +382,16 @@ int rs_validate_ti8x_app(const RSProgram* app, /* app to validate */
     //return RS_ERR_INCORRECT_PROGRAM_SIZE;
   }
 
-  if (rs_find_app_field(0x8070, hdr, hdrsize,
-			NULL, NULL, NULL)) {
-    if (rs_find_app_field(0x8170, hdr, hdrsize, NULL,NULL,NULL)) {
+  if (rs_program_find_field(app, 0x8070, hdr, hdrsize,
+			    NULL, NULL, NULL)) {
+    if (rs_program_find_field(app, 0x8170, hdr, hdrsize, NULL,NULL,NULL)) {
       rs_warning(NULL, app, "application has no program image field");
       e2 = RS_ERR_MISSING_PROGRAM_IMAGE;
     }
   }
 
-  if (rs_find_app_field(0x8080, hdr, hdrsize,
-			NULL, &fieldstart, &fieldsize)) {
+  if (rs_program_find_field(app, 0x8080, hdr, hdrsize,
+			    NULL, &fieldstart, &fieldsize)) {
     rs_warning(NULL, app, "application has no no page count field");
     e2 = RS_ERR_MISSING_PAGE_COUNT;
   }
@@ -417,7 +417,8 @@ int rs_validate_ti8x_app(const RSProgram* app, /* app to validate */
     }
   }
 
-  md5_buffer((char*) app->data, length, &hash);
+  rs_program_get_digest(app, key, RS_KEY_MD5, 0, length,
+			(unsigned char*) hash);
 
   sig = app->data + length;
   if (sig[0] != 0x02 || (sig[1] != 0x2d && (sig[0]&0xf0) !=0x30)) {
@@ -95,8 +95,8 @@ static int repair_app(RSProgram* app,     /* app to repair */
  // if (hdrsize > 128)
  //   hdrsize = 128;
 
-  if (rs_find_app_field((type << 8) | 0x10, hdr, hdrsize,
-			NULL, NULL, NULL)) {
+  if (rs_program_find_field(app, (type << 8) | 0x10, hdr, hdrsize,
+			    NULL, NULL, NULL)) {
     if (flags & RS_IGNORE_ALL_WARNINGS)
       rs_warning(NULL, app, "application has no key ID");
     else {
@@ -109,8 +109,8 @@ static int repair_app(RSProgram* app,     /* app to repair */
      this is required, but it always seems to be present in both 68k
      apps and OSes, and it is required for TI-83+ apps) */
 
-  if (rs_find_app_field(0x0320, hdr, hdrsize,
-			NULL, &fieldstart, &fieldsize)) {
+  if (rs_program_find_field(app, 0x0320, hdr, hdrsize,
+			    NULL, &fieldstart, &fieldsize)) {
     if (flags & RS_IGNORE_ALL_WARNINGS)
       rs_warning(NULL, app, "application has no date stamp");
     else {
@@ -139,8 +139,8 @@ static int repair_app(RSProgram* app,     /* app to repair */
 
   /* Check for program image field and fix length */
 
-  if (rs_find_app_field((type << 8) | 0x70, hdr, hdrsize,
-			&fieldhead, &fieldstart, &fieldsize)) {
+  if (rs_program_find_field(app, (type << 8) | 0x70, hdr, hdrsize,
+			    &fieldhead, &fieldstart, &fieldsize)) {
     if (flags & RS_IGNORE_ALL_WARNINGS)
       rs_warning(NULL, app, "application has no program image field");
     else {
@@ -168,6 +168,7 @@ static int repair_app(RSProgram* app,     /* app to repair */
       rs_error(NULL, app, "cannot set program image length");
       return RS_ERR_FIELD_TOO_SMALL;
     }
+    rs_program_invalidate_header_index(app);
   }
 
   return RS_SUCCESS;
@@ -197,39 +198,34 @@ int rs_repair_ti9x_os(RSProgram* app,     /* app to repair */
  * The app header should be checked and/or repaired by
  * rs_repair_ti9x_app() prior to calling this function.
  */
-int rs_sign_ti9x_app(RSProgram* app, /* app to sign */
-		     RSKey* key)     /* signing key */
+int rs_sign_ti9x_app(RSProgram* app,   /* app to sign */
+		     const RSKey* key) /* signing key */
 {
-  md5_uint32 md5hash[4];
-  uint32_t sha256hash[8];
-  struct sha256_ctx sha256ctx;
-  mpz_t hashv, sigv;
-  unsigned char sigdata[512];
-  size_t siglength;
+  RSDigest digest;
+  RSSignature sig;
   int e;
-  mpz_init(hashv);
-  mpz_init(sigv);
-  if (app->keytype == RS_KEY_SHA256) {
-    sha256_init_ctx(&sha256ctx);
-    sha256_process_bytes((char*) app->data,app->length,&sha256ctx);
-    sha256_finish_ctx(&sha256ctx,sha256hash);
-    
-    mpz_import(hashv, 32, -1, 1, 0, 0, sha256hash);
-  } else {
-    md5_buffer((char*) app->data, app->length, &md5hash);
-    mpz_import(hashv, 16, -1, 1, 0, 0, &md5hash);
-  }
 
+  if (app->keytype == RS_KEY_SHA256)
+    rs_program_make_digest(app, key, RS_SIG_RSA, RS_KEY_SHA256, 0, &digest);
+  else
+    rs_program_make_digest(app, key, RS_SIG_RSA, RS_KEY_MD5, 0, &digest);
+
+  rs_signature_init(&sig);
+  if (!(e = rs_sign_digest_with_context(rs_get_context(key, app), &digest,
+					  key, 0, &sig)))
+    e = rs_ti9x_app_add_signature(app, sig.value);
+  rs_signature_clear(&sig);
+  return e;
+}
 
-
-
-  rs_message(2, NULL, app, "hash = %ZX", hashv);
-
-  if ((e = rs_sign_rsa(sigv, hashv, key))) {
-    mpz_clear(hashv);
-    mpz_clear(sigv);
-    return e;
-  }
+/*
+ * Append an RSA signature to an app/OS.
+ */
+int rs_ti9x_app_add_signature(RSProgram* app,	/* app to sign */
+			      const mpz_t sigv) /* signature */
+{
+  unsigned char sigdata[512];
+  size_t siglength;
 
   rs_message(2, NULL, app, "sig = %ZX", sigv);
 
@@ -255,7 +251,6 @@ int rs_validate_ti9x_app(const RSProgram* app, /* app to validate */
   const unsigned char *hdr, *sig;
   md5_uint32 md5hash[4];
   uint32_t sha256hash[8];
-  struct sha256_ctx sha256ctx;
   mpz_t hashv, sigv;
   int e, e2 = RS_SUCCESS;
 
@@ -275,8 +270,8 @@ int rs_validate_ti9x_app(const RSProgram* app, /* app to validate */
     return RS_ERR_INCORRECT_PROGRAM_SIZE;
   }
 
-  if (rs_find_app_field((app->data[0] << 8) | 0x70, hdr, hdrsize,
-			NULL, &fieldstart, &fieldsize)) {
+  if (rs_program_find_field(app, (app->data[0] << 8) | 0x70, hdr, hdrsize,
+			    NULL, &fieldstart, &fieldsize)) {
     rs_warning(NULL, app, "application has no program image field");
     e2 = RS_ERR_MISSING_PROGRAM_IMAGE;
   }
@@ -290,13 +285,12 @@ int rs_validate_ti9x_app(const RSProgram* app, /* app to validate */
   mpz_init(hashv);
   mpz_init(sigv);
   if (app->keytype == RS_KEY_SHA256) {
-    sha256_init_ctx(&sha256ctx);
-    sha256_process_bytes(app->data,length,&sha256ctx);
-    sha256_finish_ctx(&sha256ctx,sha256hash);
-    
+    rs_program_get_digest(app, key, RS_KEY_SHA256, 0, length,
+			  (unsigned char*) sha256hash);
     mpz_import(hashv, 32, -1, 1, 0, 0, sha256hash);
   } else {
-    md5_buffer((char*) app->data, app->length, &md5hash);
+    rs_program_get_digest(app, key, RS_KEY_MD5, 0, app->length,
+			  (unsigned char*) md5hash);
     mpz_import(hashv, 16, -1, 1, 0, 0, &md5hash);
   }
   sig = app->data + length;
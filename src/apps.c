@@ -22,14 +22,22 @@
 
 #include <stdio.h>
 
+#ifdef HAVE_STRING_H
+# include <string.h>
+#else
+# ifdef HAVE_STRINGS_H
+#  include <strings.h>
+# endif
+#endif
+
 #include "rabbitsign.h"
 #include "internal.h"
 
 /*
- * Check/fix program header and data.
+ * Check/fix program header and data, according to its type.
  */
-int rs_repair_program(RSProgram* prgm,	  /* app to repair */
-		      unsigned int flags) /* flags */
+static int repair_by_type(RSProgram* prgm,	  /* app to repair */
+			  unsigned int flags) /* flags */
 {
   if (rs_calc_is_ti8x(prgm->calctype)&& prgm->keytype==RS_KEY_MD5) {
     if (prgm->datatype == RS_DATA_OS)
@@ -50,21 +58,271 @@ int rs_repair_program(RSProgram* prgm,	  /* app to repair */
   return RS_ERR_UNKNOWN_PROGRAM_TYPE;
 }
 
+/*
+ * Check/fix program header and data (without timing.)
+ *
+ * A digest read from a container (see RS_INPUT_TRUST_DIGEST) is kept
+ * only if the repair leaves the part of the program that it covers
+ * exactly as it was.  Finding that out requires a copy of that part,
+ * but copying and comparing is still much faster than hashing it
+ * again.
+ */
+static int repair_program(RSProgram* prgm,	  /* app to repair */
+			  unsigned int flags) /* flags */
+{
+  RSProgramDigest* digest = prgm->digest;
+  unsigned long length = 0, hdrlen = 0;
+  unsigned char* copy = NULL;
+  int e;
+
+  prgm->digest = NULL;
+  if (digest && digest->length <= prgm->length) {
+    length = digest->length;
+    hdrlen = (digest->withheader ? prgm->header_length : 0);
+    if ((copy = rs_ctx_malloc(prgm->ctx, length + hdrlen + 1))) {
+      memcpy(copy, prgm->data, length);
+      if (hdrlen)
+	memcpy(copy + length, prgm->header, hdrlen);
+    }
+  }
+
+  e = repair_by_type(prgm, flags);
+
+  if (!e && copy && !prgm->digest && prgm->length >= length
+      && (!digest->withheader || prgm->header_length == hdrlen)
+      && !memcmp(copy, prgm->data, length)
+      && (!hdrlen || !memcmp(copy + length, prgm->header, hdrlen))) {
+    prgm->digest = digest;
+    digest = NULL;
+  }
+
+  rs_ctx_free(prgm->ctx, digest);
+  rs_ctx_free(prgm->ctx, copy);
+  return e;
+}
+
+/*
+ * Check/fix program header and data.
+ */
+int rs_repair_program(RSProgram* prgm,	  /* app to repair */
+		      unsigned int flags) /* flags */
+{
+  RSContext* ctx = rs_get_context(NULL, prgm);
+  double start = rs_phase_start(ctx);
+  int e;
+
+  e = repair_program(prgm, flags);
+  rs_phase_end(ctx, RS_PHASE_REPAIR, start, prgm->length);
+  return e;
+}
+
+/*
+ * Determine how a program is to be signed.
+ */
+static void get_sign_params(const RSProgram* prgm, /* program */
+			    RSSigScheme* scheme,   /* signature scheme */
+			    RSKeyType* alg,	   /* hash algorithm */
+			    int* withheader)	   /* 1 = hash OS header
+						      first */
+{
+  *withheader = 0;
+
+  if (rs_calc_is_ti8x(prgm->calctype) && prgm->keytype == RS_KEY_MD5
+      && prgm->datatype == RS_DATA_OS) {
+    *scheme = RS_SIG_RSA;
+    *alg = RS_KEY_MD5;
+    *withheader = 1;
+  }
+  else if (rs_calc_is_ti8x(prgm->calctype) && prgm->keytype == RS_KEY_MD5
+	   && prgm->datatype == RS_DATA_APP) {
+    *scheme = RS_SIG_RABIN;
+    *alg = RS_KEY_MD5;
+  }
+  else {
+    *scheme = RS_SIG_RSA;
+    *alg = (prgm->keytype == RS_KEY_SHA256 ? RS_KEY_SHA256 : RS_KEY_MD5);
+  }
+}
+
+static void compute_digest(const RSProgram* prgm, /* program */
+			   const RSKey* key,	  /* key (for
+						     statistics) */
+			   RSDigest* digest)	  /* digest */
+{
+  RSSigScheme scheme;
+  RSKeyType alg;
+  int withheader;
+
+  get_sign_params(prgm, &scheme, &alg, &withheader);
+
+  /* Check if app length is risky */
+
+  if (scheme == RS_SIG_RABIN && (prgm->length % 64) == 55) {
+    rs_warning(NULL, prgm, "application has length 55 mod 64");
+    rs_warning(NULL, prgm, "(this will fail to validate on TI-83+ BE)");
+  }
+
+  rs_program_make_digest(prgm, key, scheme, alg, withheader, digest);
+}
+
+/*
+ * Compute the digest that will be signed.
+ *
+ * The program should already have been repaired; the digest covers
+ * the program exactly as it stands.  The digest can then be signed
+ * (rs_sign_digest()) and the signature added to the program
+ * (rs_program_attach_signature()) at some later time.
+ */
+int rs_program_compute_digest(const RSProgram* prgm, /* program */
+			      RSDigest* digest)	     /* digest */
+{
+  compute_digest(prgm, NULL, digest);
+  return RS_SUCCESS;
+}
+
+/*
+ * Initialize a signature structure.
+ */
+void rs_signature_init(RSSignature* sig) /* signature */
+{
+  sig->scheme = RS_SIG_RSA;
+  mpz_init(sig->value);
+  sig->f = 0;
+}
+
+/*
+ * Free a signature structure.
+ */
+void rs_signature_clear(RSSignature* sig) /* signature */
+{
+  mpz_clear(sig->value);
+}
+
+/*
+ * Sign a digest (or look up its signature in the signature cache.)
+ *
+ * sig must have been initialized using rs_signature_init().  The
+ * rootnum is ignored for RSA signatures.  The signature cache of the
+ * key's context is used.
+ */
+int rs_sign_digest(const RSDigest* digest, /* digest to sign */
+		   const RSKey* key,	   /* signing key */
+		   int rootnum,		   /* signature number */
+		   RSSignature* sig)	   /* signature */
+{
+  return rs_sign_digest_with_context(rs_get_context(key, NULL), digest,
+				     key, rootnum, sig);
+}
+
+/*
+ * Sign a digest, using the given context's signature cache.
+ */
+int rs_sign_digest_with_context(RSContext* ctx,	/* context (NULL =
+						   default) */
+				const RSDigest* digest, /* digest to sign */
+				const RSKey* key,	/* signing key */
+				int rootnum,	/* signature number */
+				RSSignature* sig) /* signature */
+{
+  mpz_t hashv;
+  RSSigCache* sc;
+  int sctype, e = RS_SUCCESS;
+
+  if (digest->length > sizeof(digest->value)) {
+    rs_error(key, NULL, "invalid digest length %u", digest->length);
+    return RS_ERR_CRITICAL;
+  }
+
+  if (digest->scheme == RS_SIG_RABIN) {
+    sctype = RS_SIG_CACHE_RABIN;
+  }
+  else {
+    sctype = digest->alg;
+    rootnum = 0;
+  }
+
+  mpz_init(hashv);
+  mpz_import(hashv, digest->length, -1, 1, 0, 0, digest->value);
+  rs_message(2, key, NULL, "hash = %ZX", hashv);
+
+  sig->scheme = digest->scheme;
+  sig->f = 0;
+
+  sc = (ctx ? ctx : rs_get_context(NULL, NULL))->sigcache;
+  if (!sc || rs_sig_cache_lookup(sc, key, sctype, digest->value,
+				 digest->length, rootnum,
+				 sig->value, &sig->f)) {
+    if (digest->scheme == RS_SIG_RABIN)
+      e = rs_sign_rabin(sig->value, &sig->f, hashv, rootnum, key);
+    else
+      e = rs_sign_rsa(sig->value, hashv, key);
+
+    if (!e && sc)
+      rs_sig_cache_store(sc, key, sctype, digest->value, digest->length,
+			 rootnum, sig->value, sig->f);
+  }
+
+  mpz_clear(hashv);
+  return e;
+}
+
+/*
+ * Add a signature to the program.  The signature must have been
+ * computed from the program's digest (see
+ * rs_program_compute_digest()); the program must not have been
+ * modified since then.
+ */
+int rs_program_attach_signature(RSProgram* prgm,	/* program */
+				const RSSignature* sig) /* signature */
+{
+  RSSigScheme scheme;
+  RSKeyType alg;
+  int withheader, e;
+
+  get_sign_params(prgm, &scheme, &alg, &withheader);
+  if (sig->scheme != scheme) {
+    rs_error(NULL, prgm, "wrong type of signature for this program");
+    return RS_ERR_UNKNOWN_PROGRAM_TYPE;
+  }
+
+  rs_program_discard_digest(prgm);
+
+  if (scheme == RS_SIG_RABIN)
+    e = rs_ti8x_app_add_signature(prgm, sig->value, sig->f);
+  else if (withheader)
+    e = rs_ti8x_os_add_signature(prgm, sig->value);
+  else
+    e = rs_ti9x_app_add_signature(prgm, sig->value);
+
+  if (!e)
+    RS_ATOMIC_ADD(rs_get_context(NULL, prgm)->stats.signatures, 1);
+  return e;
+}
+
 /*
  * Add a signature to the program.
  */
-int rs_sign_program(RSProgram* prgm, /* app to sign */
-		    RSKey* key,      /* signing key */
+int rs_sign_program(RSProgram* prgm,  /* app to sign */
+		    const RSKey* key, /* signing key */
 		    int rootnum)     /* signature number */
 {
-  if (rs_calc_is_ti8x(prgm->calctype)&&prgm->keytype==RS_KEY_MD5) {
-    if (prgm->datatype == RS_DATA_OS)
-      return rs_sign_ti8x_os(prgm, key);
-    else if (prgm->datatype == RS_DATA_APP)
-      return rs_sign_ti8x_app(prgm, key, rootnum);
-  }
+  RSContext* ctx = rs_get_context(NULL, prgm);
+  RSDigest digest;
+  RSSignature sig;
+  double start;
+  int e;
 
-  return rs_sign_ti9x_app(prgm, key);
+  compute_digest(prgm, key, &digest);
+
+  rs_signature_init(&sig);
+  start = rs_phase_start(ctx);
+  e = rs_sign_digest_with_context(rs_get_context(key, prgm), &digest,
+				  key, rootnum, &sig);
+  rs_phase_end(ctx, RS_PHASE_MATH, start, 0);
+  if (!e)
+    e = rs_program_attach_signature(prgm, &sig);
+  rs_signature_clear(&sig);
+  return e;
 }
 
 /*
@@ -73,13 +331,167 @@ int rs_sign_program(RSProgram* prgm, /* app to sign */
 int rs_validate_program(const RSProgram* prgm, /* app to validate */
 			const RSKey* key)      /* signing key */
 {
-  if (rs_calc_is_ti8x(prgm->calctype)&&prgm->keytype==RS_KEY_MD5) {
-    if (prgm->datatype == RS_DATA_OS)
-      return rs_validate_ti8x_os(prgm, key);
-    else if (prgm->datatype == RS_DATA_APP)
-      return rs_validate_ti8x_app(prgm, key);
+  RSContext* ctx = rs_get_context(key, prgm);
+  double start = rs_phase_start(ctx);
+  double hashtime = ctx->stats.phase_time[RS_PHASE_HASH];
+  int e;
+
+  RS_ATOMIC_ADD(ctx->stats.validations, 1);
+
+  if (rs_calc_is_ti8x(prgm->calctype) && prgm->keytype == RS_KEY_MD5
+      && prgm->datatype == RS_DATA_OS)
+    e = rs_validate_ti8x_os(prgm, key);
+  else if (rs_calc_is_ti8x(prgm->calctype) && prgm->keytype == RS_KEY_MD5
+	   && prgm->datatype == RS_DATA_APP)
+    e = rs_validate_ti8x_app(prgm, key);
+  else
+    e = rs_validate_ti9x_app(prgm, key);
+
+  /* (the time spent hashing is counted separately) */
+  if (start != 0.0)
+    start += ctx->stats.phase_time[RS_PHASE_HASH] - hashtime;
+  rs_phase_end(ctx, RS_PHASE_MATH, start, 0);
+  return e;
+}
+
+
+/*
+ * Determine which digest is used to sign or validate a program, as
+ * it stands (i.e., after it has been signed.)
+ *
+ * Returns 0 if successful, or -1 if the program is not complete
+ * enough to tell.
+ */
+int rs_program_digest_params(const RSProgram* prgm,   /* program */
+			     RSKeyType* alg,	      /* hash algorithm */
+			     int* withheader,	      /* 1 = hash OS
+							 header first */
+			     unsigned long* length)   /* number of bytes
+							 of data hashed */
+{
+  unsigned long hdrstart, hdrsize;
+
+  if (rs_calc_is_ti8x(prgm->calctype) && prgm->keytype == RS_KEY_MD5
+      && prgm->datatype == RS_DATA_OS) {
+    *alg = RS_KEY_MD5;
+    *withheader = 1;
+    *length = prgm->length;
+    return 0;
   }
 
-  return rs_validate_ti9x_app(prgm, key);
+  if (prgm->length < 6 || (prgm->datatype != RS_DATA_OS
+			   && prgm->datatype != RS_DATA_APP))
+    return -1;
+
+  rs_get_field_size(prgm->data, &hdrstart, &hdrsize);
+  *withheader = 0;
+
+  if (rs_calc_is_ti8x(prgm->calctype) && prgm->keytype == RS_KEY_MD5) {
+    *alg = RS_KEY_MD5;
+    *length = hdrstart + hdrsize;
+  }
+  else if (prgm->keytype == RS_KEY_SHA256) {
+    *alg = RS_KEY_SHA256;
+    *length = hdrstart + hdrsize;
+  }
+  else {
+    *alg = RS_KEY_MD5;
+    *length = prgm->length;
+  }
+
+  return (*length <= prgm->length ? 0 : -1);
 }
 
+/*
+ * Sign copies of a program with several keys and/or root numbers.
+ *
+ * The program should already have been repaired.  The digest is
+ * computed only once, and is shared by all targets; each key is used
+ * only once, so targets that differ only in root number cost no more
+ * than one (all four Rabin signatures are computed from the same pair
+ * of square roots), and targets that use the same RSA key share a
+ * single signature.
+ *
+ * Each target's result is a new program (which the caller must
+ * free), or NULL if it could not be signed.
+ */
+int rs_sign_program_multi(const RSProgram* prgm,  /* program to sign */
+			  RSSignTarget* targets, /* keys and root numbers */
+			  int ntargets)		 /* number of targets */
+{
+  RSProgram* result;
+  RSDigest digest;
+  RSSignature sig;
+  RSContext* ctx = rs_get_context(NULL, prgm);
+  mpz_t hashv, sigs[4];
+  int i, j, k, e, e2, status = RS_SUCCESS;
+  double start;
+
+  if (ntargets < 1)
+    return RS_SUCCESS;
+
+  for (i = 0; i < ntargets; i++) {
+    targets[i].result = NULL;
+    targets[i].status = RS_ERR_OUT_OF_MEMORY;
+  }
+
+  /* Compute the digest once */
+
+  compute_digest(prgm, targets[0].key, &digest);
+
+  rs_signature_init(&sig);
+  mpz_init(hashv);
+  for (i = 0; i < 4; i++)
+    mpz_init(sigs[i]);
+  mpz_import(hashv, digest.length, -1, 1, 0, 0, digest.value);
+
+  /* Sign once with each distinct key */
+
+  start = rs_phase_start(ctx);
+  for (i = 0; i < ntargets; i++) {
+    for (k = 0; k < i && targets[k].key != targets[i].key; k++)
+      ;
+    if (k < i)
+      continue;
+
+    if (digest.scheme == RS_SIG_RABIN) {
+      sig.scheme = RS_SIG_RABIN;
+      e = rs_sign_rabin_all(sigs, &sig.f, hashv, targets[i].key);
+    }
+    else {
+      e = rs_sign_digest_with_context(rs_get_context(targets[i].key, prgm),
+				      &digest, targets[i].key, 0, &sig);
+    }
+
+    for (j = i; j < ntargets; j++) {
+      if (targets[j].key != targets[i].key)
+	continue;
+
+      result = NULL;
+      e2 = RS_ERR_OUT_OF_MEMORY;
+      if (!e && (result = rs_program_copy(prgm))) {
+	if (digest.scheme == RS_SIG_RABIN)
+	  mpz_set(sig.value, sigs[targets[j].rootnum & 3]);
+
+	rs_program_discard_digest(result);
+	if ((e2 = rs_program_attach_signature(result, &sig))) {
+	  rs_program_free(result);
+	  result = NULL;
+	}
+      }
+
+      targets[j].result = result;
+      targets[j].status = (e ? e : e2);
+      if (targets[j].status)
+	status = targets[j].status;
+    }
+  }
+
+  rs_phase_end(ctx, RS_PHASE_MATH, start, 0);
+
+  rs_signature_clear(&sig);
+  mpz_clear(hashv);
+  for (i = 0; i < 4; i++)
+    mpz_clear(sigs[i]);
+  return status;
+}
@@ -63,9 +63,25 @@ unsigned long rs_program_get_key_id(const RSProgram* prgm)
   hdrsize -= hdrstart;
 
   if (hdr[0] == 0x81)
-    return rs_get_numeric_field(0x8110, hdr + hdrstart, hdrsize);
+    return rs_program_get_numeric_field(prgm, 0x8110, hdr + hdrstart,
+					hdrsize);
   else
-    return rs_get_numeric_field(0x8010, hdr + hdrstart, hdrsize);
+    return rs_program_get_numeric_field(prgm, 0x8010, hdr + hdrstart,
+					hdrsize);
+}
+
+/*
+ * Load a value from the builtin key table.
+ */
+static void load_builtin_value(mpz_t dest,			/* mpz to
+								   store
+								   result */
+			       const struct keyvalue* value)	/* value */
+{
+  if (value->length)
+    mpz_import(dest, value->length, -1, 1, 0, 0, value->data);
+  else
+    mpz_set_ui(dest, 0);
 }
 
 /*
@@ -77,7 +93,6 @@ static int try_key_file(RSKey* key, /* key structure to store result */
 			const char* c) /* third path element */
 {
   char* s;
-  FILE* f;
   int e;
 
   s = rs_malloc(strlen(a) + strlen(b) + strlen(c) + 1);
@@ -87,21 +102,9 @@ static int try_key_file(RSKey* key, /* key structure to store result */
   strcat(s, b);
   strcat(s, c);
 
-  f = fopen(s, "rt");
-  if (!f) {
-    rs_free(s);
-    return RS_ERR_KEY_NOT_FOUND;
-  }
-
-  if ((e = rs_read_key_file(key, f, s, 1))) {
-    fclose(f);
-    rs_free(s);
-    return e;
-  }
-
-  fclose(f);
+  e = rs_read_key_path(key, s);
   rs_free(s);
-  return RS_SUCCESS;
+  return e;
 }
 
 /*
@@ -146,6 +149,32 @@ static int find_key_file(RSKey* key,           /* key structure to
   return RS_ERR_KEY_NOT_FOUND;
 }
 
+/*
+ * Load the first available key file for the given ID, using the key
+ * file index.  Returns -1 if the index cannot be used.
+ */
+static int find_indexed_key_file(RSKey* key,	      /* key structure to
+							 store result */
+				 unsigned long keyid, /* key ID */
+				 int pub)	      /* 1 = search for
+							 .pub files */
+{
+  const char* paths[16];
+  int n, i, e;
+
+  n = rs_key_index_find(keyid, pub, paths, 16);
+  if (n < 0)
+    return -1;
+
+  for (i = 0; i < n; i++) {
+    e = try_key_file(key, "", "", paths[i]);
+    if (e != RS_ERR_KEY_NOT_FOUND)
+      return e;
+  }
+
+  return RS_ERR_KEY_NOT_FOUND;
+}
+
 /*
  * Find key file for the given ID.
  */
@@ -158,33 +187,30 @@ int rs_key_find_for_id(RSKey* key,	    /* key structure to store
   static const char* fmts[] = { "%02lx.%s", "%02lX.%s",
 				"%04lx.%s", "%04lX.%s", NULL };
   char buf[16];
-  int i, e;
+  int i, e, pub;
 
   mpz_set_ui(key->p, 0);
   mpz_set_ui(key->q, 0);
   mpz_set_ui(key->e, 17);
   mpz_set_ui(key->qinv, 0);
   mpz_set_ui(key->d, 0);
+  mpz_set_ui(key->dp, 0);
+  mpz_set_ui(key->dq, 0);
 
   if (keyid > 0xFF)
     sprintf(buf, "%04lX", keyid);
   else
     sprintf(buf, "%02lX", keyid);
 
-  for (i = 0; known_priv_keys[i].n; i++) {
+  for (i = 0; known_priv_keys[i].id; i++) {
     if (keyid == known_priv_keys[i].id) {
-      if ((e = rs_parse_key_value(key->n, known_priv_keys[i].n)))
-	return e;
-
-      if (known_priv_keys[i].p
-	  && (e = rs_parse_key_value(key->p, known_priv_keys[i].p)))
-	return e;
-      if (known_priv_keys[i].q
-	  && (e = rs_parse_key_value(key->q, known_priv_keys[i].q)))
-	return e;
-      if (known_priv_keys[i].d
-	  && (e = rs_parse_key_value(key->d, known_priv_keys[i].d)))
-	return e;
+      load_builtin_value(key->n, &known_priv_keys[i].n);
+      load_builtin_value(key->p, &known_priv_keys[i].p);
+      load_builtin_value(key->q, &known_priv_keys[i].q);
+      load_builtin_value(key->d, &known_priv_keys[i].d);
+      load_builtin_value(key->qinv, &known_priv_keys[i].qinv);
+      load_builtin_value(key->dp, &known_priv_keys[i].dp);
+      load_builtin_value(key->dq, &known_priv_keys[i].dq);
 
       rs_message(2, key, NULL, "Loaded builtin private key %s:", buf);
       rs_message(2, key, NULL, " n = %ZX", key->n);
@@ -201,10 +227,9 @@ int rs_key_find_for_id(RSKey* key,	    /* key structure to store
   }
 
   if (publiconly) {
-    for (i = 0; known_pub_keys[i].n; i++) {
+    for (i = 0; known_pub_keys[i].id; i++) {
       if (keyid == known_pub_keys[i].id) {
-	if ((e = rs_parse_key_value(key->n, known_pub_keys[i].n)))
-	  return e;
+	load_builtin_value(key->n, &known_pub_keys[i].n);
 
 	rs_message(2, key, NULL, "Loaded builtin public key %s:", buf);
 	rs_message(2, key, NULL, " n = %ZX", key->n);
@@ -215,9 +240,23 @@ int rs_key_find_for_id(RSKey* key,	    /* key structure to store
     }
   }
 
-  for (i = 0; fmts[i]; i++) {
-    sprintf(buf, fmts[i], keyid, "key");
-    e = find_key_file(key, buf);
+  for (pub = 0; pub <= (publiconly ? 1 : 0); pub++) {
+    e = find_indexed_key_file(key, keyid, pub);
+    if (e < 0) {
+      /* no index available; try each possible file name */
+      e = RS_ERR_KEY_NOT_FOUND;
+      for (i = 0; fmts[i] && e == RS_ERR_KEY_NOT_FOUND; i++) {
+	if (!pub) {
+	  sprintf(buf, fmts[i], keyid, "rsk");
+	  e = find_key_file(key, buf);
+	  if (e != RS_ERR_KEY_NOT_FOUND)
+	    break;
+	}
+	sprintf(buf, fmts[i], keyid, (pub ? "pub" : "key"));
+	e = find_key_file(key, buf);
+      }
+    }
+
     if (e != RS_ERR_KEY_NOT_FOUND) {
       if (e == 0 && !key->id)
 	key->id = keyid;
@@ -225,17 +264,7 @@ int rs_key_find_for_id(RSKey* key,	    /* key structure to store
     }
   }
 
-  if (publiconly) {
-    for (i = 0; fmts[i]; i++) {
-      sprintf(buf, fmts[i], keyid, "pub");
-      e = find_key_file(key, buf);
-      if (e != RS_ERR_KEY_NOT_FOUND) {
-	if (e == 0 && !key->id)
-	  key->id = keyid;
-	return e;
-      }
-    }
-  }
+  sprintf(buf, fmts[3], keyid, (publiconly ? "pub" : "key"));
 
   rs_error(NULL, NULL, "cannot find key file %s", buf);
   return RS_ERR_KEY_NOT_FOUND;
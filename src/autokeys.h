@@ -16,32 +16,203 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/* This file was generated by mkautokeys; do not edit.  Values are
+   stored least significant byte first, as used by mpz_import(). */
+
+struct keyvalue {
+  unsigned int length;
+  const unsigned char* data;
+};
+
+#define KEYVALUE(vvv) { sizeof(vvv), vvv }
+#define NOVALUE { 0, 0 }
+
+static const unsigned char pub_0101_n[] =
+  { 0x61, 0x04, 0xCD, 0xFA, 0xD9, 0x55, 0xD4, 0x1F, 0x1E, 0xCC, 0xB9, 0xB6,
+    0x22, 0x00, 0x7F, 0xE8, 0xBC, 0x75, 0xE8, 0xB2, 0x8D, 0xA1, 0x78, 0x33,
+    0x47, 0x55, 0xFE, 0xF2, 0x7C, 0x56, 0x4D, 0x47, 0xB0, 0x4F, 0xD8, 0x24,
+    0x98, 0xC1, 0x63, 0xB7, 0x62, 0x99, 0x1C, 0x68, 0xCF, 0x64, 0xE2, 0x92,
+    0x36, 0xBC, 0x41, 0xA4, 0xC1, 0xBC, 0xB9, 0x79, 0x3B, 0x6E, 0xE9, 0x65,
+    0x40, 0x7C, 0x74, 0xBC };
+
+static const unsigned char pub_0102_n[] =
+  { 0x85, 0xF1, 0x1F, 0xF8, 0x10, 0x59, 0x1B, 0x84, 0x87, 0x5F, 0xDE, 0x4C,
+    0x92, 0xA5, 0x96, 0x1C, 0xDD, 0x23, 0x3A, 0x9B, 0x7E, 0xD7, 0x6E, 0x8C,
+    0xFF, 0x65, 0x12, 0x8C, 0x71, 0x42, 0x0F, 0xCC, 0xC8, 0x0E, 0x37, 0x5D,
+    0xC8, 0xD2, 0xA8, 0x55, 0x1A, 0xE2, 0xBE, 0xB9, 0xFD, 0x41, 0x65, 0x4C,
+    0xE7, 0xB0, 0xA9, 0x5E, 0x32, 0xBE, 0x99, 0x97, 0x75, 0x04, 0x07, 0x90,
+    0x45, 0x60, 0xBE, 0xFC };
+
+static const unsigned char pub_0103_n[] =
+  { 0xED, 0x02, 0x36, 0xFD, 0x3D, 0x8B, 0x0C, 0xBA, 0x88, 0xC1, 0xCE, 0xCF,
+    0xA5, 0x49, 0xF8, 0xA8, 0x38, 0xCD, 0xBA, 0xC4, 0x87, 0xF9, 0x25, 0x3F,
+    0x6C, 0x67, 0xF2, 0x0C, 0x96, 0x27, 0x98, 0x4F, 0xEA, 0x0D, 0x0A, 0x0B,
+    0xA0, 0x35, 0x42, 0x4C, 0x7B, 0x9F, 0x5E, 0x70, 0x22, 0x86, 0xCE, 0xDC,
+    0xC6, 0x6D, 0x2D, 0xA9, 0x33, 0x20, 0xF7, 0x07, 0x1B, 0xF2, 0xC9, 0x3C,
+    0x59, 0xDE, 0x6B, 0x91 };
+
+static const unsigned char pub_010A_n[] =
+  { 0x05, 0xD1, 0xEB, 0x84, 0x85, 0xAA, 0x14, 0xC9, 0x83, 0xFF, 0xA0, 0x40,
+    0x31, 0xB2, 0x7C, 0x89, 0x95, 0x0C, 0x3D, 0x7F, 0x41, 0x81, 0xFE, 0x60,
+    0x3A, 0x35, 0x3F, 0x48, 0xDE, 0x09, 0x33, 0xDF, 0xE1, 0x17, 0x3B, 0xDD,
+    0x2E, 0x14, 0xFE, 0xB7, 0x32, 0x5B, 0xAA, 0x35, 0xA1, 0x2F, 0x21, 0x80,
+    0x4D, 0xCF, 0xD3, 0x0E, 0x56, 0x11, 0x9C, 0x13, 0x05, 0xD3, 0x48, 0xA7,
+    0x7B, 0xCF, 0x44, 0x8F };
+
+static const unsigned char pub_01_n[] =
+  { 0xF7, 0x8D, 0x55, 0xE9, 0xA4, 0x0A, 0x92, 0xD1, 0x1D, 0x5C, 0x14, 0x46,
+    0xBF, 0xCE, 0xA7, 0x4C, 0x83, 0x68, 0xBE, 0x1A, 0x81, 0xB6, 0xBA, 0x15,
+    0x96, 0x97, 0x0E, 0x6D, 0x59, 0x32, 0xD9, 0x33, 0xB8, 0x6F, 0xF3, 0xCE,
+    0xA6, 0xB3, 0x81, 0xCE, 0x65, 0xF5, 0xE3, 0x83, 0xBD, 0xB0, 0x2C, 0x82,
+    0xF3, 0x3B, 0x81, 0x90, 0x37, 0x5D, 0x0B, 0x40, 0xDE, 0xF2, 0xF1, 0xFE,
+    0x3C, 0xCA, 0x49, 0xAD };
+
+static const unsigned char pub_02_n[] =
+  { 0x81, 0x39, 0x6D, 0x55, 0xC0, 0x98, 0x9B, 0xC9, 0x49, 0xFA, 0x30, 0x82,
+    0x1F, 0xFE, 0x61, 0xC9, 0x44, 0x1E, 0xDC, 0x38, 0x27, 0xD0, 0xE8, 0x9E,
+    0xEE, 0x16, 0xDD, 0xEF, 0x69, 0x76, 0x34, 0xB8, 0xE1, 0x0B, 0x8B, 0x7F,
+    0x42, 0xFE, 0x7C, 0xC1, 0xA7, 0x47, 0x86, 0x06, 0xD6, 0xD0, 0x9F, 0x6F,
+    0xE9, 0x63, 0x65, 0xE7, 0x1E, 0x3D, 0x2A, 0xAA, 0x7C, 0x8D, 0x91, 0x06,
+    0x8F, 0x1D, 0xFA, 0xF3 };
+
+static const unsigned char pub_03_n[] =
+  { 0xE7, 0xC2, 0x1F, 0x66, 0xBD, 0x11, 0x16, 0xF2, 0xF4, 0xF6, 0x91, 0x12,
+    0x1F, 0x33, 0x30, 0x06, 0x0E, 0x24, 0xC8, 0xC7, 0xA1, 0x85, 0x8D, 0x49,
+    0x63, 0x6E, 0x24, 0xE8, 0x00, 0x15, 0xF3, 0xAA, 0x25, 0xC2, 0xF6, 0x03,
+    0x3A, 0xB3, 0x90, 0x67, 0xD4, 0x53, 0x94, 0x5A, 0xBD, 0x8A, 0x5F, 0x4C,
+    0xFA, 0xFA, 0xDA, 0xBA, 0xF8, 0xBA, 0x2B, 0xFB, 0x88, 0x89, 0x5A, 0x04,
+    0xB5, 0xD4, 0x76, 0x89 };
+
+static const unsigned char pub_04_n[] =
+  { 0x8F, 0xE5, 0x28, 0xB3, 0x40, 0xEB, 0x1C, 0x88, 0xB5, 0x05, 0xB2, 0x35,
+    0x4B, 0xAA, 0xDF, 0x47, 0xF3, 0x61, 0x6D, 0x92, 0xCB, 0x53, 0x2E, 0x7E,
+    0x5A, 0x2A, 0x0D, 0xFF, 0x1C, 0x4E, 0x42, 0x83, 0xCE, 0xEA, 0x2B, 0x2F,
+    0x7A, 0xD5, 0xF2, 0x8B, 0x7E, 0x4B, 0xE4, 0xF3, 0xF4, 0xC9, 0x9C, 0xAB,
+    0xA0, 0xD9, 0x8A, 0x8E, 0x5F, 0x2B, 0xE1, 0x5E, 0x2A, 0xAC, 0x7C, 0xED,
+    0x09, 0x40, 0xEF, 0x82 };
+
+static const unsigned char pub_08_n[] =
+  { 0x11, 0x05, 0x10, 0xEE, 0x17, 0xB0, 0xA3, 0x00, 0xE2, 0xBB, 0x27, 0x44,
+    0x1F, 0x26, 0x68, 0x43, 0xED, 0xB5, 0x41, 0xBA, 0xC1, 0x07, 0x7A, 0xC2,
+    0x03, 0xCF, 0x18, 0xAB, 0xB7, 0x80, 0x0F, 0x8F, 0x0E, 0x25, 0x94, 0x95,
+    0xF8, 0x0D, 0x86, 0x3C, 0x49, 0xC4, 0xEE, 0x7E, 0x9F, 0xB1, 0xFE, 0x03,
+    0x48, 0x8A, 0x14, 0x0C, 0x7C, 0xD5, 0xA5, 0x4C, 0xE1, 0x48, 0xC8, 0xCE,
+    0x22, 0xB0, 0x07, 0x83 };
+
+static const unsigned char pub_0A_n[] =
+  { 0xB1, 0x1C, 0x71, 0xD4, 0xEA, 0x2C, 0x13, 0xC9, 0xAB, 0x2E, 0x50, 0x1C,
+    0x60, 0x85, 0xFE, 0xC8, 0x7F, 0xF3, 0xB8, 0x8B, 0xFD, 0x78, 0x3E, 0xAC,
+    0x43, 0x35, 0x1E, 0x1B, 0x10, 0xF6, 0x5A, 0xD3, 0x1C, 0x79, 0xC1, 0x26,
+    0x8F, 0x75, 0x05, 0x1D, 0xC8, 0xFC, 0x00, 0x8E, 0xBF, 0x59, 0x3A, 0xE5,
+    0x91, 0x2E, 0x8B, 0x65, 0x39, 0x75, 0xC1, 0x31, 0x27, 0xE2, 0xB6, 0x0A,
+    0x0B, 0xEF, 0x5F, 0xEF };
+
+static const unsigned char priv_0104_n[] =
+  { 0xAD, 0x24, 0x31, 0xDA, 0x22, 0x97, 0xE4, 0x17, 0x5E, 0xAC, 0x61, 0xA3,
+    0x15, 0x4F, 0xA3, 0xD8, 0x47, 0x11, 0x57, 0x94, 0xDD, 0x33, 0x0A, 0xB7,
+    0xFF, 0x36, 0xBA, 0x59, 0xFE, 0xDA, 0x19, 0x5F, 0xEA, 0x7C, 0x16, 0x74,
+    0x3B, 0xD7, 0xBC, 0xED, 0x8A, 0x0D, 0xA8, 0x85, 0xE5, 0xE5, 0xC3, 0x4D,
+    0x5B, 0xF2, 0x0D, 0x0A, 0xB3, 0xEF, 0x91, 0x81, 0xED, 0x39, 0xBA, 0x2C,
+    0x4D, 0x89, 0x8E, 0x87 };
+static const unsigned char priv_0104_p[] =
+  { 0x5B, 0x2E, 0x54, 0xE9, 0xB5, 0xC1, 0xFE, 0x26, 0xCE, 0x93, 0x26, 0x14,
+    0x78, 0xD3, 0x87, 0x3F, 0x3F, 0xC4, 0x1B, 0xFF, 0xF1, 0xF5, 0xF9, 0x34,
+    0xD7, 0xA5, 0x79, 0x3A, 0x43, 0xC1, 0xC2, 0x1C };
+static const unsigned char priv_0104_q[] =
+  { 0x97, 0xF7, 0x70, 0x7B, 0x94, 0x07, 0x9B, 0x73, 0x85, 0x87, 0x20, 0xBF,
+    0x6D, 0x49, 0x09, 0xAB, 0x3B, 0xED, 0xA1, 0xBA, 0x9B, 0x93, 0x11, 0x2B,
+    0x04, 0x13, 0x40, 0xA1, 0x6E, 0xD5, 0x97, 0xB6, 0x04 };
+static const unsigned char priv_0104_d[] =
+  { 0xB1, 0xE0, 0xA1, 0x8C, 0x9E, 0xA3, 0x82, 0x0C, 0x37, 0x3D, 0x55, 0x3C,
+    0x69, 0x5C, 0x4D, 0x1C, 0xFD, 0x2C, 0x63, 0x73, 0x96, 0xEB, 0x2B, 0x9D,
+    0x8B, 0x49, 0xD3, 0xB2, 0xFC, 0xF4, 0xA4, 0xA1, 0x6E, 0x57, 0x42, 0x6D,
+    0xB0, 0xE8, 0xDE, 0xFD, 0xBE, 0x0C, 0x80, 0x32, 0x05, 0x7E, 0xD6, 0xEE,
+    0x55, 0x20, 0x0D, 0xA0, 0xC6, 0x0E, 0x3E, 0xC5, 0x1B, 0xCD, 0x36, 0x48,
+    0xEE, 0x35, 0x95, 0x7F };
+static const unsigned char priv_0104_qinv[] =
+  { 0xA3, 0x82, 0x96, 0xAF, 0x3D, 0xDD, 0x9B, 0x94, 0xAE, 0xA0, 0x2F, 0x2C,
+    0xE3, 0x8B, 0xCD, 0xD9, 0xC9, 0x11, 0x75, 0x4F, 0x00, 0xE4, 0xDF, 0x47,
+    0x38, 0xCD, 0x98, 0x16, 0x47, 0xF5, 0x2B, 0x0F };
+static const unsigned char priv_0104_dp[] =
+  { 0x65, 0xF6, 0x18, 0xC1, 0x6F, 0xBC, 0xE1, 0x4F, 0x27, 0xD5, 0x4F, 0xF3,
+    0xE0, 0x18, 0x2E, 0xBC, 0x52, 0x53, 0x12, 0x2D, 0xD1, 0xFE, 0xB3, 0x7E,
+    0x46, 0xD7, 0x95, 0xBB, 0xDA, 0x34, 0x62, 0x03 };
+static const unsigned char priv_0104_dq[] =
+  { 0xD7, 0x46, 0xB4, 0x9B, 0x4E, 0x4F, 0x8E, 0x97, 0x37, 0xC0, 0x98, 0xCE,
+    0xEE, 0x35, 0x50, 0x1E, 0xA7, 0x8C, 0x28, 0xBD, 0x9D, 0xC6, 0x81, 0xCB,
+    0x98, 0x91, 0xC7, 0xBE, 0x67, 0xDA, 0xC8, 0x7E, 0x02 };
+
+static const unsigned char priv_05_n[] =
+  { 0x6B, 0xAB, 0xF2, 0x7E, 0x9B, 0xF1, 0x82, 0x6F, 0xD4, 0x6C, 0xBF, 0x93,
+    0x4E, 0x33, 0x60, 0xEF, 0x1F, 0x1D, 0x3D, 0x09, 0xD6, 0xC7, 0x4E, 0x9D,
+    0xF7, 0x80, 0x49, 0xD0, 0x1A, 0x42, 0xF5, 0x84, 0xBD, 0x38, 0x3A, 0x10,
+    0xE6, 0x43, 0x30, 0xC2, 0xEE, 0x6F, 0x1B, 0x1C, 0x51, 0x62, 0x78, 0x9E,
+    0x91, 0xE9, 0x46, 0x77, 0x90, 0x0F, 0x85, 0xD9, 0x8E, 0x7D, 0x99, 0xF4,
+    0x9B, 0x30, 0xA2, 0xBF };
+static const unsigned char priv_05_p[] =
+  { 0xF5, 0x9B, 0xA0, 0x27, 0x4F, 0x1C, 0xA6, 0x23, 0x1A, 0x88, 0x2B, 0x05,
+    0x3A, 0xAD, 0x9A, 0x2B, 0x80, 0xEB, 0xE9, 0xD2, 0xB6, 0xE9, 0xFD, 0x1C,
+    0xDC, 0xFC, 0xE1, 0xAD, 0x9D, 0x94, 0x14, 0xD3 };
+static const unsigned char priv_05_q[] =
+  { 0xDF, 0xED, 0x65, 0x7A, 0x28, 0xDE, 0x2B, 0xFF, 0x75, 0xDE, 0x4F, 0x1A,
+    0xEB, 0xB7, 0x55, 0x58, 0x59, 0x77, 0x9D, 0xA3, 0x8A, 0x67, 0x1B, 0x7C,
+    0x76, 0xF8, 0x1B, 0x50, 0xF0, 0x2A, 0x6A, 0xE8 };
+static const unsigned char priv_05_d[] =
+  { 0xE1, 0x31, 0xD6, 0x63, 0x60, 0x91, 0xE0, 0xF0, 0xEB, 0x3F, 0x64, 0x44,
+    0xFA, 0x2D, 0xAB, 0xB7, 0x74, 0x4F, 0xD4, 0xDD, 0xCF, 0x54, 0x01, 0x8A,
+    0xD9, 0x06, 0xC3, 0x8A, 0x07, 0x89, 0x18, 0x0D, 0x05, 0xC7, 0xA9, 0x27,
+    0x5A, 0x91, 0x49, 0x81, 0x9B, 0x05, 0xF2, 0x79, 0xF3, 0x57, 0xCE, 0xF3,
+    0xA0, 0xC5, 0x38, 0x55, 0xAF, 0x90, 0x99, 0x25, 0x72, 0xE0, 0xF0, 0x9E,
+    0x3D, 0xC2, 0xB9, 0x70 };
+static const unsigned char priv_05_qinv[] =
+  { 0x3C, 0x71, 0x89, 0xC6, 0xA5, 0x79, 0x3A, 0x48, 0x8E, 0x60, 0xEF, 0x9B,
+    0xEC, 0xB9, 0xD2, 0x35, 0x52, 0x25, 0xFF, 0xD1, 0x50, 0x5B, 0xEC, 0xD1,
+    0x9C, 0xDF, 0x28, 0x6F, 0xF5, 0xB0, 0x25, 0x71 };
+static const unsigned char priv_05_dp[] =
+  { 0x45, 0x07, 0x55, 0x6F, 0xB1, 0xC3, 0x2A, 0x5E, 0x95, 0xCF, 0xDA, 0x20,
+    0x88, 0x2E, 0x9D, 0x9E, 0x07, 0xD7, 0x7B, 0x42, 0xD9, 0x99, 0xB3, 0x69,
+    0x56, 0xFE, 0xD1, 0x1F, 0xF9, 0x99, 0xBF, 0x6F };
+static const unsigned char priv_05_dq[] =
+  { 0xD5, 0xB4, 0x17, 0xB0, 0x7B, 0x3E, 0x42, 0xF0, 0x24, 0xA8, 0x23, 0x8E,
+    0xB2, 0xD3, 0x82, 0x0C, 0xC2, 0xDA, 0xAE, 0x77, 0xBD, 0xCD, 0x52, 0x84,
+    0x52, 0x81, 0x8F, 0xD8, 0xB6, 0x7D, 0x66, 0xBF };
+
 struct pubkeyinfo {
   unsigned long id;
-  const char* n;
+  struct keyvalue n;
 } known_pub_keys[] =
-  {{ 0x0101, "406104CDFAD955D41F1ECCB9B622007FE8BC75E8B28DA178334755FEF27C564D47B04FD82498C163B762991C68CF64E29236BC41A4C1BCB9793B6EE965407C74BC" },
-   { 0x0102, "4085F11FF810591B84875FDE4C92A5961CDD233A9B7ED76E8CFF65128C71420FCCC80E375DC8D2A8551AE2BEB9FD41654CE7B0A95E32BE9997750407904560BEFC" },
-   { 0x0103, "40ED0236FD3D8B0CBA88C1CECFA549F8A838CDBAC487F9253F6C67F20C9627984FEA0D0A0BA035424C7B9F5E702286CEDCC66D2DA93320F7071BF2C93C59DE6B91" },
-   { 0x010A, "4005D1EB8485AA14C983FFA04031B27C89950C3D7F4181FE603A353F48DE0933DFE1173BDD2E14FEB7325BAA35A12F21804DCFD30E56119C1305D348A77BCF448F" },
-   { 0x01, "40F78D55E9A40A92D11D5C1446BFCEA74C8368BE1A81B6BA1596970E6D5932D933B86FF3CEA6B381CE65F5E383BDB02C82F33B8190375D0B40DEF2F1FE3CCA49AD" },
-   { 0x02, "4081396D55C0989BC949FA30821FFE61C9441EDC3827D0E89EEE16DDEF697634B8E10B8B7F42FE7CC1A7478606D6D09F6FE96365E71E3D2AAA7C8D91068F1DFAF3" },
-   { 0x03, "40E7C21F66BD1116F2F4F691121F3330060E24C8C7A1858D49636E24E80015F3AA25C2F6033AB39067D453945ABD8A5F4CFAFADABAF8BA2BFB88895A04B5D47689" },
-   { 0x04, "408FE528B340EB1C88B505B2354BAADF47F3616D92CB532E7E5A2A0DFF1C4E4283CEEA2B2F7AD5F28B7E4BE4F3F4C99CABA0D98A8E5F2BE15E2AAC7CED0940EF82" },
-   { 0x08, "40110510EE17B0A300E2BB27441F266843EDB541BAC1077AC203CF18ABB7800F8F0E259495F80D863C49C4EE7E9FB1FE03488A140C7CD5A54CE148C8CE22B00783" },
-   { 0x0A, "40B11C71D4EA2C13C9AB2E501C6085FEC87FF3B88BFD783EAC43351E1B10F65AD31C79C1268F75051DC8FC008EBF593AE5912E8B653975C13127E2B60A0BEF5FEF" },
-   { 0, 0 }};
+  {
+   { 0x0101, KEYVALUE(pub_0101_n) },
+   { 0x0102, KEYVALUE(pub_0102_n) },
+   { 0x0103, KEYVALUE(pub_0103_n) },
+   { 0x010A, KEYVALUE(pub_010A_n) },
+   { 0x01, KEYVALUE(pub_01_n) },
+   { 0x02, KEYVALUE(pub_02_n) },
+   { 0x03, KEYVALUE(pub_03_n) },
+   { 0x04, KEYVALUE(pub_04_n) },
+   { 0x08, KEYVALUE(pub_08_n) },
+   { 0x0A, KEYVALUE(pub_0A_n) },
+   { 0, NOVALUE }};
 
 struct privkeyinfo {
   unsigned long id;
-  const char* n;
-  const char* p;
-  const char* q;
-  const char* d;
+  struct keyvalue n, p, q, d, qinv, dp, dq;
 } known_priv_keys[] =
-  {{ 0x0104, "40AD2431DA2297E4175EAC61A3154FA3D847115794DD330AB7FF36BA59FEDA195FEA7C16743BD7BCED8A0DA885E5E5C34D5BF20D0AB3EF9181ED39BA2C4D898E87",
-     "205B2E54E9B5C1FE26CE93261478D3873F3FC41BFFF1F5F934D7A5793A43C1C21C", "2197F7707B94079B73858720BF6D4909AB3BEDA1BA9B93112B041340A16ED597B604", 0 },
-   { 0x05, "406BABF27E9BF1826FD46CBF934E3360EF1F1D3D09D6C74E9DF78049D01A42F584BD383A10E64330C2EE6F1B1C5162789E91E94677900F85D98E7D99F49B30A2BF",
-     /* "20F59BA0274F1CA6231A882B053AAD9A2B80EBE9D2B6E9FD1CDCFCE1AD9D9414D3", "20DFED657A28DE2BFF75DE4F1AEBB7555859779DA38A671B7C76F81B50F02A6AE8", */
-     0, 0, "40E131D6636091E0F0EB3F6444FA2DABB7744FD4DDCF54018AD906C38A0789180D05C7A9275A9149819B05F279F357CEF3A0C53855AF90992572E0F09E3DC2B970" },
-   { 0, 0, 0, 0, 0 }};
+  {
+   { 0x0104,
+     KEYVALUE(priv_0104_n),
+     KEYVALUE(priv_0104_p),
+     KEYVALUE(priv_0104_q),
+     KEYVALUE(priv_0104_d),
+     KEYVALUE(priv_0104_qinv),
+     KEYVALUE(priv_0104_dp),
+     KEYVALUE(priv_0104_dq) },
+   { 0x05,
+     KEYVALUE(priv_05_n),
+     KEYVALUE(priv_05_p),
+     KEYVALUE(priv_05_q),
+     KEYVALUE(priv_05_d),
+     KEYVALUE(priv_05_qinv),
+     KEYVALUE(priv_05_dp),
+     KEYVALUE(priv_05_dq) },
+   { 0, NOVALUE, NOVALUE, NOVALUE, NOVALUE, NOVALUE, NOVALUE, NOVALUE }};
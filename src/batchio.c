@@ -0,0 +1,1021 @@
+/*
+ * RabbitSign - Tools for signing TI graphing calculator software
+ * Copyright (C) 2009 Benjamin Moody
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+
+#ifdef HAVE_STRING_H
+# include <string.h>
+#else
+# ifdef HAVE_STRINGS_H
+#  include <strings.h>
+# endif
+#endif
+
+#if defined(HAVE_UNISTD_H) && defined(HAVE_FCNTL_H) \
+  && defined(HAVE_SYS_STAT_H) && !defined(__MSDOS__) && !defined(__WIN32__)
+# define RS_USE_PREAD
+# ifdef HAVE_SYS_TYPES_H
+#  include <sys/types.h>
+# endif
+# include <sys/stat.h>
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+
+#if defined(RS_USE_PREAD) && defined(HAVE_LINUX_IO_URING_H) \
+  && defined(HAVE_SYS_SYSCALL_H) && defined(HAVE_SYS_MMAN_H) \
+  && defined(__GNUC__)
+# include <sys/syscall.h>
+# include <sys/mman.h>
+# include <linux/io_uring.h>
+/* (IORING_FEAT_RW_CUR_POS was added at the same time as the
+   IORING_OP_OPENAT and IORING_OP_CLOSE operations) */
+# if defined(__NR_io_uring_setup) && defined(IORING_FEAT_RW_CUR_POS)
+#  define RS_USE_IO_URING
+# endif
+#endif
+
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
+#include "rabbitsign.h"
+#include "internal.h"
+
+/*
+ * Batched file I/O
+ *
+ * When many small files are processed, most of the time is spent
+ * opening, reading, writing, and closing files rather than in
+ * hashing or signing.  A batch keeps a number of these operations
+ * in progress at once, and hands back each file as it is completed,
+ * so that one file can be parsed and signed while others are being
+ * read or written.
+ *
+ * Three backends are available:
+ *
+ *  - io_uring (Linux 5.6 or later): each request is carried out by
+ *    a chain of open, read/write, and close operations submitted to
+ *    the kernel, so that the whole batch needs only a few system
+ *    calls.
+ *
+ *  - A pool of threads, each of which performs one request at a time
+ *    using open/pread/pwrite/close.
+ *
+ *  - Synchronous: each request is carried out when its result is
+ *    requested.
+ *
+ * Requests are started in the order they are queued.  No more than
+ * `depth' requests are in progress (or completed, but not yet
+ * collected) at once, so that a long list of files can be queued
+ * without reading them all into memory.
+ */
+
+#define RS_BATCH_DEFAULT_DEPTH 64
+#define RS_BATCH_MAX_THREADS 8
+#define RS_BATCH_READ_CHUNK 65536
+
+/* Stages of a request */
+enum {
+  REQ_OPENING,
+  REQ_TRANSFER,
+  REQ_CLOSING
+};
+
+typedef struct _RSBatchReq {
+  struct _RSBatchReq* next;
+  char* filename;		/* file to read or write */
+  void* tag;			/* caller's tag */
+  int write;			/* 1 = write, 0 = read */
+  int stage;			/* current stage (io_uring only) */
+  int fd;			/* file descriptor */
+  int regular;			/* 1 = size of file is known */
+  unsigned char* data;		/* file contents */
+  unsigned long length;		/* number of bytes to transfer */
+  unsigned long alloc;		/* size of data buffer */
+  unsigned long done;		/* number of bytes transferred */
+  int error;			/* errno value (0 = success) */
+} RSBatchReq;
+
+typedef struct _RSBatchQueue {
+  RSBatchReq* head;
+  RSBatchReq* tail;
+} RSBatchQueue;
+
+#ifdef RS_USE_IO_URING
+typedef struct _RSRing {
+  int fd;
+  void* sqmap;
+  void* cqmap;
+  struct io_uring_sqe* sqes;
+  unsigned long sqmapsize, cqmapsize, sqesize;
+  unsigned *sqhead, *sqtail, *sqmask, *sqarray;
+  unsigned *cqhead, *cqtail, *cqmask;
+  struct io_uring_cqe* cqes;
+  unsigned tosubmit;		/* entries queued but not submitted */
+} RSRing;
+#endif
+
+struct _RSBatchIO {
+  RSContext* ctx;
+  RSBatchIOBackend backend;
+  unsigned int depth;
+  RSBatchQueue pending;		/* requests not yet started */
+  RSBatchQueue done;		/* requests completed */
+  unsigned int active;		/* requests started but not collected */
+  unsigned int running;		/* requests being carried out */
+#ifdef RS_USE_IO_URING
+  RSRing ring;
+#endif
+#ifdef HAVE_PTHREAD
+  pthread_mutex_t lock;
+  pthread_cond_t workcond;	/* signalled when a request may start */
+  pthread_cond_t donecond;	/* signalled when a request completes */
+  pthread_t* threads;
+  int nthreads;
+  int shutdown;
+#endif
+};
+
+#ifdef HAVE_PTHREAD
+# define LOCK(bio) pthread_mutex_lock(&(bio)->lock)
+# define UNLOCK(bio) pthread_mutex_unlock(&(bio)->lock)
+#else
+# define LOCK(bio)
+# define UNLOCK(bio)
+#endif
+
+static void queue_push(RSBatchQueue* q, RSBatchReq* req)
+{
+  req->next = NULL;
+  if (q->tail)
+    q->tail->next = req;
+  else
+    q->head = req;
+  q->tail = req;
+}
+
+static RSBatchReq* queue_pop(RSBatchQueue* q)
+{
+  RSBatchReq* req = q->head;
+
+  if (req) {
+    q->head = req->next;
+    if (!q->head)
+      q->tail = NULL;
+  }
+  return req;
+}
+
+static void free_request(RSBatchIO* bio, RSBatchReq* req)
+{
+  rs_ctx_free(bio->ctx, req->filename);
+  rs_ctx_free(bio->ctx, req->data);
+  rs_ctx_free(bio->ctx, req);
+}
+
+/*
+ * Make sure the read buffer has room for at least one more byte.
+ * (Called with the lock held, since the context is shared.)
+ */
+static int grow_buffer(RSBatchIO* bio,	  /* batch */
+		       RSBatchReq* req)	  /* request */
+{
+  unsigned char* p;
+  unsigned long n;
+
+  if (req->done < req->alloc)
+    return 0;
+
+  n = (req->alloc ? req->alloc * 2 : RS_BATCH_READ_CHUNK);
+  if (!(p = rs_ctx_realloc(bio->ctx, req->data, n))) {
+    req->error = ENOMEM;
+    return -1;
+  }
+  req->data = p;
+  req->alloc = n;
+  return 0;
+}
+
+/* Synchronous I/O (used by the sync and thread backends) */
+
+#ifdef RS_USE_PREAD
+
+/*
+ * Carry out a request from start to finish.  (Called without the
+ * lock held.)
+ */
+static void do_request(RSBatchIO* bio,	/* batch */
+		       RSBatchReq* req)	/* request */
+{
+  struct stat st;
+  ssize_t n;
+  int e;
+
+  if (req->write)
+    req->fd = open(req->filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  else
+    req->fd = open(req->filename, O_RDONLY);
+
+  if (req->fd < 0) {
+    req->error = errno;
+    return;
+  }
+
+  if (req->write) {
+    while (req->done < req->length) {
+      n = pwrite(req->fd, req->data + req->done, req->length - req->done,
+		 req->done);
+      if (n < 0 && errno == EINTR)
+	continue;
+      if (n <= 0) {
+	req->error = (n < 0 ? errno : EIO);
+	break;
+      }
+      req->done += n;
+    }
+  }
+  else {
+    if (!fstat(req->fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0) {
+      req->regular = 1;
+      LOCK(bio);
+      req->data = rs_ctx_malloc(bio->ctx, st.st_size);
+      UNLOCK(bio);
+      if (!req->data)
+	req->error = ENOMEM;
+      else
+	req->alloc = st.st_size;
+    }
+
+    while (!req->error) {
+      if (req->done >= req->alloc) {
+	if (req->regular)
+	  break;
+	LOCK(bio);
+	e = grow_buffer(bio, req);
+	UNLOCK(bio);
+	if (e)
+	  break;
+      }
+
+      n = pread(req->fd, req->data + req->done, req->alloc - req->done,
+		req->done);
+      if (n < 0 && errno == ESPIPE)
+	n = read(req->fd, req->data + req->done, req->alloc - req->done);
+      if (n < 0 && errno == EINTR)
+	continue;
+      if (n < 0)
+	req->error = errno;
+      else if (n == 0)
+	break;
+      else
+	req->done += n;
+    }
+    req->length = req->done;
+  }
+
+  if (close(req->fd) && !req->error)
+    req->error = errno;
+  req->fd = -1;
+}
+
+#else /* ! RS_USE_PREAD */
+
+static void do_request(RSBatchIO* bio,	/* batch */
+		       RSBatchReq* req)	/* request */
+{
+  FILE* f;
+  size_t n;
+  int e;
+
+  if (!(f = fopen(req->filename, req->write ? "wb" : "rb"))) {
+    req->error = (errno ? errno : ENOENT);
+    return;
+  }
+
+  if (req->write) {
+    if (fwrite(req->data, 1, req->length, f) != req->length)
+      req->error = (errno ? errno : EIO);
+    req->done = req->length;
+  }
+  else {
+    while (!req->error) {
+      LOCK(bio);
+      e = grow_buffer(bio, req);
+      UNLOCK(bio);
+      if (e)
+	break;
+
+      n = fread(req->data + req->done, 1, req->alloc - req->done, f);
+      if (n == 0) {
+	if (ferror(f))
+	  req->error = (errno ? errno : EIO);
+	break;
+      }
+      req->done += n;
+    }
+    req->length = req->done;
+  }
+
+  if (fclose(f) && !req->error)
+    req->error = (errno ? errno : EIO);
+}
+
+#endif /* ! RS_USE_PREAD */
+
+/* Thread pool backend */
+
+#ifdef HAVE_PTHREAD
+
+static void* worker_main(void* data)
+{
+  RSBatchIO* bio = data;
+  RSBatchReq* req;
+
+  LOCK(bio);
+  while (1) {
+    while (!bio->shutdown
+	   && (!bio->pending.head || bio->active >= bio->depth))
+      pthread_cond_wait(&bio->workcond, &bio->lock);
+    if (bio->shutdown)
+      break;
+
+    req = queue_pop(&bio->pending);
+    bio->active++;
+    bio->running++;
+    UNLOCK(bio);
+
+    do_request(bio, req);
+
+    LOCK(bio);
+    bio->running--;
+    queue_push(&bio->done, req);
+    pthread_cond_broadcast(&bio->donecond);
+  }
+  UNLOCK(bio);
+  return NULL;
+}
+
+static int start_threads(RSBatchIO* bio) /* batch */
+{
+  int n;
+
+  n = (bio->depth < RS_BATCH_MAX_THREADS ? bio->depth : RS_BATCH_MAX_THREADS);
+  if (!(bio->threads = rs_ctx_malloc(bio->ctx, n * sizeof(pthread_t))))
+    return RS_ERR_OUT_OF_MEMORY;
+
+  for (bio->nthreads = 0; bio->nthreads < n; bio->nthreads++) {
+    if (pthread_create(&bio->threads[bio->nthreads], NULL,
+		       &worker_main, bio))
+      break;
+  }
+
+  if (!bio->nthreads) {
+    rs_ctx_free(bio->ctx, bio->threads);
+    bio->threads = NULL;
+    return RS_ERR_FILE_IO;
+  }
+  return RS_SUCCESS;
+}
+
+static void stop_threads(RSBatchIO* bio) /* batch */
+{
+  int i;
+
+  LOCK(bio);
+  bio->shutdown = 1;
+  pthread_cond_broadcast(&bio->workcond);
+  UNLOCK(bio);
+
+  for (i = 0; i < bio->nthreads; i++)
+    pthread_join(bio->threads[i], NULL);
+  rs_ctx_free(bio->ctx, bio->threads);
+  bio->threads = NULL;
+  bio->nthreads = 0;
+}
+
+#endif /* HAVE_PTHREAD */
+
+/* io_uring backend */
+
+#ifdef RS_USE_IO_URING
+
+static int ring_setup(RSRing* ring,	    /* ring */
+		      unsigned int entries) /* number of entries */
+{
+  struct io_uring_params p;
+  struct io_uring_probe* probe;
+  unsigned long probesize;
+  long fd;
+  int ok;
+
+  memset(ring, 0, sizeof(RSRing));
+  memset(&p, 0, sizeof(p));
+
+  fd = syscall(__NR_io_uring_setup, entries, &p);
+  if (fd < 0)
+    return -1;
+  ring->fd = fd;
+
+  /* Check that the kernel supports all of the operations we need */
+  probesize = sizeof(struct io_uring_probe)
+    + 256 * sizeof(struct io_uring_probe_op);
+  if (!(probe = rs_malloc(probesize))) {
+    close(ring->fd);
+    return -1;
+  }
+  memset(probe, 0, probesize);
+  ok = (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE,
+		probe, 256) >= 0
+	&& probe->last_op >= IORING_OP_CLOSE
+	&& (probe->ops[IORING_OP_OPENAT].flags & IO_URING_OP_SUPPORTED)
+	&& (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED)
+	&& (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED)
+	&& (probe->ops[IORING_OP_CLOSE].flags & IO_URING_OP_SUPPORTED));
+  rs_free(probe);
+  if (!ok) {
+    close(ring->fd);
+    return -1;
+  }
+
+  ring->sqmapsize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  ring->cqmapsize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  ring->sqesize = p.sq_entries * sizeof(struct io_uring_sqe);
+
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring->cqmapsize > ring->sqmapsize)
+      ring->sqmapsize = ring->cqmapsize;
+    ring->cqmapsize = 0;
+  }
+
+  ring->sqmap = mmap(NULL, ring->sqmapsize, PROT_READ | PROT_WRITE,
+		     MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sqmap == MAP_FAILED) {
+    close(ring->fd);
+    return -1;
+  }
+
+  if (ring->cqmapsize) {
+    ring->cqmap = mmap(NULL, ring->cqmapsize, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cqmap == MAP_FAILED) {
+      munmap(ring->sqmap, ring->sqmapsize);
+      close(ring->fd);
+      return -1;
+    }
+  }
+  else {
+    ring->cqmap = ring->sqmap;
+  }
+
+  ring->sqes = mmap(NULL, ring->sqesize, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) {
+    if (ring->cqmapsize)
+      munmap(ring->cqmap, ring->cqmapsize);
+    munmap(ring->sqmap, ring->sqmapsize);
+    close(ring->fd);
+    return -1;
+  }
+
+  ring->sqhead = (unsigned*) ((char*) ring->sqmap + p.sq_off.head);
+  ring->sqtail = (unsigned*) ((char*) ring->sqmap + p.sq_off.tail);
+  ring->sqmask = (unsigned*) ((char*) ring->sqmap + p.sq_off.ring_mask);
+  ring->sqarray = (unsigned*) ((char*) ring->sqmap + p.sq_off.array);
+  ring->cqhead = (unsigned*) ((char*) ring->cqmap + p.cq_off.head);
+  ring->cqtail = (unsigned*) ((char*) ring->cqmap + p.cq_off.tail);
+  ring->cqmask = (unsigned*) ((char*) ring->cqmap + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe*) ((char*) ring->cqmap + p.cq_off.cqes);
+  return 0;
+}
+
+static void ring_free(RSRing* ring) /* ring */
+{
+  munmap(ring->sqes, ring->sqesize);
+  if (ring->cqmapsize)
+    munmap(ring->cqmap, ring->cqmapsize);
+  munmap(ring->sqmap, ring->sqmapsize);
+  close(ring->fd);
+}
+
+/*
+ * Get the next submission queue entry.  Each request has at most one
+ * operation outstanding, and the ring has at least as many entries
+ * as there can be active requests, so there is always room.  The
+ * entry is not seen by the kernel until ring_put_sqe() is called.
+ */
+static struct io_uring_sqe* ring_get_sqe(RSRing* ring,	   /* ring */
+					 RSBatchReq* req) /* request */
+{
+  struct io_uring_sqe* sqe;
+
+  sqe = &ring->sqes[*ring->sqtail & *ring->sqmask];
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  sqe->user_data = (unsigned long) req;
+  return sqe;
+}
+
+/*
+ * Add the entry returned by ring_get_sqe() to the submission queue.
+ * This must be done only after the entry is completely filled in,
+ * since the kernel may read it as soon as the tail is updated.
+ */
+static void ring_put_sqe(RSRing* ring) /* ring */
+{
+  unsigned tail, idx;
+
+  tail = *ring->sqtail;
+  idx = tail & *ring->sqmask;
+  ring->sqarray[idx] = idx;
+  __atomic_store_n(ring->sqtail, tail + 1, __ATOMIC_RELEASE);
+  ring->tosubmit++;
+}
+
+/*
+ * Queue the next operation for a request.
+ */
+static void ring_queue_op(RSBatchIO* bio,  /* batch */
+			  RSBatchReq* req) /* request */
+{
+  struct io_uring_sqe* sqe = ring_get_sqe(&bio->ring, req);
+
+  switch (req->stage) {
+  case REQ_OPENING:
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (unsigned long) req->filename;
+    if (req->write) {
+      sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC;
+      sqe->len = 0666;
+    }
+    else {
+      sqe->open_flags = O_RDONLY;
+    }
+    break;
+
+  case REQ_TRANSFER:
+    sqe->opcode = (req->write ? IORING_OP_WRITE : IORING_OP_READ);
+    sqe->fd = req->fd;
+    sqe->addr = (unsigned long) (req->data + req->done);
+    sqe->len = (req->write ? req->length : req->alloc) - req->done;
+    sqe->off = (req->regular ? req->done : (unsigned long) -1);
+    break;
+
+  case REQ_CLOSING:
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = req->fd;
+    break;
+  }
+
+  ring_put_sqe(&bio->ring);
+}
+
+/*
+ * Handle the result of an operation, and queue the next one (if
+ * any.)  Called with the lock held.
+ */
+static void ring_complete_op(RSBatchIO* bio,  /* batch */
+			     RSBatchReq* req, /* request */
+			     int res)	      /* result */
+{
+  struct stat st;
+
+  switch (req->stage) {
+  case REQ_OPENING:
+    if (res < 0) {
+      req->error = -res;
+      bio->running--;
+      queue_push(&bio->done, req);
+      return;
+    }
+
+    req->fd = res;
+    req->stage = REQ_TRANSFER;
+    if (!req->write) {
+      if (!fstat(req->fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0) {
+	req->regular = 1;
+	if ((req->data = rs_ctx_malloc(bio->ctx, st.st_size)))
+	  req->alloc = st.st_size;
+	else
+	  req->error = ENOMEM;
+      }
+      else {
+	grow_buffer(bio, req);
+      }
+      if (req->error)
+	req->stage = REQ_CLOSING;
+    }
+    else if (!req->length) {
+      req->stage = REQ_CLOSING;
+    }
+    break;
+
+  case REQ_TRANSFER:
+    if (res < 0 && -res == EINTR)
+      break;
+
+    if (res < 0) {
+      req->error = -res;
+      req->stage = REQ_CLOSING;
+    }
+    else if (res == 0) {
+      if (req->write)
+	req->error = EIO;
+      req->stage = REQ_CLOSING;
+    }
+    else {
+      req->done += res;
+      if (req->write ? req->done >= req->length
+	  : (req->regular && req->done >= req->alloc))
+	req->stage = REQ_CLOSING;
+      else if (!req->write && grow_buffer(bio, req))
+	req->stage = REQ_CLOSING;
+    }
+    break;
+
+  case REQ_CLOSING:
+    if (res < 0 && !req->error)
+      req->error = -res;
+    req->fd = -1;
+    if (!req->write)
+      req->length = req->done;
+    bio->running--;
+    queue_push(&bio->done, req);
+    return;
+  }
+
+  ring_queue_op(bio, req);
+}
+
+/*
+ * Start as many pending requests as possible, submit any queued
+ * operations, and wait for at least one operation to complete (if
+ * wait is 1.)  Called with the lock held.
+ */
+static int ring_run(RSBatchIO* bio, /* batch */
+		    int wait)	    /* 1 = wait for a completion */
+{
+  RSRing* ring = &bio->ring;
+  RSBatchReq* req;
+  struct io_uring_cqe* cqe;
+  unsigned head, tail;
+  long n;
+
+  while (bio->pending.head && bio->active < bio->depth) {
+    req = queue_pop(&bio->pending);
+    bio->active++;
+    bio->running++;
+    ring_queue_op(bio, req);
+  }
+
+  if (ring->tosubmit || wait) {
+    n = syscall(__NR_io_uring_enter, ring->fd, ring->tosubmit,
+		(wait ? 1 : 0), (wait ? IORING_ENTER_GETEVENTS : 0),
+		NULL, 0);
+    if (n < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+      return -1;
+    if (n > 0)
+      ring->tosubmit -= (n < (long) ring->tosubmit ? n : ring->tosubmit);
+  }
+
+  head = *ring->cqhead;
+  tail = __atomic_load_n(ring->cqtail, __ATOMIC_ACQUIRE);
+  while (head != tail) {
+    cqe = &ring->cqes[head & *ring->cqmask];
+    req = (RSBatchReq*) (unsigned long) cqe->user_data;
+    head++;
+    __atomic_store_n(ring->cqhead, head, __ATOMIC_RELEASE);
+    ring_complete_op(bio, req, cqe->res);
+  }
+
+  return 0;
+}
+
+#endif /* RS_USE_IO_URING */
+
+/*
+ * Create a new batch.
+ *
+ * backend specifies how I/O is performed (RS_BATCH_IO_AUTO to use the
+ * best one available.)  If the requested backend is not available, a
+ * slower one is used instead.  depth is the maximum number of files
+ * to read or write at once (0 for the default.)
+ *
+ * Buffers are allocated using the given context.  If threads are
+ * used, this may happen in any thread, so the context's allocation
+ * function must be thread-safe.
+ */
+RSBatchIO* rs_batch_io_new(RSContext* ctx,	       /* context */
+			   RSBatchIOBackend backend, /* backend */
+			   unsigned int depth)	       /* queue depth */
+{
+  RSBatchIO* bio;
+
+  if (!(bio = rs_ctx_malloc(ctx, sizeof(RSBatchIO))))
+    return NULL;
+  memset(bio, 0, sizeof(RSBatchIO));
+  bio->ctx = ctx;
+  bio->depth = (depth ? depth : RS_BATCH_DEFAULT_DEPTH);
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_init(&bio->lock, NULL);
+  pthread_cond_init(&bio->workcond, NULL);
+  pthread_cond_init(&bio->donecond, NULL);
+#endif
+
+  if (backend == RS_BATCH_IO_AUTO)
+    backend = RS_BATCH_IO_URING;
+
+#ifdef RS_USE_IO_URING
+  if (backend == RS_BATCH_IO_URING) {
+    if (!ring_setup(&bio->ring, bio->depth)) {
+      bio->backend = RS_BATCH_IO_URING;
+      return bio;
+    }
+  }
+#endif
+
+  if (backend == RS_BATCH_IO_URING)
+    backend = RS_BATCH_IO_THREADS;
+
+#ifdef HAVE_PTHREAD
+  if (backend == RS_BATCH_IO_THREADS && !start_threads(bio)) {
+    bio->backend = RS_BATCH_IO_THREADS;
+    return bio;
+  }
+#endif
+
+  bio->backend = RS_BATCH_IO_SYNC;
+  return bio;
+}
+
+/*
+ * Free a batch.  Any requests that are still in progress are
+ * finished first; those that have not started are discarded.
+ */
+void rs_batch_io_free(RSBatchIO* bio) /* batch */
+{
+  RSBatchReq* req;
+
+  if (!bio)
+    return;
+
+#ifdef HAVE_PTHREAD
+  if (bio->backend == RS_BATCH_IO_THREADS)
+    stop_threads(bio);
+#endif
+
+  while ((req = queue_pop(&bio->pending)))
+    free_request(bio, req);
+
+#ifdef RS_USE_IO_URING
+  if (bio->backend == RS_BATCH_IO_URING) {
+    while (bio->running && !ring_run(bio, 1))
+      ;
+    ring_free(&bio->ring);
+  }
+#endif
+
+  while ((req = queue_pop(&bio->done)))
+    free_request(bio, req);
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_destroy(&bio->lock);
+  pthread_cond_destroy(&bio->workcond);
+  pthread_cond_destroy(&bio->donecond);
+#endif
+
+  rs_ctx_free(bio->ctx, bio);
+}
+
+/*
+ * Get the backend actually used by a batch.
+ */
+RSBatchIOBackend rs_batch_io_backend(const RSBatchIO* bio) /* batch */
+{
+  return bio->backend;
+}
+
+static int add_request(RSBatchIO* bio,	       /* batch */
+		       const char* filename,	       /* file name */
+		       int write,		       /* 1 = write */
+		       unsigned char* data,	       /* data to write */
+		       unsigned long length,	       /* length of data */
+		       void* tag)		       /* caller's tag */
+{
+  RSBatchReq* req;
+
+  LOCK(bio);
+  if (!(req = rs_ctx_malloc(bio->ctx, sizeof(RSBatchReq)))) {
+    rs_ctx_free(bio->ctx, data);
+    UNLOCK(bio);
+    return RS_ERR_OUT_OF_MEMORY;
+  }
+  memset(req, 0, sizeof(RSBatchReq));
+  if (!(req->filename = rs_ctx_strdup(bio->ctx, filename))) {
+    rs_ctx_free(bio->ctx, req);
+    rs_ctx_free(bio->ctx, data);
+    UNLOCK(bio);
+    return RS_ERR_OUT_OF_MEMORY;
+  }
+
+  req->write = write;
+  req->data = data;
+  req->length = req->alloc = length;
+  req->tag = tag;
+  req->fd = -1;
+  queue_push(&bio->pending, req);
+
+#ifdef HAVE_PTHREAD
+  if (bio->backend == RS_BATCH_IO_THREADS)
+    pthread_cond_signal(&bio->workcond);
+#endif
+  UNLOCK(bio);
+  return RS_SUCCESS;
+}
+
+/*
+ * Queue a file to be read.  When the request is completed, the
+ * entire contents of the file will be returned by
+ * rs_batch_io_wait().
+ */
+int rs_batch_io_read(RSBatchIO* bio,	   /* batch */
+		     const char* filename, /* file to read */
+		     void* tag)		   /* caller's tag */
+{
+  return add_request(bio, filename, 0, NULL, 0, tag);
+}
+
+/*
+ * Queue data to be written to a file (replacing the existing
+ * contents, if any.)
+ *
+ * The batch takes ownership of the data, which must have been
+ * allocated using the batch's context (for example, by
+ * rs_write_program_buffer()), and frees it when the request is
+ * completed (or if an error occurs.)
+ */
+int rs_batch_io_write(RSBatchIO* bio,	    /* batch */
+		      const char* filename, /* file to write */
+		      unsigned char* data,  /* data to write */
+		      unsigned long length, /* length of data */
+		      void* tag)	    /* caller's tag */
+{
+  return add_request(bio, filename, 1, data, length, tag);
+}
+
+/*
+ * Wait for a request to be completed.
+ *
+ * Returns 1 and fills in *res if a request was completed, or 0 if
+ * there are no requests left.  Results are not necessarily returned
+ * in the order the requests were queued.  Each result must be passed
+ * to rs_batch_io_release() once the caller is done with it.
+ *
+ * This function may be called from several threads at once.
+ */
+int rs_batch_io_wait(RSBatchIO* bio,	  /* batch */
+		     RSBatchIOResult* res) /* result */
+{
+  RSBatchReq* req = NULL;
+
+  LOCK(bio);
+  while (!(req = queue_pop(&bio->done))) {
+    if (!bio->pending.head && !bio->running)
+      break;
+
+#ifdef RS_USE_IO_URING
+    if (bio->backend == RS_BATCH_IO_URING) {
+      if (ring_run(bio, 1)) {
+	UNLOCK(bio);
+	rs_ctx_error(bio->ctx, "io_uring: %s", strerror(errno));
+	LOCK(bio);
+	break;
+      }
+      continue;
+    }
+#endif
+#ifdef HAVE_PTHREAD
+    if (bio->backend == RS_BATCH_IO_THREADS) {
+      pthread_cond_wait(&bio->donecond, &bio->lock);
+      continue;
+    }
+#endif
+
+    if (!bio->pending.head) {
+      /* another thread is carrying out the last request */
+#ifdef HAVE_PTHREAD
+      pthread_cond_wait(&bio->donecond, &bio->lock);
+#endif
+      continue;
+    }
+
+    req = queue_pop(&bio->pending);
+    bio->active++;
+    bio->running++;
+    UNLOCK(bio);
+    do_request(bio, req);
+    LOCK(bio);
+    bio->running--;
+#ifdef HAVE_PTHREAD
+    pthread_cond_broadcast(&bio->donecond);
+#endif
+    break;
+  }
+
+  if (req) {
+    bio->active--;
+#ifdef HAVE_PTHREAD
+    if (bio->backend == RS_BATCH_IO_THREADS)
+      pthread_cond_signal(&bio->workcond);
+#endif
+  }
+  UNLOCK(bio);
+
+  if (!req)
+    return 0;
+
+  res->tag = req->tag;
+  res->filename = req->filename;
+  res->write = req->write;
+  res->data = (req->write ? NULL : req->data);
+  res->length = req->length;
+  res->error = req->error;
+  res->internal = req;
+  return 1;
+}
+
+/*
+ * Free a result returned by rs_batch_io_wait() (including the file
+ * contents, if it was a read.)
+ */
+void rs_batch_io_release(RSBatchIO* bio,	  /* batch */
+			 RSBatchIOResult* res) /* result */
+{
+  if (res->internal) {
+    LOCK(bio);
+    free_request(bio, res->internal);
+    UNLOCK(bio);
+  }
+  res->internal = NULL;
+  res->data = NULL;
+  res->filename = NULL;
+}
+
+/*
+ * Parse the name of a backend ("auto", "uring", "threads", or
+ * "sync".)  Returns 0 if successful, or -1 if the name is not
+ * recognized.
+ */
+int rs_batch_io_parse_backend(const char* name,	     /* name */
+			      RSBatchIOBackend* backend) /* result */
+{
+  if (!strcmp(name, "auto"))
+    *backend = RS_BATCH_IO_AUTO;
+  else if (!strcmp(name, "uring") || !strcmp(name, "io_uring"))
+    *backend = RS_BATCH_IO_URING;
+  else if (!strcmp(name, "threads"))
+    *backend = RS_BATCH_IO_THREADS;
+  else if (!strcmp(name, "sync"))
+    *backend = RS_BATCH_IO_SYNC;
+  else
+    return -1;
+  return 0;
+}
+
+/*
+ * Get the name of a backend.
+ */
+const char* rs_batch_io_backend_name(RSBatchIOBackend backend) /* backend */
+{
+  switch (backend) {
+  case RS_BATCH_IO_URING:
+    return "io_uring";
+  case RS_BATCH_IO_THREADS:
+    return "threads";
+  case RS_BATCH_IO_SYNC:
+    return "sync";
+  default:
+    return "auto";
+  }
+}
@@ -37,11 +37,82 @@
 # define strchr index
 #endif
 
+#if !defined(strncasecmp) && !defined(HAVE_STRNCASECMP)
+# ifdef HAVE_STRNICMP
+#  define strncasecmp strnicmp
+# else
+#  define strncasecmp strncmp
+# endif
+#endif
+
 /*
  * Parse and return next command line option.
  */
 int rs_parse_cmdline(int argc, char** argv, const char* optstring,
 		     int* i, int* j, const char** arg)
+{
+  return rs_parse_cmdline_long(argc, argv, optstring, NULL, i, j, arg);
+}
+
+/*
+ * Parse a long option (--name, --name=value, or --name value.)
+ */
+static int parse_long_option(int argc, char** argv,
+			     const RSLongOption* longopts,
+			     int* i, int* j, const char** arg)
+{
+  const char* name = argv[*i] + 2;
+  const char* value;
+  size_t n;
+  int k;
+
+  if ((value = strchr(name, '=')))
+    n = value - name;
+  else
+    n = strlen(name);
+
+  for (k = 0; longopts && longopts[k].name; k++) {
+    if (strlen(longopts[k].name) != n
+	|| strncasecmp(longopts[k].name, name, n))
+      continue;
+
+    (*i)++;
+    *j = 1;
+
+    if (!longopts[k].has_arg) {
+      if (value) {
+	rs_error(NULL, NULL, "--%s: does not take an argument",
+		 longopts[k].name);
+	return RS_CMDLINE_ERROR;
+      }
+      *arg = NULL;
+    }
+    else if (value) {
+      *arg = value + 1;
+    }
+    else {
+      if (*i >= argc) {
+	rs_error(NULL, NULL, "--%s: requires an argument",
+		 longopts[k].name);
+	return RS_CMDLINE_ERROR;
+      }
+      *arg = argv[*i];
+      (*i)++;
+    }
+    return longopts[k].val;
+  }
+
+  rs_error(NULL, NULL, "unrecognized option %s (try --help)", argv[*i]);
+  return RS_CMDLINE_ERROR;
+}
+
+/*
+ * Parse and return next command line option, including long options
+ * listed in the given table.
+ */
+int rs_parse_cmdline_long(int argc, char** argv, const char* optstring,
+			  const RSLongOption* longopts,
+			  int* i, int* j, const char** arg)
 {
   char c;
   char* p;
@@ -68,8 +139,7 @@ int rs_parse_cmdline(int argc, char** argv, const char* optstring,
       return RS_CMDLINE_VERSION;
     }
     else {
-      rs_error(NULL, NULL, "unrecognized option %s (try --help)", argv[*i]);
-      return RS_CMDLINE_ERROR;
+      return parse_long_option(argc, argv, longopts, i, j, arg);
     }
   }
 
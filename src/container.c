@@ -0,0 +1,247 @@
+/*
+ * RabbitSign - Tools for signing TI graphing calculator software
+ * Copyright (C) 2009 Benjamin Moody
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+
+#ifdef HAVE_STRING_H
+# include <string.h>
+#else
+# ifdef HAVE_STRINGS_H
+#  include <strings.h>
+# endif
+#endif
+
+#include "rabbitsign.h"
+#include "internal.h"
+
+/*
+ * Container files
+ *
+ * A container (.rsp) file holds the contents of an RSProgram exactly
+ * as they are stored in memory, so that programs can be passed from
+ * one tool to another without converting them to hex and parsing the
+ * hex again.  Reading a container involves nothing more than copying
+ * each part into place.
+ *
+ * All integers are 32-bit big-endian values.
+ *
+ *   "RSP1"  calctype  datatype  keytype  version  npagenums
+ *   header_length  length  signature_length
+ *   digestalg  digesthdr  digestlength  digest[32]
+ *   pagenums[npagenums]  <header>  <data>  <signature>
+ *
+ * The digest (if digestalg is not RSP_NO_DIGEST) is the one used to
+ * sign and validate the program, as described by
+ * rs_program_digest_params().  A container is not signed, so the
+ * stored digest is only used if the reader asks for it
+ * (RS_INPUT_TRUST_DIGEST), and if its parameters agree with the
+ * program's type and length; otherwise, it is ignored.
+ */
+
+#define RSP_MAGIC "RSP1"
+#define RSP_FIXED_SIZE (4 + 11 * 4 + 32)
+#define RSP_NO_DIGEST 0xfffffffful
+
+/*
+ * Check whether a block of data looks like a container file.
+ */
+int rs_is_program_container(const unsigned char* data, /* data */
+			    unsigned long length)      /* length of data */
+{
+  return (length >= 4 && !memcmp(data, RSP_MAGIC, 4));
+}
+
+/*
+ * Read a program from the contents of a container file.
+ */
+int rs_parse_program_container(RSProgram* prgm,	       /* program */
+			       const unsigned char* data, /* file
+							     contents */
+			       unsigned long length,	  /* length of
+							     data */
+			       unsigned int flags)	  /* input flags */
+{
+  unsigned long npagenums, hdrlen, datalen, siglen, alg, pos, i;
+  unsigned char *hdr, *sig;
+  unsigned int* pagenums;
+  RSProgramDigest* d;
+  RSKeyType palg;
+  unsigned long plength;
+  int pwithheader, e;
+
+  if (length < RSP_FIXED_SIZE || !rs_is_program_container(data, length)) {
+    rs_error(NULL, prgm, "invalid container file");
+    return RS_ERR_UNKNOWN_FILE_FORMAT;
+  }
+
+  npagenums = rs_get_u32(data + 20);
+  hdrlen = rs_get_u32(data + 24);
+  datalen = rs_get_u32(data + 28);
+  siglen = rs_get_u32(data + 32);
+  alg = rs_get_u32(data + 36);
+
+  pos = RSP_FIXED_SIZE;
+  if (npagenums > (length - pos) / 4
+      || hdrlen > length - pos - npagenums * 4
+      || datalen > length - pos - npagenums * 4 - hdrlen
+      || siglen > length - pos - npagenums * 4 - hdrlen - datalen) {
+    rs_error(NULL, prgm, "container file is truncated");
+    return RS_ERR_UNKNOWN_FILE_FORMAT;
+  }
+
+  pagenums = NULL;
+  if (npagenums) {
+    pagenums = rs_ctx_malloc(prgm->ctx, npagenums * sizeof(unsigned int));
+    if (!pagenums)
+      return RS_ERR_OUT_OF_MEMORY;
+    for (i = 0; i < npagenums; i++)
+      pagenums[i] = rs_get_u32(data + pos + 4 * i);
+    pos += 4 * npagenums;
+  }
+
+  hdr = sig = NULL;
+  if ((hdrlen && !(hdr = rs_ctx_malloc(prgm->ctx, hdrlen)))
+      || (siglen && !(sig = rs_ctx_malloc(prgm->ctx, siglen)))) {
+    rs_ctx_free(prgm->ctx, pagenums);
+    rs_ctx_free(prgm->ctx, hdr);
+    return RS_ERR_OUT_OF_MEMORY;
+  }
+
+  if (hdrlen)
+    memcpy(hdr, data + pos, hdrlen);
+  pos += hdrlen;
+
+  rs_program_set_length(prgm, 0);
+  if ((e = rs_program_append_data(prgm, data + pos, datalen))) {
+    rs_ctx_free(prgm->ctx, pagenums);
+    rs_ctx_free(prgm->ctx, hdr);
+    rs_ctx_free(prgm->ctx, sig);
+    return e;
+  }
+  pos += datalen;
+
+  if (siglen)
+    memcpy(sig, data + pos, siglen);
+
+  prgm->calctype = rs_get_u32(data + 4);
+  prgm->datatype = rs_get_u32(data + 8);
+  prgm->keytype = rs_get_u32(data + 12);
+  prgm->version = rs_get_u32(data + 16);
+
+  rs_ctx_free(prgm->ctx, prgm->pagenums);
+  prgm->pagenums = pagenums;
+  prgm->npagenums = npagenums;
+
+  rs_program_invalidate_header_index(prgm);
+  rs_ctx_free(prgm->ctx, prgm->header);
+  prgm->header = hdr;
+  prgm->header_length = hdrlen;
+
+  rs_ctx_free(prgm->ctx, prgm->signature);
+  prgm->signature = sig;
+  prgm->signature_length = siglen;
+
+  if (!(flags & RS_INPUT_TRUST_DIGEST) || alg == RSP_NO_DIGEST)
+    return RS_SUCCESS;
+
+  /* The stored digest must be the one that would be computed for this
+     program (and must not cover more data than there is) */
+  if (rs_program_digest_params(prgm, &palg, &pwithheader, &plength)
+      || alg != (unsigned long) palg
+      || rs_get_u32(data + 40) != (unsigned long) pwithheader
+      || rs_get_u32(data + 44) != plength) {
+    rs_warning(NULL, prgm, "ignoring stored digest (does not match program)");
+    return RS_SUCCESS;
+  }
+
+  if ((d = rs_ctx_malloc(prgm->ctx, sizeof(RSProgramDigest)))) {
+    d->alg = palg;
+    d->withheader = pwithheader;
+    d->length = plength;
+    memcpy(d->value, data + 48, 32);
+    prgm->digest = d;
+  }
+
+  return RS_SUCCESS;
+}
+
+/*
+ * Get the size of a container file.
+ */
+unsigned long rs_program_container_size(const RSProgram* prgm) /* program */
+{
+  return (RSP_FIXED_SIZE + 4 * prgm->npagenums + prgm->header_length
+	  + prgm->length + prgm->signature_length);
+}
+
+/*
+ * Write a program to a container file (or buffer.)
+ *
+ * The digest used to sign the program is computed and stored, if the
+ * program is complete enough for it to be determined.
+ */
+int rs_output_program_container(RSOutput* out,	       /* output */
+				const RSProgram* prgm) /* program */
+{
+  unsigned char buf[RSP_FIXED_SIZE];
+  unsigned char pnbuf[4];
+  RSProgramDigest d;
+  int i, e;
+
+  memset(buf, 0, sizeof(buf));
+  memcpy(buf, RSP_MAGIC, 4);
+  rs_put_u32(buf + 4, prgm->calctype);
+  rs_put_u32(buf + 8, prgm->datatype);
+  rs_put_u32(buf + 12, prgm->keytype);
+  rs_put_u32(buf + 16, prgm->version);
+  rs_put_u32(buf + 20, prgm->npagenums);
+  rs_put_u32(buf + 24, prgm->header_length);
+  rs_put_u32(buf + 28, prgm->length);
+  rs_put_u32(buf + 32, prgm->signature_length);
+
+  if (!rs_program_digest_params(prgm, &d.alg, &d.withheader, &d.length)) {
+    memset(d.value, 0, sizeof(d.value));
+    rs_program_get_digest(prgm, NULL, d.alg, d.withheader, d.length,
+			  d.value);
+    rs_put_u32(buf + 36, d.alg);
+    rs_put_u32(buf + 40, d.withheader);
+    rs_put_u32(buf + 44, d.length);
+    memcpy(buf + 48, d.value, 32);
+  }
+  else {
+    rs_put_u32(buf + 36, RSP_NO_DIGEST);
+  }
+
+  if ((e = rs_output_write(out, buf, RSP_FIXED_SIZE)))
+    return e;
+
+  for (i = 0; i < prgm->npagenums; i++) {
+    rs_put_u32(pnbuf, prgm->pagenums[i]);
+    if ((e = rs_output_write(out, pnbuf, 4)))
+      return e;
+  }
+
+  if ((e = rs_output_write(out, prgm->header, prgm->header_length))
+      || (e = rs_output_write(out, prgm->data, prgm->length)))
+    return e;
+  return rs_output_write(out, prgm->signature, prgm->signature_length);
+}
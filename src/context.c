@@ -0,0 +1,291 @@
+/*
+ * RabbitSign - Tools for signing TI graphing calculator software
+ * Copyright (C) 2009 Benjamin Moody
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+
+#ifdef HAVE_CLOCK_GETTIME
+# include <time.h>
+#else
+# if defined(HAVE_SYS_TIME_H) && defined(HAVE_GETTIMEOFDAY)
+#  include <sys/time.h>
+# else
+#  include <time.h>
+# endif
+#endif
+
+#ifdef HAVE_STRING_H
+# include <string.h>
+#else
+# ifdef HAVE_STRINGS_H
+#  include <strings.h>
+# endif
+#endif
+
+#include "rabbitsign.h"
+#include "internal.h"
+
+static RSContext default_context;
+
+/*
+ * Get the default context.
+ */
+RSContext* rs_context_default()
+{
+  return &default_context;
+}
+
+/*
+ * Get the context to be used for a given key and/or program.
+ *
+ * Messages concerning a program are sent to the program's context;
+ * otherwise, they are sent to the key's context.
+ */
+RSContext* rs_get_context(const RSKey* key,      /* key (may be NULL) */
+			  const RSProgram* prgm) /* program (may be
+						    NULL) */
+{
+  if (prgm && prgm->ctx)
+    return prgm->ctx;
+  else if (key && key->ctx)
+    return key->ctx;
+  else
+    return &default_context;
+}
+
+/*
+ * Create a new context.
+ *
+ * The new context's program name, verbosity level, timing setting,
+ * and logging and tracing functions are copied from the default
+ * context.  Its allocator is
+ * not (use rs_context_set_allocator() to select one.)
+ */
+RSContext* rs_context_new()
+{
+  RSContext* ctx = rs_malloc(sizeof(RSContext));
+
+  if (!ctx)
+    return NULL;
+
+  memset(ctx, 0, sizeof(RSContext));
+  ctx->progname = default_context.progname;
+  ctx->verbose = default_context.verbose;
+  ctx->timing = default_context.timing;
+  ctx->tracefunc = default_context.tracefunc;
+  ctx->tracefuncdata = default_context.tracefuncdata;
+  ctx->errorfunc = default_context.errorfunc;
+  ctx->errorfuncdata = default_context.errorfuncdata;
+  ctx->messagefunc = default_context.messagefunc;
+  ctx->messagefuncdata = default_context.messagefuncdata;
+  return ctx;
+}
+
+/*
+ * Free a context.
+ *
+ * All keys and programs belonging to the context must be freed
+ * first.
+ */
+void rs_context_free(RSContext* ctx)
+{
+  if (!ctx || ctx == &default_context)
+    return;
+
+  rs_free(ctx);
+}
+
+/*
+ * Set program name for a context.
+ */
+void rs_context_set_progname(RSContext* ctx, const char* s)
+{
+  ctx->progname = s;
+}
+
+/*
+ * Set verbosity level for a context.
+ */
+void rs_context_set_verbose(RSContext* ctx, int v)
+{
+  ctx->verbose = v;
+}
+
+/*
+ * Set error logging function for a context.
+ */
+void rs_context_set_error_func(RSContext* ctx, RSMessageFunc func,
+			       void* data)
+{
+  ctx->errorfunc = func;
+  ctx->errorfuncdata = data;
+}
+
+/*
+ * Set message logging function for a context.
+ */
+void rs_context_set_message_func(RSContext* ctx, RSMessageFunc func,
+				 void* data)
+{
+  ctx->messagefunc = func;
+  ctx->messagefuncdata = data;
+}
+
+/*
+ * Set memory allocation function for a context.
+ *
+ * This must be done before any keys or programs are created using
+ * the context.  Contexts with no allocation function of their own
+ * use the global allocator (see rs_set_allocator().)
+ */
+void rs_context_set_allocator(RSContext* ctx, RSReallocFunc func,
+			      void* data)
+{
+  ctx->reallocfunc = func;
+  ctx->reallocfuncdata = data;
+}
+
+/*
+ * Reset statistics for a context.
+ */
+void rs_context_reset_stats(RSContext* ctx)
+{
+  memset(&ctx->stats, 0, sizeof(RSStats));
+}
+
+/*
+ * Enable or disable timing for a context.
+ *
+ * When timing is enabled, the time spent in each phase of processing
+ * (loading keys, parsing, repairing, hashing, signing or validating,
+ * and formatting output) is added to the context's statistics.
+ * Byte counts for each phase are always recorded.
+ */
+void rs_context_set_timing(RSContext* ctx, int timing)
+{
+  ctx->timing = timing;
+}
+
+/*
+ * Set phase tracing function for a context.
+ *
+ * The function is called at the end of each phase (whether or not
+ * timing is enabled), in whichever thread is using the context.
+ */
+void rs_context_set_trace_func(RSContext* ctx, RSTraceFunc func,
+			       void* data)
+{
+  ctx->tracefunc = func;
+  ctx->tracefuncdata = data;
+}
+
+/*
+ * Read a monotonic clock, in seconds from some arbitrary starting
+ * point.  If there is no monotonic clock, the time of day (or, as a
+ * last resort, the processor time) is used instead.
+ */
+double rs_get_time()
+{
+#ifdef HAVE_CLOCK_GETTIME
+  struct timespec ts;
+
+# ifdef CLOCK_MONOTONIC
+  if (!clock_gettime(CLOCK_MONOTONIC, &ts))
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+# endif
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+#else
+# if defined(HAVE_SYS_TIME_H) && defined(HAVE_GETTIMEOFDAY)
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+# else
+  return (double) clock() / CLOCKS_PER_SEC;
+# endif
+#endif
+}
+
+/*
+ * Start timing a phase.  Returns the current time, or 0 if neither
+ * timing nor tracing is enabled.
+ */
+double rs_phase_start(const RSContext* ctx) /* context */
+{
+  return (ctx->timing || ctx->tracefunc ? rs_get_time() : 0.0);
+}
+
+/*
+ * Add to a floating-point counter that may be shared between threads.
+ */
+static void add_time(double* total, /* counter */
+		     double t)	    /* time to add */
+{
+#ifdef __ATOMIC_RELAXED
+  double old, new;
+
+  __atomic_load(total, &old, __ATOMIC_RELAXED);
+  do {
+    new = old + t;
+  } while (!__atomic_compare_exchange(total, &old, &new, 0,
+				      __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+#else
+  *total += t;
+#endif
+}
+
+/*
+ * Finish timing a phase, add the elapsed time and the number of bytes
+ * processed to the context's statistics, and pass them to the
+ * context's tracing function (if any.)
+ */
+void rs_phase_end(RSContext* ctx,	 /* context */
+		  RSPhase phase,	 /* phase */
+		  double start,		 /* value returned by
+					    rs_phase_start() */
+		  unsigned long nbytes)	 /* number of bytes
+					    processed */
+{
+  double end;
+
+  RS_ATOMIC_ADD(ctx->stats.phase_bytes[phase], nbytes);
+  if (start == 0.0)
+    return;
+
+  end = rs_get_time();
+  if (ctx->timing)
+    add_time(&ctx->stats.phase_time[phase], end - start);
+  if (ctx->tracefunc)
+    (*ctx->tracefunc)(ctx, phase, start, end, nbytes, ctx->tracefuncdata);
+}
+
+/*
+ * Set the signature cache used by a context.
+ *
+ * The cache is not owned by the context, and must be closed by the
+ * caller after the context is no longer in use.
+ */
+void rs_context_set_sig_cache(RSContext* ctx, RSSigCache* sc)
+{
+  ctx->sigcache = sc;
+}
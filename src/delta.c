@@ -0,0 +1,436 @@
+/*
+ * RabbitSign - Tools for signing TI graphing calculator software
+ * Copyright (C) 2009 Benjamin Moody
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+
+#ifdef HAVE_STRING_H
+# include <string.h>
+#else
+# ifdef HAVE_STRINGS_H
+#  include <strings.h>
+# endif
+#endif
+
+#if defined(HAVE_UNISTD_H) && !defined(__MSDOS__) && !defined(__WIN32__)
+# define RS_USE_PWRITE
+# ifdef HAVE_SYS_TYPES_H
+#  include <sys/types.h>
+# endif
+# include <unistd.h>
+#endif
+
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP) && defined(HAVE_SYS_STAT_H)
+# define RS_USE_MMAP
+# ifdef HAVE_SYS_TYPES_H
+#  include <sys/types.h>
+# endif
+# include <sys/stat.h>
+# include <sys/mman.h>
+#endif
+
+#include "rabbitsign.h"
+#include "internal.h"
+#include "sha256.h"
+
+/*
+ * Signature deltas
+ *
+ * Signing a large program usually changes only a few bytes of the
+ * file it was read from: the signature is added at the end, and a
+ * length field or two in the header may be updated.  Rather than
+ * writing out the whole signed file, we can write a delta listing
+ * only the bytes that differ, which can later be applied to the
+ * original file in place.
+ *
+ * All integers are 32-bit big-endian values.  A delta file consists
+ * of:
+ *
+ *   "RSD2"  old_length  new_length  old_digest[32]
+ *
+ * followed by any number of records:
+ *
+ *   offset  length  <data>
+ *
+ * Applying the delta means writing each record's data at the given
+ * offset, then setting the length of the file to new_length.  The
+ * delta may only be applied to a file that is old_length bytes long,
+ * and whose SHA-256 digest is old_digest; this is checked, and the
+ * whole delta is read, before anything is written.
+ */
+
+#define RSD_MAGIC "RSD2"
+#define RSD_HEADER_SIZE 44
+
+/* Differing regions separated by this many bytes or fewer are
+   combined into a single record */
+#define RSD_MERGE_GAP 16
+
+/* Maximum length of a single record */
+#define RSD_MAX_RECORD 65536
+
+/* Size of blocks compared at once when looking for differences */
+#define RSD_BLOCK_SIZE 256
+
+#define RSD_BUFSIZE 65536
+
+/*
+ * Read the contents of a file into memory (mapping it, if possible.)
+ */
+static int load_file(const RSProgram* prgm,   /* program (for errors) */
+		     FILE* f,		      /* file */
+		     unsigned char** data,    /* file contents */
+		     unsigned long* length,   /* length of file */
+		     int* mapped)	      /* set to 1 if mapped */
+{
+  unsigned char* p;
+  unsigned long alloc;
+  size_t n;
+#ifdef RS_USE_MMAP
+  struct stat st;
+  void* map;
+
+  if (!fstat(fileno(f), &st) && S_ISREG(st.st_mode) && st.st_size > 0) {
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+    if (map != MAP_FAILED) {
+      *data = map;
+      *length = st.st_size;
+      *mapped = 1;
+      return RS_SUCCESS;
+    }
+  }
+#endif
+
+  *mapped = 0;
+  *length = 0;
+  alloc = RSD_BUFSIZE;
+  if (!(*data = rs_ctx_malloc(prgm->ctx, alloc)))
+    return RS_ERR_OUT_OF_MEMORY;
+
+  do {
+    if (*length >= alloc) {
+      alloc = *length * 2;
+      if (!(p = rs_ctx_realloc(prgm->ctx, *data, alloc))) {
+	rs_ctx_free(prgm->ctx, *data);
+	return RS_ERR_OUT_OF_MEMORY;
+      }
+      *data = p;
+    }
+    n = fread(*data + *length, 1, alloc - *length, f);
+    *length += n;
+  } while (n > 0);
+
+  if (ferror(f)) {
+    rs_ctx_free(prgm->ctx, *data);
+    rs_error(NULL, prgm, "file I/O error");
+    return RS_ERR_FILE_IO;
+  }
+  return RS_SUCCESS;
+}
+
+static void unload_file(const RSProgram* prgm, /* program */
+			unsigned char* data,   /* file contents */
+			unsigned long length,  /* length of file */
+			int mapped)	       /* 1 if mapped */
+{
+#ifdef RS_USE_MMAP
+  if (mapped) {
+    munmap(data, length);
+    return;
+  }
+#else
+  (void) length;
+  (void) mapped;
+#endif
+  rs_ctx_free(prgm->ctx, data);
+}
+
+/*
+ * Find the first byte, at or after pos, at which two buffers differ
+ * (returns length if there is none, or pos if pos is already past the
+ * end.)
+ */
+static unsigned long find_difference(const unsigned char* a, /* data */
+				     const unsigned char* b, /* data */
+				     unsigned long pos,	     /* start */
+				     unsigned long length)   /* length */
+{
+  if (pos >= length)
+    return pos;
+  while (length - pos >= RSD_BLOCK_SIZE
+	 && !memcmp(a + pos, b + pos, RSD_BLOCK_SIZE))
+    pos += RSD_BLOCK_SIZE;
+  while (pos < length && a[pos] == b[pos])
+    pos++;
+  return pos;
+}
+
+static int write_record(FILE* f,		   /* delta file */
+			unsigned long offset,	   /* offset in file */
+			const unsigned char* data, /* new contents */
+			unsigned long length)	   /* length of data */
+{
+  unsigned char hdr[8];
+
+  rs_put_u32(hdr, offset);
+  rs_put_u32(hdr + 4, length);
+  return (fwrite(hdr, 1, 8, f) != 8
+	  || fwrite(data, 1, length, f) != length);
+}
+
+/*
+ * Write a delta which, when applied to the file origfile, turns it
+ * into the program as it would be written by rs_write_program_file().
+ *
+ * The signed program is formatted in memory and compared with the
+ * original file a block at a time, so only the blocks that signing
+ * changed (the header fields, the signature, and anything that was
+ * added or removed at the end) are examined byte by byte.  origfile
+ * should be the file that the program was read from.
+ */
+int rs_write_program_delta(const RSProgram* prgm, /* program */
+			   FILE* origfile,	  /* original file */
+			   FILE* outfile,	  /* delta file to write */
+			   int month,		  /* timestamp month */
+			   int day,		  /* timestamp day */
+			   int year,		  /* timestamp year */
+			   unsigned int flags)	  /* output flags */
+{
+  unsigned char *newdata = NULL, *olddata, hdr[RSD_HEADER_SIZE];
+  unsigned long oldlen, newlen, cmplen, pos, start, last, nrecords = 0;
+  struct sha256_ctx ctx;
+  int e, mapped;
+
+  if ((e = rs_write_program_buffer(prgm, &newdata, &newlen,
+				   month, day, year, flags)))
+    return e;
+
+  if ((e = load_file(prgm, origfile, &olddata, &oldlen, &mapped))) {
+    rs_ctx_free(prgm->ctx, newdata);
+    return e;
+  }
+
+  memcpy(hdr, RSD_MAGIC, 4);
+  rs_put_u32(hdr + 4, oldlen);
+  rs_put_u32(hdr + 8, newlen);
+  sha256_init_ctx(&ctx);
+  sha256_process_bytes(olddata, oldlen, &ctx);
+  sha256_finish_ctx(&ctx, hdr + 12);
+  if (fwrite(hdr, 1, RSD_HEADER_SIZE, outfile) != RSD_HEADER_SIZE)
+    goto ioerr;
+
+  cmplen = (oldlen < newlen ? oldlen : newlen);
+  pos = 0;
+  while ((start = find_difference(olddata, newdata, pos, cmplen)) < newlen) {
+    /* Extend the record until the next RSD_MERGE_GAP bytes are all
+       unchanged */
+    last = start + 1;
+    for (pos = last; pos < newlen && pos - start < RSD_MAX_RECORD; pos++) {
+      if (pos >= oldlen || olddata[pos] != newdata[pos])
+	last = pos + 1;
+      else if (pos - last >= RSD_MERGE_GAP)
+	break;
+    }
+
+    if (write_record(outfile, start, newdata + start, last - start))
+      goto ioerr;
+    nrecords++;
+    pos = last;
+  }
+
+  rs_message(1, NULL, prgm, "delta: %lu bytes -> %lu bytes, %lu records",
+	     oldlen, newlen, nrecords);
+
+  unload_file(prgm, olddata, oldlen, mapped);
+  rs_ctx_free(prgm->ctx, newdata);
+  return RS_SUCCESS;
+
+ ioerr:
+  unload_file(prgm, olddata, oldlen, mapped);
+  rs_ctx_free(prgm->ctx, newdata);
+  rs_error(NULL, prgm, "file I/O error");
+  return RS_ERR_FILE_IO;
+}
+
+static int patch_file(FILE* f,			 /* file to patch */
+		      unsigned long offset,	 /* offset in file */
+		      const unsigned char* data, /* new contents */
+		      unsigned long length)	 /* length of data */
+{
+#ifdef RS_USE_PWRITE
+  return (pwrite(fileno(f), data, length, offset) != (ssize_t) length);
+#else
+  return (fseek(f, offset, SEEK_SET)
+	  || fwrite(data, 1, length, f) != length);
+#endif
+}
+
+/*
+ * Check that a file has the given SHA-256 digest.
+ */
+static int check_file_digest(FILE* f,			  /* file */
+			     const unsigned char* digest) /* expected
+							     digest */
+{
+  struct sha256_ctx ctx;
+  unsigned char* buf;
+  unsigned char value[32];
+  size_t n;
+
+  if (fseek(f, 0L, SEEK_SET) || !(buf = rs_malloc(RSD_BUFSIZE)))
+    return -1;
+
+  sha256_init_ctx(&ctx);
+  while ((n = fread(buf, 1, RSD_BUFSIZE, f)) > 0)
+    sha256_process_bytes(buf, n, &ctx);
+  sha256_finish_ctx(&ctx, value);
+  rs_free(buf);
+
+  if (ferror(f))
+    return -1;
+  return (memcmp(value, digest, 32) ? 1 : 0);
+}
+
+/*
+ * Apply a delta (written by rs_write_program_delta()) to a file.
+ *
+ * targetfile must be open for both reading and writing.  The file is
+ * modified in place.  Nothing is written unless the whole delta is
+ * valid and the file is the one it was computed from; if an I/O
+ * error occurs while writing, the file's contents are undefined.
+ */
+int rs_apply_program_delta(FILE* deltafile,	  /* delta file */
+			   FILE* targetfile,	  /* file to patch */
+			   const char* targetname) /* name of file to
+						      patch (for error
+						      messages) */
+{
+  unsigned char hdr[RSD_HEADER_SIZE], *recs = NULL, *p;
+  unsigned long oldlen, newlen, offset, length, nrecs, alloc, pos;
+  size_t n;
+  long curlen;
+  int e;
+
+  if (fread(hdr, 1, RSD_HEADER_SIZE, deltafile) != RSD_HEADER_SIZE
+      || memcmp(hdr, RSD_MAGIC, 4)) {
+    rs_error(NULL, NULL, "%s: invalid delta file", targetname);
+    return RS_ERR_UNKNOWN_FILE_FORMAT;
+  }
+  oldlen = rs_get_u32(hdr + 4);
+  newlen = rs_get_u32(hdr + 8);
+
+  /* Read and check all of the records */
+
+  nrecs = 0;
+  alloc = 0;
+  do {
+    if (nrecs >= alloc) {
+      alloc += RSD_BUFSIZE;
+      if (!(p = rs_realloc(recs, alloc))) {
+	rs_free(recs);
+	return RS_ERR_OUT_OF_MEMORY;
+      }
+      recs = p;
+    }
+    n = fread(recs + nrecs, 1, alloc - nrecs, deltafile);
+    nrecs += n;
+  } while (n > 0);
+
+  if (ferror(deltafile)) {
+    rs_free(recs);
+    rs_error(NULL, NULL, "%s: file I/O error", targetname);
+    return RS_ERR_FILE_IO;
+  }
+
+  for (pos = 0; pos < nrecs; pos += 8 + length) {
+    length = 0;
+    if (nrecs - pos < 8
+	|| (offset = rs_get_u32(recs + pos)) > newlen
+	|| (length = rs_get_u32(recs + pos + 4)) > RSD_MAX_RECORD
+	|| length > newlen - offset
+	|| length > nrecs - pos - 8) {
+      rs_free(recs);
+      rs_error(NULL, NULL, "%s: delta file is truncated or corrupt",
+	       targetname);
+      return RS_ERR_UNKNOWN_FILE_FORMAT;
+    }
+  }
+
+  /* Check that this is the file the delta was computed from */
+
+  if (fseek(targetfile, 0L, SEEK_END)
+      || (curlen = ftell(targetfile)) < 0) {
+    rs_free(recs);
+    rs_error(NULL, NULL, "%s: file I/O error", targetname);
+    return RS_ERR_FILE_IO;
+  }
+  if ((unsigned long) curlen != oldlen) {
+    rs_free(recs);
+    rs_error(NULL, NULL, "%s: wrong file length (%ld, expected %lu)",
+	     targetname, curlen, oldlen);
+    return RS_ERR_UNKNOWN_FILE_FORMAT;
+  }
+#ifndef RS_USE_PWRITE
+  if (newlen < oldlen) {
+    rs_free(recs);
+    rs_error(NULL, NULL, "%s: cannot truncate file", targetname);
+    return RS_ERR_FILE_IO;
+  }
+#endif
+
+  if ((e = check_file_digest(targetfile, hdr + 12))) {
+    rs_free(recs);
+    if (e < 0) {
+      rs_error(NULL, NULL, "%s: file I/O error", targetname);
+      return RS_ERR_FILE_IO;
+    }
+    rs_error(NULL, NULL, "%s: file does not match the delta"
+	     " (not the file it was computed from?)", targetname);
+    return RS_ERR_UNKNOWN_FILE_FORMAT;
+  }
+
+  /* Apply the records */
+
+  for (pos = 0; pos < nrecs; pos += 8 + length) {
+    offset = rs_get_u32(recs + pos);
+    length = rs_get_u32(recs + pos + 4);
+    if (patch_file(targetfile, offset, recs + pos + 8, length)) {
+      rs_free(recs);
+      rs_error(NULL, NULL, "%s: file I/O error", targetname);
+      return RS_ERR_FILE_IO;
+    }
+  }
+  rs_free(recs);
+
+#ifdef RS_USE_PWRITE
+  if (newlen != oldlen && ftruncate(fileno(targetfile), newlen)) {
+    rs_error(NULL, NULL, "%s: unable to set file length", targetname);
+    return RS_ERR_FILE_IO;
+  }
+#endif
+
+  if (fflush(targetfile)) {
+    rs_error(NULL, NULL, "%s: file I/O error", targetname);
+    return RS_ERR_FILE_IO;
+  }
+
+  return RS_SUCCESS;
+}
@@ -34,51 +34,54 @@
 #include "rabbitsign.h"
 #include "internal.h"
 
-static const char* progname;
-static int verbose;
-static RSMessageFunc errorfunc, messagefunc;
-static void *errorfuncdata, *messagefuncdata;
-
 void rs_set_progname(s)
      const char* s;
 {
-  progname = s;
+  rs_context_set_progname(rs_context_default(), s);
 }
 
 void rs_set_verbose(v)
      int v;
 {
-  verbose = v;
+  rs_context_set_verbose(rs_context_default(), v);
 }
 
 void rs_set_error_func(RSMessageFunc func, void* data)
 {
-  errorfunc = func;
-  errorfuncdata = data;
+  rs_context_set_error_func(rs_context_default(), func, data);
 }
 
 void rs_set_message_func(RSMessageFunc func, void* data)
 {
-  messagefunc = func;
-  messagefuncdata = data;
+  rs_context_set_message_func(rs_context_default(), func, data);
 }
 
-static void print_message(const RSKey* key, const RSProgram* prgm,
-			  const char* msg)
+static void print_message(const RSContext* ctx, const RSKey* key,
+			  const RSProgram* prgm, const char* msg)
 {
   if (prgm && prgm->filename)
     fprintf(stderr, "%s: ", prgm->filename);
   else if (key && key->filename)
     fprintf(stderr, "%s: ", key->filename);
-  else if (progname)
-    fprintf(stderr, "%s: ", progname);
+  else if (ctx->progname)
+    fprintf(stderr, "%s: ", ctx->progname);
   fputs(msg, stderr);
   fputc('\n', stderr);
 }
 
+static void log_error(RSContext* ctx, const RSKey* key,
+		      const RSProgram* prgm, const char* msg)
+{
+  if (ctx->errorfunc)
+    (*ctx->errorfunc)(key, prgm, msg, ctx->errorfuncdata);
+  else
+    print_message(ctx, key, prgm, msg);
+}
+
 /* Display a critical error */
 void rs_error(const RSKey* key, const RSProgram* prgm, const char* fmt, ...)
 {
+  RSContext* ctx = rs_get_context(key, prgm);
   char msg[512];
   va_list ap;
 
@@ -87,15 +90,32 @@ void rs_error(const RSKey* key, const RSProgram* prgm, const char* fmt, ...)
   rs_vsnprintf(msg + 7, sizeof(msg) - 7, fmt, ap);
   va_end(ap);
 
-  if (errorfunc)
-    (*errorfunc)(key, prgm, msg, errorfuncdata);
-  else
-    print_message(key, prgm, msg);
+  RS_ATOMIC_ADD(ctx->stats.errors, 1);
+  log_error(ctx, key, prgm, msg);
+}
+
+/* Display a critical error using a particular context */
+void rs_ctx_error(RSContext* ctx, const char* fmt, ...)
+{
+  char msg[512];
+  va_list ap;
+
+  if (!ctx)
+    ctx = rs_context_default();
+
+  va_start(ap, fmt);
+  strcpy(msg, "error: ");
+  rs_vsnprintf(msg + 7, sizeof(msg) - 7, fmt, ap);
+  va_end(ap);
+
+  RS_ATOMIC_ADD(ctx->stats.errors, 1);
+  log_error(ctx, NULL, NULL, msg);
 }
 
 /* Display a warning message */
 void rs_warning(const RSKey* key, const RSProgram* prgm, const char* fmt, ...)
 {
+  RSContext* ctx = rs_get_context(key, prgm);
   char msg[512];
   va_list ap;
 
@@ -104,28 +124,41 @@ void rs_warning(const RSKey* key, const RSProgram* prgm, const char* fmt, ...)
   rs_vsnprintf(msg + 9, sizeof(msg) - 9, fmt, ap);
   va_end(ap);
 
-  if (errorfunc)
-    (*errorfunc)(key, prgm, msg, errorfuncdata);
-  else
-    print_message(key, prgm, msg);
+  RS_ATOMIC_ADD(ctx->stats.warnings, 1);
+  log_error(ctx, key, prgm, msg);
 }
 
 /* Display an informative message */
 void rs_message(int level, const RSKey* key, const RSProgram* prgm,
 		const char* fmt, ...)
 {
+  RSContext* ctx = rs_get_context(key, prgm);
   char msg[1024];
   va_list ap;
 
-  if (level > verbose)
+  if (level > ctx->verbose)
     return;
 
   va_start(ap, fmt);
   rs_vsnprintf(msg, sizeof(msg), fmt, ap);
   va_end(ap);
 
-  if (messagefunc)
-    (*messagefunc)(key, prgm, msg, messagefuncdata);
+  if (ctx->messagefunc)
+    (*ctx->messagefunc)(key, prgm, msg, ctx->messagefuncdata);
+  else
+    print_message(ctx, key, prgm, msg);
+}
+
+/* Log a message that has already been formatted (e.g., one received
+   from a signing server) */
+void rs_relay_message(const RSProgram* prgm, int iserror, const char* msg)
+{
+  RSContext* ctx = rs_get_context(NULL, prgm);
+
+  if (iserror)
+    log_error(ctx, NULL, prgm, msg);
+  else if (ctx->messagefunc)
+    (*ctx->messagefunc)(NULL, prgm, msg, ctx->messagefuncdata);
   else
-    print_message(key, prgm, msg);
+    print_message(ctx, NULL, prgm, msg);
 }
@@ -49,7 +49,7 @@
 /*
  * Write a TIFL header to a file.
  */
-int rs_write_tifl_header(FILE* outfile,    /* file to write to */
+int rs_write_tifl_header(RSOutput* out,    /* file to write to */
 			 int is_hex,	    /* is file in hex format? */
              int is_ce,     /* is the header in the CE format */
 			 int major,	    /* major version # */
@@ -114,11 +114,6 @@ int rs_write_tifl_header(FILE* outfile,    /* file to write to */
   buf[76] = (filesize >> 16) & 0xff;
   buf[77] = (filesize >> 24) & 0xff;
 
-  if (fwrite(buf, 1, 78, outfile) != 78) {
-    rs_error(NULL, NULL, "file I/O error");
-    return RS_ERR_FILE_IO;
-  }
-
-  return RS_SUCCESS;
+  return rs_output_write(out, buf, 78);
 }
 
@@ -22,6 +22,14 @@
 
 #include <stdio.h>
 
+#ifdef HAVE_STRING_H
+# include <string.h>
+#else
+# ifdef HAVE_STRINGS_H
+#  include <strings.h>
+# endif
+#endif
+
 #include "rabbitsign.h"
 #include "internal.h"
 
@@ -140,6 +148,28 @@ int rs_find_app_field(unsigned int type,         /* Type of field to
   return -1;
 }
 
+/*
+ * Get the value of a numeric field, given its location.
+ */
+static unsigned long get_numeric_value(const unsigned char* data,
+				       unsigned long fstart,
+				       unsigned long fsize)
+{
+  unsigned long value;
+
+  if (fsize > 4)
+    return 0;
+
+  value = 0;
+  while (fsize > 0) {
+    value <<= 8;
+    value |= data[fstart];
+    fstart++;
+    fsize--;
+  }
+  return value;
+}
+
 /*
  * Get value of a numeric header field.
  *
@@ -150,20 +180,134 @@ unsigned long rs_get_numeric_field (unsigned int type,
 				    const unsigned char* data,
 				    unsigned long length)
 {
-  unsigned long fstart, fsize, value;
+  unsigned long fstart, fsize;
 
   if (rs_find_app_field(type, data, length, NULL, &fstart, &fsize))
     return 0;
 
-  if (fsize > 4)
-    return 0;
+  return get_numeric_value(data, fstart, fsize);
+}
 
-  value = 0;
-  while (fsize > 0) {
-    value <<= 8;
-    value |= data[fstart];
-    fstart++;
-    fsize--;
+/*
+ * Header field index
+ *
+ * Most of the header fields are looked up several times for each
+ * program (when guessing its type, finding its key, repairing,
+ * validating, and writing it.)  Rather than scanning the header from
+ * the beginning each time, the header is scanned once, and the
+ * location of the first field of each type (that is, each
+ * combination of the first byte and the upper nibble of the second
+ * byte) is recorded.
+ *
+ * Since the fields are always found by walking the same chain from
+ * the start of the header, an index built for a given length of
+ * header can answer queries for any shorter length as well.  It must
+ * be rebuilt if the header is moved, if a longer header is
+ * searched, or if the header's structure changes; the latter is done
+ * by calling rs_program_invalidate_header_index().
+ */
+
+static void build_header_index(RSHeaderIndex* idx,	  /* index */
+			       const unsigned char* hdr,  /* header data */
+			       unsigned long hdrsize)	  /* length of
+							     header */
+{
+  unsigned long pos = 0, fstart, fsize;
+  unsigned int t;
+
+  memset(idx->slot, 0, sizeof(idx->slot));
+  idx->nfields = 0;
+  idx->overflow = 0;
+
+  while (pos < hdrsize) {
+    t = (hdr[pos] << 4) | (hdr[pos + 1] >> 4);
+    rs_get_field_size(hdr + pos, &fstart, &fsize);
+
+    if (!idx->slot[t]) {
+      if (idx->nfields < RS_HEADER_INDEX_FIELDS) {
+	idx->fields[idx->nfields].head = pos;
+	idx->fields[idx->nfields].start = pos + fstart;
+	idx->fields[idx->nfields].size = fsize;
+	idx->slot[t] = ++idx->nfields;
+      }
+      else {
+	idx->overflow = 1;
+      }
+    }
+
+    pos += fstart + fsize;
   }
-  return value;
+
+  idx->hdr = hdr;
+  idx->hdrsize = hdrsize;
+}
+
+/*
+ * Find a given field in a program header, using the program's header
+ * index if possible.
+ */
+int rs_program_find_field(const RSProgram* prgm, /* program */
+			  unsigned int type,	 /* type of field */
+			  const unsigned char* hdr, /* header data */
+			  unsigned long hdrsize, /* length of header */
+			  unsigned long* fieldhead, /* offset to field
+						       type bytes */
+			  unsigned long* fieldstart, /* offset to field
+							contents */
+			  unsigned long* fieldsize)  /* length of field
+							contents */
+{
+  RSHeaderIndex* idx = prgm->hdrindex;
+  unsigned int n;
+
+  if (!idx)
+    return rs_find_app_field(type, hdr, hdrsize,
+			     fieldhead, fieldstart, fieldsize);
+
+  if (idx->hdr != hdr || idx->hdrsize < hdrsize)
+    build_header_index(idx, hdr, hdrsize);
+
+  n = idx->slot[(type >> 4) & 0xfff];
+  if (!n) {
+    if (idx->overflow)
+      return rs_find_app_field(type, hdr, hdrsize,
+			       fieldhead, fieldstart, fieldsize);
+    return -1;
+  }
+
+  n--;
+  if (idx->fields[n].head >= hdrsize)
+    return -1;
+
+  if (fieldhead) *fieldhead = idx->fields[n].head;
+  if (fieldstart) *fieldstart = idx->fields[n].start;
+  if (fieldsize) *fieldsize = idx->fields[n].size;
+  return 0;
+}
+
+/*
+ * Get value of a numeric field in a program header.
+ */
+unsigned long rs_program_get_numeric_field(const RSProgram* prgm, /* program */
+					   unsigned int type, /* field type */
+					   const unsigned char* hdr, /* header
+									data */
+					   unsigned long hdrsize) /* length of
+								     header */
+{
+  unsigned long fstart, fsize;
+
+  if (rs_program_find_field(prgm, type, hdr, hdrsize, NULL, &fstart, &fsize))
+    return 0;
+
+  return get_numeric_value(hdr, fstart, fsize);
+}
+
+/*
+ * Discard the program's header index.
+ */
+void rs_program_invalidate_header_index(RSProgram* prgm) /* program */
+{
+  if (prgm->hdrindex)
+    prgm->hdrindex->hdr = NULL;
 }
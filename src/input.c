@@ -30,6 +30,15 @@
 # endif
 #endif
 
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP) && defined(HAVE_SYS_STAT_H)
+# define RS_USE_MMAP
+# ifdef HAVE_SYS_TYPES_H
+#  include <sys/types.h>
+# endif
+# include <sys/stat.h>
+# include <sys/mman.h>
+#endif
+
 #include "rabbitsign.h"
 #include "internal.h"
 
@@ -47,7 +56,7 @@ static void guess_type(RSProgram* prgm, int is_hex)
     rs_get_field_size(prgm->header, &hdrstart, NULL);
     hdr = prgm->header + hdrstart;
     hdrsize = prgm->header_length - hdrstart;
-    keyid = rs_get_numeric_field(0x8010, hdr, hdrsize);
+    keyid = rs_program_get_numeric_field(prgm, 0x8010, hdr, hdrsize);
 
     prgm->datatype = RS_DATA_OS;
 
@@ -68,7 +77,7 @@ static void guess_type(RSProgram* prgm, int is_hex)
     /* Z80 apps and 68k OSes have field type 0x8000 */
 
     if (prgm->data[0] == 0x80 && (prgm->data[1] & 0xf0) == 0x00) {
-      keyid = rs_get_numeric_field(0x8010, hdr, hdrsize);
+      keyid = rs_program_get_numeric_field(prgm, 0x8010, hdr, hdrsize);
 
       switch (keyid & 0xff) {
       case 0x02:
@@ -112,7 +121,7 @@ static void guess_type(RSProgram* prgm, int is_hex)
     /* 68k apps have field type 0x8100 */
 
     else if (prgm->data[0] == 0x81 && (prgm->data[1] & 0xf0) == 0x00) {
-      keyid = rs_get_numeric_field(0x8110, hdr, hdrsize);
+      keyid = rs_program_get_numeric_field(prgm, 0x8110, hdr, hdrsize);
       prgm->datatype = RS_DATA_APP;
 
       switch (keyid & 0xff) {
@@ -139,8 +148,8 @@ static void guess_type(RSProgram* prgm, int is_hex)
     else if (prgm->data[0] == 0x03 && (prgm->data[1] & 0xf0) == 0x00) {
       prgm->datatype = RS_DATA_CERT;
 
-      if (!rs_find_app_field(0x0400, hdr, hdrsize,
-			     NULL, &fieldstart, &fieldsize)
+      if (!rs_program_find_field(prgm, 0x0400, hdr, hdrsize,
+				 NULL, &fieldstart, &fieldsize)
 	  && fieldsize >= 1) {
 	switch (hdr[fieldstart]) {
 	case 0x02:
@@ -170,38 +179,14 @@ static void guess_type(RSProgram* prgm, int is_hex)
 /*
  * Read the contents of a binary file into an RSProgram.
  */
-static int read_file_binary(RSProgram* prgm,
-			    FILE* f,
-			    unsigned long filesize)
+static int read_file_binary(RSProgram* prgm,	      /* program */
+			    const unsigned char* data, /* file data */
+			    unsigned long length)     /* length of data */
 {
-  unsigned char buf[1024];
-  size_t count;
-  unsigned long fieldstart,fieldsize;
-
-  if (filesize) {
-    while (filesize > 0) {
-      if (filesize > 1024)
-	count = fread(buf, 1, 1024, f);
-      else
-	count = fread(buf, 1, filesize, f);
-
-      if (count > 0)
-	rs_program_append_data(prgm, buf, count);
-      else
-	break;
+  int e;
 
-      filesize -= count;
-    }
-  }
-  else {
-    do {
-      count = fread(buf, 1, 1024, f);
-      if (count > 0) {
-	rs_program_append_data(prgm, buf, count);
-      }
-    } while (count > 0);
-  }
-  rs_get_field_size(prgm->data, &fieldstart, &fieldsize);
+  if ((e = rs_program_append_data(prgm, data, length)))
+    return e;
   //if (!prgm->calctype || !prgm->datatype)
     guess_type(prgm, 0);
   return RS_SUCCESS;
@@ -221,7 +206,7 @@ static int getpageidx(RSProgram* prgm,	    /* program */
     if (prgm->pagenums[i] == pagenum)
       return i;
 
-  if (!(array = rs_realloc(prgm->pagenums, (i + 1) * sizeof(unsigned int))))
+  if (!(array = rs_ctx_realloc(prgm->ctx, prgm->pagenums, (i + 1) * sizeof(unsigned int))))
     return 0;
   prgm->pagenums = array;
   prgm->npagenums = i + 1;
@@ -229,14 +214,53 @@ static int getpageidx(RSProgram* prgm,	    /* program */
   return i;
 }
 
+/*
+ * Read a hexadecimal number of at most ndigits digits, skipping any
+ * whitespace before it (as fscanf() would.)  Returns 0 if there are
+ * no digits to read.
+ */
+static int get_hex(const unsigned char* data, /* file data */
+		   unsigned long length,      /* length of data */
+		   unsigned long* pos,	      /* current position */
+		   int ndigits,		      /* maximum number of digits */
+		   unsigned int* value)	      /* value read */
+{
+  unsigned long p = *pos;
+  int i, c;
+
+  while (p < length && (data[p] == ' ' || data[p] == '\t'
+			|| data[p] == '\n' || data[p] == '\r'
+			|| data[p] == '\v' || data[p] == '\f'))
+    p++;
+
+  *value = 0;
+  for (i = 0; i < ndigits && p < length; i++, p++) {
+    c = data[p];
+    if (c >= '0' && c <= '9')
+      *value = (*value << 4) + (c - '0');
+    else if (c >= 'A' && c <= 'F')
+      *value = (*value << 4) + (c - 'A' + 10);
+    else if (c >= 'a' && c <= 'f')
+      *value = (*value << 4) + (c - 'a' + 10);
+    else
+      break;
+  }
+
+  *pos = p;
+  return i;
+}
+
 /*
  * Read an Intel/TI hex file into an RSProgram.
  *
- * Note that the first ':' is assumed to have been read already.
+ * Note that the first ':' is assumed to have been read already (pos
+ * is the position following it.)
  */
-static int read_file_hex(RSProgram* prgm,
-			 FILE* f,
-			 unsigned int flags)
+static int read_file_hex(RSProgram* prgm,	   /* program */
+			 const unsigned char* hex, /* file data */
+			 unsigned long length,	   /* length of data */
+			 unsigned long pos,	   /* starting position */
+			 unsigned int flags)	   /* input flags */
 {
   int c;
   unsigned int nbytes, addr, rectype, sum, i, b, value;
@@ -247,14 +271,16 @@ static int read_file_hex(RSProgram* prgm,
   int nparts = 0;
   int possibly_os_header = 1;
 
-  rs_free(prgm->pagenums);
-  if (!(prgm->pagenums = rs_malloc(sizeof(unsigned int))))
+  rs_ctx_free(prgm->ctx, prgm->pagenums);
+  if (!(prgm->pagenums = rs_ctx_malloc(prgm->ctx, sizeof(unsigned int))))
     return RS_ERR_OUT_OF_MEMORY;
   prgm->pagenums[0] = 0;
   prgm->npagenums = 1;
 
-  while (!feof(f) && !ferror(f)) {
-    if (3 > fscanf(f, "%2X%4X%2X", &nbytes, &addr, &rectype)) {
+  for (;;) {
+    if (!get_hex(hex, length, &pos, 2, &nbytes)
+	|| !get_hex(hex, length, &pos, 4, &addr)
+	|| !get_hex(hex, length, &pos, 2, &rectype)) {
       rs_error(NULL, prgm, "invalid hex data (following %X:%X)",
 	       pagenum, lastaddr);
       return RS_ERR_HEX_SYNTAX;
@@ -265,7 +291,7 @@ static int read_file_hex(RSProgram* prgm,
     sum = nbytes + addr + (addr >> 8) + rectype;
     value = 0;
     for (i = 0; i < nbytes; i++) {
-      if (1 > fscanf(f, "%2X", &b)) {
+      if (!get_hex(hex, length, &pos, 2, &b)) {
 	rs_error(NULL, prgm, "invalid hex data (at %X:%X)",
 		 pagenum, addr);
 	return RS_ERR_HEX_SYNTAX;
@@ -277,18 +303,15 @@ static int read_file_hex(RSProgram* prgm,
 
     /* Read checksum */
 
-    c = fgetc(f);
-    if (c == 'X') {
-      c = fgetc(f);
-      if (c != 'X') {
+    if (pos < length && hex[pos] == 'X') {
+      if (++pos >= length || hex[pos++] != 'X') {
 	rs_error(NULL, prgm, "invalid hex data (at %X:%X)",
 		 pagenum, addr);
 	return RS_ERR_HEX_SYNTAX;
       }
     }
     else {
-      ungetc(c, f);
-      if (1 > fscanf(f, "%2X", &b)) {
+      if (!get_hex(hex, length, &pos, 2, &b)) {
 	rs_error(NULL, prgm, "invalid hex data (at %X:%X)",
 		 pagenum, addr);
 	return RS_ERR_HEX_SYNTAX;
@@ -325,7 +348,8 @@ static int read_file_hex(RSProgram* prgm,
       if (nparts == 2 && prgm->header_length) {
 	/* Reading an OS signature */
 	if (addr + nbytes > prgm->signature_length) {
-	  if (!(sigp = rs_realloc(prgm->signature, addr + nbytes)))
+	  if (!(sigp = rs_ctx_realloc(prgm->ctx, prgm->signature,
+				    addr + nbytes)))
 	    return RS_ERR_OUT_OF_MEMORY;
 
 	  prgm->signature = sigp;
@@ -341,6 +365,7 @@ static int read_file_hex(RSProgram* prgm,
 	/* Reading normal program data */
 	offset = ((unsigned long) pageidx << 14) | addr;
 	if (offset + nbytes <= prgm->length) {
+	  rs_program_invalidate_header_index(prgm);
 	  memcpy(prgm->data + offset, data, nbytes);
 	}
 	else {
@@ -370,7 +395,7 @@ static int read_file_hex(RSProgram* prgm,
     }
 
     do {
-      c = fgetc(f);
+      c = (pos < length ? hex[pos++] : EOF);
     } while (c == '\n' || c == '\r' || c == ' ');
 
     if (c == EOF)
@@ -391,8 +416,9 @@ static int read_file_hex(RSProgram* prgm,
       flags &= ~RS_INPUT_SORTED;
       pagenum = pageidx = 0;
 
-      rs_free(prgm->header);
-      if (!(prgm->header = rs_malloc(prgm->length)))
+      rs_program_invalidate_header_index(prgm);
+      rs_ctx_free(prgm->ctx, prgm->header);
+      if (!(prgm->header = rs_ctx_malloc(prgm->ctx, prgm->length)))
 	return RS_ERR_OUT_OF_MEMORY;
 
       memcpy(prgm->header, prgm->data, prgm->length);
@@ -439,7 +465,7 @@ static int check_tifl_type(int calctype,
 }
 
 /*
- * Read program contents from a file.
+ * Read program contents from a block of memory.
  *
  * Various file formats are supported:
  *
@@ -447,51 +473,56 @@ static int check_tifl_type(int calctype,
  * - Plain Intel/TI hex
  * - Binary TIFL (89k, 89u, ...)
  * - Hex TIFL (8xk, 8xu, ...)
+ * - RabbitSign container (rsp; see container.c)
  *
- * Note: on platforms where it matters, all input files must be opened
- * in "binary" mode.
+ * The data are parsed in place; nothing is copied other than the
+ * program contents themselves.
  */
-int rs_read_program_file(RSProgram* prgm,    /* program */
-			 FILE* f,	     /* file */
-			 const char* fname,  /* file name */
-			 unsigned int flags) /* option flags */
+static int parse_program_buffer(RSProgram* prgm,	   /* program */
+				const unsigned char* data, /* file
+							      contents */
+				unsigned long length,	   /* length of
+							      data */
+				unsigned int flags)	   /* option flags */
 {
+  const unsigned char* tiflbuf;
+  unsigned long tiflsize, pos, n;
   int c;
-  unsigned char tiflbuf[78];
-  unsigned long tiflsize, i;
-  int e;
 
   rs_program_set_length(prgm, 0);
   prgm->header_length = 0;
   prgm->signature_length = 0;
   prgm->npagenums = 0;
 
-  rs_free(prgm->filename);
-  prgm->filename = rs_strdup(fname);
-  if (fname && !prgm->filename)
-    return RS_ERR_OUT_OF_MEMORY;
-
   if (flags & RS_INPUT_BINARY)
-    return read_file_binary(prgm, f, 0);
+    return read_file_binary(prgm, data, length);
 
-  c = fgetc(f);
-  if (c == 0x80 || c == 0x81) {
-    tiflbuf[0] = c;
-    if ((e = rs_program_append_data(prgm, tiflbuf, 1)))
-      return e;
-    return read_file_binary(prgm, f, 0);
+  if (length > 0 && (data[0] == 0x80 || data[0] == 0x81))
+    return read_file_binary(prgm, data, length);
+
+  if (length > 0 && data[0] == 'R') {
+    if (!rs_is_program_container(data, length)) {
+      rs_error(NULL, prgm, "unknown input file format");
+      return RS_ERR_UNKNOWN_FILE_FORMAT;
+    }
+    return rs_parse_program_container(prgm, data, length, flags);
   }
 
-  while (!feof(f) && !ferror(f)) {
+  pos = 0;
+  while (pos < length) {
+    c = data[pos++];
+
     if (c == ':') {
-      return read_file_hex(prgm, f, flags);
+      return read_file_hex(prgm, data, length, pos, flags);
     }
     else if (c == '*') {
-      if (fread(tiflbuf, 1, 78, f) < 78
-	  || strncmp((char*) tiflbuf, "*TIFL**", 7)) {
+      tiflbuf = data + pos;
+      if (length - pos < 78
+	  || strncmp((const char*) tiflbuf, "*TIFL**", 7)) {
 	rs_error(NULL, prgm, "unknown input file format");
 	return RS_ERR_UNKNOWN_FILE_FORMAT;
       }
+      pos += 78;
 
       tiflsize = ((unsigned long) tiflbuf[73]
 		  | ((unsigned long) tiflbuf[74] << 8)
@@ -509,30 +540,113 @@ int rs_read_program_file(RSProgram* prgm,    /* program */
 	prgm->datatype = tiflbuf[48];
 
 	if (tiflbuf[77] == ':')
-	  return read_file_hex(prgm, f, 0);
+	  return read_file_hex(prgm, data, length, pos, 0);
 	else {
-	  if ((e = rs_program_append_data(prgm, tiflbuf + 77, 1)))
-	    return e;
-	  return read_file_binary(prgm, f, tiflsize ? tiflsize - 1 : 0);
+	  /* (a size of 0 or 1 means "the rest of the file") */
+	  n = length - (pos - 1);
+	  if (tiflsize > 1 && tiflsize < n)
+	    n = tiflsize;
+	  return read_file_binary(prgm, tiflbuf + 77, n);
 	}
       }
       else {
 	/* extra data (license, certificate, etc.) -- ignore */
-	if (fseek(f, tiflsize - 1, SEEK_CUR)) {
-	  for (i = 0; i < tiflsize - 1; i++) {
-	    if (fgetc(f) == EOF) {
-	      rs_error(NULL, prgm, "unexpected EOF");
-	      return RS_ERR_UNKNOWN_FILE_FORMAT;
-	    }
-	  }
+	if (!tiflsize || tiflsize - 1 > length - pos) {
+	  rs_error(NULL, prgm, "unexpected EOF");
+	  return RS_ERR_UNKNOWN_FILE_FORMAT;
 	}
+	pos += tiflsize - 1;
       }
     }
-
-    c = fgetc(f);
   }
 
   rs_error(NULL, prgm, "unknown input file format");
   return RS_ERR_UNKNOWN_FILE_FORMAT;
 }
 
+int rs_read_program_buffer(RSProgram* prgm,	      /* program */
+			   const unsigned char* data, /* file contents */
+			   unsigned long length,      /* length of data */
+			   unsigned int flags)	      /* option flags */
+{
+  RSContext* ctx = rs_get_context(NULL, prgm);
+  double start = rs_phase_start(ctx);
+  int e;
+
+  e = parse_program_buffer(prgm, data, length, flags);
+  rs_phase_end(ctx, RS_PHASE_PARSE, start, length);
+  return e;
+}
+
+/*
+ * Read program contents from a file.
+ *
+ * The remainder of the file is mapped into memory (or read, if it
+ * cannot be mapped) and parsed by rs_read_program_buffer().
+ *
+ * Note: on platforms where it matters, all input files must be opened
+ * in "binary" mode.
+ */
+int rs_read_program_file(RSProgram* prgm,    /* program */
+			 FILE* f,	     /* file */
+			 const char* fname,  /* file name */
+			 unsigned int flags) /* option flags */
+{
+  unsigned char *data, *p;
+  unsigned long length, alloc;
+  size_t n;
+  int e;
+#ifdef RS_USE_MMAP
+  struct stat st;
+  long start;
+  void* map;
+#endif
+
+  rs_ctx_free(prgm->ctx, prgm->filename);
+  prgm->filename = rs_ctx_strdup(prgm->ctx, fname);
+  if (fname && !prgm->filename)
+    return RS_ERR_OUT_OF_MEMORY;
+
+#ifdef RS_USE_MMAP
+  if ((start = ftell(f)) >= 0 && !fstat(fileno(f), &st)
+      && S_ISREG(st.st_mode) && st.st_size > start) {
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+    if (map != MAP_FAILED) {
+      e = rs_read_program_buffer(prgm, (unsigned char*) map + start,
+				 st.st_size - start, flags);
+      munmap(map, st.st_size);
+      fseek(f, 0L, SEEK_END);
+      return e;
+    }
+  }
+#endif
+
+  length = 0;
+  alloc = 65536;
+  if (!(data = rs_ctx_malloc(prgm->ctx, alloc)))
+    return RS_ERR_OUT_OF_MEMORY;
+
+  do {
+    if (length >= alloc) {
+      alloc = length * 2;
+      p = rs_ctx_realloc(prgm->ctx, data, alloc);
+      if (!p) {
+	rs_ctx_free(prgm->ctx, data);
+	return RS_ERR_OUT_OF_MEMORY;
+      }
+      data = p;
+    }
+    n = fread(data + length, 1, alloc - length, f);
+    length += n;
+  } while (n > 0);
+
+  if (ferror(f)) {
+    rs_ctx_free(prgm->ctx, data);
+    rs_error(NULL, prgm, "file I/O error");
+    return RS_ERR_FILE_IO;
+  }
+
+  e = rs_read_program_buffer(prgm, data, length, flags);
+  rs_ctx_free(prgm->ctx, data);
+  return e;
+}
@@ -30,32 +30,286 @@ extern "C" {
 void* rs_realloc (void* ptr, unsigned long count) RS_ATTR_MALLOC;
 char* rs_strdup (const char* str) RS_ATTR_MALLOC;
 
+/* Allocate memory using a particular context's allocator */
+#define rs_ctx_malloc(ccc, nnn) rs_ctx_realloc((ccc), 0, (nnn))
+#define rs_ctx_free(ccc, ppp) rs_ctx_realloc((ccc), (ppp), 0)
+void* rs_ctx_realloc (RSContext* ctx, void* ptr, unsigned long count)
+  RS_ATTR_MALLOC;
+char* rs_ctx_strdup (RSContext* ctx, const char* str) RS_ATTR_MALLOC;
+
+
+/**** Atomic counters ****/
+
+/* Add to (or compare and swap) a counter that may be shared between
+   threads.  Without compiler support, the counter is simply updated,
+   and threads must not share contexts. */
+#if defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 1))
+# define RS_ATOMIC_ADD(vvv, nnn) __sync_add_and_fetch(&(vvv), (nnn))
+# define RS_ATOMIC_CAS(vvv, ooo, nnn) \
+  __sync_bool_compare_and_swap(&(vvv), (ooo), (nnn))
+#else
+# define RS_ATOMIC_ADD(vvv, nnn) ((vvv) += (nnn))
+# define RS_ATOMIC_CAS(vvv, ooo, nnn) ((vvv) = (nnn), 1)
+#endif
+
+
+/**** Library contexts (context.c) ****/
+
+/* Get the context to be used for a given key and/or program. */
+RSContext* rs_get_context (const RSKey* key, const RSProgram* prgm);
+
+/* Start timing a phase (returns 0 if timing is disabled.) */
+double rs_phase_start (const RSContext* ctx);
+
+/* Finish timing a phase, and add it to the context's statistics. */
+void rs_phase_end (RSContext* ctx, RSPhase phase, double start,
+		   unsigned long nbytes);
+
+
+/**** Header field index (header.c) ****/
+
+#define RS_HEADER_INDEX_FIELDS 64
+
+typedef struct _RSHeaderIndex {
+  const unsigned char* hdr;	/* Header that was indexed (NULL = none) */
+  unsigned long hdrsize;	/* Length of header that was indexed */
+  int nfields;			/* Number of field types found */
+  int overflow;			/* 1 = some field types not indexed */
+  unsigned char slot[4096];	/* Field number + 1 for each field type */
+  struct {
+    unsigned long head, start, size;
+  } fields[RS_HEADER_INDEX_FIELDS]; /* First field of each type */
+} RSHeaderIndex;
+
+/* Find a field in a program's header, using the program's header
+   index.  Arguments and result are the same as rs_find_app_field(). */
+int rs_program_find_field (const RSProgram* prgm, unsigned int type,
+			   const unsigned char* hdr, unsigned long hdrsize,
+			   unsigned long* fieldhead,
+			   unsigned long* fieldstart,
+			   unsigned long* fieldsize);
+
+/* Get value of a numeric field in a program's header. */
+unsigned long rs_program_get_numeric_field (const RSProgram* prgm,
+					    unsigned int type,
+					    const unsigned char* hdr,
+					    unsigned long hdrsize);
+
+/* Discard the header index (must be done whenever the header is
+   modified, other than changing the contents of a field in place.) */
+void rs_program_invalidate_header_index (RSProgram* prgm);
+
+
+/**** Program digests (program.c) ****/
+
+/* A digest of (part of) a program, as used for signing */
+typedef struct _RSProgramDigest {
+  RSKeyType alg;		/* RS_KEY_MD5 or RS_KEY_SHA256 */
+  int withheader;		/* 1 = OS header is hashed first */
+  unsigned long length;		/* number of bytes of data hashed */
+  unsigned char value[32];	/* digest (16 bytes for MD5) */
+} RSProgramDigest;
+
+/* Compute the digest of a program (the header, if withheader is 1,
+   followed by the first length bytes of data), or use the known
+   digest if it matches. */
+void rs_program_get_digest (const RSProgram* prgm, const RSKey* key,
+			    RSKeyType alg, int withheader,
+			    unsigned long length, unsigned char* value);
+
+/* Compute the digest used for signing a program (the header, if
+   withheader is 1, followed by all of the data.) */
+void rs_program_make_digest (const RSProgram* prgm, const RSKey* key,
+			     RSSigScheme scheme, RSKeyType alg,
+			     int withheader, RSDigest* digest);
+
+/* Discard the program's known digest. */
+void rs_program_discard_digest (RSProgram* prgm);
+
+/* Determine which digest is used to sign or validate a program (see
+   apps.c.)  Returns 0 if successful. */
+int rs_program_digest_params (const RSProgram* prgm, RSKeyType* alg,
+			      int* withheader, unsigned long* length);
+
+
+/**** Hash midstates (midstate.c) ****/
+
+/* Compute a digest using and updating the program's saved hash
+   states.  Returns 0 if successful. */
+int rs_midstates_digest (const RSProgram* prgm, RSKeyType alg,
+			 int withheader, unsigned long length,
+			 unsigned char* value, unsigned long* nhashed);
+
+/* Free saved hash states. */
+void rs_midstates_free (RSContext* ctx, RSMidstates* ms);
+
+
+/**** Program output (output.c) ****/
+
+/* Destination for program output: either a file or a block of
+   memory */
+typedef struct _RSOutput {
+  const RSProgram* prgm;	/* program (for error messages) */
+  FILE* f;			/* file (NULL = write to memory) */
+  unsigned char* data;		/* buffer (NULL = only count bytes) */
+  unsigned long size;		/* size of buffer */
+  unsigned long length;		/* number of bytes written */
+} RSOutput;
+
+/* Write data to a file or buffer. */
+RSStatus rs_output_write (RSOutput* out, const void* data,
+			  unsigned long length);
+
+/* Read or write a 32-bit big-endian integer (as used in cache and
+   container files.) */
+unsigned long rs_get_u32 (const unsigned char* p);
+void rs_put_u32 (unsigned char* p, unsigned long v);
+
+
+/**** TI-73/83+/84+ file output (output8x.c) ****/
+
+/* Write program as a .73k/.73u/.8xk/.8xu or .app file. */
+RSStatus rs_output_ti8x_file (RSOutput* out, const RSProgram* prgm,
+			      int month, int day, int year,
+			      unsigned int flags);
+
+/* Get the size of a .73k/.73u/.8xk/.8xu or .app file. */
+unsigned long rs_ti8x_file_size (const RSProgram* prgm, unsigned int flags);
+
+
+/**** TI-89/92+ file output (output9x.c) ****/
+
+/* Write program as a .89k/.89u/.9xk/.9xu file. */
+RSStatus rs_output_ti9x_file (RSOutput* out, const RSProgram* prgm,
+			      int month, int day, int year,
+			      unsigned int flags);
+
+/* Get the size of a .89k/.89u/.9xk/.9xu file. */
+unsigned long rs_ti9x_file_size (const RSProgram* prgm, unsigned int flags);
+
+
+/**** Container files (container.c) ****/
+
+/* Check whether a block of data looks like a container file. */
+int rs_is_program_container (const unsigned char* data,
+			     unsigned long length);
+
+/* Read a program from the contents of a container file. */
+RSStatus rs_parse_program_container (RSProgram* prgm,
+				     const unsigned char* data,
+				     unsigned long length,
+				     unsigned int flags);
+
+/* Write a program to a container file. */
+RSStatus rs_output_program_container (RSOutput* out,
+				      const RSProgram* prgm);
+
+/* Get the size of a container file. */
+unsigned long rs_program_container_size (const RSProgram* prgm);
+
+
+/**** Key file index (keystore.c) ****/
+
+/* Find key files for the given ID, in order of preference.  Returns
+   -1 if the index is not available. */
+int rs_key_index_find (unsigned long keyid, int pub,
+		       const char** paths, int max);
+
+
+/**** Signature cache (sigcache.c) ****/
+
+/* Signature type for Rabin signatures (RSA signatures use the
+   RSKeyType of the digest) */
+#define RS_SIG_CACHE_RABIN 0x10
+
+/* Look up a signature in the cache.  Returns 0 if found. */
+int rs_sig_cache_lookup (const RSSigCache* sc, const RSKey* key,
+			 int sigtype, const unsigned char* digest,
+			 unsigned int digestlen, int rootnum,
+			 mpz_t sig, int* f);
+
+/* Add a signature to the cache. */
+void rs_sig_cache_store (RSSigCache* sc, const RSKey* key,
+			 int sigtype, const unsigned char* digest,
+			 unsigned int digestlen, int rootnum,
+			 const mpz_t sig, int f);
+
+
+/**** Shared key cache (keyshm.c) ****/
+
+/* Read a key from the named file, using the shared key cache if it is
+   enabled.  Returns RS_ERR_KEY_NOT_FOUND if the file does not exist. */
+RSStatus rs_read_key_path (RSKey* key, const char* fname);
+
+
+/**** Prepared key files (rskfile.c) ****/
+
+/* Check whether data looks like a prepared key file. */
+int rs_is_key_rsk (const unsigned char* data, unsigned long length);
+
+/* Read a key from prepared key data. */
+RSStatus rs_parse_key_rsk (RSKey* key, const unsigned char* data,
+			   unsigned long length, const char* fname);
+
+/* Read a key from a prepared key file. */
+RSStatus rs_read_key_rsk (RSKey* key, FILE* f, const char* fname);
+
 
 /**** Rabin signature functions (rabin.c) ****/
 
 /* Compute a Rabin signature and the useful value of f. */
 RSStatus rs_sign_rabin (mpz_t res, int* f, const mpz_t hash,
-			int rootnum, RSKey* key);
+			int rootnum, const RSKey* key);
+
+/* Compute all four Rabin signatures and the useful value of f. */
+RSStatus rs_sign_rabin_all (mpz_t* res, int* f, const mpz_t hash,
+			    const RSKey* key);
 
 /* Check that the given Rabin signature is valid. */
 RSStatus rs_validate_rabin (const mpz_t sig, int f, const mpz_t hash,
 			    const RSKey* key);
 
+/* Compute q^-1 mod p. */
+RSStatus rs_rabin_get_qinv (mpz_t res, const mpz_t p, const mpz_t q);
+
 
 /**** RSA signature functions (rsa.c) ****/
 
 /* Compute an RSA signature. */
-RSStatus rs_sign_rsa (mpz_t res, const mpz_t hash, RSKey* key);
+RSStatus rs_sign_rsa (mpz_t res, const mpz_t hash, const RSKey* key);
+
+/* Calculate the RSA signing exponent. */
+RSStatus rs_rsa_get_exponent (mpz_t res, const mpz_t e,
+			      const mpz_t p, const mpz_t q);
 
 /* Check that the given RSA signature is valid. */
 RSStatus rs_validate_rsa (const mpz_t sig, const mpz_t hash,
 			  const RSKey* key);
 
 
+/**** TI-73/83+/84+ app signing (app8x.c) ****/
+
+/* Append a Rabin signature to a Flash app. */
+RSStatus rs_ti8x_app_add_signature (RSProgram* app, const mpz_t sigv,
+				    int f);
+
+
+/**** TI-73/83+/84+ OS signing (os8x.c) ****/
+
+/* Add an RSA signature to an OS. */
+RSStatus rs_ti8x_os_add_signature (RSProgram* os, const mpz_t sigv);
+
+
+/**** TI-89/92+ app/OS signing (app9x.c) ****/
+
+/* Append an RSA signature to a 68k app/OS. */
+RSStatus rs_ti9x_app_add_signature (RSProgram* app, const mpz_t sigv);
+
+
 /**** TIFL file output (graphlink.c) ****/
 
 /* Write TIFL header to a file. */
-RSStatus rs_write_tifl_header (FILE* f, int is_hex, int is_ce, int major, int minor,
+RSStatus rs_write_tifl_header (RSOutput* out, int is_hex, int is_ce, int major, int minor,
 			       int month, int day, int year,
 			       const char* name, int calctype, int datatype,
 			       unsigned long filesize);
@@ -77,6 +331,9 @@ const char* rs_calc_type_to_string (RSCalcType calctype);
 /* Get a human-readable description of a data type. */
 const char* rs_data_type_to_string (RSDataType datatype);
 
+/* Get a short name for a status code. */
+const char* rs_status_to_string (RSStatus status);
+
 
 /**** Command line option parsing (cmdline.c) ****/
 
@@ -86,9 +343,21 @@ const char* rs_data_type_to_string (RSDataType datatype);
 #define RS_CMDLINE_VERSION '@'
 #define RS_CMDLINE_ERROR '?'
 
+/* Long option descriptor (a table of these is terminated by an
+   entry with a NULL name) */
+typedef struct _RSLongOption {
+  const char* name;             /* Option name (without "--") */
+  int has_arg;                  /* 1 = option requires an argument */
+  int val;                      /* Value to return */
+} RSLongOption;
+
 int rs_parse_cmdline(int argc, char** argv, const char* optstring,
 		     int* i, int* j, const char** arg);
 
+int rs_parse_cmdline_long(int argc, char** argv, const char* optstring,
+			  const RSLongOption* longopts,
+			  int* i, int* j, const char** arg);
+
 
 /**** Error/message logging (error.c) ****/
 
@@ -104,6 +373,13 @@ void rs_warning (const RSKey* key, const RSProgram* prgm,
 void rs_message (int level, const RSKey* key, const RSProgram* prgm,
 		 const char* fmt, ...) /*RS_ATTR_PRINTF(4,5)*/;
 
+/* Display a critical error using a particular context */
+void rs_ctx_error (RSContext* ctx, const char* fmt, ...)
+  RS_ATTR_PRINTF(2,3);
+
+/* Log a message that has already been formatted */
+void rs_relay_message (const RSProgram* prgm, int iserror, const char* msg);
+
 #ifdef __cplusplus
 }
 #endif
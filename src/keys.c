@@ -32,17 +32,28 @@
 
 #include "rabbitsign.h"
 #include "internal.h"
+#include "sha256.h"
 
 /*
  * Create a new key.
  */
 RSKey* rs_key_new()
 {
-  RSKey* key = rs_malloc(sizeof(RSKey));
+  return rs_key_new_with_context(NULL);
+}
+
+/*
+ * Create a new key belonging to the given context.
+ */
+RSKey* rs_key_new_with_context(RSContext* ctx) /* context (NULL =
+						  default) */
+{
+  RSKey* key = rs_ctx_malloc(ctx, sizeof(RSKey));
 
   if (!key)
     return NULL;
 
+  key->ctx = ctx;
   key->filename = NULL;
   key->id = 0;
   mpz_init(key->n);
@@ -51,6 +62,8 @@ RSKey* rs_key_new()
   mpz_init(key->e);
   mpz_init(key->qinv);
   mpz_init(key->d);
+  mpz_init(key->dp);
+  mpz_init(key->dq);
 
   return key;
 }
@@ -63,14 +76,16 @@ void rs_key_free(RSKey* key)
   if (!key)
     return;
 
-  rs_free(key->filename);
+  rs_ctx_free(key->ctx, key->filename);
   mpz_clear(key->n);
   mpz_clear(key->p);
   mpz_clear(key->q);
   mpz_clear(key->e);
   mpz_clear(key->qinv);
   mpz_clear(key->d);
-  rs_free(key);
+  mpz_clear(key->dp);
+  mpz_clear(key->dq);
+  rs_ctx_free(key->ctx, key);
 }
 
 /*
@@ -81,9 +96,16 @@ static int parse_value(mpz_t dest,	/* mpz to store result */
 {
   unsigned int count, b, i;
   int n=strlen(str);
+  unsigned long len=strlen(str);
   unsigned char buf[1024];
+
+  /* ignore trailing whitespace (including CR+LF line endings) */
+  while (len > 0 && (str[len - 1] == '\n' || str[len - 1] == '\r'
+		     || str[len - 1] == ' ' || str[len - 1] == '\t'))
+    len--;
+
   if (  sscanf(str, "%2X%n", &count, &n)>=1 && n == 2
-      && (count * 2 + 3) >= strlen(str)) {
+      && (count * 2 + 2) >= len) {
 
     for (i = 0; i < count; i++) {
       if (1 > sscanf(str + 2 + 2 * i, "%2X%n", &b, &n) || n != 2)
@@ -94,7 +116,7 @@ static int parse_value(mpz_t dest,	/* mpz to store result */
     mpz_import(dest, i, -1, 1, 0, 0, buf);
     return 0;
   } else if ( sscanf(str, "%4X%n", &count, &n)>=1 && n == 4
-      && (count * 2 + 5	) >= strlen(str)) {
+      && (count * 2 + 4) >= len) {
 
     for (i = 0; i < count; i++) {
       if (1 > sscanf(str + 4 + 2 * i, "%2X%n", &b, &n) || n != 2)
@@ -126,6 +148,9 @@ static int parse_value(mpz_t dest,	/* mpz to store result */
  *
  * Note that "Rabin" style key files can be used to generate RSA
  * signatures, but not vice versa.
+ *
+ * Prepared (.rsk) key files, as written by rs_write_key_rsk(), are
+ * also accepted (see rskfile.c.)
  */
 int rs_read_key_file(RSKey* key,        /* key structure */
 		     FILE* f,	        /* file to read */
@@ -134,13 +159,20 @@ int rs_read_key_file(RSKey* key,        /* key structure */
 {
   char buf[1024];
   mpz_t tmp;
-  int fgs;
+  int fgs, c;
 
-  rs_free(key->filename);
-  key->filename = rs_strdup(fname);
+  rs_ctx_free(key->ctx, key->filename);
+  key->filename = rs_ctx_strdup(key->ctx, fname);
   if (fname && !key->filename)
     return RS_ERR_OUT_OF_MEMORY;
 
+  /* Text key files always begin with a hex digit; prepared key files
+     begin with "RSK" */
+  if ((c = getc(f)) != EOF)
+    ungetc(c, f);
+  if (c == 'R')
+    return rs_read_key_rsk(key, f, key->filename);
+
   if (!fgets(buf, sizeof(buf), f)) {
     rs_error(key, NULL, "invalid key file syntax");
     return RS_ERR_KEY_SYNTAX;
@@ -182,6 +214,8 @@ int rs_read_key_file(RSKey* key,        /* key structure */
     mpz_set_ui(key->p, 0);
     mpz_set_ui(key->q, 0);
     mpz_set_ui(key->qinv, 0);
+    mpz_set_ui(key->dp, 0);
+    mpz_set_ui(key->dq, 0);
   }
   else {
 
@@ -217,6 +251,8 @@ int rs_read_key_file(RSKey* key,        /* key structure */
 
     mpz_set_ui(key->qinv, 0);
     mpz_set_ui(key->d, 0);
+    mpz_set_ui(key->dp, 0);
+    mpz_set_ui(key->dq, 0);
     key->id = 0;
   }
 
@@ -239,6 +275,94 @@ int rs_read_key_file(RSKey* key,        /* key structure */
   return RS_SUCCESS;
 }
 
+/*
+ * Compute all values derived from the private key.
+ *
+ * If both factors are known, this computes q^-1 mod p (used for
+ * Rabin and CRT-RSA signatures), and d, d mod (p-1), and d mod (q-1)
+ * (used for RSA signatures.)  A key that is unsuitable for one of
+ * the two algorithms is not an error; the corresponding values are
+ * left unset, and the signing function will report the problem if
+ * the key is actually used that way.
+ *
+ * The signing functions never modify the key, so once this has been
+ * called, a key may be used by several threads at once.
+ */
+int rs_key_prepare(RSKey* key)	/* key structure */
+{
+  mpz_t tmp;
+
+  if (!mpz_sgn(key->p) || !mpz_sgn(key->q))
+    return RS_SUCCESS;
+
+  if (!mpz_sgn(key->qinv)
+      && rs_rabin_get_qinv(key->qinv, key->p, key->q))
+    mpz_set_ui(key->qinv, 0);
+
+  if (!mpz_sgn(key->d)
+      && rs_rsa_get_exponent(key->d, key->e, key->p, key->q))
+    mpz_set_ui(key->d, 0);
+
+  /* (builtin keys already include d mod (p-1) and d mod (q-1)) */
+  if (mpz_sgn(key->d) && (!mpz_sgn(key->dp) || !mpz_sgn(key->dq))) {
+    mpz_init(tmp);
+    mpz_sub_ui(tmp, key->p, 1);
+    mpz_mod(key->dp, key->d, tmp);
+    mpz_sub_ui(tmp, key->q, 1);
+    mpz_mod(key->dq, key->d, tmp);
+    mpz_clear(tmp);
+  }
+  else if (!mpz_sgn(key->d)) {
+    mpz_set_ui(key->dp, 0);
+    mpz_set_ui(key->dq, 0);
+  }
+
+  return RS_SUCCESS;
+}
+
+/*
+ * Add a number to a fingerprint.
+ */
+static void fingerprint_value(struct sha256_ctx* ctx, /* hash state */
+			      const RSKey* key,	      /* key */
+			      const mpz_t value)      /* value */
+{
+  unsigned char buf[4];
+  unsigned char* data;
+  size_t count = 0;
+
+  data = (mpz_sgn(value)
+	  ? rs_ctx_malloc(key->ctx, (mpz_sizeinbase(value, 2) + 7) / 8)
+	  : NULL);
+  if (data)
+    mpz_export(data, &count, -1, 1, 0, 0, value);
+
+  buf[0] = (count >> 24) & 0xff;
+  buf[1] = (count >> 16) & 0xff;
+  buf[2] = (count >> 8) & 0xff;
+  buf[3] = count & 0xff;
+  sha256_process_bytes(buf, 4, ctx);
+  if (count)
+    sha256_process_bytes(data, count, ctx);
+  rs_ctx_free(key->ctx, data);
+}
+
+/*
+ * Compute a fingerprint (SHA-256 hash) of a key's public values.
+ */
+void rs_key_get_fingerprint(const RSKey* key,	  /* key */
+			    unsigned char* fp)	  /* buffer for
+						     fingerprint (32
+						     bytes) */
+{
+  struct sha256_ctx ctx;
+
+  sha256_init_ctx(&ctx);
+  fingerprint_value(&ctx, key, key->n);
+  fingerprint_value(&ctx, key, key->e);
+  sha256_finish_ctx(&ctx, fp);
+}
+
 /*
  * Parse a number written in TI's hexadecimal key format.
  */
@@ -0,0 +1,365 @@
+/*
+ * RabbitSign - Tools for signing TI graphing calculator software
+ * Copyright (C) 2009 Benjamin Moody
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+# include <string.h>
+#else
+# ifdef HAVE_STRINGS_H
+#  include <strings.h>
+# endif
+#endif
+
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP) && defined(HAVE_SYS_STAT_H) \
+  && defined(HAVE_FCNTL_H) && defined(HAVE_UNISTD_H)
+# define RS_USE_SHM_CACHE
+# ifdef HAVE_SYS_TYPES_H
+#  include <sys/types.h>
+# endif
+# include <sys/stat.h>
+# include <sys/mman.h>
+# include <fcntl.h>
+# include <unistd.h>
+# ifndef O_NOFOLLOW
+#  define O_NOFOLLOW 0
+# endif
+#endif
+
+#include "rabbitsign.h"
+#include "internal.h"
+#include "sha256.h"
+
+/*
+ * Shared key cache
+ *
+ * When many short-lived processes use the same keys (for example, a
+ * build that runs rabbitsign once for each app), each of them would
+ * otherwise read, check, and prepare the same key files.  If a cache
+ * directory is given (usually somewhere in /dev/shm), the first
+ * process to load a key file writes the prepared key into the cache
+ * (in the .rsk format), and later processes map that entry instead.
+ *
+ * Entries are named after the identity of the original file (device,
+ * inode, size, and modification/change times), so editing or
+ * replacing a key file automatically causes a new entry to be
+ * created.  Stale entries are never removed; the cache directory can
+ * be deleted at any time.
+ *
+ * An entry is written to a temporary file and renamed into place, so
+ * readers never see a partial entry.  A lock file is used so that
+ * only one process populates a given entry at a time.
+ *
+ * Since the cache may hold private keys, and since whatever is found
+ * in it is trusted, the directory must belong to the current user and
+ * be inaccessible to anyone else (otherwise it is not used at all),
+ * and entries belonging to anyone else are ignored.
+ */
+
+static char* shm_dir = NULL;
+static int shm_dir_set = 0;
+static int shm_dir_ok = -1;	/* 1 = directory checked, 0 = unsafe */
+
+/*
+ * Set the directory used for the shared key cache (NULL to disable.)
+ *
+ * If this is never called, the RABBITSIGN_KEY_CACHE environment
+ * variable is used.
+ */
+int rs_set_key_shm_dir(const char* dir) /* cache directory */
+{
+  char* s = NULL;
+
+  if (dir && !(s = rs_strdup(dir)))
+    return RS_ERR_OUT_OF_MEMORY;
+
+  rs_free(shm_dir);
+  shm_dir = s;
+  shm_dir_set = 1;
+  shm_dir_ok = -1;
+  return RS_SUCCESS;
+}
+
+#ifdef RS_USE_SHM_CACHE
+
+static const char* get_shm_dir(void)
+{
+  const char* p;
+
+  if (!shm_dir_set) {
+    shm_dir_set = 1;
+    if ((p = getenv("RABBITSIGN_KEY_CACHE")) && *p)
+      shm_dir = rs_strdup(p);
+  }
+
+  return shm_dir;
+}
+
+/*
+ * Create the cache directory if necessary, and check that it is
+ * private.
+ */
+static int check_shm_dir(const char* dir) /* cache directory */
+{
+  struct stat st;
+
+  if (shm_dir_ok < 0) {
+    mkdir(dir, 0700);
+    if (lstat(dir, &st) || !S_ISDIR(st.st_mode)
+	|| st.st_uid != geteuid() || (st.st_mode & 077)) {
+      rs_warning(NULL, NULL, "key cache directory %s is not private;"
+		 " not using it", dir);
+      shm_dir_ok = 0;
+    }
+    else {
+      shm_dir_ok = 1;
+    }
+  }
+
+  return shm_dir_ok;
+}
+
+/*
+ * Check that a file in the cache belongs to us and is private.
+ */
+static int is_private_file(int fd) /* open file */
+{
+  struct stat st;
+
+  return (!fstat(fd, &st) && S_ISREG(st.st_mode)
+	  && st.st_uid == geteuid() && !(st.st_mode & 077));
+}
+
+static int is_rsk_name(const char* fname)
+{
+  size_t n = strlen(fname);
+  return (n >= 4 && !strcmp(fname + n - 4, ".rsk"));
+}
+
+/*
+ * Get the name of the cache entry for a file.
+ */
+static char* entry_name(const char* dir,       /* cache directory */
+			const struct stat* st) /* status of key file */
+{
+  struct sha256_ctx ctx;
+  unsigned char hash[32];
+  char buf[128];
+  char* s;
+  int i;
+
+  sprintf(buf, "%lx:%lx:%lx:%lx:%lx",
+	  (unsigned long) st->st_dev, (unsigned long) st->st_ino,
+	  (unsigned long) st->st_size, (unsigned long) st->st_mtime,
+	  (unsigned long) st->st_ctime);
+
+  sha256_init_ctx(&ctx);
+  sha256_process_bytes(buf, strlen(buf), &ctx);
+  sha256_finish_ctx(&ctx, hash);
+
+  s = rs_malloc(strlen(dir) + 1 + 32 + 4 + 1);
+  if (!s)
+    return NULL;
+
+  strcpy(s, dir);
+  strcat(s, "/");
+  for (i = 0; i < 16; i++)
+    sprintf(s + strlen(s), "%02x", hash[i]);
+  strcat(s, ".rsk");
+  return s;
+}
+
+/*
+ * Load a key from a cache entry.  Returns RS_ERR_KEY_NOT_FOUND if the
+ * entry does not exist.
+ */
+static int load_entry(RSKey* key,	 /* key structure */
+		      const char* name,	 /* name of cache entry */
+		      const char* fname) /* name of original key file */
+{
+  struct stat st;
+  void* map;
+  int fd, e;
+
+  if ((fd = open(name, O_RDONLY | O_NOFOLLOW)) < 0)
+    return RS_ERR_KEY_NOT_FOUND;
+
+  if (!is_private_file(fd)) {
+    rs_warning(key, NULL, "ignoring key cache entry %s"
+	       " (not owned by the current user)", name);
+    close(fd);
+    return RS_ERR_KEY_NOT_FOUND;
+  }
+
+  if (fstat(fd, &st) || st.st_size <= 0
+      || (map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0))
+      == MAP_FAILED) {
+    close(fd);
+    return RS_ERR_KEY_NOT_FOUND;
+  }
+
+  e = rs_parse_key_rsk(key, map, st.st_size, name);
+  munmap(map, st.st_size);
+  close(fd);
+
+  if (!e) {
+    rs_ctx_free(key->ctx, key->filename);
+    if (!(key->filename = rs_ctx_strdup(key->ctx, fname)))
+      return RS_ERR_OUT_OF_MEMORY;
+    rs_message(2, key, NULL, "using cached key %s", name);
+  }
+
+  return e;
+}
+
+/*
+ * Write a prepared key into the cache.  Errors are not fatal (the key
+ * has already been loaded) and are reported only as warnings.
+ */
+static void save_entry(const RSKey* key,	/* key structure */
+		       const char* name)	/* name of cache entry */
+{
+  struct flock lk;
+  char *lockname, *tempname;
+  FILE* f;
+  int fd, tfd, e;
+
+  lockname = rs_malloc(strlen(name) + 6);
+  tempname = rs_malloc(strlen(name) + 8);
+  if (!lockname || !tempname) {
+    rs_free(lockname);
+    rs_free(tempname);
+    return;
+  }
+  strcpy(lockname, name);
+  strcat(lockname, ".lock");
+  strcpy(tempname, name);
+  strcat(tempname, ".XXXXXX");
+
+  if ((fd = open(lockname, O_RDWR | O_CREAT | O_NOFOLLOW, 0600)) < 0
+      || !is_private_file(fd)) {
+    if (fd >= 0)
+      close(fd);
+    rs_warning(key, NULL, "unable to create key cache entry %s", name);
+    rs_free(lockname);
+    rs_free(tempname);
+    return;
+  }
+
+  memset(&lk, 0, sizeof(lk));
+  lk.l_type = F_WRLCK;
+  lk.l_whence = SEEK_SET;
+
+  if (!fcntl(fd, F_SETLKW, &lk)) {
+    /* another process may have created the entry while we were
+       waiting for the lock */
+    if (access(name, F_OK)) {
+      /* (the cache may hold private keys, so don't let other users
+	 read it; mkstemp() creates a new file with mode 0600) */
+      if ((tfd = mkstemp(tempname)) >= 0
+	  && (f = fdopen(tfd, "wb"))) {
+	e = rs_write_key_rsk(key, f);
+	if (fclose(f) || e || rename(tempname, name)) {
+	  rs_warning(key, NULL, "unable to create key cache entry %s", name);
+	  remove(tempname);
+	}
+	else {
+	  rs_message(2, key, NULL, "added key to cache as %s", name);
+	}
+      }
+      else {
+	if (tfd >= 0) {
+	  close(tfd);
+	  remove(tempname);
+	}
+	rs_warning(key, NULL, "unable to create key cache entry %s", name);
+      }
+    }
+
+    lk.l_type = F_UNLCK;
+    fcntl(fd, F_SETLK, &lk);
+  }
+
+  close(fd);
+  rs_free(lockname);
+  rs_free(tempname);
+}
+
+#endif /* RS_USE_SHM_CACHE */
+
+/*
+ * Read a key from the named file, using the shared key cache if it is
+ * enabled.  Returns RS_ERR_KEY_NOT_FOUND if the file cannot be opened.
+ *
+ * Keys obtained from the cache have already been prepared.
+ */
+int rs_read_key_path(RSKey* key,	/* key structure */
+		     const char* fname) /* key file name */
+{
+  FILE* f;
+  int e;
+#ifdef RS_USE_SHM_CACHE
+  const char* dir;
+  char* name = NULL;
+  struct stat st;
+
+  /* (there is nothing to gain by caching a file that is already in
+     prepared format) */
+  if ((dir = get_shm_dir()) && !is_rsk_name(fname)
+      && !stat(fname, &st) && S_ISREG(st.st_mode) && check_shm_dir(dir)) {
+    if ((name = entry_name(dir, &st))) {
+      e = load_entry(key, name, fname);
+      if (e == RS_SUCCESS) {
+	rs_free(name);
+	return RS_SUCCESS;
+      }
+      else if (e != RS_ERR_KEY_NOT_FOUND) {
+	/* damaged entry; replace it */
+	remove(name);
+      }
+    }
+  }
+#endif
+
+  f = fopen(fname, "rb");
+  if (!f) {
+#ifdef RS_USE_SHM_CACHE
+    rs_free(name);
+#endif
+    return RS_ERR_KEY_NOT_FOUND;
+  }
+
+  e = rs_read_key_file(key, f, fname, 1);
+  fclose(f);
+
+#ifdef RS_USE_SHM_CACHE
+  if (!e && name && !(e = rs_key_prepare(key)))
+    save_entry(key, name);
+  rs_free(name);
+#endif
+
+  return e;
+}
@@ -0,0 +1,641 @@
+/*
+ * RabbitSign - Tools for signing TI graphing calculator software
+ * Copyright (C) 2009 Benjamin Moody
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+# include <string.h>
+#else
+# ifdef HAVE_STRINGS_H
+#  include <strings.h>
+# endif
+#endif
+
+#ifdef HAVE_DIRENT_H
+# include <dirent.h>
+#endif
+
+#if defined(HAVE_SYS_INOTIFY_H) && defined(HAVE_INOTIFY_INIT1)
+# include <sys/inotify.h>
+# include <unistd.h>
+# define RS_WATCH_DIRS
+#endif
+
+#include "rabbitsign.h"
+#include "internal.h"
+
+/*
+ * Key file index
+ *
+ * rs_key_find_for_id() looks for key files named after the key ID,
+ * in several directories and with several spellings of the ID.
+ * Rather than trying to open each possible file, we scan each of the
+ * directories once, and remember which key files are present.
+ *
+ * The entries for a given ID and file type are sorted in the order
+ * in which rs_key_find_for_id() would otherwise have tried them:
+ * first by spelling of the file name, then by directory.  A prepared
+ * (.rsk) key file is preferred to a .key file with the same name.
+ */
+
+typedef struct _RSKeyIndexEntry {
+  unsigned long id;		/* key ID */
+  int pub;			/* 0 = .rsk or .key file, 1 = .pub file */
+  int rank;			/* search order */
+  char* path;			/* path to file */
+} RSKeyIndexEntry;
+
+static RSKeyIndexEntry* index_entries = NULL;
+static int index_count = 0;
+static int index_valid = 0;
+static unsigned long index_generation = 0;
+
+#ifdef RS_WATCH_DIRS
+static int index_watch_fd = -1;
+#endif
+
+/* File name formats, in order of preference */
+static const char* const name_formats[] = { "%02lx.%s", "%02lX.%s",
+					    "%04lx.%s", "%04lX.%s", NULL };
+
+/*
+ * Get the list of directories to search, in order of preference.
+ * Each is a prefix to be prepended to the file name.
+ */
+static int get_key_dirs(const char** dirs, /* array to store prefixes */
+			const char** seps) /* array to store separators */
+{
+  const char* p;
+  int n = 0;
+
+  dirs[n] = "";
+  seps[n++] = "";
+
+  if ((p = getenv("RABBITSIGN_KEY_DIR"))) {
+    dirs[n] = p;
+#if defined(__MSDOS__) || defined(__WIN32__)
+    seps[n++] = "\\";
+#else
+    seps[n++] = "/";
+#endif
+  }
+
+#if defined(__MSDOS__) || defined(__WIN32__)
+  if ((p = getenv("TI83PLUSDIR"))) {
+    dirs[n] = p;
+    seps[n++] = "\\Utils\\";
+  }
+#endif
+
+#ifdef SHARE_DIR
+  dirs[n] = SHARE_DIR;
+  seps[n++] = "";
+#endif
+
+  return n;
+}
+
+static void free_index(void)
+{
+  int i;
+
+  for (i = 0; i < index_count; i++)
+    rs_free(index_entries[i].path);
+  rs_free(index_entries);
+  index_entries = NULL;
+  index_count = 0;
+  index_valid = 0;
+}
+
+static int compare_entries(const void* a, const void* b)
+{
+  const RSKeyIndexEntry* x = a;
+  const RSKeyIndexEntry* y = b;
+
+  if (x->id != y->id)
+    return (x->id < y->id ? -1 : 1);
+  if (x->pub != y->pub)
+    return x->pub - y->pub;
+  return x->rank - y->rank;
+}
+
+#ifdef HAVE_DIRENT_H
+
+/*
+ * Add a directory entry to the index, if it is a key file.
+ */
+static int add_entry(const char* dir,	 /* directory prefix */
+		     const char* sep,	 /* separator */
+		     const char* name,	 /* file name */
+		     int dirnum,	 /* directory number */
+		     int ndirs,		 /* number of directories */
+		     int* nalloc)	 /* size of index array */
+{
+  char buf[32];
+  const char* ext;
+  char* end;
+  unsigned long id;
+  RSKeyIndexEntry* ent;
+  int i, pub, text;
+
+  ext = strrchr(name, '.');
+  if (!ext || ext == name || strlen(name) > 16)
+    return RS_SUCCESS;
+  if (!strcmp(ext + 1, "rsk") || !strcmp(ext + 1, "key"))
+    pub = 0;
+  else if (!strcmp(ext + 1, "pub"))
+    pub = 1;
+  else
+    return RS_SUCCESS;
+  text = (strcmp(ext + 1, "rsk") != 0);
+
+  id = strtoul(name, &end, 16);
+  if (end != ext)
+    return RS_SUCCESS;
+
+  /* Only accept names that rs_key_find_for_id() would have tried */
+  for (i = 0; name_formats[i]; i++) {
+    sprintf(buf, name_formats[i], id, ext + 1);
+    if (!strcmp(buf, name))
+      break;
+  }
+  if (!name_formats[i])
+    return RS_SUCCESS;
+
+  if (index_count >= *nalloc) {
+    *nalloc = index_count * 2 + 16;
+    ent = rs_realloc(index_entries, *nalloc * sizeof(RSKeyIndexEntry));
+    if (!ent)
+      return RS_ERR_OUT_OF_MEMORY;
+    index_entries = ent;
+  }
+
+  ent = &index_entries[index_count];
+  ent->id = id;
+  ent->pub = pub;
+  ent->rank = (i * ndirs + dirnum) * 2 + text;
+  ent->path = rs_malloc(strlen(dir) + strlen(sep) + strlen(name) + 1);
+  if (!ent->path)
+    return RS_ERR_OUT_OF_MEMORY;
+  strcpy(ent->path, dir);
+  strcat(ent->path, sep);
+  strcat(ent->path, name);
+  index_count++;
+  return RS_SUCCESS;
+}
+
+#endif /* HAVE_DIRENT_H */
+
+/*
+ * Scan the key directories, and rebuild the index.
+ */
+int rs_key_index_refresh()
+{
+#ifdef HAVE_DIRENT_H
+  const char* dirs[8];
+  const char* seps[8];
+  char* dname;
+  DIR* d;
+  struct dirent* de;
+  int ndirs, i, nalloc = 0, e;
+
+  free_index();
+  index_generation++;
+
+  ndirs = get_key_dirs(dirs, seps);
+
+  for (i = 0; i < ndirs; i++) {
+    dname = rs_malloc(strlen(dirs[i]) + strlen(seps[i]) + 2);
+    if (!dname) {
+      free_index();
+      return RS_ERR_OUT_OF_MEMORY;
+    }
+    strcpy(dname, dirs[i]);
+    strcat(dname, seps[i]);
+    if (!dname[0])
+      strcpy(dname, ".");
+
+    d = opendir(dname);
+    rs_free(dname);
+    if (!d)
+      continue;
+
+    while ((de = readdir(d))) {
+      if ((e = add_entry(dirs[i], seps[i], de->d_name,
+			 i, ndirs, &nalloc))) {
+	closedir(d);
+	free_index();
+	return e;
+      }
+    }
+    closedir(d);
+  }
+
+  if (index_count)
+    qsort(index_entries, index_count, sizeof(RSKeyIndexEntry),
+	  &compare_entries);
+
+  index_valid = 1;
+  return RS_SUCCESS;
+#else
+  return RS_ERR_KEY_NOT_FOUND;
+#endif
+}
+
+/*
+ * Watch the key directories for changes, so that the index will be
+ * refreshed automatically.  This is only useful for programs that
+ * run for a long time.
+ */
+int rs_key_index_watch()
+{
+#ifdef RS_WATCH_DIRS
+  const char* dirs[8];
+  const char* seps[8];
+  char* dname;
+  int ndirs, i;
+
+  if (index_watch_fd >= 0)
+    return RS_SUCCESS;
+
+  index_watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (index_watch_fd < 0)
+    return RS_ERR_FILE_IO;
+
+  ndirs = get_key_dirs(dirs, seps);
+  for (i = 0; i < ndirs; i++) {
+    dname = rs_malloc(strlen(dirs[i]) + strlen(seps[i]) + 2);
+    if (!dname)
+      return RS_ERR_OUT_OF_MEMORY;
+    strcpy(dname, dirs[i]);
+    strcat(dname, seps[i]);
+    if (!dname[0])
+      strcpy(dname, ".");
+
+    inotify_add_watch(index_watch_fd, dname,
+		      (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO
+		       | IN_CLOSE_WRITE | IN_ATTRIB));
+    rs_free(dname);
+  }
+
+  return RS_SUCCESS;
+#else
+  return RS_ERR_FILE_IO;
+#endif
+}
+
+/*
+ * Check whether the key directories have changed, and if so,
+ * invalidate the index.
+ */
+static void check_index(void)
+{
+#ifdef RS_WATCH_DIRS
+  char buf[4096];
+  int changed = 0;
+
+  if (index_watch_fd < 0)
+    return;
+
+  while (read(index_watch_fd, buf, sizeof(buf)) > 0)
+    changed = 1;
+
+  if (changed && index_valid) {
+    free_index();
+    index_generation++;
+  }
+#endif
+}
+
+/*
+ * Get the current index generation.  This changes whenever the index
+ * is rebuilt, so callers that cache keys can tell when their cached
+ * keys may be out of date.
+ */
+unsigned long rs_key_index_generation()
+{
+  check_index();
+  return index_generation;
+}
+
+/*
+ * Find key files for the given ID.
+ *
+ * Up to max paths are stored in the paths array, in order of
+ * preference.  These remain valid until the index is refreshed.
+ * Returns the number of paths found, or -1 if the index cannot be
+ * used (in which case the caller must search for the files itself.)
+ */
+int rs_key_index_find(unsigned long keyid, /* key ID */
+		      int pub,		   /* 1 = find .pub files */
+		      const char** paths,  /* array to store paths */
+		      int max)		   /* size of array */
+{
+  int i, n = 0;
+
+  check_index();
+
+  if (!index_valid && rs_key_index_refresh())
+    return -1;
+
+  for (i = 0; i < index_count && n < max; i++)
+    if (index_entries[i].id == keyid && index_entries[i].pub == pub)
+      paths[n++] = index_entries[i].path;
+
+  return n;
+}
+
+
+/*
+ * Key cache
+ *
+ * A key cache holds a limited number of parsed and prepared keys, so
+ * that programs signed with the same key need not reload it.  Keys
+ * are kept in order of most recent use; when the cache is full, the
+ * least recently used key that is not in use is discarded.
+ */
+
+typedef struct _RSKeyCacheEntry {
+  RSKey* key;
+  char* filename;		/* file name (NULL = found by ID) */
+  int private;			/* 1 = key can be used for signing */
+  unsigned int refs;		/* number of users */
+  unsigned long generation;	/* index generation when loaded */
+  struct _RSKeyCacheEntry* next;
+} RSKeyCacheEntry;
+
+struct _RSKeyCache {
+  RSContext* ctx;
+  unsigned int size;		/* maximum number of unused keys */
+  unsigned int count;		/* number of keys */
+  RSKeyCacheEntry* head;	/* most recently used key */
+};
+
+/*
+ * Create a new key cache.
+ */
+RSKeyCache* rs_key_cache_new(RSContext* ctx,	/* context (NULL =
+						   default) */
+			     unsigned int size)	/* maximum number of
+						   keys (0 = no
+						   limit) */
+{
+  RSKeyCache* kc = rs_ctx_malloc(ctx, sizeof(RSKeyCache));
+
+  if (!kc)
+    return NULL;
+
+  kc->ctx = ctx;
+  kc->size = size;
+  kc->count = 0;
+  kc->head = NULL;
+  return kc;
+}
+
+static void free_entry(RSKeyCache* kc, RSKeyCacheEntry* ent)
+{
+  rs_key_free(ent->key);
+  rs_ctx_free(kc->ctx, ent->filename);
+  rs_ctx_free(kc->ctx, ent);
+  kc->count--;
+}
+
+/*
+ * Free a key cache, and all keys in it.
+ */
+void rs_key_cache_free(RSKeyCache* kc)
+{
+  RSKeyCacheEntry* ent;
+
+  if (!kc)
+    return;
+
+  while ((ent = kc->head)) {
+    kc->head = ent->next;
+    free_entry(kc, ent);
+  }
+  rs_ctx_free(kc->ctx, kc);
+}
+
+/*
+ * Discard unused keys until the cache is no larger than its limit.
+ */
+static void trim_cache(RSKeyCache* kc)
+{
+  RSKeyCacheEntry **pent, **last, *ent;
+
+  while (kc->size && kc->count > kc->size) {
+    last = NULL;
+    for (pent = &kc->head; *pent; pent = &(*pent)->next)
+      if (!(*pent)->refs)
+	last = pent;
+
+    if (!last)
+      return;
+    ent = *last;
+    *last = ent->next;
+    free_entry(kc, ent);
+  }
+}
+
+/*
+ * Discard unused keys found by ID whose files may have changed.
+ */
+static void expire_cache(RSKeyCache* kc)
+{
+  unsigned long gen = rs_key_index_generation();
+  RSKeyCacheEntry **pent, *ent;
+
+  pent = &kc->head;
+  while ((ent = *pent)) {
+    if (!ent->refs && !ent->filename && ent->generation != gen) {
+      *pent = ent->next;
+      free_entry(kc, ent);
+    }
+    else {
+      pent = &ent->next;
+    }
+  }
+}
+
+/*
+ * Add a key to the cache, with one reference.
+ */
+static const RSKey* add_entry_key(RSKeyCache* kc,
+				  RSKey* key,
+				  const char* filename)
+{
+  RSKeyCacheEntry* ent = rs_ctx_malloc(kc->ctx, sizeof(RSKeyCacheEntry));
+
+  if (!ent) {
+    rs_key_free(key);
+    return NULL;
+  }
+
+  ent->filename = NULL;
+  if (filename && !(ent->filename = rs_ctx_strdup(kc->ctx, filename))) {
+    rs_ctx_free(kc->ctx, ent);
+    rs_key_free(key);
+    return NULL;
+  }
+
+  ent->private = ((mpz_sgn(key->p) && mpz_sgn(key->q))
+		  || mpz_sgn(key->d));
+  if (ent->private)
+    rs_key_prepare(key);
+
+  ent->key = key;
+  ent->refs = 1;
+  ent->generation = index_generation;
+  ent->next = kc->head;
+  kc->head = ent;
+  kc->count++;
+
+  trim_cache(kc);
+  return key;
+}
+
+/*
+ * Find a key in the cache, and move it to the front.
+ */
+static const RSKey* use_entry(RSKeyCache* kc,
+			      RSKeyCacheEntry** pent)
+{
+  RSKeyCacheEntry* ent = *pent;
+
+  *pent = ent->next;
+  ent->next = kc->head;
+  kc->head = ent;
+  ent->refs++;
+  return ent->key;
+}
+
+/*
+ * Add an already loaded key to the cache, so that it can be found
+ * by its ID.  The cache takes ownership of the key.  The key is
+ * returned with one reference held.
+ */
+const RSKey* rs_key_cache_add(RSKeyCache* kc, /* key cache */
+			      RSKey* key)     /* key to add */
+{
+  return add_entry_key(kc, key, NULL);
+}
+
+/*
+ * Get the key with the given ID, loading it if necessary.
+ *
+ * The key must be released with rs_key_cache_release() when it is no
+ * longer needed.
+ */
+const RSKey* rs_key_cache_find(RSKeyCache* kc,	     /* key cache */
+			       unsigned long keyid,  /* key ID */
+			       int publiconly)	     /* 1 = public key is
+							sufficient */
+{
+  RSKeyCacheEntry** pent;
+  RSContext* ctx;
+  RSKey* key;
+  const RSKey* result;
+  double start;
+
+  expire_cache(kc);
+
+  for (pent = &kc->head; *pent; pent = &(*pent)->next)
+    if (!(*pent)->filename && (*pent)->key->id == keyid
+	&& (publiconly || (*pent)->private))
+      return use_entry(kc, pent);
+
+  ctx = (kc->ctx ? kc->ctx : rs_context_default());
+  start = rs_phase_start(ctx);
+
+  key = rs_key_new_with_context(kc->ctx);
+  if (key && rs_key_find_for_id(key, keyid, publiconly)) {
+    rs_key_free(key);
+    key = NULL;
+  }
+
+  result = (key ? add_entry_key(kc, key, NULL) : NULL);
+  rs_phase_end(ctx, RS_PHASE_KEY, start, 0);
+  return result;
+}
+
+/*
+ * Get the key stored in the given file, loading it if necessary.
+ *
+ * The key must be released with rs_key_cache_release() when it is no
+ * longer needed.
+ */
+const RSKey* rs_key_cache_load_file(RSKeyCache* kc,	  /* key cache */
+				    const char* filename) /* key file */
+{
+  RSKeyCacheEntry** pent;
+  RSContext* ctx;
+  RSKey* key;
+  const RSKey* result;
+  double start;
+  int e;
+
+  for (pent = &kc->head; *pent; pent = &(*pent)->next)
+    if ((*pent)->filename && !strcmp((*pent)->filename, filename))
+      return use_entry(kc, pent);
+
+  ctx = (kc->ctx ? kc->ctx : rs_context_default());
+  start = rs_phase_start(ctx);
+
+  key = rs_key_new_with_context(kc->ctx);
+  if (key && (e = rs_read_key_path(key, filename))) {
+    if (e == RS_ERR_KEY_NOT_FOUND)
+      rs_ctx_error(kc->ctx, "%s: unable to open key file", filename);
+    rs_key_free(key);
+    key = NULL;
+  }
+
+  result = (key ? add_entry_key(kc, key, filename) : NULL);
+  rs_phase_end(ctx, RS_PHASE_KEY, start, 0);
+  return result;
+}
+
+/*
+ * Release a key obtained from the cache.
+ */
+void rs_key_cache_release(RSKeyCache* kc,  /* key cache */
+			  const RSKey* key) /* key to release */
+{
+  RSKeyCacheEntry* ent;
+
+  if (!key)
+    return;
+
+  for (ent = kc->head; ent; ent = ent->next) {
+    if (ent->key == key) {
+      if (ent->refs)
+	ent->refs--;
+      break;
+    }
+  }
+
+  trim_cache(kc);
+}
@@ -34,30 +34,152 @@
 # endif
 #endif
 
+#if defined(HAVE_MALLOC_H) && defined(HAVE_MALLOC_USABLE_SIZE)
+# include <malloc.h>
+# define BLOCK_SIZE(ppp) ((ppp) ? (long) malloc_usable_size(ppp) : 0L)
+#else
+# define BLOCK_SIZE(ppp) 0L
+#endif
+
 #include "rabbitsign.h"
 #include "internal.h"
 
-void* rs_realloc(void* ptr, unsigned long count)
+/*
+ * All memory used by the library is allocated by rs_ctx_realloc(),
+ * using the context's allocation function if it has one, and
+ * otherwise the global allocation function (see rs_set_allocator();
+ * by default, realloc().)  Big-number arithmetic (GMP or mpz.c)
+ * allocates memory using the global allocation function as well.
+ *
+ * Allocations may optionally be counted (see rs_set_alloc_stats().)
+ * The counters are shared by all threads, and are updated using
+ * atomic operations (see internal.h) where the compiler provides
+ * them.  The number of bytes in use is only known for blocks
+ * allocated by realloc() (if the system can tell us their sizes) and
+ * for big-number arithmetic, whose allocation functions are told the
+ * size of each block.
+ *
+ * The big-number allocation functions are only replaced while they
+ * are needed, and the functions that were installed before (which
+ * may belong to the program using the library) are put back
+ * afterwards.  Unless there is a global allocation function, our
+ * replacements call the previous functions to do the actual work.
+ */
+
+/* Global allocation function (NULL = use realloc()) */
+static RSReallocFunc reallocfunc = NULL;
+static void* reallocfuncdata = NULL;
+
+/* 1 = a block has been allocated using the global allocation function
+   or the big-number allocation functions, so the global allocation
+   function can no longer be changed */
+static int allocated = 0;
+
+/* Big-number allocation functions in use before ours were installed */
+static int mphooked = 0;
+static void* (*prev_mp_alloc)(size_t) = NULL;
+static void* (*prev_mp_realloc)(void*, size_t, size_t) = NULL;
+static void (*prev_mp_free)(void*, size_t) = NULL;
+
+/* Allocation counters (see rs_set_alloc_stats) */
+static int countallocs = 0;
+static unsigned long nallocs = 0, nfrees = 0, nbytes = 0;
+static long inuse = 0, peak = 0;
+
+/*
+ * Count a call to an allocation function.
+ */
+static void count_alloc(const void* ptr,     /* block being resized or
+						freed (NULL = none) */
+			unsigned long count, /* number of bytes
+						requested */
+			long oldsize,	     /* known size of old
+						block */
+			long newsize)	     /* known size of new
+						block */
 {
-  void* p;
+  long n, m;
+
+  if (count) {
+    RS_ATOMIC_ADD(nallocs, 1);
+    RS_ATOMIC_ADD(nbytes, count);
+  }
+  else if (ptr) {
+    RS_ATOMIC_ADD(nfrees, 1);
+  }
+
+  if (newsize != oldsize) {
+    n = RS_ATOMIC_ADD(inuse, newsize - oldsize);
+    while (n > (m = peak) && !RS_ATOMIC_CAS(peak, m, n))
+      ;
+  }
+}
+
+/*
+ * Allocate, resize, or free a block using the global allocation
+ * function.
+ */
+static void* global_realloc(void* ptr,		 /* old block */
+			    unsigned long count) /* new size */
+{
+  if (count && !ptr)
+    allocated = 1;
+
+  if (reallocfunc)
+    return (*reallocfunc)(ptr, count, reallocfuncdata);
 
   if (!count) {
-    if (ptr) {
+    if (ptr)
       free(ptr);
-    }
     return NULL;
   }
+  else if (ptr)
+    return realloc(ptr, count);
+  else
+    return malloc(count);
+}
+
+void* rs_ctx_realloc(RSContext* ctx, void* ptr, unsigned long count)
+{
+  void* p;
+  long oldsize;
+
+  if (!ctx)
+    ctx = rs_context_default();
+
+  if (ctx->reallocfunc) {
+    p = (*ctx->reallocfunc)(ptr, count, ctx->reallocfuncdata);
+    if (!p && count)
+      rs_ctx_error(ctx, "out of memory (need %lu bytes)", count);
+    else if (countallocs)
+      count_alloc(ptr, count, 0, 0);
+    return p;
+  }
 
-  if (ptr)
-    p = realloc(ptr, count);
+  if (!countallocs || reallocfunc) {
+    p = global_realloc(ptr, count);
+    if (!p && count)
+      rs_ctx_error(ctx, "out of memory (need %lu bytes)", count);
+    else if (countallocs)
+      count_alloc(ptr, count, 0, 0);
+    return p;
+  }
+
+  oldsize = BLOCK_SIZE(ptr);
+  p = global_realloc(ptr, count);
+  if (!p && count)
+    rs_ctx_error(ctx, "out of memory (need %lu bytes)", count);
   else
-    p = malloc(count);
-  if (!p)
-    rs_error(NULL, NULL, "out of memory (need %lu bytes)", count);
+    count_alloc(ptr, count, oldsize, BLOCK_SIZE(p));
   return p;
 }
 
-char* rs_strdup(const char* str)
+void* rs_realloc(void* ptr, unsigned long count)
+{
+  return rs_ctx_realloc(NULL, ptr, count);
+}
+
+char* rs_ctx_strdup(RSContext* ctx, const char* str)
 {
   int n;
   char* p;
@@ -66,8 +188,139 @@ char* rs_strdup(const char* str)
     return NULL;
 
   n = strlen(str);
-  p = rs_malloc(n + 1);
+  p = rs_ctx_malloc(ctx, n + 1);
   if (p)
     memcpy(p, str, n + 1);
   return p;  
 }
+
+char* rs_strdup(const char* str)
+{
+  return rs_ctx_strdup(NULL, str);
+}
+
+/*
+ * Memory allocation functions for big-number arithmetic.  These may
+ * not fail.
+ */
+static void* mp_realloc(void* ptr,    /* old block */
+			size_t oldsize, /* size of old block */
+			size_t count)	/* new size */
+{
+  void* p;
+
+  if (reallocfunc || !prev_mp_realloc || !prev_mp_alloc)
+    p = global_realloc(ptr, count);
+  else if (ptr)
+    p = (*prev_mp_realloc)(ptr, oldsize, count);
+  else {
+    allocated = 1;
+    p = (*prev_mp_alloc)(count);
+  }
+
+  if (!p) {
+    rs_error(NULL, NULL, "out of memory (need %lu bytes)",
+	     (unsigned long) count);
+    abort();
+  }
+  if (countallocs)
+    count_alloc(ptr, count, (ptr ? (long) oldsize : 0L), (long) count);
+  return p;
+}
+
+static void* mp_alloc(size_t count) /* size of block */
+{
+  return mp_realloc(NULL, 0, count);
+}
+
+static void mp_free(void* ptr,	     /* block */
+		    size_t oldsize)  /* size of block */
+{
+  if (reallocfunc || !prev_mp_free)
+    global_realloc(ptr, 0);
+  else
+    (*prev_mp_free)(ptr, oldsize);
+  if (countallocs)
+    count_alloc(ptr, 0, (long) oldsize, 0L);
+}
+
+/*
+ * Route big-number allocations through our own functions, if they
+ * need to be counted or sent to a custom allocator; otherwise, put
+ * back the functions we replaced.
+ */
+static void update_mp_functions(void)
+{
+  if (reallocfunc || countallocs) {
+    if (!mphooked) {
+      mp_get_memory_functions(&prev_mp_alloc, &prev_mp_realloc,
+			      &prev_mp_free);
+      mp_set_memory_functions(&mp_alloc, &mp_realloc, &mp_free);
+      mphooked = 1;
+    }
+  }
+  else if (mphooked) {
+    mp_set_memory_functions(prev_mp_alloc, prev_mp_realloc, prev_mp_free);
+    prev_mp_alloc = NULL;
+    prev_mp_realloc = NULL;
+    prev_mp_free = NULL;
+    mphooked = 0;
+  }
+}
+
+/*
+ * Set the global memory allocation function.
+ *
+ * The function is used by contexts that have no allocation function
+ * of their own (see rs_context_set_allocator()), and for big-number
+ * arithmetic.  Like rs_realloc(), it is called with a count of zero
+ * to free a block; it must be safe to call from any thread that uses
+ * the library.
+ *
+ * Blocks are always freed using the current allocation function, so
+ * this must be done before the library allocates any memory (and
+ * before the program using the library allocates any big numbers);
+ * once the library has allocated memory, the allocation function
+ * cannot be changed, and RS_ERR_CRITICAL is returned.
+ */
+int rs_set_allocator(RSReallocFunc func, /* allocation function
+					    (NULL = use realloc()) */
+		     void* data)	 /* data passed to func */
+{
+  if (allocated) {
+    if (func == reallocfunc && data == reallocfuncdata)
+      return RS_SUCCESS;
+    rs_error(NULL, NULL, "cannot change allocator after memory has"
+	     " been allocated");
+    return RS_ERR_CRITICAL;
+  }
+
+  reallocfunc = func;
+  reallocfuncdata = data;
+  update_mp_functions();
+  return RS_SUCCESS;
+}
+
+/*
+ * Enable or disable counting of memory allocations.
+ *
+ * Counting may be turned on at any time, but blocks allocated before
+ * then are not included in the number of bytes in use.
+ */
+void rs_set_alloc_stats(int enable) /* 1 = count allocations */
+{
+  countallocs = enable;
+  update_mp_functions();
+}
+
+/*
+ * Get memory allocation statistics.
+ */
+void rs_get_alloc_stats(RSAllocStats* st) /* statistics */
+{
+  st->allocations = nallocs;
+  st->frees = nfrees;
+  st->bytes = nbytes;
+  st->in_use = (inuse > 0 ? inuse : 0);
+  st->peak = (peak > 0 ? peak : 0);
+}
@@ -0,0 +1,388 @@
+/*
+ * RabbitSign - Tools for signing TI graphing calculator software
+ * Copyright (C) 2009 Benjamin Moody
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+
+#ifdef HAVE_STRING_H
+# include <string.h>
+#else
+# ifdef HAVE_STRINGS_H
+#  include <strings.h>
+# endif
+#endif
+
+#include "rabbitsign.h"
+#include "internal.h"
+#include "md5.h"
+#include "sha256.h"
+
+/*
+ * Hash midstates
+ *
+ * When a large program is signed over and over, with only the last
+ * few pages changing each time, most of the work of computing its
+ * digest is repeated.  To avoid this, we can save the state of the
+ * hash computation at the start of every 16k page, together with a
+ * copy of the data that was hashed.  The next time the digest is
+ * computed, we compare the program with the saved copy, and resume
+ * hashing from the first page that has changed.  (Comparing is much
+ * faster than hashing, and unlike a checksum of each page, can't be
+ * fooled by a page that has changed but happens to have the same
+ * checksum.)
+ *
+ * The hash states themselves can't be checked, so a midstate file
+ * must come from a trusted source (such as a previous run of the same
+ * build.)  The hash states are stored in the host's native format, so
+ * a midstate file written on one system is ignored by a different
+ * kind of system.
+ *
+ * The file format is:
+ *
+ *   "RSM2"  alg  withheader  statesize  count  byteorder  hdrlength
+ *   (32-bit big-endian values, except byteorder, which is the value
+ *   0x01020304 in native order)
+ *
+ *   header (hdrlength bytes)
+ *   pages (16384 bytes * (count - 1))
+ *   hash states (statesize * count)
+ *
+ * where state i is the state after hashing the header (if withheader
+ * is 1) followed by the first i pages of data.
+ */
+
+#define RSM_MAGIC "RSM2"
+#define RSM_HEADER_SIZE 28
+#define RSM_PAGE_SIZE 16384
+
+/* Sanity limit on the size of the OS header */
+#define RSM_MAX_HEADER 65536
+
+/* Sanity limit on the number of pages (4 GB of data) */
+#define RSM_MAX_COUNT (1 + 0x40000)
+
+/* Saved hash states for a program */
+struct _RSMidstates {
+  RSKeyType alg;		/* RS_KEY_MD5 or RS_KEY_SHA256 */
+  int withheader;		/* 1 = OS header is hashed first */
+  unsigned char* header;	/* copy of OS header */
+  unsigned long header_length;	/* length of OS header */
+  unsigned long count;		/* number of states */
+  unsigned long alloc;		/* number of states allocated */
+  unsigned char* pages;		/* copy of each page */
+  unsigned char* states;	/* hash states */
+};
+
+typedef union _RSHashState {
+  struct md5_ctx md5;
+  struct sha256_ctx sha256;
+} RSHashState;
+
+static size_t state_size(RSKeyType alg)
+{
+  return (alg == RS_KEY_SHA256
+	  ? sizeof(struct sha256_ctx)
+	  : sizeof(struct md5_ctx));
+}
+
+static void hash_init(RSHashState* st, RSKeyType alg)
+{
+  if (alg == RS_KEY_SHA256)
+    sha256_init_ctx(&st->sha256);
+  else
+    md5_init_ctx(&st->md5);
+}
+
+static void hash_bytes(RSHashState* st, RSKeyType alg,
+		       const unsigned char* data, unsigned long length)
+{
+  if (alg == RS_KEY_SHA256)
+    sha256_process_bytes(data, length, &st->sha256);
+  else
+    md5_process_bytes(data, length, &st->md5);
+}
+
+static void hash_finish(RSHashState* st, RSKeyType alg, unsigned char* value)
+{
+  md5_uint32 md5hash[4];
+  uint32_t sha256hash[8];
+
+  /* (finish functions need aligned buffers) */
+  if (alg == RS_KEY_SHA256) {
+    sha256_finish_ctx(&st->sha256, sha256hash);
+    memcpy(value, sha256hash, 32);
+  }
+  else {
+    md5_finish_ctx(&st->md5, md5hash);
+    memcpy(value, md5hash, 16);
+  }
+}
+
+/*
+ * Make room for the given number of states (and pages.)
+ */
+static int midstates_reserve(RSContext* ctx,	  /* context */
+			     RSMidstates* ms,	  /* midstates */
+			     unsigned long count) /* number of states */
+{
+  unsigned char *pages, *states;
+
+  if (count <= ms->alloc)
+    return 0;
+
+  pages = rs_ctx_realloc(ctx, ms->pages, count * RSM_PAGE_SIZE);
+  if (!pages)
+    return -1;
+  ms->pages = pages;
+
+  states = rs_ctx_realloc(ctx, ms->states, count * sizeof(RSHashState));
+  if (!states)
+    return -1;
+  ms->states = states;
+
+  ms->alloc = count;
+  return 0;
+}
+
+/*
+ * Save a copy of the OS header.
+ */
+static int midstates_set_header(RSContext* ctx,	      /* context */
+				RSMidstates* ms,      /* midstates */
+				const unsigned char* header, /* header */
+				unsigned long length) /* length of header */
+{
+  unsigned char* p;
+
+  if (length > ms->header_length || !ms->header) {
+    if (!(p = rs_ctx_realloc(ctx, ms->header, length ? length : 1)))
+      return -1;
+    ms->header = p;
+  }
+  if (length)
+    memcpy(ms->header, header, length);
+  ms->header_length = length;
+  return 0;
+}
+
+/*
+ * Compute the digest of a program, resuming from a saved state if
+ * possible, and save the state at each page boundary for next time.
+ *
+ * Returns 0 if successful, or -1 if the digest must be computed in
+ * the ordinary way (out of memory.)
+ */
+int rs_midstates_digest(const RSProgram* prgm, /* program */
+			RSKeyType alg,	       /* hash algorithm */
+			int withheader,	       /* 1 = hash OS header
+						  first */
+			unsigned long length,  /* number of bytes of data
+						  to hash */
+			unsigned char* value,  /* buffer for digest */
+			unsigned long* nhashed) /* number of bytes
+						   actually hashed */
+{
+  RSMidstates* ms = prgm->midstates;
+  RSHashState st;
+  unsigned long npages, k, pos, hdrlen;
+  RSHashState* states;
+
+  npages = length / RSM_PAGE_SIZE;
+  if (midstates_reserve(prgm->ctx, ms, npages + 1))
+    return -1;
+  states = (RSHashState*) ms->states;
+
+  hdrlen = (withheader ? prgm->header_length : 0);
+
+  *nhashed = 0;
+  k = 0;
+  if (ms->count > 0 && ms->alg == alg && ms->withheader == withheader
+      && ms->header_length == hdrlen
+      && (!hdrlen || !memcmp(ms->header, prgm->header, hdrlen))) {
+    /* find the first page that has changed */
+    while (k + 1 < ms->count && k < npages
+	   && !memcmp(prgm->data + k * RSM_PAGE_SIZE,
+		      ms->pages + k * RSM_PAGE_SIZE, RSM_PAGE_SIZE))
+      k++;
+    rs_message(2, NULL, prgm, "resuming hash at page %lu of %lu",
+	       k, npages + 1);
+  }
+  else {
+    if (midstates_set_header(prgm->ctx, ms, prgm->header, hdrlen))
+      return -1;
+    ms->alg = alg;
+    ms->withheader = withheader;
+
+    hash_init(&states[0], alg);
+    if (withheader) {
+      hash_bytes(&states[0], alg, prgm->header, prgm->header_length);
+      *nhashed += prgm->header_length;
+    }
+  }
+
+  st = states[k];
+  pos = k * RSM_PAGE_SIZE;
+  *nhashed += length - pos;
+  while (k < npages) {
+    hash_bytes(&st, alg, prgm->data + pos, RSM_PAGE_SIZE);
+    memcpy(ms->pages + pos, prgm->data + pos, RSM_PAGE_SIZE);
+    pos += RSM_PAGE_SIZE;
+    k++;
+    states[k] = st;
+  }
+  ms->count = k + 1;
+
+  hash_bytes(&st, alg, prgm->data + pos, length - pos);
+  hash_finish(&st, alg, value);
+  return 0;
+}
+
+/*
+ * Free saved midstates.
+ */
+void rs_midstates_free(RSContext* ctx,	 /* context */
+		       RSMidstates* ms) /* midstates */
+{
+  if (ms) {
+    rs_ctx_free(ctx, ms->header);
+    rs_ctx_free(ctx, ms->pages);
+    rs_ctx_free(ctx, ms->states);
+    rs_ctx_free(ctx, ms);
+  }
+}
+
+/*
+ * Load saved hash states for a program from a file, and save new
+ * states there whenever the program's digest is computed.
+ *
+ * If f is NULL, or the file cannot be used on this system, the
+ * program starts with no saved states.
+ */
+int rs_program_load_midstates(RSProgram* prgm, /* program */
+			      FILE* f)	       /* midstate file */
+{
+  RSMidstates* ms;
+  RSHashState* states;
+  unsigned char hdr[RSM_HEADER_SIZE];
+  unsigned long count, statesize, hdrlen, i;
+  md5_uint32 order = 0x01020304;
+
+  rs_midstates_free(prgm->ctx, prgm->midstates);
+  prgm->midstates = NULL;
+
+  if (!(ms = rs_ctx_malloc(prgm->ctx, sizeof(RSMidstates))))
+    return RS_ERR_OUT_OF_MEMORY;
+  memset(ms, 0, sizeof(RSMidstates));
+  prgm->midstates = ms;
+
+  if (!f)
+    return RS_SUCCESS;
+
+  if (fread(hdr, 1, RSM_HEADER_SIZE, f) != RSM_HEADER_SIZE
+      || memcmp(hdr, RSM_MAGIC, 4)) {
+    rs_warning(NULL, prgm, "invalid midstate file (ignored)");
+    return RS_SUCCESS;
+  }
+
+  ms->alg = rs_get_u32(hdr + 4);
+  ms->withheader = rs_get_u32(hdr + 8);
+  statesize = rs_get_u32(hdr + 12);
+  count = rs_get_u32(hdr + 16);
+  hdrlen = rs_get_u32(hdr + 24);
+
+  if ((ms->alg != RS_KEY_MD5 && ms->alg != RS_KEY_SHA256)
+      || statesize != state_size(ms->alg)
+      || memcmp(hdr + 20, &order, 4)
+      || count < 1 || count > RSM_MAX_COUNT || hdrlen > RSM_MAX_HEADER) {
+    rs_message(1, NULL, prgm,
+	       "midstate file was written on a different system (ignored)");
+    return RS_SUCCESS;
+  }
+
+  if (midstates_reserve(prgm->ctx, ms, count)
+      || !(ms->header = rs_ctx_malloc(prgm->ctx, hdrlen ? hdrlen : 1)))
+    return RS_ERR_OUT_OF_MEMORY;
+  states = (RSHashState*) ms->states;
+
+  if (fread(ms->header, 1, hdrlen, f) != hdrlen
+      || (fread(ms->pages, RSM_PAGE_SIZE, count - 1, f) != count - 1))
+    goto truncated;
+  ms->header_length = hdrlen;
+
+  for (i = 0; i < count; i++)
+    if (fread(&states[i], 1, statesize, f) != statesize)
+      goto truncated;
+
+  ms->count = count;
+  return RS_SUCCESS;
+
+ truncated:
+  rs_warning(NULL, prgm, "midstate file is truncated (ignored)");
+  return RS_SUCCESS;
+}
+
+/*
+ * Write the program's hash states (as of the last time its digest was
+ * computed) to a file.
+ */
+int rs_program_save_midstates(const RSProgram* prgm, /* program */
+			      FILE* f)		     /* midstate file */
+{
+  const RSMidstates* ms = prgm->midstates;
+  const RSHashState* states;
+  unsigned char hdr[RSM_HEADER_SIZE];
+  unsigned long statesize, i;
+  md5_uint32 order = 0x01020304;
+
+  if (!ms || !ms->count) {
+    rs_error(NULL, prgm, "no hash states to save");
+    return RS_ERR_MISSING_HEADER;
+  }
+
+  statesize = state_size(ms->alg);
+  states = (const RSHashState*) ms->states;
+
+  memcpy(hdr, RSM_MAGIC, 4);
+  rs_put_u32(hdr + 4, ms->alg);
+  rs_put_u32(hdr + 8, ms->withheader);
+  rs_put_u32(hdr + 12, statesize);
+  rs_put_u32(hdr + 16, ms->count);
+  memcpy(hdr + 20, &order, 4);
+  rs_put_u32(hdr + 24, ms->header_length);
+
+  if (fwrite(hdr, 1, RSM_HEADER_SIZE, f) != RSM_HEADER_SIZE
+      || (ms->header_length
+	  && (fwrite(ms->header, 1, ms->header_length, f)
+	      != ms->header_length))
+      || (fwrite(ms->pages, RSM_PAGE_SIZE, ms->count - 1, f)
+	  != ms->count - 1))
+    goto ioerr;
+
+  for (i = 0; i < ms->count; i++)
+    if (fwrite(&states[i], 1, statesize, f) != statesize)
+      goto ioerr;
+
+  return RS_SUCCESS;
+
+ ioerr:
+  rs_error(NULL, prgm, "file I/O error");
+  return RS_ERR_FILE_IO;
+}
@@ -0,0 +1,274 @@
+/*
+ * RabbitSign - Tools for signing TI graphing calculator software
+ * Copyright (C) 2009 Benjamin Moody
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Generate autokeys.h from a list of key files.
+ *
+ * This is only needed by maintainers, when the set of builtin keys
+ * changes (run "make autokeys" in the src directory.)  Each key is
+ * written as a set of byte arrays that can be loaded directly with
+ * mpz_import(); for private keys, all of the values computed by
+ * rs_key_prepare() are included as well.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+# include <string.h>
+#else
+# ifdef HAVE_STRINGS_H
+#  include <strings.h>
+# endif
+#endif
+
+#include "rabbitsign.h"
+#include "internal.h"
+
+#if !defined(strrchr) && !defined(HAVE_STRRCHR) && defined(HAVE_RINDEX)
+# define strrchr rindex
+#endif
+
+static const char* getbasename(const char* f)
+{
+  const char *p;
+
+  if ((p = strrchr(f, '/')))
+    f = p + 1;
+
+#if defined(__MSDOS__) || defined(__WIN32__)
+  if ((p = strrchr(f, '\\')))
+    f = p + 1;
+#endif
+
+  return f;
+}
+
+static const char* value_names[] = { "n", "p", "q", "d", "qinv",
+				     "dp", "dq" };
+
+/*
+ * Get the name used for a key in the generated file.
+ */
+static void key_name(char* buf,		   /* buffer to store name */
+		     const RSKey* key,	   /* key */
+		     int private)	   /* 1 = private key */
+{
+  if (key->id > 0xff)
+    sprintf(buf, "%s_%04lX", (private ? "priv" : "pub"), key->id);
+  else
+    sprintf(buf, "%s_%02lX", (private ? "priv" : "pub"), key->id);
+}
+
+/*
+ * Write a number as an array of bytes, least significant first.
+ */
+static void print_value(const char* keyname, /* name of key */
+			const char* name,    /* name of value */
+			const mpz_t value)   /* value */
+{
+  unsigned char buf[1024];
+  size_t count, i;
+
+  if (!mpz_sgn(value))
+    return;
+
+  mpz_export(buf, &count, -1, 1, 0, 0, value);
+  while (count > 0 && !buf[count - 1])
+    count--;
+
+  printf("static const unsigned char %s_%s[] =\n  {", keyname, name);
+  for (i = 0; i < count; i++) {
+    if (i && !(i % 12))
+      fputs("\n   ", stdout);
+    printf(" 0x%02X%s", buf[i], (i + 1 < count ? "," : ""));
+  }
+  fputs(" };\n", stdout);
+}
+
+/*
+ * Write a reference to a value in a key table.
+ */
+static void print_value_ref(const char* keyname, /* name of key */
+			    const char* name,	 /* name of value */
+			    const mpz_t value)	 /* value */
+{
+  if (mpz_sgn(value))
+    printf(",\n     KEYVALUE(%s_%s)", keyname, name);
+  else
+    fputs(",\n     NOVALUE", stdout);
+}
+
+/*
+ * Read a key file, taking the key ID from the file name if it is not
+ * stored in the file itself.
+ */
+static RSKey* load_key(const char* filename)
+{
+  RSKey* key;
+  FILE* f;
+  const char* p;
+  char* end;
+
+  if (!(f = fopen(filename, "rb"))) {
+    perror(filename);
+    return NULL;
+  }
+
+  key = rs_key_new();
+  if (!key || rs_read_key_file(key, f, filename, 1)) {
+    fclose(f);
+    rs_key_free(key);
+    return NULL;
+  }
+  fclose(f);
+
+  if (!key->id) {
+    p = getbasename(filename);
+    key->id = strtoul(p, &end, 16);
+    if (end == p || (*end && *end != '.')) {
+      rs_error(key, NULL, "unable to determine key ID");
+      rs_key_free(key);
+      return NULL;
+    }
+  }
+
+  return key;
+}
+
+int main(int argc, char** argv)
+{
+  RSKey** keys;
+  int* private;
+  char name[32];
+  int i, j;
+
+  rs_set_progname("mkautokeys");
+
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s KEYFILE... > autokeys.h\n", argv[0]);
+    return 5;
+  }
+
+  keys = rs_malloc((argc - 1) * sizeof(RSKey*));
+  private = rs_malloc((argc - 1) * sizeof(int));
+  if (!keys || !private)
+    return 4;
+
+  for (i = 1; i < argc; i++) {
+    if (!(keys[i - 1] = load_key(argv[i])))
+      return 3;
+    private[i - 1] = ((mpz_sgn(keys[i - 1]->p) && mpz_sgn(keys[i - 1]->q))
+		      || mpz_sgn(keys[i - 1]->d));
+    if (private[i - 1])
+      rs_key_prepare(keys[i - 1]);
+  }
+
+  puts("/*\n"
+       " * RabbitSign - Tools for signing TI graphing calculator software\n"
+       " * Copyright (C) 2009 Benjamin Moody\n"
+       " *\n"
+       " * This program is free software; you can redistribute it and/or\n"
+       " * modify it under the terms of the GNU General Public License as\n"
+       " * published by the Free Software Foundation; either version 3 of the\n"
+       " * License, or (at your option) any later version.\n"
+       " *\n"
+       " * This program is distributed in the hope that it will be useful, but\n"
+       " * WITHOUT ANY WARRANTY; without even the implied warranty of\n"
+       " * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU\n"
+       " * General Public License for more details.\n"
+       " *\n"
+       " * You should have received a copy of the GNU General Public License\n"
+       " * along with this program.  If not, see <http://www.gnu.org/licenses/>.\n"
+       " */\n"
+       "\n"
+       "/* This file was generated by mkautokeys; do not edit.  Values are\n"
+       "   stored least significant byte first, as used by mpz_import(). */\n"
+       "\n"
+       "struct keyvalue {\n"
+       "  unsigned int length;\n"
+       "  const unsigned char* data;\n"
+       "};\n"
+       "\n"
+       "#define KEYVALUE(vvv) { sizeof(vvv), vvv }\n"
+       "#define NOVALUE { 0, 0 }\n");
+
+  for (i = 0; i < argc - 1; i++) {
+    key_name(name, keys[i], private[i]);
+    print_value(name, "n", keys[i]->n);
+    if (private[i]) {
+      print_value(name, "p", keys[i]->p);
+      print_value(name, "q", keys[i]->q);
+      print_value(name, "d", keys[i]->d);
+      print_value(name, "qinv", keys[i]->qinv);
+      print_value(name, "dp", keys[i]->dp);
+      print_value(name, "dq", keys[i]->dq);
+    }
+    putchar('\n');
+  }
+
+  puts("struct pubkeyinfo {\n"
+       "  unsigned long id;\n"
+       "  struct keyvalue n;\n"
+       "} known_pub_keys[] =\n"
+       "  {");
+  for (i = 0; i < argc - 1; i++) {
+    if (private[i])
+      continue;
+    key_name(name, keys[i], 0);
+    printf("   { 0x%s, KEYVALUE(%s_n) },\n", name + 4, name);
+  }
+  puts("   { 0, NOVALUE }};\n");
+
+  printf("struct privkeyinfo {\n"
+	 "  unsigned long id;\n"
+	 "  struct keyvalue");
+  for (j = 0; j < 7; j++)
+    printf("%s %s", (j ? "," : ""), value_names[j]);
+  puts(";\n"
+       "} known_priv_keys[] =\n"
+       "  {");
+  for (i = 0; i < argc - 1; i++) {
+    if (!private[i])
+      continue;
+    key_name(name, keys[i], 1);
+    printf("   { 0x%s,\n     KEYVALUE(%s_n)", name + 5, name);
+    print_value_ref(name, "p", keys[i]->p);
+    print_value_ref(name, "q", keys[i]->q);
+    print_value_ref(name, "d", keys[i]->d);
+    print_value_ref(name, "qinv", keys[i]->qinv);
+    print_value_ref(name, "dp", keys[i]->dp);
+    print_value_ref(name, "dq", keys[i]->dq);
+    puts(" },");
+  }
+  puts("   { 0, NOVALUE, NOVALUE, NOVALUE, NOVALUE, NOVALUE, NOVALUE,"
+       " NOVALUE }};");
+
+  for (i = 0; i < argc - 1; i++)
+    rs_key_free(keys[i]);
+  rs_free(keys);
+  rs_free(private);
+  return 0;
+}
@@ -69,8 +69,37 @@
       &(_nn->m[_ii]); })))
 */
 
-static void* xrealloc(p, n)
+/* Memory allocation functions (see mp_set_memory_functions) */
+static void* (*mp_alloc_func) __P((size_t)) = 0;
+static void* (*mp_realloc_func) __P((void*, size_t, size_t)) = 0;
+static void (*mp_free_func) __P((void*, size_t)) = 0;
+
+void mp_set_memory_functions(alloc_func, realloc_func, free_func)
+     void* (*alloc_func) __P((size_t));
+     void* (*realloc_func) __P((void*, size_t, size_t));
+     void (*free_func) __P((void*, size_t));
+{
+  mp_alloc_func = alloc_func;
+  mp_realloc_func = realloc_func;
+  mp_free_func = free_func;
+}
+
+void mp_get_memory_functions(alloc_func, realloc_func, free_func)
+     void* (**alloc_func) __P((size_t));
+     void* (**realloc_func) __P((void*, size_t, size_t));
+     void (**free_func) __P((void*, size_t));
+{
+  if (alloc_func)
+    *alloc_func = mp_alloc_func;
+  if (realloc_func)
+    *realloc_func = mp_realloc_func;
+  if (free_func)
+    *free_func = mp_free_func;
+}
+
+static void* xrealloc(p, oldn, n)
      void* p;
+     size_t oldn;
      size_t n;
 {
   void* res;
@@ -79,9 +108,9 @@ static void* xrealloc(p, n)
     n = 1;
 
   if (p)
-    res = realloc(p, n);
+    res = (mp_realloc_func ? (*mp_realloc_func)(p, oldn, n) : realloc(p, n));
   else
-    res = malloc(n);
+    res = (mp_alloc_func ? (*mp_alloc_func)(n) : malloc(n));
 
   if (!res) {
     fprintf(stderr,"mpz: out of memory (need %lu bytes)\n",
@@ -94,9 +123,12 @@ static void* xrealloc(p, n)
 static inline void allocate_mpz(x)
      mpz_t x;
 {
+  size_t oldn;
+
   if (x->size_alloc < x->size) {
+    oldn = (x->size_alloc ? x->size_alloc : 1) * sizeof(limb_t);
     x->size_alloc = x->size;
-    x->m = (limb_t*) xrealloc(x->m, x->size_alloc * sizeof(limb_t));
+    x->m = (limb_t*) xrealloc(x->m, oldn, x->size_alloc * sizeof(limb_t));
   }
 }
 
@@ -139,8 +171,13 @@ void mpz_init(x)
 void mpz_clear(x)
      mpz_t x;
 {
-  if (x->m)
-    free(x->m);
+  if (x->m) {
+    if (mp_free_func)
+      (*mp_free_func)(x->m, (x->size_alloc ? x->size_alloc : 1)
+		      * sizeof(limb_t));
+    else
+      free(x->m);
+  }
   mpz_init(x);
 }
 
@@ -229,19 +266,44 @@ void mpz_export(dest, count, order, size, endian, nails, op)
      size_t nails; /* must be 0 (no nails) */
      const mpz_t op;
 {
-  size_t i, j;
+  size_t i, j, n;
 
   assert(order == -1);
   assert(size == 1);
   assert(endian == 0);
   assert(nails == 0);
 
+  /* like GMP, write only as many bytes as are significant */
+  n = (mpz_sizeinbase(op, 2) + 7) / 8;
+  if (!mpz_sgn(op))
+    n = 0;
+
   for (i = 0; i < op->size; i++) {
-    for (j = 0; j < LIMB_BYTES; j++) {
+    for (j = 0; j < LIMB_BYTES && (i * LIMB_BYTES) + j < n; j++) {
       ((unsigned char*)dest)[(i * LIMB_BYTES) + j] = IDX(op, i) >> 8 * j;
     }
   }
-  *count = op->size * LIMB_BYTES;
+  *count = n;
+}
+
+size_t mpz_sizeinbase(a, base)
+     const mpz_t a;
+     int base; /* must be 2 */
+{
+  size_t i = a->size, n;
+  limb_t x;
+
+  assert(base == 2);
+
+  while (i > 0 && IDX(a, i - 1) == 0)
+    i--;
+  if (i == 0)
+    return 1;
+
+  n = (i - 1) * LIMB_BITS;
+  for (x = IDX(a, i - 1); x; x >>= 1)
+    n++;
+  return n;
 }
 
 /**************** Comparison ****************/
@@ -59,6 +59,15 @@ typedef struct _mpz mpz_t[1];
 # define __P(x) ()
 #endif
 
+/* Memory allocation (NULL = use malloc(), realloc(), and free()) */
+void mp_set_memory_functions __P((void* (*alloc_func)(size_t),
+				  void* (*realloc_func)(void*, size_t, size_t),
+				  void (*free_func)(void*, size_t)));
+void mp_get_memory_functions __P((void* (**alloc_func)(size_t),
+				  void* (**realloc_func)(void*, size_t,
+							 size_t),
+				  void (**free_func)(void*, size_t)));
+
 void mpz_init __P((mpz_t x));
 void mpz_clear __P((mpz_t x));
 
@@ -73,6 +82,9 @@ void mpz_import __P((mpz_t dest, size_t count, int order, int size,
 void mpz_export __P((void* dest, size_t* count, int order, int size,
 		     int endian, size_t nails, const mpz_t op));
 
+/* Size: requires base == 2 */
+size_t mpz_sizeinbase __P((const mpz_t a, int base));
+
 /* Check sign */
 int mpz_sgn __P((const mpz_t a));
 
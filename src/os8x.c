@@ -73,8 +73,9 @@ int rs_repair_ti8x_os(RSProgram* os,      /* OS */
       || os->header[1] != 0x0f) {
     for (i = 0; i < os->npagenums; i++) {
       if (os->pagenums[i] == 0x1a) {
-	rs_free(os->header);
-	if (!(os->header = rs_malloc(256)))
+	rs_program_invalidate_header_index(os);
+	rs_ctx_free(os->ctx, os->header);
+	if (!(os->header = rs_ctx_malloc(os->ctx, 256)))
 	  return RS_ERR_OUT_OF_MEMORY;
 	memcpy(os->header, os->data + ((unsigned long) i << 14), 256);
 	os->header_length = 256;
@@ -107,8 +108,8 @@ int rs_repair_ti8x_os(RSProgram* os,      /* OS */
   hdr = os->header + hdrstart;
   hdrsize = os->header_length - hdrstart;
 
-  if (rs_find_app_field(0x8070, hdr, hdrsize,
-			&fieldhead, &fieldstart, &fieldsize)) {
+  if (rs_program_find_field(os, 0x8070, hdr, hdrsize,
+			    &fieldhead, &fieldstart, &fieldsize)) {
     rs_error(NULL, os, "OS header has no program image field");
     return RS_ERR_MISSING_PROGRAM_IMAGE;
   }
@@ -141,11 +142,12 @@ int rs_repair_ti8x_os(RSProgram* os,      /* OS */
       rs_error(NULL, os, "cannot set OS image length");
       return RS_ERR_FIELD_TOO_SMALL;
     }
+    rs_program_invalidate_header_index(os);
   }
 
   /* Check for key ID */
 
-  if (rs_find_app_field(0x8010, hdr, hdrsize, NULL, NULL, NULL)) {
+  if (rs_program_find_field(os, 0x8010, hdr, hdrsize, NULL, NULL, NULL)) {
     if (flags & RS_IGNORE_ALL_WARNINGS) 
       rs_warning(NULL, os, "OS header has no key ID field");
     else {
@@ -156,8 +158,8 @@ int rs_repair_ti8x_os(RSProgram* os,      /* OS */
 
   /* Check/fix page count */
 
-  if (rs_find_app_field(0x8080, hdr, hdrsize,
-			NULL, &fieldstart, &fieldsize)) {
+  if (rs_program_find_field(os, 0x8080, hdr, hdrsize,
+			    NULL, &fieldstart, &fieldsize)) {
     if (os->length != 14 * 0x4000L) {
       rs_warning(NULL, os, "OS header has no page count field");
     }
@@ -204,32 +206,31 @@ int rs_repair_ti8x_os(RSProgram* os,      /* OS */
 /*
  * Compute signature for an OS.
  */
-int rs_sign_ti8x_os(RSProgram* os, /* OS */
-		    RSKey* key)	   /* signing key */
+int rs_sign_ti8x_os(RSProgram* os,    /* OS */
+		    const RSKey* key) /* signing key */
 {
-  struct md5_ctx ctx;
-  md5_uint32 hash[4];
-  mpz_t hashv, sigv;
-  unsigned char sigdata[512];
-  size_t siglength;
+  RSDigest digest;
+  RSSignature sig;
   int e;
 
-  md5_init_ctx(&ctx);
-  md5_process_bytes(os->header, os->header_length, &ctx);
-  md5_process_bytes(os->data, os->length, &ctx);
-  md5_finish_ctx(&ctx, hash);
+  rs_program_make_digest(os, key, RS_SIG_RSA, RS_KEY_MD5, 1, &digest);
 
-  mpz_init(hashv);
-  mpz_init(sigv);
-
-  mpz_import(hashv, 16, -1, 1, 0, 0, hash);
-  rs_message(2, NULL, os, "hash = %ZX", hashv);
+  rs_signature_init(&sig);
+  if (!(e = rs_sign_digest_with_context(rs_get_context(key, os), &digest,
+					  key, 0, &sig)))
+    e = rs_ti8x_os_add_signature(os, sig.value);
+  rs_signature_clear(&sig);
+  return e;
+}
 
-  if ((e = rs_sign_rsa(sigv, hashv, key))) {
-    mpz_clear(hashv);
-    mpz_clear(sigv);
-    return e;
-  }
+/*
+ * Store an RSA signature as the OS signature.
+ */
+int rs_ti8x_os_add_signature(RSProgram* os,	/* OS */
+			     const mpz_t sigv)	/* signature */
+{
+  unsigned char sigdata[512];
+  size_t siglength;
 
   rs_message(2, NULL, os, "sig = %ZX", sigv);
 
@@ -245,8 +246,8 @@ int rs_sign_ti8x_os(RSProgram* os, /* OS */
 //  while (siglength < 96)
 //    sigdata[siglength++] = 0xff;
 
-  rs_free(os->signature);
-  if (!(os->signature = rs_malloc(siglength)))
+  rs_ctx_free(os->ctx, os->signature);
+  if (!(os->signature = rs_ctx_malloc(os->ctx, siglength)))
     return RS_ERR_OUT_OF_MEMORY;
 
   memcpy(os->signature, sigdata, siglength);
@@ -261,7 +262,6 @@ int rs_validate_ti8x_os(const RSProgram* os,
 			const RSKey* key)
 {
   unsigned long fieldstart, fieldsize;
-  struct md5_ctx ctx;
   md5_uint32 hash[4];
   mpz_t hashv, sigv;
   int e;
@@ -277,10 +277,8 @@ int rs_validate_ti8x_os(const RSProgram* os,
   }
   rs_get_field_size(os->signature, &fieldstart, &fieldsize);
 
-  md5_init_ctx(&ctx);
-  md5_process_bytes(os->header, os->header_length, &ctx);
-  md5_process_bytes(os->data, os->length, &ctx);
-  md5_finish_ctx(&ctx, hash);
+  rs_program_get_digest(os, key, RS_KEY_MD5, 1, os->length,
+			(unsigned char*) hash);
 
   mpz_init(hashv);
   mpz_init(sigv);
@@ -22,18 +22,164 @@
 
 #include <stdio.h>
 
+#ifdef HAVE_STRING_H
+# include <string.h>
+#else
+# ifdef HAVE_STRINGS_H
+#  include <strings.h>
+# endif
+#endif
+
 #include "rabbitsign.h"
+#include "internal.h"
+
+/*
+ * Read a 32-bit big-endian integer.
+ */
+unsigned long rs_get_u32(const unsigned char* p) /* data */
+{
+  return (((unsigned long) p[0] << 24) | ((unsigned long) p[1] << 16)
+	  | ((unsigned long) p[2] << 8) | (unsigned long) p[3]);
+}
+
+/*
+ * Write a 32-bit big-endian integer.
+ */
+void rs_put_u32(unsigned char* p,  /* buffer */
+		unsigned long v)   /* value */
+{
+  p[0] = (v >> 24) & 0xff;
+  p[1] = (v >> 16) & 0xff;
+  p[2] = (v >> 8) & 0xff;
+  p[3] = v & 0xff;
+}
+
+/*
+ * Write data to a file or to memory.
+ */
+int rs_output_write(RSOutput* out,	  /* destination */
+		    const void* data,	  /* data to write */
+		    unsigned long length) /* number of bytes */
+{
+  if (out->f) {
+    if (fwrite(data, 1, length, out->f) != length) {
+      rs_error(NULL, out->prgm, "file I/O error");
+      return RS_ERR_FILE_IO;
+    }
+  }
+  else if (out->data && length) {
+    if (length > out->size - out->length) {
+      rs_error(NULL, out->prgm, "output buffer too small");
+      return RS_ERR_FILE_IO;
+    }
+    memcpy(out->data + out->length, data, length);
+  }
+
+  out->length += length;
+  return RS_SUCCESS;
+}
+
+static int output_program(RSOutput* out,	/* destination */
+			  const RSProgram* prgm, /* program */
+			  int month,		/* timestamp month */
+			  int day,		/* timestamp day */
+			  int year,		/* timestamp year */
+			  unsigned int flags)	/* output flags */
+{
+  RSContext* ctx = rs_get_context(NULL, prgm);
+  double start = rs_phase_start(ctx);
+  int e;
+
+  if (flags & RS_OUTPUT_CONTAINER)
+    e = rs_output_program_container(out, prgm);
+  else if (rs_calc_is_ti8x(prgm->calctype)
+	   && (prgm->datatype == RS_DATA_OS || prgm->datatype == RS_DATA_APP))
+    e = rs_output_ti8x_file(out, prgm, month, day, year, flags);
+  else
+    e = rs_output_ti9x_file(out, prgm, month, day, year, flags);
+
+  rs_phase_end(ctx, RS_PHASE_OUTPUT, start, out->length);
+  return e;
+}
 
 /*
  * Write program contents to a file.
  */
-int rs_write_program_file(const RSProgram* prgm, FILE* f,
-			  int month, int day, int year,
-			  unsigned int flags)
+int rs_write_program_file(const RSProgram* prgm, /* program */
+			  FILE* f,		 /* file to write */
+			  int month,		 /* timestamp month */
+			  int day,		 /* timestamp day */
+			  int year,		 /* timestamp year */
+			  unsigned int flags)	 /* output flags */
+{
+  RSOutput out;
+
+  memset(&out, 0, sizeof(out));
+  out.prgm = prgm;
+  out.f = f;
+  return output_program(&out, prgm, month, day, year, flags);
+}
+
+/*
+ * Determine the number of bytes that rs_write_program_file() or
+ * rs_write_program_buffer() will write.  This is computed from the
+ * lengths of the program's parts, without formatting the output.
+ */
+unsigned long rs_program_output_size(const RSProgram* prgm, /* program */
+				     unsigned int flags)    /* output
+							       flags */
 {
-  if (rs_calc_is_ti8x(prgm->calctype)
-      && (prgm->datatype == RS_DATA_OS || prgm->datatype == RS_DATA_APP))
-    return rs_write_ti8x_file(prgm, f, month, day, year, flags);
+  if (flags & RS_OUTPUT_CONTAINER)
+    return rs_program_container_size(prgm);
+  else if (rs_calc_is_ti8x(prgm->calctype)
+	   && (prgm->datatype == RS_DATA_OS || prgm->datatype == RS_DATA_APP))
+    return rs_ti8x_file_size(prgm, flags);
   else
-    return rs_write_ti9x_file(prgm, f, month, day, year, flags);
+    return rs_ti9x_file_size(prgm, flags);
+}
+
+/*
+ * Write program contents to a block of memory.
+ *
+ * If *data is NULL, a buffer of the required size is allocated using
+ * the program's context (that is, using the context's allocation
+ * function, or else the global one; by default, malloc()), and the
+ * caller must free it the same way.
+ * Otherwise, *data must point to a buffer of *length bytes, which
+ * should be at least rs_program_output_size() bytes.  In either case,
+ * the output is formatted directly into the buffer, and *length is
+ * set to the number of bytes written.
+ */
+int rs_write_program_buffer(const RSProgram* prgm,  /* program */
+			    unsigned char** data,   /* output buffer */
+			    unsigned long* length,  /* size of buffer */
+			    int month,		    /* timestamp month */
+			    int day,		    /* timestamp day */
+			    int year,		    /* timestamp year */
+			    unsigned int flags)	    /* output flags */
+{
+  RSOutput out;
+  int e, allocated = 0;
+
+  memset(&out, 0, sizeof(out));
+  out.prgm = prgm;
+
+  if (!*data) {
+    *length = rs_program_output_size(prgm, flags);
+    if (!(*data = rs_ctx_malloc(prgm->ctx, *length ? *length : 1)))
+      return RS_ERR_OUT_OF_MEMORY;
+    allocated = 1;
+  }
+
+  out.data = *data;
+  out.size = *length;
+
+  e = output_program(&out, prgm, month, day, year, flags);
+
+  if (e && allocated) {
+    rs_ctx_free(prgm->ctx, *data);
+    *data = NULL;
+  }
+  *length = out.length;
+  return e;
 }
@@ -36,7 +36,7 @@
 /*
  * Write a single record to an Intel hex file.
  */
-static int write_hex_record(FILE* outfile,	 /* output file */
+static int write_hex_record(RSOutput* out,	 /* output file */
 			    unsigned int nbytes, /* number of bytes */
 			    unsigned int addr,	 /* address */
 			    unsigned int type,	 /* record type */
@@ -44,7 +44,7 @@ static int write_hex_record(FILE* outfile,	 /* output file */
 			    unsigned int flags,	 /* flags */
 			    int final)
 {
-  char buf[256];
+  char buf[16 + 2 * 255];
   unsigned int i;
   unsigned int sum;
 
@@ -67,33 +67,48 @@ static int write_hex_record(FILE* outfile,	 /* output file */
       strcpy(buf + 11 + 2 * i, "\r\n");
   }
 
-  if (fputs(buf, outfile) == EOF) {
-    rs_error(NULL, NULL, "file I/O error");
-    return RS_ERR_FILE_IO;
-  }
+  return rs_output_write(out, buf, strlen(buf));
+}
 
-  return RS_SUCCESS;
+/*
+ * Get the number of data bytes to write in each hex record.
+ */
+static unsigned int get_record_size(unsigned int flags) /* flags */
+{
+  unsigned int n = (flags & RS_OUTPUT_RECORD_SIZE_MASK) >> 16;
+  return (n ? n : 0x20);
+}
+
+/*
+ * Get the number of hex records needed for a chunk of data.
+ */
+static unsigned long count_records(unsigned long length, /* number of
+							    bytes */
+				   unsigned int flags)	 /* flags */
+{
+  unsigned int n = get_record_size(flags);
+  return ((length + n - 1) / n);
 }
 
 /*
  * Write a chunk of data to an Intel hex file.
  */
-static int write_hex_data(FILE* outfile,	/* output file */
+static int write_hex_data(RSOutput* out,	/* output file */
 			  unsigned long length, /* number of bytes */
 			  unsigned long addr,	/* starting address */
 			  unsigned char* data,	/* data */
 			  unsigned int flags)
 {
-  unsigned int count;
+  unsigned int count, recsize = get_record_size(flags);
   int e;
 
   while (length > 0) {
-    if (length < 0x20)
+    if (length < recsize)
       count = length;
     else
-      count = 0x20;
+      count = recsize;
 
-    if ((e = write_hex_record(outfile, count, addr, 0, data, flags, 0)))
+    if ((e = write_hex_record(out, count, addr, 0, data, flags, 0)))
       return e;
 
     length -= count;
@@ -104,6 +119,56 @@ static int write_hex_data(FILE* outfile,	/* output file */
   return RS_SUCCESS;
 }
 
+/*
+ * Get the number of bytes of data (following the TIFL header, if
+ * any) that will be written.
+ */
+static unsigned long get_data_size(const RSProgram* prgm, /* program */
+				   unsigned int flags)	  /* flags */
+{
+  unsigned long npages, nrecords;
+
+  if (flags & RS_OUTPUT_BINARY)
+    return prgm->signature_length + prgm->length + prgm->header_length;
+
+  /* (records never cross a page boundary) */
+  npages = ((prgm->length + 0x3fff) >> 14);
+  nrecords = 1 + npages;
+  if (npages)
+    nrecords += ((npages - 1) * count_records(0x4000, flags)
+		 + count_records(prgm->length - (npages - 1) * 0x4000,
+				 flags));
+
+  if (prgm->header_length)
+    nrecords += 1 + count_records(prgm->header_length, flags);
+  if (prgm->signature_length)
+    nrecords += 1 + count_records(prgm->signature_length, flags);
+
+  if (flags & RS_OUTPUT_APPSIGN) {
+    return (npages * 4
+	    + prgm->length * 2
+	    + prgm->header_length * 2
+	    + prgm->signature_length * 2
+	    + nrecords * 12 - 1);
+  }
+  else {
+    return (npages * 4
+	    + prgm->length * 2
+	    + prgm->header_length * 2
+	    + prgm->signature_length * 2
+	    + nrecords * 13 - 2);
+  }
+}
+
+/*
+ * Get the size of a .73k/.73u/.8xk/.8xu or .app file.
+ */
+unsigned long rs_ti8x_file_size(const RSProgram* prgm, /* program */
+				unsigned int flags)    /* flags */
+{
+  return ((flags & RS_OUTPUT_HEX_ONLY) ? 0 : 78) + get_data_size(prgm, flags);
+}
+
 /*
  * Write program to a .73k/.73u/.8xk/.8xu or .app file.
  *
@@ -118,11 +183,29 @@ int rs_write_ti8x_file(const RSProgram* prgm,  /* program */
 		       int day,		       /* timestamp day */
 		       int year,	       /* timestamp year*/
 		       unsigned int flags)     /* flags */
+{
+  RSOutput out;
+
+  memset(&out, 0, sizeof(out));
+  out.prgm = prgm;
+  out.f = outfile;
+  return rs_output_ti8x_file(&out, prgm, month, day, year, flags);
+}
+
+/*
+ * Write program to a .73k/.73u/.8xk/.8xu or .app file (or buffer.)
+ */
+int rs_output_ti8x_file(RSOutput* out,	       /* output file */
+			const RSProgram* prgm, /* program */
+			int month,	       /* timestamp month */
+			int day,	       /* timestamp day */
+			int year,	       /* timestamp year*/
+			unsigned int flags)    /* flags */
 {
   const unsigned char *hdr;
   unsigned long hdrstart, hdrsize, fieldstart, fieldsize;
   int major, minor, i;
-  unsigned long npages, nrecords, hexsize;
+  unsigned long hexsize;
   char name[9];
   unsigned int pagenum, addr;
   unsigned long count;
@@ -146,8 +229,8 @@ int rs_write_ti8x_file(const RSProgram* prgm,  /* program */
       if (hdrsize > 128)
 	hdrsize = 128;
 
-      major = rs_get_numeric_field(0x8020, hdr, hdrsize);
-      minor = rs_get_numeric_field(0x8030, hdr, hdrsize);
+      major = rs_program_get_numeric_field(prgm, 0x8020, hdr, hdrsize);
+      minor = rs_program_get_numeric_field(prgm, 0x8030, hdr, hdrsize);
 
       if (prgm->datatype == RS_DATA_OS) {
 	if (prgm->calctype == RS_CALC_TI73)
@@ -155,15 +238,15 @@ int rs_write_ti8x_file(const RSProgram* prgm,  /* program */
 	else
 	  strcpy(name, "basecode");
       }
-      else if (!rs_find_app_field(0x8040, hdr, hdrsize,
-				  NULL, &fieldstart, &fieldsize)) {
+      else if (!rs_program_find_field(prgm, 0x8040, hdr, hdrsize,
+				      NULL, &fieldstart, &fieldsize)) {
 	if (fieldsize > 8)
 	  fieldsize = 8;
 	strncpy(name, (char*) hdr + fieldstart, fieldsize);
 	name[fieldsize] = 0;
       }
-       else if (!rs_find_app_field(0x8140, hdr, hdrsize,
-				  NULL, &fieldstart, &fieldsize)) {
+       else if (!rs_program_find_field(prgm, 0x8140, hdr, hdrsize,
+				       NULL, &fieldstart, &fieldsize)) {
 	if (fieldsize > 8)
 	  fieldsize = 8;
 	strncpy(name, (char*) hdr + fieldstart, fieldsize);
@@ -178,48 +261,25 @@ int rs_write_ti8x_file(const RSProgram* prgm,  /* program */
       name[0] = 0;
     }
 
-    npages = ((prgm->length + 0x3fff) >> 14);
-    nrecords = 1 + npages + ((prgm->length + 0x1f) >> 5);
-
-    if (prgm->header_length)
-      nrecords += 1 + ((prgm->header_length + 0x1f) >> 5);
-    if (prgm->signature_length)
-      nrecords += 1 + ((prgm->signature_length + 0x1f) >> 5);
+    hexsize = get_data_size(prgm, flags);
 
-    if (flags & RS_OUTPUT_APPSIGN) {
-      hexsize = (npages * 4
-		 + prgm->length * 2
-		 + prgm->header_length * 2
-		 + prgm->signature_length * 2
-		 + nrecords * 12 - 1);
-    }
-    else if (flags & RS_OUTPUT_BINARY) {
-      hexsize = prgm->signature_length+prgm->length+prgm->header_length;
-    }
-    else {
-      hexsize = (npages * 4
-		 + prgm->length * 2
-		 + prgm->header_length * 2
-		 + prgm->signature_length * 2
-		 + nrecords * 13 - 2);
-    }
-
-    if ((e = rs_write_tifl_header(outfile, !(flags & RS_OUTPUT_BINARY),prgm->keytype==RS_KEY_SHA256, major, minor,
+    if ((e = rs_write_tifl_header(out, !(flags & RS_OUTPUT_BINARY),prgm->keytype==RS_KEY_SHA256, major, minor,
 				  month, day, year, name,
 				  prgm->calctype, prgm->datatype,
 				  hexsize)))
       return e;
   }
   if (flags & RS_OUTPUT_BINARY) {
-    fwrite(prgm->data,1,prgm->length+prgm->header_length,outfile);
-    fwrite(prgm->signature,1,prgm->signature_length,outfile);
-    return 0;
+    if ((e = rs_output_write(out, prgm->data,
+			     prgm->length + prgm->header_length)))
+      return e;
+    return rs_output_write(out, prgm->signature, prgm->signature_length);
   }
   if (prgm->header_length) {
-    if ((e = write_hex_data(outfile, prgm->header_length, 0,
+    if ((e = write_hex_data(out, prgm->header_length, 0,
 			    prgm->header, flags)))
       return e;
-    if ((e = write_hex_record(outfile, 0, 0, 1, NULL, flags, 0)))
+    if ((e = write_hex_record(out, 0, 0, 1, NULL, flags, 0)))
       return e;
   }
 
@@ -237,26 +297,26 @@ int rs_write_ti8x_file(const RSProgram* prgm,  /* program */
     pnbuf[0] = (pagenum >> 8) & 0xff;
     pnbuf[1] = pagenum & 0xff;
 
-    if ((e = write_hex_record(outfile, 2, 0, 2, pnbuf, flags, 0)))
+    if ((e = write_hex_record(out, 2, 0, 2, pnbuf, flags, 0)))
       return e;
 
     count = prgm->length - i * 0x4000;
     if (count > 0x4000)
       count = 0x4000;
 
-    if ((e = write_hex_data(outfile, count, addr,
+    if ((e = write_hex_data(out, count, addr,
 			    prgm->data + i * 0x4000, flags)))
       return e;
   }
 
   if (prgm->signature_length) {
-    if ((e = write_hex_record(outfile, 0, 0, 1, NULL, flags, 0)))
+    if ((e = write_hex_record(out, 0, 0, 1, NULL, flags, 0)))
       return e;
-    if (e = write_hex_data(outfile, prgm->signature_length, 0,
+    if (e = write_hex_data(out, prgm->signature_length, 0,
 			    prgm->signature, flags))
       return e;
   }
 
-  return write_hex_record(outfile, 0, 0, 1, NULL, flags, 1);
+  return write_hex_record(out, 0, 0, 1, NULL, flags, 1);
 }
 
@@ -46,7 +46,34 @@ int rs_write_ti9x_file(const RSProgram* prgm, /* program */
 		       int month,	      /* timestamp month */
 		       int day,		      /* timestamp day */
 		       int year,	      /* timestamp year*/
-		       unsigned int flags RS_ATTR_UNUSED)
+		       unsigned int flags)    /* flags */
+{
+  RSOutput out;
+
+  memset(&out, 0, sizeof(out));
+  out.prgm = prgm;
+  out.f = outfile;
+  return rs_output_ti9x_file(&out, prgm, month, day, year, flags);
+}
+
+/*
+ * Get the size of a .89k/.89u/.9xk/.9xu file.
+ */
+unsigned long rs_ti9x_file_size(const RSProgram* prgm, /* program */
+				unsigned int flags RS_ATTR_UNUSED)
+{
+  return 78 + prgm->length;
+}
+
+/*
+ * Write program to a .89k/.89u/.9xk/.9xu file (or buffer.)
+ */
+int rs_output_ti9x_file(RSOutput* out,	       /* output file */
+			const RSProgram* prgm, /* program */
+			int month,	       /* timestamp month */
+			int day,	       /* timestamp day */
+			int year,	       /* timestamp year*/
+			unsigned int flags RS_ATTR_UNUSED)
 {
   const unsigned char *hdr;
   unsigned long hdrstart, hdrsize, fieldstart, fieldsize;
@@ -62,8 +89,8 @@ int rs_write_ti9x_file(const RSProgram* prgm, /* program */
     if (prgm->datatype == RS_DATA_OS) {
       strcpy(name, "basecode");
     }
-    else if (!rs_find_app_field(0x8140, hdr, hdrsize,
-				NULL, &fieldstart, &fieldsize)) {
+    else if (!rs_program_find_field(prgm, 0x8140, hdr, hdrsize,
+				    NULL, &fieldstart, &fieldsize)) {
       if (fieldsize > 8)
 	fieldsize = 8;
       strncpy(name, (char*) hdr + fieldstart, fieldsize);
@@ -80,17 +107,12 @@ int rs_write_ti9x_file(const RSProgram* prgm, /* program */
   /* Note: the "version" header fields used in TI's 68k apps and
      OSes seem to have no relation to the actual version numbers. */
 
-  if ((e = rs_write_tifl_header(outfile, 0, prgm->keytype==RS_KEY_SHA256,0, 0,
+  if ((e = rs_write_tifl_header(out, 0, prgm->keytype==RS_KEY_SHA256,0, 0,
 				month, day, year, name,
 				prgm->calctype, prgm->datatype,
 				prgm->length)))
     return e;
 
-  if (fwrite(prgm->data, 1, prgm->length, outfile) != prgm->length) {
-    rs_error(NULL, NULL, "file I/O error");
-    return RS_ERR_FILE_IO;
-  }
-
-  return RS_SUCCESS;
+  return rs_output_write(out, prgm->data, prgm->length);
 }
 
@@ -64,7 +64,8 @@ static const char* usage[]={
   "  -t TYPE        set program type (8xk, 73u, etc.)\n",
   "  -d MM/DD/YYYY  set application date stamp\n",
   "  -c ID          set calculator device ID\n",
-  "  -o FILE        set output file\n",
+  "  -o FILE        set output file (FILE.rsp writes a RabbitSign\n",
+  "                 container rather than a TI file)\n",
   NULL};
 
 int main(int argc, char** argv)
@@ -75,6 +76,7 @@ int main(int argc, char** argv)
   RSCalcType calctype = RS_CALC_UNKNOWN;
   RSDataType datatype = RS_DATA_UNKNOWN;
   int month = 0, day = 0, year = 0;
+  unsigned int outflags = 0;
 
   FILE *infile, *outfile;
   RSProgram *prgm;
@@ -173,6 +175,9 @@ int main(int argc, char** argv)
 	      progname, outfilename);
       return 2;
     }
+
+    if ((ptr = strrchr(outfilename, '.')) && !strcmp(ptr + 1, "rsp"))
+      outflags = RS_OUTPUT_CONTAINER;
   }
 
   i = j = 1;
@@ -216,7 +221,7 @@ int main(int argc, char** argv)
     if (infile != stdin)
       fclose(infile);
 
-    if (rs_write_program_file(prgm, outfile, month, day, year, 0)) {
+    if (rs_write_program_file(prgm, outfile, month, day, year, outflags)) {
       rs_program_free(prgm);
       if (outfile != stdout)
 	fclose(outfile);
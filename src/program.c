@@ -32,20 +32,33 @@
 
 #include "rabbitsign.h"
 #include "internal.h"
+#include "md5.h"
+#include "sha256.h"
 
 /*
  * Create a new program.
  */
 RSProgram* rs_program_new()
 {
-  RSProgram* prgm = rs_malloc(sizeof(RSProgram));
+  return rs_program_new_with_context(NULL);
+}
+
+/*
+ * Create a new program belonging to the given context.
+ */
+RSProgram* rs_program_new_with_context(RSContext* ctx) /* context (NULL
+							  = default) */
+{
+  RSProgram* prgm = rs_ctx_malloc(ctx, sizeof(RSProgram));
 
   if (!prgm)
     return NULL;
 
+  prgm->ctx = ctx;
   prgm->filename = NULL;
   prgm->calctype = 0;
   prgm->datatype = 0;
+  prgm->keytype = RS_KEY_MD5;
   prgm->data = NULL;
   prgm->length = 0;
   prgm->length_a = 0;
@@ -55,6 +68,15 @@ RSProgram* rs_program_new()
   prgm->signature_length = 0;
   prgm->pagenums = NULL;
   prgm->npagenums = 0;
+  prgm->digest = NULL;
+  prgm->midstates = NULL;
+
+  prgm->hdrindex = rs_ctx_malloc(ctx, sizeof(RSHeaderIndex));
+  if (!prgm->hdrindex) {
+    rs_ctx_free(ctx, prgm);
+    return NULL;
+  }
+  prgm->hdrindex->hdr = NULL;
 
   return prgm;
 }
@@ -103,6 +125,72 @@ RSProgram* rs_program_new_with_data(RSCalcType ctype, /* calc type */
   return prgm;
 }
 
+/*
+ * Allocate a block of memory holding a copy of the given data.
+ */
+static void* copy_block(RSContext* ctx,	    /* context */
+			const void* data,   /* data to copy */
+			unsigned long size, /* size of data */
+			int* failed)	    /* set to 1 if out of
+					       memory */
+{
+  void* p;
+
+  if (!data || !size)
+    return NULL;
+  if ((p = rs_ctx_malloc(ctx, size)))
+    memcpy(p, data, size);
+  else
+    *failed = 1;
+  return p;
+}
+
+/*
+ * Create a copy of a program (including its known digest, but not
+ * its saved hash states.)
+ */
+RSProgram* rs_program_copy(const RSProgram* src) /* program to copy */
+{
+  RSProgram* prgm;
+  int failed = 0;
+
+  if (!(prgm = rs_program_new_with_context(src->ctx)))
+    return NULL;
+
+  prgm->calctype = src->calctype;
+  prgm->datatype = src->datatype;
+  prgm->keytype = src->keytype;
+  prgm->version = src->version;
+
+  if (src->filename)
+    prgm->filename = rs_ctx_strdup(prgm->ctx, src->filename);
+  prgm->header = copy_block(prgm->ctx, src->header,
+			    src->header_length, &failed);
+  prgm->header_length = src->header_length;
+  prgm->signature = copy_block(prgm->ctx, src->signature,
+			       src->signature_length, &failed);
+  prgm->signature_length = src->signature_length;
+  prgm->pagenums = copy_block(prgm->ctx, src->pagenums,
+			      src->npagenums * sizeof(unsigned int), &failed);
+  prgm->npagenums = src->npagenums;
+
+  if ((src->filename && !prgm->filename) || failed
+      || rs_program_append_data(prgm, src->data, src->length)) {
+    rs_program_free(prgm);
+    return NULL;
+  }
+
+  /* (append_data discards the digest, so copy it last) */
+  if (src->digest && !(prgm->digest = copy_block(prgm->ctx, src->digest,
+						 sizeof(RSProgramDigest),
+						 &failed))) {
+    rs_program_free(prgm);
+    return NULL;
+  }
+
+  return prgm;
+}
+
 /*
  * Free program data.
  */
@@ -111,12 +199,15 @@ void rs_program_free(RSProgram* prgm)
   if (!prgm)
     return;
 
-  rs_free(prgm->filename);
-  rs_free(prgm->data);
-  rs_free(prgm->header);
-  rs_free(prgm->signature);
-  rs_free(prgm->pagenums);
-  rs_free(prgm);
+  rs_ctx_free(prgm->ctx, prgm->filename);
+  rs_ctx_free(prgm->ctx, prgm->data);
+  rs_ctx_free(prgm->ctx, prgm->header);
+  rs_ctx_free(prgm->ctx, prgm->signature);
+  rs_ctx_free(prgm->ctx, prgm->pagenums);
+  rs_ctx_free(prgm->ctx, prgm->hdrindex);
+  rs_ctx_free(prgm->ctx, prgm->digest);
+  rs_midstates_free(prgm->ctx, prgm->midstates);
+  rs_ctx_free(prgm->ctx, prgm);
 }
 
 /*
@@ -133,6 +224,9 @@ int rs_program_set_length(RSProgram* prgm,	/* program */
   unsigned long length_a, i;
   unsigned char* dptr;
 
+  rs_program_invalidate_header_index(prgm);
+  rs_program_discard_digest(prgm);
+
   if (length <= prgm->length) {
     prgm->length = length;
     return RS_SUCCESS;
@@ -141,7 +235,7 @@ int rs_program_set_length(RSProgram* prgm,	/* program */
     if (length > prgm->length_a) {
       length_a = length + 16384;
 
-      dptr = rs_realloc(prgm->data, length_a);
+      dptr = rs_ctx_realloc(prgm->ctx, prgm->data, length_a);
       if (!dptr)
 	return RS_ERR_OUT_OF_MEMORY;
       prgm->data = dptr;
@@ -170,11 +264,14 @@ int rs_program_append_data(RSProgram* prgm,           /* program */
   unsigned long nlength, length_a;
   unsigned char* dptr;
 
+  rs_program_invalidate_header_index(prgm);
+  rs_program_discard_digest(prgm);
+
   nlength = prgm->length + length;
   if (nlength > prgm->length_a) {
     length_a = nlength + 16384;
 
-    dptr = rs_realloc(prgm->data, length_a);
+    dptr = rs_ctx_realloc(prgm->ctx, prgm->data, length_a);
     if (!dptr)
       return RS_ERR_OUT_OF_MEMORY;
     prgm->data = dptr;
@@ -185,3 +282,99 @@ int rs_program_append_data(RSProgram* prgm,           /* program */
   prgm->length = nlength;
   return RS_SUCCESS;
 }
+
+/*
+ * Compute the digest of a program.
+ *
+ * The known digest (prgm->digest) is used instead, if it was computed
+ * in the same way; this is only set when reading a container file
+ * with RS_INPUT_TRUST_DIGEST, and is discarded whenever the program
+ * is modified by any of the rs_program_* functions, by a call to
+ * rs_repair_program() that changes anything, or by signing it.
+ *
+ * If the program has saved hash states (see midstate.c), hashing
+ * resumes from the first page that has changed since they were saved.
+ */
+void rs_program_get_digest(const RSProgram* prgm, /* program */
+			   const RSKey* key,	  /* key (for
+						     statistics) */
+			   RSKeyType alg,	  /* hash algorithm */
+			   int withheader,	  /* 1 = hash OS header
+						     first */
+			   unsigned long length,  /* number of bytes of
+						     data to hash */
+			   unsigned char* value)  /* buffer for digest */
+{
+  struct md5_ctx md5ctx;
+  struct sha256_ctx sha256ctx;
+  const RSProgramDigest* d = prgm->digest;
+  RSContext* ctx = rs_get_context(key, prgm);
+  unsigned long n;
+  double start;
+
+  if (d && d->alg == alg && d->withheader == withheader
+      && d->length == length) {
+    memcpy(value, d->value, (alg == RS_KEY_SHA256 ? 32 : 16));
+    rs_message(2, NULL, prgm, "using stored digest");
+    return;
+  }
+
+  start = rs_phase_start(ctx);
+
+  if (prgm->midstates
+      && !rs_midstates_digest(prgm, alg, withheader, length, value, &n)) {
+    RS_ATOMIC_ADD(ctx->stats.bytes_hashed, n);
+    rs_phase_end(ctx, RS_PHASE_HASH, start, n);
+    return;
+  }
+
+  n = length + (withheader ? prgm->header_length : 0);
+
+  if (alg == RS_KEY_SHA256) {
+    sha256_init_ctx(&sha256ctx);
+    if (withheader)
+      sha256_process_bytes(prgm->header, prgm->header_length, &sha256ctx);
+    sha256_process_bytes(prgm->data, length, &sha256ctx);
+    sha256_finish_ctx(&sha256ctx, value);
+  }
+  else {
+    md5_init_ctx(&md5ctx);
+    if (withheader)
+      md5_process_bytes(prgm->header, prgm->header_length, &md5ctx);
+    md5_process_bytes(prgm->data, length, &md5ctx);
+    md5_finish_ctx(&md5ctx, value);
+  }
+
+  RS_ATOMIC_ADD(ctx->stats.bytes_hashed, n);
+  rs_phase_end(ctx, RS_PHASE_HASH, start, n);
+}
+
+/*
+ * Compute the digest used to sign a program: the header (if
+ * withheader is 1) followed by all of the program data.
+ */
+void rs_program_make_digest(const RSProgram* prgm, /* program */
+			    const RSKey* key,	   /* key (for
+						      statistics) */
+			    RSSigScheme scheme,	   /* signature scheme */
+			    RSKeyType alg,	   /* hash algorithm */
+			    int withheader,	   /* 1 = hash OS header
+						      first */
+			    RSDigest* digest)	   /* digest */
+{
+  digest->scheme = scheme;
+  digest->alg = alg;
+  digest->length = (alg == RS_KEY_SHA256 ? 32 : 16);
+  memset(digest->value, 0, sizeof(digest->value));
+  rs_program_get_digest(prgm, key, alg, withheader, prgm->length,
+			digest->value);
+}
+
+/*
+ * Discard the program's known digest.
+ */
+void rs_program_discard_digest(RSProgram* prgm) /* program */
+{
+  rs_ctx_free(prgm->ctx, prgm->digest);
+  prgm->digest = NULL;
+}
@@ -34,6 +34,25 @@
 # endif
 #endif
 
+#if defined(HAVE_SYS_INOTIFY_H) && defined(HAVE_INOTIFY_INIT1) \
+  && defined(HAVE_DIRENT_H) && defined(HAVE_SYS_STAT_H) \
+  && defined(HAVE_UNISTD_H) && defined(HAVE_SIGNAL_H)
+# define RS_WATCH_SPOOL
+# include <errno.h>
+# include <signal.h>
+# ifdef HAVE_SYS_TYPES_H
+#  include <sys/types.h>
+# endif
+# include <sys/stat.h>
+# include <sys/inotify.h>
+# include <dirent.h>
+# include <unistd.h>
+#endif
+
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
 #include "rabbitsign.h"
 #include "internal.h"
 
@@ -45,97 +64,2516 @@
 # endif
 #endif
 
-#if !defined(strrchr) && !defined(HAVE_STRRCHR) && defined(HAVE_RINDEX)
-# define strrchr rindex
+#if !defined(strrchr) && !defined(HAVE_STRRCHR) && defined(HAVE_RINDEX)
+# define strrchr rindex
+#endif
+
+static const char* getbasename(const char* f)
+{
+  const char *p;
+
+  if ((p = strrchr(f, '/')))
+    f = p + 1;
+
+#if defined(__MSDOS__) || defined(__WIN32__)
+  if ((p = strrchr(f, '\\')))
+    f = p + 1;
+#endif
+
+  return f;
+}
+
+static const char* usage[]={
+  "Usage: %s [options] app-file ...\n",
+  "Where options may include:\n",
+  "   -a:          appsign compatibility mode (Unix-style output)\n",
+  "   -b:          read raw binary data (default: auto-detect)\n",
+  "   -c:          check existing app signatures rather than signing\n",
+  "   -f:          force signing despite errors\n",
+  "   -g:          write app in GraphLink (XXk) format\n",
+  "   -j N:        with --watch, sign N files at once (default: number\n",
+  "                of CPUs)\n",
+  "   -k KEYFILE:  use specified key file\n",
+  "   -K NUM:      use specified key ID (hexadecimal)\n",
+  "   -n:          do not alter the app header\n",
+  "   -o OUTFILE:  write to specified output file (default is <name>.app\n",
+  "                or <name>.8xk)\n",
+  "                (may be repeated to write several formats at once)\n",
+  "   -p:          fix the pages field if found\n",
+  "   -P:          add an extra page if necessary\n",
+  "   -q:          suppress warning messages\n",
+  "   -r:          re-sign a previously signed app (i.e. strip off all\n",
+  "                data beyond that indicated by the size header)\n",
+  "   -R R:        specify the root to use (0, 1, 2, or 3) (default is 0)\n",
+  "   -t TYPE:     specify program type (e.g. 8xk, 73u)\n",
+  "   -u:          assume plain hex input is unsorted (default is sorted)\n",
+  "   -v:          be verbose (-vv for even more verbosity)\n",
+  "   --apply:     apply the deltas named on the command line to the\n",
+  "                original files (or to the file given by -o)\n",
+  "   --cache DIR: remember the results of -c in DIR, and skip files\n",
+  "                that have not changed since they were last checked\n",
+  "   --delta:     write a delta against the input file rather than\n",
+  "                the complete signed file (default is <name>.rsd)\n",
+  "   --io BACKEND:\n",
+  "                with --manifest, read and write files using BACKEND\n",
+  "                (auto, uring, threads, or sync)\n",
+  "   --manifest FILE:\n",
+  "                process the jobs listed in FILE (- for standard input)\n",
+  "   --midstates: save the state of the hash at each page in <name>.rsm,\n",
+  "                and use it to skip unchanged pages next time\n",
+  "   --paranoid:  with --cache, compare file contents rather than\n",
+  "                modification times\n",
+  "   --record-size N:\n",
+  "                write N bytes per hex record (default 32; up to 255)\n",
+  "   --server SOCKET:\n",
+  "                sign or validate using a rabbitsignd server\n",
+  "   --target KEY,ROOT,OUTFILE:\n",
+  "                sign with the given key (ID or file name) and root\n",
+  "                number, and write the result to OUTFILE; may be\n",
+  "                repeated to sign several ways at once (KEY and ROOT\n",
+  "                may be empty to use the defaults)\n",
+  "   --sig-cache FILE:\n",
+  "                reuse signatures stored in FILE (and add new ones)\n",
+  "   --stats FORMAT:\n",
+  "                print the time spent in each phase of processing\n",
+  "                (text or json)\n",
+  "   --trace FILE:\n",
+  "                write a timeline of each phase of processing to FILE\n",
+  "                (in Chrome trace event format)\n",
+  "   --trust-digest:\n",
+  "                use the digest stored in an .rsp input file rather\n",
+  "                than computing it again\n",
+  "   --watch DIR: sign each file as soon as it is written to DIR, and\n",
+  "                write the result to DIR/signed (or the directory\n",
+  "                given by -o)\n",
+  "   --help:      describe options\n",
+  "   --version:   print version info\n",
+  NULL};
+
+/* One of several ways to sign a file (see --target) */
+typedef struct _RSTargetSpec {
+  const char* keyfilename;	/* file name for key (NULL = automatic) */
+  unsigned long keyid;		/* key ID (0 = automatic) */
+  int rootnum;			/* root number (-1 = default) */
+  const char* outfilename;	/* file name for output */
+} RSTargetSpec;
+
+/* Description of a single file to process */
+typedef struct _RSJob {
+  const char* infilename;	/* file name for input ("-" = standard
+				   input) */
+
+  const char* outfilename;	/* file name for output (NULL =
+				   default) */
+
+  const char* const* extraoutfiles; /* additional output files (see
+				       -o) */
+  int nextraoutfiles;
+
+  const char* keyfilename;	/* file name for key (NULL =
+				   automatic) */
+
+  unsigned long keyid;		/* key ID (0 = automatic) */
+
+  RSCalcType ctype;		/* program type (unknown = guess from
+				   file name) */
+  RSDataType dtype;
+
+  int rootnum;			/* which of the four valid signatures
+				   to generate
+
+				   0 = standard (r,s)
+				   1 = (-r,s)
+				   2 = (r,-s)
+				   3 = (-r,-s) */
+
+  int rawmode;			/* 0 = fix app headers
+				   1 = sign "raw" data */
+
+  int valmode;			/* 0 = sign apps
+				   1 = validate apps */
+
+  int deltamode;		/* 0 = write signed file
+				   1 = write delta against input file */
+
+  int midstates;		/* 1 = save hash states in <input>.rsm */
+
+  const RSTargetSpec* targets;	/* keys, roots, and output files (if
+				   signing several ways at once) */
+  int ntargets;
+
+  const unsigned char* indata;	/* contents of input file, if it has
+				   already been read (NULL = read it) */
+  unsigned long inlength;
+
+  RSBatchIO* io;		/* batch used to write the output file
+				   (NULL = write it directly) */
+  void* iotag;			/* tag for the output request */
+
+  unsigned int flags;		/* repair, input, and output flags */
+} RSJob;
+
+static RSKeyCache* keycache = NULL; /* keys loaded so far */
+
+static int verbose = 0;		/* -1 = quiet (errors only)
+				   0 = default (warnings + errors)
+				   1 = verbose (print file names / status)
+				   2 = very verbose (details of computation) */
+
+static const char* servername = NULL; /* signing server socket */
+static int serverfd = -1;
+
+static RSValCache* valcache = NULL; /* validation cache */
+static int paranoid = 0;	/* 1 = compare contents of cached files */
+
+static RSBatchIOBackend iobackend = RS_BATCH_IO_AUTO; /* how to read
+							 and write files
+							 in a manifest */
+
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t key_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t state_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+# define LOCK(x) pthread_mutex_lock(&x##_lock)
+# define UNLOCK(x) pthread_mutex_unlock(&x##_lock)
+# define WAIT(x) pthread_cond_wait(&x##_cond, &x##_lock)
+# define WAKE(x) pthread_cond_broadcast(&x##_cond)
+#else
+# define LOCK(x)
+# define UNLOCK(x)
+# define WAIT(x)
+# define WAKE(x)
+#endif
+
+/* Timing of a single file (see --stats) */
+typedef struct _RSFileStats {
+  double total;			/* total time */
+  double phase[RS_NUM_PHASES];	/* time spent in each phase */
+} RSFileStats;
+
+static int statsformat = 0;	/* 0 = no statistics
+				   1 = print statistics as text
+				   2 = print statistics as JSON */
+
+/* Names of the phases, as used in statistics */
+static const char* const phasenames[RS_NUM_PHASES] = {
+  "keys", "parse", "repair", "hash", "math", "output"
+};
+
+/* Timing of each file processed so far (only used while holding
+   output_lock) */
+static RSFileStats* filestats = NULL;
+static unsigned long nfilestats = 0;
+static unsigned long nfilestats_a = 0;
+
+/* Statistics from contexts that have been freed */
+static RSStats oldstats;
+
+/* Maximum number of threads shown in a trace */
+#define TRACE_MAX_THREADS 64
+
+/* Trace event file (see --trace), and the number of events written
+   to it (only used while holding trace_lock) */
+static FILE* tracefile = NULL;
+static unsigned long ntraceevents = 0;
+static double tracestart;	/* time when tracing started */
+
+#ifdef HAVE_PTHREAD
+static pthread_t tracethreads[TRACE_MAX_THREADS]; /* threads seen so
+						     far (trace_lock) */
+static int ntracethreads = 0;
+static pthread_t mainthread;
+#else
+static int ntracethreads = 0;
+#endif
+
+/*
+ * Write a string in JSON syntax.
+ */
+static void write_json_string(FILE* f,	     /* output file */
+			      const char* s) /* string */
+{
+  putc('"', f);
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\')
+      fprintf(f, "\\%c", *s);
+    else if ((unsigned char) *s < 0x20)
+      fprintf(f, "\\u%04x", (unsigned char) *s);
+    else
+      putc(*s, f);
+  }
+  putc('"', f);
+}
+
+/*
+ * Get the trace ID of the current thread (writing a metadata event to
+ * name the thread, the first time it is seen.)  Must be called while
+ * holding trace_lock.
+ */
+static int get_trace_tid(void)
+{
+  int i, ismain = 1;
+
+#ifdef HAVE_PTHREAD
+  pthread_t self = pthread_self();
+
+  for (i = 0; i < ntracethreads; i++)
+    if (pthread_equal(tracethreads[i], self))
+      return i + 1;
+  if (ntracethreads >= TRACE_MAX_THREADS)
+    return 0;
+  tracethreads[ntracethreads] = self;
+  ismain = pthread_equal(self, mainthread);
+#else
+  if (ntracethreads)
+    return 1;
+#endif
+
+  i = ++ntracethreads;
+  fprintf(tracefile, "%s{\"name\":\"thread_name\",\"ph\":\"M\","
+	  "\"pid\":1,\"tid\":%d,\"args\":{\"name\":",
+	  (ntraceevents++ ? ",\n" : ""), i);
+  if (ismain)
+    fputs("\"main\"}}", tracefile);
+  else
+    fprintf(tracefile, "\"worker %d\"}}", i - 1);
+  return i;
+}
+
+/*
+ * Write a complete ("X") event to the trace file.
+ */
+static void trace_span(const char* name, /* event name */
+		       const char* cat,	 /* category */
+		       double start,	 /* start time */
+		       double end,	 /* end time */
+		       const char* args) /* arguments (JSON object
+					    members) */
+{
+  int tid;
+
+  if (!tracefile)
+    return;
+
+  LOCK(trace);
+  tid = get_trace_tid();
+  fprintf(tracefile, "%s{\"name\":", (ntraceevents++ ? ",\n" : ""));
+  write_json_string(tracefile, name);
+  fprintf(tracefile, ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,"
+	  "\"dur\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{%s}}",
+	  cat, (start - tracestart) * 1e6, (end - start) * 1e6, tid, args);
+  UNLOCK(trace);
+}
+
+/*
+ * Write an event for a single phase (called by the library.)
+ */
+static void trace_phase(RSContext* ctx RS_ATTR_UNUSED,
+			RSPhase phase, double start, double end,
+			unsigned long nbytes, void* data RS_ATTR_UNUSED)
+{
+  char args[32];
+
+  sprintf(args, "\"bytes\":%lu", nbytes);
+  trace_span(phasenames[phase], "phase", start, end, args);
+}
+
+/*
+ * Start writing trace events (see --trace.)
+ */
+static int open_trace(const char* filename) /* trace file */
+{
+  if (!(tracefile = fopen(filename, "w"))) {
+    perror(filename);
+    return 4;
+  }
+  setvbuf(tracefile, NULL, _IOFBF, 65536);
+#ifdef HAVE_PTHREAD
+  mainthread = pthread_self();
+#endif
+  tracestart = rs_get_time();
+  fputs("[\n", tracefile);
+  rs_context_set_trace_func(rs_context_default(), &trace_phase, NULL);
+  return 0;
+}
+
+/*
+ * Finish the trace file.
+ */
+static void close_trace(void)
+{
+  if (!tracefile)
+    return;
+
+  rs_context_set_trace_func(rs_context_default(), NULL, NULL);
+  fputs("\n]\n", tracefile);
+  if (fclose(tracefile))
+    perror("trace file");
+  tracefile = NULL;
+}
+
+/*
+ * Add one set of statistics to another.
+ */
+static void add_stats(RSStats* dest,	  /* total */
+		      const RSStats* src) /* statistics to add */
+{
+  int i;
+
+  dest->errors += src->errors;
+  dest->warnings += src->warnings;
+  dest->signatures += src->signatures;
+  dest->validations += src->validations;
+  dest->bytes_hashed += src->bytes_hashed;
+  for (i = 0; i < RS_NUM_PHASES; i++) {
+    dest->phase_time[i] += src->phase_time[i];
+    dest->phase_bytes[i] += src->phase_bytes[i];
+  }
+}
+
+/*
+ * Record the time taken to process a file (the difference between
+ * the context's statistics before and after), and display it if in
+ * verbose mode.
+ */
+static void record_file_stats(const RSContext* ctx,   /* context */
+			      const RSStats* before, /* statistics
+							before processing
+							the file */
+			      double start,	     /* time when we
+							started */
+			      const char* filename,  /* file name */
+			      int status)	     /* result */
+{
+  RSFileStats fs, *p;
+  double end;
+  char args[32];
+  int i;
+
+  if (!statsformat && !tracefile)
+    return;
+
+  end = rs_get_time();
+  if (tracefile) {
+    sprintf(args, "\"status\":%d", status);
+    trace_span(filename, "file", start, end, args);
+  }
+  if (!statsformat)
+    return;
+
+  fs.total = end - start;
+  for (i = 0; i < RS_NUM_PHASES; i++)
+    fs.phase[i] = ctx->stats.phase_time[i] - before->phase_time[i];
+
+  LOCK(output);
+  if (nfilestats >= nfilestats_a) {
+    nfilestats_a = (nfilestats_a ? nfilestats_a * 2 : 64);
+    if (!(p = rs_realloc(filestats, nfilestats_a * sizeof(RSFileStats)))) {
+      UNLOCK(output);
+      return;
+    }
+    filestats = p;
+  }
+  filestats[nfilestats++] = fs;
+
+  if (verbose > 0) {
+    if (statsformat == 2) {
+      fprintf(stderr, "{\"file\":");
+      write_json_string(stderr, filename);
+      fprintf(stderr, ",\"total_ms\":%.3f", fs.total * 1000);
+      for (i = 0; i < RS_NUM_PHASES; i++)
+	fprintf(stderr, ",\"%s_ms\":%.3f", phasenames[i], fs.phase[i] * 1000);
+      fprintf(stderr, "}\n");
+    }
+    else {
+      fprintf(stderr, "%s: %.3f ms (", filename, fs.total * 1000);
+      for (i = 0; i < RS_NUM_PHASES; i++)
+	fprintf(stderr, "%s%s %.3f", (i ? ", " : ""), phasenames[i],
+		fs.phase[i] * 1000);
+      fprintf(stderr, ")\n");
+    }
+  }
+  UNLOCK(output);
+}
+
+static int compare_doubles(const void* a, const void* b)
+{
+  double x = *(const double*) a, y = *(const double*) b;
+  return (x < y ? -1 : x > y ? 1 : 0);
+}
+
+/*
+ * Compute the 50th, 95th, and 99th percentiles of the time spent on
+ * each file (in a given phase, or in total if phase is -1.)
+ */
+static void get_percentiles(double* values, /* buffer (nfilestats
+					       values) */
+			    int phase,	    /* phase */
+			    double* pct)    /* array to store
+					       percentiles */
+{
+  static const int levels[3] = { 50, 95, 99 };
+  unsigned long i;
+
+  if (!nfilestats) {
+    pct[0] = pct[1] = pct[2] = 0.0;
+    return;
+  }
+
+  for (i = 0; i < nfilestats; i++)
+    values[i] = (phase < 0 ? filestats[i].total : filestats[i].phase[phase]);
+  qsort(values, nfilestats, sizeof(double), &compare_doubles);
+
+  /* (nearest rank) */
+  for (i = 0; i < 3; i++)
+    pct[i] = values[(nfilestats * levels[i] + 99) / 100 - 1];
+}
+
+/*
+ * Print a summary of the statistics collected (see --stats) to
+ * standard error.
+ */
+static void print_stats(double start) /* time when we started */
+{
+  RSStats st = oldstats;
+  RSAllocStats mem;
+  double elapsed = rs_get_time() - start;
+  double* values;
+  double pct[3], rate;
+  int i;
+
+  if (!statsformat)
+    return;
+
+  add_stats(&st, &rs_context_default()->stats);
+  rs_get_alloc_stats(&mem);
+  values = rs_malloc((nfilestats ? nfilestats : 1) * sizeof(double));
+  if (!values)
+    return;
+
+  if (statsformat == 2) {
+    fprintf(stderr, "{\"files\":%lu,\"elapsed_ms\":%.3f,"
+	    "\"signatures\":%lu,\"signatures_per_second\":%.1f,"
+	    "\"validations\":%lu,\"validations_per_second\":%.1f,"
+	    "\"errors\":%lu,\"warnings\":%lu",
+	    nfilestats, elapsed * 1000,
+	    st.signatures, (elapsed > 0 ? st.signatures / elapsed : 0.0),
+	    st.validations, (elapsed > 0 ? st.validations / elapsed : 0.0),
+	    st.errors, st.warnings);
+
+    fprintf(stderr, ",\"memory\":{\"allocations\":%lu,"
+	    "\"allocations_per_file\":%.1f,\"frees\":%lu,\"bytes\":%lu,"
+	    "\"peak_bytes\":%lu}",
+	    mem.allocations,
+	    (nfilestats ? (double) mem.allocations / nfilestats : 0.0),
+	    mem.frees, mem.bytes, mem.peak);
+
+    get_percentiles(values, -1, pct);
+    fprintf(stderr, ",\"file_ms\":{\"p50\":%.3f,\"p95\":%.3f,\"p99\":%.3f}",
+	    pct[0] * 1000, pct[1] * 1000, pct[2] * 1000);
+
+    fprintf(stderr, ",\"phases\":{");
+    for (i = 0; i < RS_NUM_PHASES; i++) {
+      get_percentiles(values, i, pct);
+      rate = (st.phase_time[i] > 0
+	      ? st.phase_bytes[i] / st.phase_time[i] / 1e6 : 0.0);
+      fprintf(stderr, "%s\"%s\":{\"total_ms\":%.3f,\"bytes\":%lu,"
+	      "\"mb_per_second\":%.1f,\"p50_ms\":%.3f,\"p95_ms\":%.3f,"
+	      "\"p99_ms\":%.3f}",
+	      (i ? "," : ""), phasenames[i], st.phase_time[i] * 1000,
+	      st.phase_bytes[i], rate,
+	      pct[0] * 1000, pct[1] * 1000, pct[2] * 1000);
+    }
+    fprintf(stderr, "}}\n");
+  }
+  else {
+    fprintf(stderr, "Statistics: %lu files in %.3f s\n",
+	    nfilestats, elapsed);
+    fprintf(stderr, "  %lu signatures (%.1f per second),"
+	    " %lu validations (%.1f per second)\n",
+	    st.signatures, (elapsed > 0 ? st.signatures / elapsed : 0.0),
+	    st.validations, (elapsed > 0 ? st.validations / elapsed : 0.0));
+    fprintf(stderr, "  %lu errors, %lu warnings\n", st.errors, st.warnings);
+    fprintf(stderr, "  %lu allocations (%.1f per file), %lu frees,"
+	    " %lu bytes requested, peak %lu bytes in use\n",
+	    mem.allocations,
+	    (nfilestats ? (double) mem.allocations / nfilestats : 0.0),
+	    mem.frees, mem.bytes, mem.peak);
+
+    fprintf(stderr, "  %-8s %10s %12s %8s %9s %9s %9s\n", "phase",
+	    "total (s)", "bytes", "MB/s", "p50 (ms)", "p95 (ms)", "p99 (ms)");
+    for (i = 0; i < RS_NUM_PHASES; i++) {
+      get_percentiles(values, i, pct);
+      fprintf(stderr, "  %-8s %10.4f %12lu ", phasenames[i],
+	      st.phase_time[i], st.phase_bytes[i]);
+      if (st.phase_bytes[i] && st.phase_time[i] > 0)
+	fprintf(stderr, "%8.1f", st.phase_bytes[i] / st.phase_time[i] / 1e6);
+      else
+	fprintf(stderr, "%8s", "-");
+      fprintf(stderr, " %9.3f %9.3f %9.3f\n",
+	      pct[0] * 1000, pct[1] * 1000, pct[2] * 1000);
+    }
+
+    get_percentiles(values, -1, pct);
+    fprintf(stderr, "  %-8s %10s %12s %8s %9.3f %9.3f %9.3f\n", "file",
+	    "", "", "", pct[0] * 1000, pct[1] * 1000, pct[2] * 1000);
+  }
+
+  rs_free(values);
+}
+
+/*
+ * Print statistics and finish the trace file (if requested.)
+ */
+static void finish_reports(double start) /* time when we started */
+{
+  print_stats(start);
+  close_trace();
+}
+
+/*
+ * Apply a single-letter option that affects how a file is processed.
+ * Returns 0 if the option is not one of these.
+ */
+static int apply_flag(RSJob* job, int c)
+{
+  switch (c) {
+  case 'b':
+    job->flags |= RS_INPUT_BINARY;
+    break;
+
+  case 'u':
+    job->flags &= ~RS_INPUT_SORTED;
+    break;
+
+  case 'f':
+    job->flags |= RS_IGNORE_ALL_WARNINGS;
+    break;
+
+  case 'g':
+    job->flags &= ~RS_OUTPUT_HEX_ONLY;
+    break;
+
+  case 'B':
+    job->flags |= RS_OUTPUT_BINARY;
+    break;
+
+  case 'a':
+    job->flags |= RS_OUTPUT_APPSIGN;
+    break;
+
+  case 'n':
+    job->rawmode = 1;
+    break;
+ 
+  case 'r':
+    job->flags |= RS_REMOVE_OLD_SIGNATURE;
+    break;
+
+  case 'P':
+    job->flags |= RS_ZEALOUSLY_PAD_APP;
+    break;
+
+  case 'p':
+    job->flags |= RS_FIX_PAGE_COUNT;
+    break;
+
+  case 'c':
+    job->valmode = 1;
+    break;
+
+  default:
+    return 0;
+  }
+  return 1;
+}
+
+static int process_program(const RSJob* job, RSProgram* prgm,
+			   const RSKey* key, RSRemoteRequest* req,
+			   const char* infilename, int fromstdin,
+			   unsigned int flags, char** outname,
+			   int* writing);
+
+/*
+ * Check whether a file has already been validated, using the same
+ * key, since it was last modified.
+ *
+ * Returns 0 or 1 (as for process_file) if the cached result can be
+ * used, or -1 if the file must be checked.
+ */
+static int check_val_cache(const RSJob* job) /* what to do */
+{
+  const RSKey* key;
+  unsigned long keyid;
+  unsigned char keyfp[32], fp[32];
+  RSStatus verdict;
+
+  if (rs_val_cache_lookup(valcache, job->infilename, paranoid,
+			  &keyid, keyfp, &verdict))
+    return -1;
+
+  if (!job->keyfilename && !job->keyid && !keyid)
+    return -1;
+
+  LOCK(key);
+  if (job->keyfilename)
+    key = rs_key_cache_load_file(keycache, job->keyfilename);
+  else
+    key = rs_key_cache_find(keycache, (job->keyid ? job->keyid : keyid), 1);
+  if (key) {
+    rs_key_get_fingerprint(key, fp);
+    rs_key_cache_release(keycache, key);
+  }
+  UNLOCK(key);
+  if (!key || memcmp(fp, keyfp, 32))
+    return -1;
+
+  if (verdict) {
+    fprintf(stderr, "%s: signature is not valid (cached result)\n",
+	    job->infilename);
+    return 1;
+  }
+
+  if (verbose > 0)
+    fprintf(stderr, "%s: signature is valid (cached result)\n",
+	    job->infilename);
+  return 0;
+}
+
+/*
+ * Get the name of the midstate file for an input file.
+ */
+static char* midstate_file_name(const char* infilename)
+{
+  char* name;
+
+  if ((name = rs_malloc(strlen(infilename) + 5))) {
+    strcpy(name, infilename);
+    strcat(name, ".rsm");
+  }
+  return name;
+}
+
+/*
+ * Load saved hash states for a program (if any.)
+ */
+static void load_midstates(RSProgram* prgm,	   /* program */
+			   const char* infilename) /* input file name */
+{
+  char* name;
+  FILE* f;
+
+  if (!(name = midstate_file_name(infilename)))
+    return;
+
+  f = fopen(name, "rb");
+  rs_program_load_midstates(prgm, f);
+  if (f)
+    fclose(f);
+  rs_free(name);
+}
+
+/*
+ * Save hash states for a program after signing or validating it.
+ */
+static void save_midstates(const RSProgram* prgm,   /* program */
+			   const char* infilename) /* input file name */
+{
+  char* name;
+  FILE* f;
+
+  if (!(name = midstate_file_name(infilename)))
+    return;
+
+  if (!(f = fopen(name, "wb")))
+    perror(name);
+  else {
+    rs_program_save_midstates(prgm, f);
+    if (fclose(f))
+      perror(name);
+  }
+  rs_free(name);
+}
+
+/*
+ * Determine the output flags to use for a given output file name.
+ */
+static unsigned int get_output_flags(unsigned int flags, /* default
+							    flags */
+				     const char* name)	 /* output file
+							    name */
+{
+  const char* ptr;
+
+  if (name && (ptr = strrchr(name, '.'))) {
+    if (!rs_suffix_to_type(ptr + 1, NULL, NULL))
+      flags &= ~RS_OUTPUT_HEX_ONLY;
+    else if (!strcasecmp(ptr + 1, "rsp"))
+      flags |= RS_OUTPUT_CONTAINER;
+  }
+  return flags;
+}
+
+/*
+ * Write a signed program to a file ("-" = standard output.)
+ */
+static int write_program(const RSProgram* prgm, /* program */
+			 const char* name,	 /* output file name */
+			 unsigned int flags)	 /* output flags */
+{
+  FILE* outfile;
+  int e;
+
+  if (strcmp(name, "-")) {
+    if (!(outfile = fopen(name, "wb"))) {
+      perror(name);
+      return 4;
+    }
+  }
+  else {
+    outfile = stdout;
+  }
+
+  e = rs_write_program_file(prgm, outfile, 0, 0, 0, flags);
+
+  if (outfile != stdout && fclose(outfile) && !e) {
+    perror(name);
+    e = RS_ERR_FILE_IO;
+  }
+  return (e ? 4 : 0);
+}
+
+/*
+ * Sign a program with each of the keys and root numbers listed in
+ * job->targets, and write each result to the corresponding file.
+ */
+static int process_targets(const RSJob* job,	   /* what to do */
+			   RSProgram* prgm,	   /* program */
+			   const char* infilename, /* input file name */
+			   unsigned int flags)	   /* repair, input, and
+						      output flags */
+{
+  const RSTargetSpec* spec;
+  RSSignTarget* targets;
+  unsigned long keyid;
+  int i, n, e, status = 0;
+
+  if (!(targets = rs_malloc(job->ntargets * sizeof(RSSignTarget))))
+    return 4;
+
+  /* Find keys */
+
+  for (n = 0; n < job->ntargets; n++) {
+    spec = &job->targets[n];
+
+    if (spec->keyfilename || (!spec->keyid && job->keyfilename)) {
+      LOCK(key);
+      targets[n].key = rs_key_cache_load_file(keycache,
+					      (spec->keyfilename
+					       ? spec->keyfilename
+					       : job->keyfilename));
+      UNLOCK(key);
+    }
+    else {
+      keyid = (spec->keyid ? spec->keyid : job->keyid);
+      if (!keyid && !(keyid = rs_program_get_key_id(prgm))) {
+	fprintf(stderr, "%s: unable to determine key ID\n", infilename);
+	targets[n].key = NULL;
+      }
+      else {
+	LOCK(key);
+	targets[n].key = rs_key_cache_find(keycache, keyid, 0);
+	UNLOCK(key);
+      }
+    }
+
+    if (!targets[n].key) {
+      status = 3;
+      break;
+    }
+
+    targets[n].rootnum = (spec->rootnum >= 0 ? spec->rootnum : job->rootnum);
+    targets[n].result = NULL;
+  }
+
+  /* Repair and sign */
+
+  if (!status) {
+    if (verbose > 0)
+      fprintf(stderr, "Signing %s %s %s (%d targets)...\n",
+	      rs_calc_type_to_string(prgm->calctype),
+	      rs_data_type_to_string(prgm->datatype),
+	      infilename, n);
+
+    if (!job->rawmode && (e = rs_repair_program(prgm, flags))) {
+      if (!(flags & RS_IGNORE_ALL_WARNINGS)
+	  && e > 0 && e < RS_ERR_CRITICAL)
+	fprintf(stderr, "(use -f to override)\n");
+      status = 2;
+    }
+    else if (rs_sign_program_multi(prgm, targets, n)) {
+      status = 2;
+    }
+  }
+
+  /* Write output files */
+
+  for (i = 0; i < n; i++) {
+    spec = &job->targets[i];
+
+    if (!status)
+      status = write_program(targets[i].result, spec->outfilename,
+			     get_output_flags(flags, spec->outfilename));
+
+    rs_program_free(targets[i].result);
+    LOCK(key);
+    rs_key_cache_release(keycache, targets[i].key);
+    UNLOCK(key);
+  }
+
+  rs_free(targets);
+  return status;
+}
+
+/*
+ * Find the key for a program (the one given on the command line, or
+ * the one named in the program header.)  Returns NULL if it cannot be
+ * found.
+ */
+static const RSKey* find_key(const RSJob* job,	    /* what to do */
+			     const RSProgram* prgm,  /* program */
+			     const char* infilename) /* input file name */
+{
+  const RSKey* key;
+  unsigned long keyid = job->keyid;
+  double start, end;
+
+  if (!job->keyfilename && !keyid
+      && !(keyid = rs_program_get_key_id(prgm))) {
+    fprintf(stderr, "%s: unable to determine key ID\n", infilename);
+    return NULL;
+  }
+
+  /* (trace the time spent waiting for the lock, if it's noticeable) */
+  start = (tracefile ? rs_get_time() : 0.0);
+  LOCK(key);
+  if (tracefile && (end = rs_get_time()) - start > 1e-6)
+    trace_span("key cache lock", "lock", start, end, "");
+
+  if (job->keyfilename)
+    key = rs_key_cache_load_file(keycache, job->keyfilename);
+  else
+    key = rs_key_cache_find(keycache, keyid, job->valmode);
+  UNLOCK(key);
+  return key;
+}
+
+/*
+ * Release a key returned by find_key().
+ */
+static void release_key(const RSKey* key) /* key */
+{
+  LOCK(key);
+  rs_key_cache_release(keycache, key);
+  UNLOCK(key);
+}
+
+/*
+ * Sign or validate a single file.
+ *
+ * Returns 0 if successful, 1 if the signature is invalid, 2 if the
+ * program could not be signed, 3 if the key could not be found, or 4
+ * for I/O errors.  The name of the output file (if any) is stored in
+ * *outname, and must be freed by the caller.
+ *
+ * If job->io is set, the output file may be written asynchronously;
+ * in that case, *writing is set to 1, and the status of the write
+ * request must be checked as well.
+ */
+static int process_file(const RSJob* job,   /* what to do */
+			char** outname,	    /* output file name */
+			int* writing)	    /* set to 1 if output file
+					       is being written */
+{
+  const char* infilename;
+  FILE* infile;
+  const RSKey* key = NULL;
+  RSProgram* prgm;
+  RSRemoteRequest req;
+  unsigned int flags = job->flags;
+  char *ptr;
+  int e;
+
+  *outname = NULL;
+
+  if (valcache && job->valmode && !servername
+      && strcmp(job->infilename, "-")
+      && (e = check_val_cache(job)) >= 0)
+    return e;
+
+  /* A delta must be written in the same format as the input file */
+  flags = get_output_flags(flags, (job->deltamode
+				   ? job->infilename
+				   : job->outfilename));
+
+  /* Read input file */
+
+  if (job->indata) {
+    infilename = job->infilename;
+    infile = NULL;
+  }
+  else if (strcmp(job->infilename, "-")) {
+    infilename = job->infilename;
+    infile = fopen(infilename, "rb");
+    if (!infile) {
+      perror(infilename);
+      return 4;
+    }
+  }
+  else {
+    infilename = "(standard input)";
+    infile = stdin;
+  }
+
+  prgm = rs_program_new();
+  if (!prgm) {
+    if (infile && infile != stdin)
+      fclose(infile);
+    return 4;
+  }
+
+  if (job->ctype && job->dtype) {
+    prgm->calctype = job->ctype;
+    prgm->datatype = job->dtype;
+  }
+  else if ((ptr = strrchr(infilename, '.'))) {
+    rs_suffix_to_type(ptr + 1, &prgm->calctype, &prgm->datatype);
+  }
+
+  if (infile)
+    e = rs_read_program_file(prgm, infile, infilename, flags);
+  else if (!(prgm->filename = rs_ctx_strdup(prgm->ctx, infilename)))
+    e = RS_ERR_OUT_OF_MEMORY;
+  else
+    e = rs_read_program_buffer(prgm, job->indata, job->inlength, flags);
+
+  if (infile && infile != stdin)
+    fclose(infile);
+  if (e) {
+    rs_program_free(prgm);
+    return 4;
+  }
+
+  /* Sign several ways at once, if requested */
+
+  if (job->ntargets && !job->valmode) {
+    if (job->midstates && infile != stdin)
+      load_midstates(prgm, infilename);
+
+    e = process_targets(job, prgm, infilename, flags);
+
+    if (job->midstates && infile != stdin && !e)
+      save_midstates(prgm, infilename);
+
+    rs_program_free(prgm);
+    return e;
+  }
+
+  /* Find key (unless the server does that for us) */
+
+  if (servername) {
+    req.keyid = job->keyid;
+    req.flags = flags;
+    req.rootnum = job->rootnum;
+    req.rawmode = job->rawmode;
+    req.verbose = verbose;
+  }
+  else if (!(key = find_key(job, prgm, infilename))) {
+    rs_program_free(prgm);
+    return 3;
+  }
+
+  if (job->midstates && !servername && infile != stdin)
+    load_midstates(prgm, infilename);
+
+  e = process_program(job, prgm, key, &req, infilename,
+		      (infile == stdin), flags, outname, writing);
+
+  if (job->midstates && !servername && infile != stdin && !e)
+    save_midstates(prgm, infilename);
+
+  if (valcache && job->valmode && key && infile != stdin && e <= 1)
+    rs_val_cache_store(valcache, infilename, key, e);
+
+  release_key(key);
+  rs_program_free(prgm);
+  return e;
+}
+
+/*
+ * Sign or validate a program that has been read from a file.
+ */
+static int process_program(const RSJob* job,	   /* what to do */
+			   RSProgram* prgm,	   /* program */
+			   const RSKey* key,	   /* key (NULL if using
+						      server) */
+			   RSRemoteRequest* req,   /* server request */
+			   const char* infilename, /* input file name */
+			   int fromstdin,	   /* 1 = input was
+						      standard input */
+			   unsigned int flags,	   /* repair, input, and
+						      output flags */
+			   char** outname,	   /* output file name */
+			   int* writing)	   /* set to 1 if output
+						      file is being
+						      written */
+{
+  FILE *outfile, *origfile;
+  RSStatus result;
+  RSSignature sig;
+  char *ptr, *tempname;
+  const char *ext;
+  unsigned char* data;
+  unsigned long length;
+  int i, e;
+
+  if (job->valmode) {
+    /* Validate application */
+    if (verbose > 0)
+      fprintf(stderr, "Validating %s %s %s...\n",
+	      rs_calc_type_to_string(prgm->calctype),
+	      rs_data_type_to_string(prgm->datatype),
+	      infilename);
+
+    if (servername) {
+      req->op = RS_REMOTE_VALIDATE;
+      if (rs_remote_call(serverfd, req, prgm, &result))
+	return 4;
+      e = result;
+    }
+    else {
+      e = rs_validate_program(prgm, key);
+    }
+
+    return (e ? 1 : 0);
+  }
+
+  /* Sign application */
+  if (verbose > 0)
+    fprintf(stderr, "Signing %s %s %s...\n",
+	    rs_calc_type_to_string(prgm->calctype),
+	    rs_data_type_to_string(prgm->datatype),
+	    infilename);
+
+  if (!job->rawmode)
+    e = rs_repair_program(prgm, flags);
+  else
+    e = RS_SUCCESS;
+
+  if (e) {
+    if (!(flags & RS_IGNORE_ALL_WARNINGS)
+	&& e > 0 && e < RS_ERR_CRITICAL)
+      fprintf(stderr, "(use -f to override)\n");
+    return 2;
+  }
+
+  if (servername) {
+    /* Hash the program here, and send only the digest to the
+       server.  (The server will not sign a Rabin digest, so for
+       Rabin signatures, send the repaired program instead.) */
+    req->op = RS_REMOTE_SIGN_DIGEST;
+    if (!req->keyid && !(req->keyid = rs_program_get_key_id(prgm))) {
+      fprintf(stderr, "%s: unable to determine key ID\n", infilename);
+      return 3;
+    }
+    rs_program_compute_digest(prgm, &req->digest);
+
+    if (req->digest.scheme == RS_SIG_RABIN) {
+      req->op = RS_REMOTE_SIGN;
+      req->rawmode = 1;
+      if (rs_remote_call(serverfd, req, prgm, &result))
+	return 4;
+      if (result)
+	return 2;
+    }
+    else {
+      rs_signature_init(&sig);
+      if (rs_remote_sign_digest(serverfd, req, &sig, &result)) {
+	rs_signature_clear(&sig);
+	return 4;
+      }
+      e = (result ? result : rs_program_attach_signature(prgm, &sig));
+      rs_signature_clear(&sig);
+      if (e)
+	return 2;
+    }
+  }
+  else if (rs_sign_program(prgm, key, job->rootnum)) {
+    return 2;
+  }
+
+  /* Generate output file name */
+
+  if (job->deltamode && fromstdin) {
+    fprintf(stderr, "%s: --delta cannot be used with standard input\n",
+	    infilename);
+    return 4;
+  }
+
+  if (job->outfilename && strcmp(job->outfilename, "-")) {
+    tempname = rs_strdup(job->outfilename);
+  }
+  else if (job->outfilename || fromstdin) {
+    tempname = rs_strdup("-");
+  }
+  else if (job->deltamode) {
+    tempname = rs_malloc(strlen(infilename) + 5);
+    if (tempname) {
+      strcpy(tempname, infilename);
+      strcat(tempname, ".rsd");
+    }
+  }
+  else {
+    ext = rs_type_to_suffix(prgm->calctype, prgm->datatype,
+			    (flags & RS_OUTPUT_HEX_ONLY));
+
+    tempname = rs_malloc(strlen(infilename) + 32);
+    if (tempname) {
+      strcpy(tempname, infilename);
+
+      ptr = strrchr(tempname, '.');
+      if (!ptr) {
+	strcat(tempname, ".");
+	strcat(tempname, ext);
+      }
+      else if (strcasecmp(ptr + 1, ext)) {
+	strcpy(ptr + 1, ext);
+      }
+      else {
+	strcpy(ptr, "-signed.");
+	strcat(ptr, ext);
+      }
+    }
+  }
+
+  if (!tempname)
+    return 4;
+  *outname = tempname;
+
+  /* Format the signed program in memory, and let the batch write it
+     out along with other files.  (Extra output files are not allowed
+     in a manifest, so there is nothing else to write.) */
+
+  if (job->io && !job->deltamode && strcmp(tempname, "-")) {
+    data = NULL;
+    if (rs_write_program_buffer(prgm, &data, &length, 0, 0, 0, flags)
+	|| rs_batch_io_write(job->io, tempname, data, length, job->iotag))
+      return 4;
+    *writing = 1;
+    return 0;
+  }
+
+  if (strcmp(tempname, "-")) {
+    outfile = fopen(tempname, "wb");
+    if (!outfile) {
+      perror(tempname);
+      return 4;
+    }
+  }
+  else {
+    outfile = stdout;
+  }
+
+  /* Write signed application (or delta) to output file */
+
+  if (job->deltamode) {
+    if (!(origfile = fopen(infilename, "rb"))) {
+      perror(infilename);
+      if (outfile != stdout)
+	fclose(outfile);
+      return 4;
+    }
+    e = rs_write_program_delta(prgm, origfile, outfile, 0, 0, 0, flags);
+    fclose(origfile);
+  }
+  else {
+    e = rs_write_program_file(prgm, outfile, 0, 0, 0, flags);
+  }
+
+  if (e) {
+    if (outfile != stdout)
+      fclose(outfile);
+    return 4;
+  }
+
+  if (outfile != stdout && fclose(outfile)) {
+    perror(tempname);
+    return 4;
+  }
+
+  /* Write the same program to any other output files, each in the
+     format implied by its name */
+
+  for (i = 0; i < job->nextraoutfiles; i++) {
+    if ((e = write_program(prgm, job->extraoutfiles[i],
+			   get_output_flags(job->flags,
+					    job->extraoutfiles[i]))))
+      return e;
+  }
+
+  return 0;
+}
+
+/* Number of manifest entries that may be in progress at once */
+#define MANIFEST_WINDOW 64
+
+/* States of a manifest entry */
+enum {
+  ENTRY_READING,		/* waiting for input file to be read */
+  ENTRY_READY,			/* ready to process */
+  ENTRY_WRITING,		/* waiting for output file to be written */
+  ENTRY_DONE			/* finished */
+};
+
+/* A job listed in a manifest */
+typedef struct _RSManifestEntry {
+  char line[4096];		/* text of the line (the job's file names
+				   point into this) */
+  unsigned long lineno;		/* line number */
+  RSJob job;			/* what to do */
+  int state;			/* current state */
+  int status;			/* result (as returned by process_file()) */
+  char* outname;		/* output file name */
+  RSBatchIOResult input;	/* contents of input file */
+} RSManifestEntry;
+
+/*
+ * Parse a line of a manifest.
+ *
+ * Returns 0 if the line describes a job, or -1 if it is blank or a
+ * comment.  If the line is invalid, ent->status is set to 5.
+ */
+static int parse_manifest_line(const char* mfname,	/* manifest file */
+			       RSManifestEntry* ent,	/* entry */
+			       const RSJob* defaults)	/* default
+							   settings */
+{
+  char* fields[6];
+  char* p;
+  int i;
+
+  for (i = 0; i < 6; i++)
+    fields[i] = strtok(i ? NULL : ent->line, " \t\r\n");
+
+  if (!fields[0] || fields[0][0] == '#')
+    return -1;
+
+  for (i = 1; i < 6; i++)
+    if (fields[i] && !strcmp(fields[i], "-"))
+      fields[i] = NULL;
+
+  ent->job = *defaults;
+  ent->job.infilename = fields[0];
+  ent->status = 0;
+  ent->outname = NULL;
+  memset(&ent->input, 0, sizeof(RSBatchIOResult));
+
+  if (fields[1])
+    ent->job.outfilename = fields[1];
+
+  if (fields[2]) {
+    if (strchr(fields[2], '.') || strchr(fields[2], '/')) {
+      ent->job.keyfilename = fields[2];
+      ent->job.keyid = 0;
+    }
+    else if (sscanf(fields[2], "%lx", &ent->job.keyid) == 1) {
+      ent->job.keyfilename = NULL;
+    }
+    else {
+      fprintf(stderr, "%s:%lu: invalid key %s\n",
+	      mfname, ent->lineno, fields[2]);
+      ent->status = 5;
+    }
+  }
+
+  if (fields[3] && rs_suffix_to_type(fields[3], &ent->job.ctype,
+				     &ent->job.dtype)) {
+    fprintf(stderr, "%s:%lu: unrecognized file type %s\n",
+	    mfname, ent->lineno, fields[3]);
+    ent->status = 5;
+  }
+
+  if (fields[4] && (sscanf(fields[4], "%d", &ent->job.rootnum) != 1
+		    || ent->job.rootnum < 0 || ent->job.rootnum > 3)) {
+    fprintf(stderr, "%s:%lu: invalid root number %s\n",
+	    mfname, ent->lineno, fields[4]);
+    ent->status = 5;
+  }
+
+  for (p = fields[5]; p && *p; p++) {
+    if (!apply_flag(&ent->job, *p)) {
+      fprintf(stderr, "%s:%lu: unrecognized flag %c\n",
+	      mfname, ent->lineno, *p);
+      ent->status = 5;
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * Get the name of the file a job writes, or if that is not yet known,
+ * the part of the name that is (the input file name up to its suffix,
+ * which is how the default output file name begins.)  Returns 0 if
+ * the job does not write a file.
+ */
+static int get_output_name(const RSManifestEntry* ent, /* entry */
+			   const char** name,	       /* file name */
+			   size_t* length,	       /* length of name */
+			   int* exact)		       /* 1 = whole name
+							  is known */
+{
+  const char* p;
+
+  if (ent->outname || ent->job.outfilename) {
+    *name = (ent->outname ? ent->outname : ent->job.outfilename);
+    *length = strlen(*name);
+    *exact = 1;
+    return strcmp(*name, "-");
+  }
+
+  *name = ent->job.infilename;
+  if (!strcmp(*name, "-"))
+    return 0;
+  p = strrchr(*name, '.');
+  *length = (p ? (size_t) (p - *name) : strlen(*name));
+  *exact = 0;
+  return 1;
+}
+
+/*
+ * Check whether two file names, either of which may only be partly
+ * known, might be the same.
+ */
+static int names_may_match(const char* a,   /* first name */
+			   size_t alength,  /* length of a */
+			   int aexact,	    /* 1 = a is complete */
+			   const char* b,   /* second name */
+			   size_t blength,  /* length of b */
+			   int bexact)	    /* 1 = b is complete */
+{
+  if (aexact && bexact && alength != blength)
+    return 0;
+  if (aexact && alength < blength)
+    return 0;
+  if (bexact && blength < alength)
+    return 0;
+  return !memcmp(a, b, (alength < blength ? alength : blength));
+}
+
+/*
+ * Check whether a job reads or writes a file that an earlier job in
+ * the window (entries first to last - 1) has not yet finished writing.
+ */
+static int depends_on_pending(const RSManifestEntry* entries, /* window */
+			      unsigned long first,  /* first entry */
+			      unsigned long last,   /* last entry + 1 */
+			      const RSManifestEntry* ent) /* new job */
+{
+  const RSManifestEntry* prev;
+  const char *pname, *oname;
+  size_t plength, olength;
+  int pexact, oexact, hasout;
+
+  hasout = get_output_name(ent, &oname, &olength, &oexact);
+
+  for (; first < last; first++) {
+    prev = &entries[first % MANIFEST_WINDOW];
+    if (prev->state == ENTRY_DONE
+	|| !get_output_name(prev, &pname, &plength, &pexact))
+      continue;
+
+    if (strcmp(ent->job.infilename, "-")
+	&& names_may_match(ent->job.infilename,
+			   strlen(ent->job.infilename), 1,
+			   pname, plength, pexact))
+      return 1;
+    if (hasout && names_may_match(oname, olength, oexact,
+				  pname, plength, pexact))
+      return 1;
+  }
+  return 0;
+}
+
+/*
+ * Process a list of jobs.
+ *
+ * Each line of the manifest describes one file, and consists of up
+ * to six fields separated by whitespace:
+ *
+ *   input  output  key  type  root  flags
+ *
+ * Any field except the input file may be "-" (or omitted) to use the
+ * default given on the command line.  The key may be either a key ID
+ * (in hexadecimal) or a key file name (anything containing a '.' or
+ * '/'.)  The flags are a string of single-letter options, as they
+ * would be given on the command line (e.g., "gr".)  Blank lines and
+ * lines beginning with '#' are ignored.
+ *
+ * For each job, a line is written to standard output, consisting of
+ * the line number, "ok", "invalid", or "failed", the status code (as
+ * returned by process_file()), the input file, and the output file,
+ * separated by tabs.
+ *
+ * Jobs are processed in order, but input files are read ahead (up to
+ * MANIFEST_WINDOW lines), and output files are written in the
+ * background, using a batch.  The report for each job is written
+ * once its output file is complete.  A job whose input or output file
+ * might be the output of an earlier job that is still pending is not
+ * started until all earlier jobs are finished.
+ */
+static int process_manifest(const char* mfname,	   /* manifest file */
+			    const RSJob* defaults) /* default settings */
+{
+  static const char* statusnames[] = { "ok", "invalid", "failed",
+				       "failed", "failed" };
+  RSManifestEntry *entries, *ent;
+  RSBatchIO* io;
+  RSBatchIOResult res;
+  RSStats before;
+  double start;
+  FILE* mf;
+  unsigned long lineno = 0, nread = 0, nproc = 0, nreport = 0;
+  int eof = 0, held = 0, writing, worst = 0;
+
+  if (strcmp(mfname, "-")) {
+    mf = fopen(mfname, "rt");
+    if (!mf) {
+      perror(mfname);
+      return 4;
+    }
+  }
+  else {
+    mf = stdin;
+  }
+
+  entries = rs_malloc(MANIFEST_WINDOW * sizeof(RSManifestEntry));
+  io = rs_batch_io_new(NULL, iobackend, MANIFEST_WINDOW);
+  if (!entries || !io) {
+    rs_free(entries);
+    rs_batch_io_free(io);
+    if (mf != stdin)
+      fclose(mf);
+    return 4;
+  }
+
+  if (verbose > 0)
+    fprintf(stderr, "Using %s I/O\n",
+	    rs_batch_io_backend_name(rs_batch_io_backend(io)));
+
+  while (1) {
+    /* Read ahead in the manifest, and start reading input files */
+
+    while (!eof && nread < nreport + MANIFEST_WINDOW) {
+      ent = &entries[nread % MANIFEST_WINDOW];
+      if (!held) {
+	if (!fgets(ent->line, sizeof(ent->line), mf)) {
+	  eof = 1;
+	  break;
+	}
+	ent->lineno = ++lineno;
+	if (parse_manifest_line(mfname, ent, defaults))
+	  continue;
+      }
+
+      /* (if the job might use the output of an earlier job, hold it
+	 back until the earlier jobs are finished) */
+      held = (!ent->status
+	      && depends_on_pending(entries, nreport, nread, ent));
+      if (held)
+	break;
+
+      if (ent->status)
+	ent->state = ENTRY_DONE;
+      else if (!strcmp(ent->job.infilename, "-")
+	       || (valcache && ent->job.valmode))
+	ent->state = ENTRY_READY;
+      else if (!rs_batch_io_read(io, ent->job.infilename, ent))
+	ent->state = ENTRY_READING;
+      else {
+	ent->status = 4;
+	ent->state = ENTRY_DONE;
+      }
+      nread++;
+    }
+
+    /* Process the next job, once its input file has been read */
+
+    if (nproc < nread
+	&& entries[nproc % MANIFEST_WINDOW].state != ENTRY_READING) {
+      ent = &entries[nproc % MANIFEST_WINDOW];
+      if (ent->state == ENTRY_READY) {
+	ent->job.indata = ent->input.data;
+	ent->job.inlength = ent->input.length;
+	ent->job.io = io;
+	ent->job.iotag = ent;
+	writing = 0;
+	before = rs_context_default()->stats;
+	start = rs_get_time();
+	ent->status = process_file(&ent->job, &ent->outname, &writing);
+	record_file_stats(rs_context_default(), &before, start,
+			  ent->job.infilename, ent->status);
+	rs_batch_io_release(io, &ent->input);
+	ent->state = (writing ? ENTRY_WRITING : ENTRY_DONE);
+      }
+      nproc++;
+    }
+
+    /* Report finished jobs, in order */
+
+    while (nreport < nproc
+	   && entries[nreport % MANIFEST_WINDOW].state == ENTRY_DONE) {
+      ent = &entries[nreport % MANIFEST_WINDOW];
+      printf("%lu\t%s\t%d\t%s\t%s\n", ent->lineno,
+	     (ent->status < 5 ? statusnames[ent->status] : "failed"),
+	     ent->status, ent->job.infilename,
+	     (ent->outname ? ent->outname : "-"));
+      fflush(stdout);
+      rs_free(ent->outname);
+
+      if (ent->status > worst)
+	worst = ent->status;
+      nreport++;
+    }
+
+    if (eof && nreport == nread)
+      break;
+    if (nproc < nread
+	&& entries[nproc % MANIFEST_WINDOW].state != ENTRY_READING)
+      continue;
+    if (held && nreport == nread)
+      continue;
+
+    /* Wait for an input file to be read or an output file to be
+       written */
+
+    if (!rs_batch_io_wait(io, &res)) {
+      worst = 4;
+      break;
+    }
+
+    ent = res.tag;
+    if (res.error) {
+      fprintf(stderr, "%s: %s\n", res.filename, strerror(res.error));
+      ent->status = 4;
+    }
+
+    if (res.write || res.error) {
+      rs_batch_io_release(io, &res);
+      ent->state = ENTRY_DONE;
+    }
+    else {
+      ent->input = res;
+      ent->state = ENTRY_READY;
+    }
+  }
+
+  /* (only if something went badly wrong) */
+  for (; nreport < nread; nreport++) {
+    ent = &entries[nreport % MANIFEST_WINDOW];
+    rs_batch_io_release(io, &ent->input);
+    rs_free(ent->outname);
+  }
+
+  rs_batch_io_free(io);
+  rs_free(entries);
+
+  if (ferror(mf)) {
+    perror(mfname);
+    worst = 4;
+  }
+
+  if (mf != stdin)
+    fclose(mf);
+  return worst;
+}
+
+#ifdef RS_WATCH_SPOOL
+
+/* Name of the state file (in the watched directory) */
+#define WATCH_STATE_NAME ".rabbitsign-state"
+
+/* Number of hash buckets for the state table */
+#define WATCH_STATE_BUCKETS 256
+
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+# define MTIME_NSEC(st) ((long) (st)->st_mtim.tv_nsec)
+#else
+# define MTIME_NSEC(st) 0L
+#endif
+
+/* A file waiting to be signed */
+typedef struct _WatchItem {
+  struct _WatchItem* next;
+  char* name;			/* file name (relative to the watched
+				   directory) */
+  int busy;			/* 1 = being signed */
+  int again;			/* 1 = changed again while being
+				   signed */
+} WatchItem;
+
+/* A file that has been signed */
+typedef struct _WatchStateEntry {
+  struct _WatchStateEntry* next;
+  char* name;			/* file name */
+  unsigned long size;		/* size of the input file */
+  long mtime;			/* modification time of the input file */
+  long mtimensec;
+} WatchStateEntry;
+
+/* State of a worker thread */
+typedef struct _WatchWorker {
+  RSContext* ctx;
+  int index;			/* worker number (used to name
+				   temporary files) */
+} WatchWorker;
+
+static const RSJob* watchjob = NULL; /* settings given on the command
+					line */
+static const char* watchdir = NULL; /* directory being watched */
+static const char* watchoutdir = NULL; /* directory for signed files */
+
+/* Files to be signed, and whether to stop (only used while holding
+   queue_lock) */
+static WatchItem* watchqueue = NULL;
+static int watchdone = 0;
+
+/* Files already signed (only used while holding state_lock) */
+static WatchStateEntry* watchstate[WATCH_STATE_BUCKETS];
+static FILE* watchstatefile = NULL;
+
+static volatile sig_atomic_t watchsignal = 0;
+
+/*
+ * Join a directory name and a file name.
+ */
+static char* join_path(const char* dname, /* directory name */
+		       const char* fname) /* file name */
+{
+  char* path;
+
+  if ((path = rs_malloc(strlen(dname) + strlen(fname) + 2))) {
+    strcpy(path, dname);
+    strcat(path, "/");
+    strcat(path, fname);
+  }
+  return path;
+}
+
+/*
+ * Find the state entry for a file.
+ */
+static WatchStateEntry** find_state(const char* name) /* file name */
+{
+  WatchStateEntry** p;
+  unsigned int h = 0;
+  const char* s;
+
+  for (s = name; *s; s++)
+    h = h * 31 + (unsigned char) *s;
+
+  for (p = &watchstate[h % WATCH_STATE_BUCKETS]; *p; p = &(*p)->next)
+    if (!strcmp((*p)->name, name))
+      break;
+  return p;
+}
+
+/*
+ * Check whether a file has already been signed, in its current form.
+ */
+static int state_matches(const char* name,	 /* file name */
+			 const struct stat* st) /* file status */
+{
+  WatchStateEntry* ent = *find_state(name);
+
+  return (ent && ent->size == (unsigned long) st->st_size
+	  && ent->mtime == (long) st->st_mtime
+	  && ent->mtimensec == MTIME_NSEC(st));
+}
+
+/*
+ * Record the size and modification time of a file.
+ */
+static int set_state(const char* name,	 /* file name */
+		     unsigned long size, /* size */
+		     long mtime,	 /* modification time */
+		     long mtimensec)
+{
+  WatchStateEntry** p = find_state(name);
+  WatchStateEntry* ent = *p;
+
+  if (!ent) {
+    if (!(ent = rs_malloc(sizeof(WatchStateEntry))))
+      return RS_ERR_OUT_OF_MEMORY;
+    if (!(ent->name = rs_strdup(name))) {
+      rs_free(ent);
+      return RS_ERR_OUT_OF_MEMORY;
+    }
+    ent->next = NULL;
+    *p = ent;
+  }
+
+  ent->size = size;
+  ent->mtime = mtime;
+  ent->mtimensec = mtimensec;
+  return RS_SUCCESS;
+}
+
+/*
+ * Record that a file has been signed, and add it to the state file.
+ */
+static void record_state(const char* name,	/* file name */
+			 const struct stat* st) /* file status (before
+						   reading it) */
+{
+  /* (such names can't be written to the state file; the file will
+     simply be signed again next time) */
+  if (strchr(name, '\n'))
+    return;
+
+  LOCK(state);
+  if (!set_state(name, st->st_size, st->st_mtime, MTIME_NSEC(st))
+      && watchstatefile) {
+    fprintf(watchstatefile, "%lu %ld %ld %s\n",
+	    (unsigned long) st->st_size, (long) st->st_mtime,
+	    MTIME_NSEC(st), name);
+    fflush(watchstatefile);
+  }
+  UNLOCK(state);
+}
+
+/*
+ * Read the state file, and rewrite it, leaving out files that have
+ * since been changed or removed.
+ *
+ * Each line of the state file consists of the size, modification
+ * time (seconds and nanoseconds), and name of a file that has been
+ * signed.  Lines are appended as files are signed, so a later line
+ * overrides an earlier one for the same file.
+ */
+static int load_state(void)
+{
+  WatchStateEntry* ent;
+  struct stat st;
+  char line[4096];
+  char *statename, *tempname, *path, *p;
+  unsigned long size;
+  long mtime, mtimensec;
+  int i, n, e = RS_SUCCESS;
+  FILE* f;
+
+  if (!(statename = join_path(watchdir, WATCH_STATE_NAME))
+      || !(tempname = join_path(watchdir, WATCH_STATE_NAME ".tmp"))) {
+    rs_free(statename);
+    return RS_ERR_OUT_OF_MEMORY;
+  }
+
+  if ((f = fopen(statename, "rt"))) {
+    while (!e && fgets(line, sizeof(line), f)) {
+      if ((p = strchr(line, '\n')))
+	*p = 0;
+      if (sscanf(line, "%lu %ld %ld %n", &size, &mtime, &mtimensec, &n) >= 3
+	  && line[n])
+	e = set_state(line + n, size, mtime, mtimensec);
+    }
+    fclose(f);
+  }
+
+  if (!e && !(f = fopen(tempname, "wt"))) {
+    perror(tempname);
+    e = RS_ERR_FILE_IO;
+  }
+
+  for (i = 0; !e && i < WATCH_STATE_BUCKETS; i++) {
+    for (ent = watchstate[i]; !e && ent; ent = ent->next) {
+      if (!(path = join_path(watchdir, ent->name))) {
+	fclose(f);
+	e = RS_ERR_OUT_OF_MEMORY;
+      }
+      else {
+	if (!stat(path, &st) && state_matches(ent->name, &st))
+	  fprintf(f, "%lu %ld %ld %s\n", ent->size, ent->mtime,
+		  ent->mtimensec, ent->name);
+	rs_free(path);
+      }
+    }
+  }
+
+  if (!e) {
+    if (fclose(f) || rename(tempname, statename)) {
+      perror(statename);
+      e = RS_ERR_FILE_IO;
+    }
+    else if (!(watchstatefile = fopen(statename, "at"))) {
+      perror(statename);
+      e = RS_ERR_FILE_IO;
+    }
+  }
+
+  rs_free(statename);
+  rs_free(tempname);
+  return e;
+}
+
+/*
+ * Free the state table.
+ */
+static void free_state(void)
+{
+  WatchStateEntry *ent, *next;
+  int i;
+
+  for (i = 0; i < WATCH_STATE_BUCKETS; i++) {
+    for (ent = watchstate[i]; ent; ent = next) {
+      next = ent->next;
+      rs_free(ent->name);
+      rs_free(ent);
+    }
+    watchstate[i] = NULL;
+  }
+
+  if (watchstatefile)
+    fclose(watchstatefile);
+  watchstatefile = NULL;
+}
+
+/*
+ * Add a file to the queue (unless it is already waiting.)
+ */
+static int queue_file(const char* name) /* file name */
+{
+  WatchItem** p;
+  WatchItem* item;
+
+  /* Temporary files (including our own state file) are ignored */
+  if (name[0] == '.')
+    return RS_SUCCESS;
+
+  LOCK(queue);
+  for (p = &watchqueue; *p; p = &(*p)->next) {
+    if (!strcmp((*p)->name, name)) {
+      if ((*p)->busy)
+	(*p)->again = 1;
+      UNLOCK(queue);
+      return RS_SUCCESS;
+    }
+  }
+
+  if (!(item = rs_malloc(sizeof(WatchItem)))
+      || !(item->name = rs_strdup(name))) {
+    rs_free(item);
+    UNLOCK(queue);
+    return RS_ERR_OUT_OF_MEMORY;
+  }
+  item->next = NULL;
+  item->busy = item->again = 0;
+  *p = item;
+  WAKE(queue);
+  UNLOCK(queue);
+  return RS_SUCCESS;
+}
+
+/*
+ * Add all files currently in the watched directory to the queue.
+ */
+static int queue_all_files(void)
+{
+  DIR* d;
+  struct dirent* de;
+  int e = RS_SUCCESS;
+
+  if (!(d = opendir(watchdir))) {
+    perror(watchdir);
+    return RS_ERR_FILE_IO;
+  }
+
+  while (!e && (de = readdir(d)))
+    e = queue_file(de->d_name);
+
+  closedir(d);
+  return e;
+}
+
+/*
+ * Sign a file from the watched directory, and write the result to
+ * the output directory.
+ *
+ * The output is written to a temporary file, which is then renamed,
+ * so that a partially written file is never visible.  Returns the
+ * status (as for process_file), or -1 if the file doesn't need to be
+ * signed.
+ */
+static int sign_watched_file(WatchWorker* w,   /* worker state */
+			     const char* name) /* file name */
+{
+  RSJob job = *watchjob;
+  RSProgram* prgm;
+  const RSKey* key;
+  RSStats before;
+  double start;
+  struct stat st;
+  char *path, *outname, *tempname, *base, *ptr;
+  char *written = NULL;
+  char suffix[64];
+  const char* ext;
+  FILE* infile;
+  int e, writing = 0;
+
+  if (!(path = join_path(watchdir, name)))
+    return 4;
+
+  if (stat(path, &st) || !S_ISREG(st.st_mode)) {
+    rs_free(path);
+    return -1;
+  }
+
+  LOCK(state);
+  e = state_matches(name, &st);
+  UNLOCK(state);
+  if (e) {
+    if (verbose > 0)
+      fprintf(stderr, "%s: already signed\n", path);
+    rs_free(path);
+    return -1;
+  }
+
+  /* Read input file */
+
+  before = w->ctx->stats;
+  start = rs_get_time();
+
+  if (!(infile = fopen(path, "rb"))) {
+    perror(path);
+    rs_free(path);
+    return 4;
+  }
+
+  if (!(prgm = rs_program_new_with_context(w->ctx))) {
+    fclose(infile);
+    rs_free(path);
+    return 4;
+  }
+
+  if (job.ctype && job.dtype) {
+    prgm->calctype = job.ctype;
+    prgm->datatype = job.dtype;
+  }
+  else if ((ptr = strrchr(name, '.'))) {
+    rs_suffix_to_type(ptr + 1, &prgm->calctype, &prgm->datatype);
+  }
+
+  e = rs_read_program_file(prgm, infile, path, job.flags);
+  fclose(infile);
+  if (e) {
+    rs_program_free(prgm);
+    rs_free(path);
+    return 4;
+  }
+
+  if (!(key = find_key(&job, prgm, path))) {
+    rs_program_free(prgm);
+    rs_free(path);
+    return 3;
+  }
+
+  /* Output file is named after the input file, with the suffix
+     replaced */
+
+  ext = rs_type_to_suffix(prgm->calctype, prgm->datatype,
+			  (job.flags & RS_OUTPUT_HEX_ONLY));
+  outname = rs_malloc(strlen(watchoutdir) + strlen(name) + 34);
+  tempname = rs_malloc(strlen(watchoutdir) + strlen(name) + 80);
+  if (!outname || !tempname) {
+    rs_free(outname);
+    rs_free(tempname);
+    release_key(key);
+    rs_program_free(prgm);
+    rs_free(path);
+    return 4;
+  }
+
+  sprintf(outname, "%s/", watchoutdir);
+  base = outname + strlen(outname);
+  strcat(outname, name);
+  if ((ptr = strrchr(base, '.')))
+    *ptr = 0;
+  strcat(outname, ".");
+  strcat(outname, ext);
+
+  sprintf(suffix, ".%lu-%d.tmp", (unsigned long) getpid(), w->index);
+  sprintf(tempname, "%s/.%s%s", watchoutdir, base, suffix);
+
+  /* Sign and write the temporary file */
+
+  job.infilename = path;
+  job.outfilename = tempname;
+  e = process_program(&job, prgm, key, NULL, path, 0, job.flags,
+		      &written, &writing);
+  rs_free(written);
+  release_key(key);
+  rs_program_free(prgm);
+
+  if (!e && rename(tempname, outname)) {
+    perror(outname);
+    e = 4;
+  }
+  if (e)
+    unlink(tempname);
+  else
+    record_state(name, &st);
+
+  record_file_stats(w->ctx, &before, start, path, e);
+
+  LOCK(output);
+  printf("%s\t%d\t%s\t%s\n", (e ? "failed" : "ok"), e, path,
+	 (e ? "-" : outname));
+  fflush(stdout);
+  UNLOCK(output);
+
+  rs_free(outname);
+  rs_free(tempname);
+  rs_free(path);
+  return e;
+}
+
+/*
+ * Take the next file from the queue and sign it.  If wait is 1, wait
+ * for a file to be added if the queue is empty.  Returns 0 if there
+ * is nothing more to do.
+ */
+static int sign_next_file(WatchWorker* w, /* worker state */
+			  int wait)	  /* 1 = wait for a file */
+{
+  WatchItem **p, *item;
+
+  LOCK(queue);
+  while (1) {
+    item = NULL;
+    if (watchdone)
+      break;
+    for (item = watchqueue; item && item->busy; item = item->next)
+      ;
+    if (item || !wait)
+      break;
+    WAIT(queue);
+  }
+
+  if (!item) {
+    UNLOCK(queue);
+    return 0;
+  }
+  item->busy = 1;
+  UNLOCK(queue);
+
+  sign_watched_file(w, item->name);
+
+  /* If the file changed again while we were signing it, leave it in
+     the queue, otherwise remove it */
+
+  LOCK(queue);
+  item->busy = 0;
+  if (item->again) {
+    item->again = 0;
+    WAKE(queue);
+  }
+  else {
+    for (p = &watchqueue; *p != item; p = &(*p)->next)
+      ;
+    *p = item->next;
+    rs_free(item->name);
+    rs_free(item);
+  }
+  UNLOCK(queue);
+  return 1;
+}
+
+#ifdef HAVE_PTHREAD
+static void* watch_worker_main(void* data)
+{
+  while (sign_next_file(data, 1))
+    ;
+  return NULL;
+}
+#endif
+
+static void handle_watch_signal(int sig RS_ATTR_UNUSED)
+{
+  watchsignal = 1;
+}
+
+/*
+ * Watch a directory, and sign each file as soon as it is written to
+ * (or moved into) that directory.
+ *
+ * Existing files are signed when we start, except for those listed in
+ * the state file (which records each file that has been signed, and
+ * its size and modification time at the time.)  Runs until
+ * interrupted (returning 0) or an error occurs.
+ */
+static int watch_directory(const RSJob* job,	/* what to do */
+			   const char* dname,	/* directory to watch */
+			   const char* outdname, /* output directory (NULL =
+						    default) */
+			   int nworkers)	/* number of workers (0 =
+						   default) */
+{
+  long buf[4096 / sizeof(long)]; /* (aligned for inotify_event) */
+  const struct inotify_event* ev;
+  struct stat st, outst;
+  struct sigaction sa;
+  WatchWorker* workers;
+  WatchItem* item;
+  char* defoutdname = NULL;
+  ssize_t n, pos;
+  int fd, i, e = 0;
+#ifdef HAVE_PTHREAD
+  pthread_t* threads;
+  sigset_t sigs, oldsigs;
+  int nthreads;
+#endif
+
+  watchjob = job;
+  watchdir = dname;
+
+  if (!outdname && !(outdname = defoutdname = join_path(dname, "signed")))
+    return 4;
+  watchoutdir = outdname;
+
+  if (stat(dname, &st) || !S_ISDIR(st.st_mode)) {
+    fprintf(stderr, "%s: not a directory\n", dname);
+    rs_free(defoutdname);
+    return 4;
+  }
+
+  if (stat(outdname, &outst) && (mkdir(outdname, 0777)
+				 || stat(outdname, &outst))) {
+    perror(outdname);
+    rs_free(defoutdname);
+    return 4;
+  }
+
+  if (st.st_dev == outst.st_dev && st.st_ino == outst.st_ino) {
+    fprintf(stderr, "%s: output directory must be different from"
+	    " the directory being watched\n", outdname);
+    rs_free(defoutdname);
+    return 5;
+  }
+
+  /* Start watching before looking at existing files, so that nothing
+     is missed */
+
+  if ((fd = inotify_init1(IN_CLOEXEC)) < 0
+      || inotify_add_watch(fd, dname, (IN_CLOSE_WRITE | IN_MOVED_TO
+				       | IN_DELETE_SELF
+				       | IN_MOVE_SELF)) < 0) {
+    perror(dname);
+    if (fd >= 0)
+      close(fd);
+    rs_free(defoutdname);
+    return 4;
+  }
+
+  rs_key_index_watch();
+
+  if (load_state() || queue_all_files()) {
+    close(fd);
+    free_state();
+    rs_free(defoutdname);
+    return 4;
+  }
+
+  /* Start workers (signals are handled only by the main thread) */
+
+#ifdef HAVE_PTHREAD
+# if defined(_SC_NPROCESSORS_ONLN)
+  if (!nworkers)
+    nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+# endif
+  if (nworkers < 1)
+    nworkers = 1;
+#else
+  nworkers = 1;
+#endif
+
+  if (!(workers = rs_malloc(nworkers * sizeof(WatchWorker)))) {
+    close(fd);
+    free_state();
+    rs_free(defoutdname);
+    return 4;
+  }
+
+  /* (if anything fails from here on, e is set, no more workers are
+     started, and everything is freed below) */
+
+  for (i = 0; i < nworkers; i++) {
+    if (!(workers[i].ctx = rs_context_new())) {
+      nworkers = i;
+      e = 4;
+      break;
+    }
+    rs_context_set_sig_cache(workers[i].ctx,
+			     rs_context_default()->sigcache);
+    workers[i].index = i;
+  }
+
+#ifdef HAVE_PTHREAD
+  threads = NULL;
+  if (!e && !(threads = rs_malloc(nworkers * sizeof(pthread_t))))
+    e = 4;
+
+  sigemptyset(&sigs);
+  sigaddset(&sigs, SIGINT);
+  sigaddset(&sigs, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &sigs, &oldsigs);
+
+  for (nthreads = 0; !e && nthreads < nworkers; nthreads++) {
+    if (pthread_create(&threads[nthreads], NULL, &watch_worker_main,
+		       &workers[nthreads])) {
+      rs_error(NULL, NULL, "unable to create thread");
+      break;
+    }
+  }
 #endif
 
-static const char* getbasename(const char* f)
-{
-  const char *p;
+  /* (a second signal kills us immediately) */
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = &handle_watch_signal;
+  sa.sa_flags = SA_RESETHAND;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+#ifdef HAVE_PTHREAD
+  pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
+  if (!nthreads)
+    e = 4;
+#endif
 
-  if ((p = strrchr(f, '/')))
-    f = p + 1;
+  if (verbose > 0)
+    fprintf(stderr, "Watching %s (writing to %s)\n", dname, outdname);
 
-#if defined(__MSDOS__) || defined(__WIN32__)
-  if ((p = strrchr(f, '\\')))
-    f = p + 1;
+  /* Wait for files to be written */
+
+  while (!e && !watchsignal) {
+#ifndef HAVE_PTHREAD
+    while (!watchsignal && sign_next_file(&workers[0], 0))
+      ;
+    if (watchsignal)
+      break;
 #endif
 
-  return f;
+    n = read(fd, buf, sizeof(buf));
+    if (n < 0) {
+      if (errno != EINTR) {
+	perror(dname);
+	e = 4;
+      }
+      continue;
+    }
+
+    for (pos = 0; !e && pos < n;
+	 pos += sizeof(struct inotify_event) + ev->len) {
+      ev = (const struct inotify_event*) ((char*) buf + pos);
+
+      if (ev->mask & IN_Q_OVERFLOW) {
+	e = queue_all_files();
+      }
+      else if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+	fprintf(stderr, "%s: directory was removed\n", dname);
+	e = 4;
+      }
+      else if (ev->len && ev->name[0]) {
+	e = queue_file(ev->name);
+      }
+    }
+    if (e)
+      e = 4;
+  }
+
+  /* Finish the files that are being signed, and stop */
+
+  LOCK(queue);
+  watchdone = 1;
+  WAKE(queue);
+  UNLOCK(queue);
+
+#ifdef HAVE_PTHREAD
+  for (i = 0; i < nthreads; i++)
+    pthread_join(threads[i], NULL);
+  rs_free(threads);
+#endif
+
+  for (i = 0; i < nworkers; i++) {
+    add_stats(&oldstats, &workers[i].ctx->stats);
+    rs_context_free(workers[i].ctx);
+  }
+  rs_free(workers);
+
+  while ((item = watchqueue)) {
+    watchqueue = item->next;
+    rs_free(item->name);
+    rs_free(item);
+  }
+
+  close(fd);
+  free_state();
+  rs_free(defoutdname);
+  return e;
 }
 
-static const char* usage[]={
-  "Usage: %s [options] app-file ...\n",
-  "Where options may include:\n",
-  "   -a:          appsign compatibility mode (Unix-style output)\n",
-  "   -b:          read raw binary data (default: auto-detect)\n",
-  "   -c:          check existing app signatures rather than signing\n",
-  "   -f:          force signing despite errors\n",
-  "   -g:          write app in GraphLink (XXk) format\n",
-  "   -k KEYFILE:  use specified key file\n",
-  "   -K NUM:      use specified key ID (hexadecimal)\n",
-  "   -n:          do not alter the app header\n",
-  "   -o OUTFILE:  write to specified output file (default is <name>.app\n",
-  "                or <name>.8xk)\n",
-  "   -p:          fix the pages field if found\n",
-  "   -P:          add an extra page if necessary\n",
-  "   -q:          suppress warning messages\n",
-  "   -r:          re-sign a previously signed app (i.e. strip off all\n",
-  "                data beyond that indicated by the size header)\n",
-  "   -R R:        specify the root to use (0, 1, 2, or 3) (default is 0)\n",
-  "   -t TYPE:     specify program type (e.g. 8xk, 73u)\n",
-  "   -u:          assume plain hex input is unsorted (default is sorted)\n",
-  "   -v:          be verbose (-vv for even more verbosity)\n",
-  "   --help:      describe options\n",
-  "   --version:   print version info\n",
-  NULL};
+#endif /* RS_WATCH_SPOOL */
 
-int main(int argc, char** argv)
+/*
+ * Apply a delta written by --delta.  Unless otherwise specified, the
+ * file to patch is the name of the delta with ".rsd" removed.
+ */
+static int apply_delta(const char* deltaname,  /* delta file name */
+		       const char* targetname) /* file to patch (NULL =
+						  default) */
 {
-  unsigned int flags = (RS_INPUT_SORTED | RS_OUTPUT_HEX_ONLY);
+  FILE *deltafile, *targetfile;
+  char *tempname = NULL, *ptr;
+  int e;
 
-  int rootnum = 0;		/* which of the four valid signatures
-				   to generate
+  if (!targetname || !strcmp(targetname, "-")) {
+    if (!(tempname = rs_strdup(deltaname)))
+      return 4;
+    ptr = strrchr(tempname, '.');
+    if (!ptr || strcasecmp(ptr, ".rsd")) {
+      fprintf(stderr, "%s: delta file name does not end in .rsd"
+	      " (use -o to specify the file to patch)\n", deltaname);
+      rs_free(tempname);
+      return 5;
+    }
+    *ptr = 0;
+    targetname = tempname;
+  }
 
-				   0 = standard (r,s)
-				   1 = (-r,s)
-				   2 = (r,-s)
-				   3 = (-r,-s) */
+  if (!(deltafile = fopen(deltaname, "rb"))) {
+    perror(deltaname);
+    rs_free(tempname);
+    return 4;
+  }
+  if (!(targetfile = fopen(targetname, "r+b"))) {
+    perror(targetname);
+    fclose(deltafile);
+    rs_free(tempname);
+    return 4;
+  }
 
-  int rawmode = 0;		/* 0 = fix app headers
-				   1 = sign "raw" data */
+  if (verbose > 0)
+    fprintf(stderr, "Applying %s to %s...\n", deltaname, targetname);
 
-  int valmode = 0;		/* 0 = sign apps
-				   1 = validate apps */
+  e = rs_apply_program_delta(deltafile, targetfile, targetname);
+  fclose(deltafile);
+  if (fclose(targetfile) && !e) {
+    perror(targetname);
+    e = RS_ERR_FILE_IO;
+  }
+  rs_free(tempname);
+  return (e ? 4 : 0);
+}
+
+/*
+ * Parse an argument to --target (KEY,ROOT,OUTFILE.)
+ */
+static int parse_target(const char* arg,    /* argument */
+			RSTargetSpec* spec) /* target to fill in */
+{
+  char *keyname, *rootstr, *outname;
 
-  const char* infilename;	/* file name for input */
+  if (!(keyname = rs_strdup(arg)))
+    return 1;
 
-  const char* outfilename = NULL; /* file name for output */
+  if (!(rootstr = strchr(keyname, ','))
+      || !(outname = strchr(rootstr + 1, ','))
+      || !outname[1]) {
+    rs_free(keyname);
+    return 1;
+  }
+  *rootstr++ = 0;
+  *outname++ = 0;
+
+  spec->keyfilename = NULL;
+  spec->keyid = 0;
+  spec->rootnum = -1;
+  spec->outfilename = outname;
+
+  if (strchr(keyname, '.') || strchr(keyname, '/'))
+    spec->keyfilename = keyname;
+  else if (*keyname && sscanf(keyname, "%lx", &spec->keyid) != 1) {
+    rs_free(keyname);
+    return 1;
+  }
 
-  const char* keyfilename = NULL; /* file name for key */
+  if (*rootstr && (sscanf(rootstr, "%d", &spec->rootnum) != 1
+		   || spec->rootnum < 0 || spec->rootnum > 3)) {
+    rs_free(keyname);
+    return 1;
+  }
 
-  int verbose = 0;		/* -1 = quiet (errors only)
-				   0 = default (warnings + errors)
-				   1 = verbose (print file names / status)
-				   2 = very verbose (details of computation) */
+  /* (keyname is kept, since the other strings point into it) */
+  return 0;
+}
 
-  static const char optstring[] = "abBcfgk:K:no:pPqrR:t:uv";
+int main(int argc, char** argv)
+{
+  RSJob job;			/* settings given on the command line */
+  const char* manifest = NULL;	/* list of jobs to process */
+  const char* sigcachename = NULL; /* signature cache file */
+  RSSigCache* sigcache = NULL;
+  const char* valcachename = NULL; /* validation cache directory */
+  const char* watchname = NULL;	/* directory to watch */
+  const char* tracename = NULL;	/* trace event file */
+  int nworkers = 0;		/* number of files to sign at once */
+  RSStats before;		/* statistics before processing a file */
+  double starttime, filestart;
+
+  static const char optstring[] = "abBcfgj:k:K:no:pPqrR:t:uv";
+  static const RSLongOption longopts[] = {
+    { "manifest", 1, 'M' },
+    { "server", 1, 'S' },
+    { "sig-cache", 1, 'C' },
+    { "cache", 1, 'D' },
+    { "paranoid", 0, 'Y' },
+    { "record-size", 1, 'L' },
+    { "trust-digest", 0, 'T' },
+    { "delta", 0, 'E' },
+    { "apply", 0, 'A' },
+    { "midstates", 0, 'H' },
+    { "target", 1, 'G' },
+    { "io", 1, 'I' },
+    { "watch", 1, 'W' },
+    { "stats", 1, 'X' },
+    { "trace", 1, 'Z' },
+    { NULL, 0, 0 }
+  };
   const char *progname;
   int i, j, c, e;
   const char* arg;
-  char *tempname;
-
-  FILE* infile;
-  FILE* outfile;
-  RSKey* key;
-  RSProgram* prgm;
-  unsigned long keyid = 0, appkeyid;
-  RSCalcType ctype = RS_CALC_UNKNOWN;
-  RSDataType dtype = RS_DATA_UNKNOWN;
-
-  char *ptr;
-  const char *ext;
+  char* outname;
+  int writing;
   int invalidapps = 0;
+  int recsize;
+  int applymode = 0;
+  RSTargetSpec* targets = NULL;
+  int ntargets = 0;
+  int ninputs = 0;
+  const char** outfiles = NULL;
+  int noutfiles = 0;
 
   progname = getbasename(argv[0]);
   rs_set_progname(progname);
@@ -148,8 +2586,15 @@ int main(int argc, char** argv)
     return 5;
   }
 
+  memset(&job, 0, sizeof(job));
+  job.flags = (RS_INPUT_SORTED | RS_OUTPUT_HEX_ONLY);
+
   i = j = 1;
-  while ((c = rs_parse_cmdline(argc, argv, optstring, &i, &j, &arg))) {
+  while ((c = rs_parse_cmdline_long(argc, argv, optstring, longopts,
+				    &i, &j, &arg))) {
+    if (apply_flag(&job, c))
+      continue;
+
     switch (c) {
     case RS_CMDLINE_HELP:
       printf(usage[0], progname);
@@ -166,87 +2611,144 @@ int main(int argc, char** argv)
       return 0;
 
     case 'o':
-      outfilename = arg;
+      if (!job.outfilename) {
+	job.outfilename = arg;
+      }
+      else {
+	outfiles = rs_realloc(outfiles, (noutfiles + 1) * sizeof(char*));
+	if (!outfiles)
+	  return 4;
+	outfiles[noutfiles++] = arg;
+      }
+      break;
+
+    case 'j':
+      if (!sscanf(arg, "%d", &nworkers) || nworkers < 1) {
+	fprintf(stderr, "%s: -j: invalid argument %s\n", progname, arg);
+	return 5;
+      }
       break;
 
     case 'k':
-      keyfilename = arg;
+      job.keyfilename = arg;
       break;
 
     case 'K':
-      if (!sscanf(arg, "%lx", &keyid)) {
+      if (!sscanf(arg, "%lx", &job.keyid)) {
 	fprintf(stderr, "%s: -K: invalid argument %s\n", progname, arg);
 	return 5;
       }
       break;
 
-    case 'b':
-      flags |= RS_INPUT_BINARY;
+    case 'R':
+      if (!sscanf(arg, "%d", &job.rootnum)) {
+	fprintf(stderr, "%s: -R: invalid argument %s\n", progname, arg);
+	return 5;
+      }
+      break;
+
+    case 't':
+      if (rs_suffix_to_type(arg, &job.ctype, &job.dtype)) {
+	fprintf(stderr, "%s: unrecognized file type %s\n", progname, arg);
+	return 5;
+      }
       break;
 
-    case 'u':
-      flags &= ~RS_INPUT_SORTED;
+    case 'v':
+      verbose++;
       break;
 
-    case 'f':
-      flags |= RS_IGNORE_ALL_WARNINGS;
+    case 'q':
+      verbose--;
       break;
 
-    case 'g':
-      flags &= ~RS_OUTPUT_HEX_ONLY;
+    case 'M':
+      manifest = arg;
       break;
 
-    case 'B':
-      flags |= RS_OUTPUT_BINARY;
+    case 'S':
+      servername = arg;
       break;
 
-    case 'a':
-      flags |= RS_OUTPUT_APPSIGN;
+    case 'C':
+      sigcachename = arg;
       break;
 
-    case 'R':
-      if (!sscanf(arg, "%d", &rootnum)) {
-	fprintf(stderr, "%s: -R: invalid argument %s\n", progname, arg);
-	return 5;
-      }
+    case 'D':
+      valcachename = arg;
       break;
 
-    case 't':
-      if (rs_suffix_to_type(arg, &ctype, &dtype)) {
-	fprintf(stderr, "%s: unrecognized file type %s\n", progname, arg);
-	return 5;
-      }
+    case 'Y':
+      paranoid = 1;
       break;
 
-    case 'n':
-      rawmode = 1;
+    case 'T':
+      job.flags |= RS_INPUT_TRUST_DIGEST;
       break;
- 
-    case 'r':
-      flags |= RS_REMOVE_OLD_SIGNATURE;
+
+    case 'E':
+      job.deltamode = 1;
       break;
 
-    case 'P':
-      flags |= RS_ZEALOUSLY_PAD_APP;
+    case 'A':
+      applymode = 1;
       break;
 
-    case 'p':
-      flags |= RS_FIX_PAGE_COUNT;
+    case 'H':
+      job.midstates = 1;
       break;
 
-    case 'c':
-      valmode = 1;
+    case 'G':
+      if (!(targets = rs_realloc(targets, ((ntargets + 1)
+					   * sizeof(RSTargetSpec))))) {
+	return 4;
+      }
+      if (parse_target(arg, &targets[ntargets])) {
+	fprintf(stderr, "%s: --target: invalid argument %s\n",
+		progname, arg);
+	return 5;
+      }
+      ntargets++;
       break;
 
-    case 'v':
-      verbose++;
+    case 'W':
+      watchname = arg;
       break;
 
-    case 'q':
-      verbose--;
+    case 'Z':
+      tracename = arg;
+      break;
+
+    case 'X':
+      if (!strcmp(arg, "text"))
+	statsformat = 1;
+      else if (!strcmp(arg, "json"))
+	statsformat = 2;
+      else {
+	fprintf(stderr, "%s: --stats: unknown format %s\n", progname, arg);
+	return 5;
+      }
+      break;
+
+    case 'I':
+      if (rs_batch_io_parse_backend(arg, &iobackend)) {
+	fprintf(stderr, "%s: --io: unknown backend %s\n", progname, arg);
+	return 5;
+      }
+      break;
+
+    case 'L':
+      if (!sscanf(arg, "%d", &recsize) || recsize < 1 || recsize > 255) {
+	fprintf(stderr, "%s: --record-size: invalid argument %s\n",
+		progname, arg);
+	return 5;
+      }
+      job.flags = ((job.flags & ~RS_OUTPUT_RECORD_SIZE_MASK)
+		   | RS_OUTPUT_RECORD_SIZE(recsize));
       break;
 
     case RS_CMDLINE_FILENAME:
+      ninputs++;
       break;
 
     case RS_CMDLINE_ERROR:
@@ -261,206 +2763,155 @@ int main(int argc, char** argv)
 
   rs_set_verbose(verbose);
 
-  if (outfilename && (ptr = strrchr(outfilename, '.'))
-      && !rs_suffix_to_type(ptr + 1, NULL, NULL))
-    flags &= ~RS_OUTPUT_HEX_ONLY;
-
-
-  /* Read key file (if manually specified) */
-
-  key = rs_key_new();
+  /* Apply deltas (no keys needed) */
 
-  if (keyfilename) {
-    infile = fopen(keyfilename, "rb");
-    if (!infile) {
-      perror(keyfilename);
-      rs_key_free(key);
-      return 3;
-    }
-    if (rs_read_key_file(key, infile, keyfilename, 1)) {
-      fclose(infile);
-      rs_key_free(key);
-      return 3;
+  if (applymode) {
+    i = j = 1;
+    while ((c = rs_parse_cmdline_long(argc, argv, optstring, longopts,
+				      &i, &j, &arg))) {
+      if (c == RS_CMDLINE_FILENAME && (e = apply_delta(arg, job.outfilename)))
+	return e;
     }
-    fclose(infile);
+    return 0;
   }
-  else if (keyid) {
-    if (rs_key_find_for_id(key, keyid, valmode)) {
-      rs_key_free(key);
-      return 3;
+
+  if (watchname) {
+#ifdef RS_WATCH_SPOOL
+    if (job.valmode || servername || manifest || ntargets || job.deltamode
+	|| job.midstates || noutfiles || ninputs) {
+      fprintf(stderr, "%s: --watch cannot be used with input files, -c,"
+	      " --delta, --manifest, --midstates, --server or --target\n",
+	      progname);
+      return 5;
     }
+#else
+    fprintf(stderr, "%s: --watch is not supported on this system\n",
+	    progname);
+    return 5;
+#endif
   }
 
-  /* Process applications */
-
-  i = j = 1;
-  while ((c = rs_parse_cmdline(argc, argv, optstring, &i, &j, &arg))) {
-    if (c != RS_CMDLINE_FILENAME)
-      continue;
-
-    /* Read input file */
-
-    if (strcmp(arg, "-")) {
-      infilename = arg;
-      infile = fopen(arg, "rb");
-      if (!infile) {
-	perror(arg);
-	rs_key_free(key);
-	return 4;
-      }
-    }
-    else {
-      infilename = "(standard input)";
-      infile = stdin;
-    }
+  /* (statistics include the time taken to load keys given on the
+     command line) */
+  rs_context_set_timing(rs_context_default(),
+			(statsformat != 0 || tracename != NULL));
+  rs_set_alloc_stats(statsformat != 0);
+  starttime = rs_get_time();
+  if (tracename && open_trace(tracename))
+    return 4;
+
+  keycache = rs_key_cache_new(NULL, 16);
+  if (!keycache)
+    return 4;
+
+  if (sigcachename) {
+    if (!(sigcache = rs_sig_cache_open(NULL, sigcachename, 0)))
+      return 4;
+    rs_context_set_sig_cache(rs_context_default(), sigcache);
+  }
 
-    prgm = rs_program_new();
+  if (valcachename && !(valcache = rs_val_cache_open(NULL, valcachename)))
+    return 4;
 
-    if (ctype && dtype) {
-      prgm->calctype = ctype;
-      prgm->datatype = dtype;
-    }
-    else if ((ptr = strrchr(infilename, '.'))) {
-      rs_suffix_to_type(ptr + 1, &prgm->calctype, &prgm->datatype);
+  if (ntargets) {
+    if (servername || manifest || job.outfilename || ninputs != 1) {
+      fprintf(stderr, "%s: --target requires a single input file,"
+	      " and cannot be used with -o, --server or --manifest\n", progname);
+      return 5;
     }
+    job.targets = targets;
+    job.ntargets = ntargets;
+  }
 
-    if (rs_read_program_file(prgm, infile, infilename, flags)) {
-      rs_program_free(prgm);
-      rs_key_free(key);
-      if (infile != stdin)
-	fclose(infile);
-      return 4;
+  if (noutfiles) {
+    if (manifest || job.deltamode) {
+      fprintf(stderr, "%s: -o may only be given once with --manifest"
+	      " or --delta\n", progname);
+      return 5;
     }
-    if (infile != stdin)
-      fclose(infile);
-
-    /* Read key file (if automatic) */
+    job.extraoutfiles = outfiles;
+    job.nextraoutfiles = noutfiles;
+  }
 
-    if (!keyfilename && !keyid) {
-      appkeyid = rs_program_get_key_id(prgm);
-      if (!appkeyid) {
-	fprintf(stderr, "%s: unable to determine key ID\n", infilename);
-	rs_program_free(prgm);
-	rs_key_free(key);
-	return 3;
-      }
+  /* Connect to signing server (if specified) */
 
-      if (appkeyid != key->id) {
-	if (rs_key_find_for_id(key, appkeyid, valmode)) {
-	  rs_program_free(prgm);
-	  rs_key_free(key);
-	  return 3;
-	}
-      }
+  if (servername) {
+    if (job.keyfilename) {
+      fprintf(stderr, "%s: -k cannot be used with --server\n", progname);
+      return 5;
     }
+    if ((serverfd = rs_remote_connect(servername)) < 0)
+      return 3;
+  }
 
-    if (valmode) {
-      /* Validate application */
-      if (verbose > 0)
-	fprintf(stderr, "Validating %s %s %s...\n",
-		rs_calc_type_to_string(prgm->calctype),
-		rs_data_type_to_string(prgm->datatype),
-		infilename);
-
-      if (rs_validate_program(prgm, key))
-	invalidapps++;
-    }
-    else {
-      /* Sign application */
-      if (verbose > 0)
-	fprintf(stderr, "Signing %s %s %s...\n",
-		rs_calc_type_to_string(prgm->calctype),
-		rs_data_type_to_string(prgm->datatype),
-		infilename);
-
-      if (!rawmode) {
-	if ((e = rs_repair_program(prgm, flags))) {
-	  if (!(flags & RS_IGNORE_ALL_WARNINGS)
-	      && e < RS_ERR_CRITICAL)
-	    fprintf(stderr, "(use -f to override)\n");
-	  rs_program_free(prgm);
-	  rs_key_free(key);
-	  return 2;
-	}
-      }
-      if (rs_sign_program(prgm, key, rootnum)) {
-	rs_program_free(prgm);
-	rs_key_free(key);
-	return 2;
-      }
+  /* Read key file (if manually specified) */
 
-      /* Generate output file name */
-
-      if (outfilename) {
-	if (strcmp(outfilename, "-")) {
-	  outfile = fopen(outfilename, "wb");
-	  if (!outfile) {
-	    perror(outfilename);
-	    rs_program_free(prgm);
-	    rs_key_free(key);
-	    return 4;
-	  }
-	}
-	else {
-	  outfile = stdout;
-	}
-      }
-      else if (infile == stdin) {
-	outfile = stdout;
-      }
-      else {
-	ext = rs_type_to_suffix(prgm->calctype, prgm->datatype,
-				(flags & RS_OUTPUT_HEX_ONLY));
+  else if (job.keyfilename) {
+    if (!rs_key_cache_load_file(keycache, job.keyfilename))
+      return 3;
+  }
+  else if (job.keyid) {
+    if (!rs_key_cache_find(keycache, job.keyid, job.valmode))
+      return 3;
+  }
 
-	tempname = rs_malloc(strlen(infilename) + 32);
-	if (!tempname) {
-	  rs_program_free(prgm);
-	  rs_key_free(key);
-	  return 4;
-	}
-	strcpy(tempname, infilename);
+  /* Process applications */
 
-	ptr = strrchr(tempname, '.');
-	if (!ptr) {
-	  strcat(tempname, ".");
-	  strcat(tempname, ext);
-	}
-	else if (strcasecmp(ptr + 1, ext)) {
-	  strcpy(ptr + 1, ext);
-	}
-	else {
-	  strcpy(ptr, "-signed.");
-	  strcat(ptr, ext);
-	}
+#ifdef RS_WATCH_SPOOL
+  if (watchname) {
+    /* (-o names the output directory) */
+    arg = job.outfilename;
+    job.outfilename = NULL;
+    e = watch_directory(&job, watchname, arg, nworkers);
+    finish_reports(starttime);
+    rs_key_cache_free(keycache);
+    rs_sig_cache_close(sigcache);
+    rs_val_cache_close(valcache);
+    return e;
+  }
+#endif
 
-	outfile = fopen(tempname, "wb");
-	if (!outfile) {
-	  perror(tempname);
-	  rs_free(tempname);
-	  rs_program_free(prgm);
-	  rs_key_free(key);
-	  return 4;
-	}
-	rs_free(tempname);
-      }
+  if (manifest) {
+    e = process_manifest(manifest, &job);
+    finish_reports(starttime);
+    rs_key_cache_free(keycache);
+    rs_sig_cache_close(sigcache);
+    rs_val_cache_close(valcache);
+    rs_remote_close(serverfd);
+    return e;
+  }
 
-      /* Write signed application to output file */
+  i = j = 1;
+  while ((c = rs_parse_cmdline_long(argc, argv, optstring, longopts,
+				    &i, &j, &arg))) {
+    if (c != RS_CMDLINE_FILENAME)
+      continue;
 
-      if (rs_write_program_file(prgm, outfile, 0, 0, 0, flags)) {
-	if (outfile != stdout)
-	  fclose(outfile);
-	rs_program_free(prgm);
-	rs_key_free(key);
-	return 4;
-      }
+    job.infilename = arg;
+    before = rs_context_default()->stats;
+    filestart = rs_get_time();
+    e = process_file(&job, &outname, &writing);
+    record_file_stats(rs_context_default(), &before, filestart, arg, e);
+    rs_free(outname);
 
-      if (outfile != stdout)
-	fclose(outfile);
+    if (e == 1) {
+      invalidapps++;
+    }
+    else if (e) {
+      finish_reports(starttime);
+      rs_key_cache_free(keycache);
+      rs_sig_cache_close(sigcache);
+      rs_val_cache_close(valcache);
+      rs_remote_close(serverfd);
+      return e;
     }
-    rs_program_free(prgm);
   }
 
-  rs_key_free(key);
+  finish_reports(starttime);
+  rs_key_cache_free(keycache);
+  rs_sig_cache_close(sigcache);
+  rs_val_cache_close(valcache);
+  rs_remote_close(serverfd);
 
   if (invalidapps)
     return 1;
@@ -77,8 +77,11 @@ typedef enum _RSRepairFlags {
 typedef enum _RSInputFlags {
   RS_INPUT_BINARY            = 32, /* Assume input is raw binary
                                       data */
-  RS_INPUT_SORTED            = 64  /* Assume plain hex input is sorted
+  RS_INPUT_SORTED            = 64, /* Assume plain hex input is sorted
                                       (implicit page switch) */
+  RS_INPUT_TRUST_DIGEST      = 2048 /* Use the digest stored in a
+                                       container file, rather than
+                                       computing it again */
 } RSInputFlags;
 
 /* Flags for file output */
@@ -86,31 +89,53 @@ typedef enum _RSOutputFlags {
   RS_OUTPUT_HEX_ONLY         = 128, /* Write plain hex (.app) format */
   RS_OUTPUT_APPSIGN          = 256, /* Write hex data in
                                        appsign-compatible format */
-  RS_OUTPUT_BINARY           = 512  /* Write binary data for CE */
+  RS_OUTPUT_BINARY           = 512, /* Write binary data for CE */
+  RS_OUTPUT_CONTAINER        = 1024, /* Write a container (.rsp)
+                                        file */
+  RS_OUTPUT_RECORD_SIZE_MASK = 0xff0000 /* Number of data bytes per
+                                           hex record (0 = default) */
 } RSOutputFlags;
+
+/* Flag value to select the number of data bytes per hex record (1 to
+   255; the default is 32, which is what TI's software writes) */
+#define RS_OUTPUT_RECORD_SIZE(n) (((unsigned int) (n) & 0xff) << 16)
 typedef enum _RSKeyType {
   RS_KEY_MD5 = 0,
   RS_KEY_SHA256 = 1
 } RSKeyType;
+
+/* Library context (see below) */
+typedef struct _RSContext RSContext;
+
+/* Signature cache */
+typedef struct _RSSigCache RSSigCache;
+
+/* Validation cache */
+typedef struct _RSValCache RSValCache;
+
 /* Encryption key structure */
 typedef struct _RSKey {
+  RSContext* ctx;               /* Context (NULL = default) */
   char* filename;               /* Filename */
   unsigned long id;             /* Key ID */
   mpz_t n;                      /* Modulus (public key) */
   mpz_t p;                      /* First factor */
   mpz_t q;                      /* Second factor */
   mpz_t e;
-  mpz_t qinv;                   /* q^-1 mod p (for Rabin)
-                                   (rs_sign_rabin() will calculate
+  mpz_t qinv;                   /* q^-1 mod p (for Rabin and RSA)
+                                   (rs_key_prepare() will calculate
+                                   this based on p and q) */
+  mpz_t d;                      /* Signing exponent (for RSA)
+                                   (rs_key_prepare() will calculate
                                    this based on p and q, if
                                    needed) */
-  mpz_t d;                      /* Signing exponent (for RSA)
-                                   (rs_sign_rsa() will calculate this
-                                   based on p and q, if needed) */
+  mpz_t dp;                     /* d mod (p-1) (for RSA) */
+  mpz_t dq;                     /* d mod (q-1) (for RSA) */
 } RSKey;
 
 /* Program data structure */
 typedef struct _RSProgram {
+  RSContext* ctx;                /* Context (NULL = default) */
   char* filename;                /* Filename */
   RSCalcType calctype;           /* Calculator type */
   RSDataType datatype;           /* Program data type */
@@ -127,6 +152,14 @@ typedef struct _RSProgram {
   unsigned int signature_length; /* Length of OS signature */
   unsigned int* pagenums;        /* List of page numbers */
   int npagenums;                 /* Number of page numbers */
+
+  struct _RSHeaderIndex* hdrindex; /* Index of header fields */
+  struct _RSProgramDigest* digest; /* Known digest of program (see
+                                      rs_program_get_digest(); must be
+                                      discarded if the data are
+                                      changed directly) */
+  struct _RSMidstates* midstates; /* Saved hash states (see
+                                     rs_program_load_midstates()) */
 } RSProgram;
 
 /* Status codes */
@@ -166,12 +199,152 @@ typedef enum _RSStatus {
   RS_SIGNATURE_INCORRECT = -1
 } RSStatus;
 
+/* Message logging function */
+typedef void (*RSMessageFunc) (const RSKey*, const RSProgram*,
+			       const char*, void*);
+
+/* Memory allocation function (same semantics as rs_realloc(): a
+   count of zero frees the block) */
+typedef void* (*RSReallocFunc) (void*, unsigned long, void*);
+
+/* Memory allocation statistics (see rs_set_alloc_stats) */
+typedef struct _RSAllocStats {
+  unsigned long allocations;     /* Number of blocks allocated or
+                                    resized */
+  unsigned long frees;           /* Number of blocks freed */
+  unsigned long bytes;           /* Total number of bytes requested */
+  unsigned long in_use;          /* Number of bytes currently allocated */
+  unsigned long peak;            /* Maximum number of bytes allocated
+                                    at once */
+} RSAllocStats;
+
+/* Phases of processing a program (see RSStats) */
+typedef enum _RSPhase {
+  RS_PHASE_KEY = 0,              /* Finding and loading keys */
+  RS_PHASE_PARSE,                /* Parsing input files */
+  RS_PHASE_REPAIR,               /* Repairing headers */
+  RS_PHASE_HASH,                 /* Computing digests */
+  RS_PHASE_MATH,                 /* Computing or checking signatures */
+  RS_PHASE_OUTPUT,               /* Formatting output files */
+  RS_NUM_PHASES
+} RSPhase;
+
+/* Statistics collected while processing programs */
+typedef struct _RSStats {
+  unsigned long errors;          /* Number of errors reported */
+  unsigned long warnings;        /* Number of warnings reported */
+  unsigned long signatures;      /* Number of programs signed */
+  unsigned long validations;     /* Number of programs validated */
+  unsigned long bytes_hashed;    /* Number of bytes hashed */
+  double phase_time[RS_NUM_PHASES]; /* Seconds spent in each phase
+                                    (only if timing is enabled) */
+  unsigned long phase_bytes[RS_NUM_PHASES]; /* Bytes processed in each
+                                               phase */
+} RSStats;
+
+/* Phase tracing function (called at the end of each phase, with the
+   times when it started and ended, as returned by rs_get_time(), and
+   the number of bytes processed) */
+typedef void (*RSTraceFunc) (RSContext*, RSPhase, double, double,
+			     unsigned long, void*);
+
+/* Library context structure
+ *
+ * Each key and program refers to a context, which determines where
+ * messages are logged and how memory is allocated.  A context must
+ * not be used by more than one thread at a time; programs that sign
+ * or validate in several threads at once should give each thread its
+ * own context.  Keys and programs with a NULL context use the
+ * default context, which is what rs_set_progname() and friends
+ * modify.
+ */
+struct _RSContext {
+  const char* progname;          /* Program name */
+  int verbose;                   /* Verbosity level */
+  RSMessageFunc errorfunc;       /* Error logging function */
+  void* errorfuncdata;
+  RSMessageFunc messagefunc;     /* Message logging function */
+  void* messagefuncdata;
+  RSReallocFunc reallocfunc;     /* Memory allocation function
+                                    (NULL = use the global allocator) */
+  void* reallocfuncdata;
+  RSStats stats;                 /* Statistics */
+  int timing;                    /* 1 = measure time spent in each
+                                    phase */
+  RSTraceFunc tracefunc;         /* Phase tracing function */
+  void* tracefuncdata;
+  RSSigCache* sigcache;          /* Signature cache (NULL = none) */
+};
+
+
+/**** Library contexts (context.c) ****/
+
+/* Get the default context. */
+RSContext* rs_context_default (void);
+
+/* Create a new context (with the settings of the default context.) */
+RSContext* rs_context_new (void) RS_ATTR_MALLOC;
+
+/* Free a context. */
+void rs_context_free (RSContext* ctx);
+
+/* Set program name for a context. */
+void rs_context_set_progname (RSContext* ctx, const char* s);
+
+/* Set verbosity level for a context. */
+void rs_context_set_verbose (RSContext* ctx, int v);
+
+/* Set error logging function for a context. */
+void rs_context_set_error_func (RSContext* ctx, RSMessageFunc func,
+				void* data);
+
+/* Set message logging function for a context. */
+void rs_context_set_message_func (RSContext* ctx, RSMessageFunc func,
+				  void* data);
+
+/* Set memory allocation function for a context. */
+void rs_context_set_allocator (RSContext* ctx, RSReallocFunc func,
+			       void* data);
+
+/* Reset statistics for a context. */
+void rs_context_reset_stats (RSContext* ctx);
+
+/* Enable or disable timing of each phase for a context. */
+void rs_context_set_timing (RSContext* ctx, int timing);
+
+/* Set phase tracing function for a context. */
+void rs_context_set_trace_func (RSContext* ctx, RSTraceFunc func,
+				void* data);
+
+/* Read the clock used for timing (in seconds.) */
+double rs_get_time (void);
+
+/* Set the signature cache used by a context (NULL = none.) */
+void rs_context_set_sig_cache (RSContext* ctx, RSSigCache* sc);
+
+
+/**** Memory management (mem.c) ****/
+
+/* Set the global memory allocation function (NULL = use realloc().)
+   This must be done before the library allocates any memory; it
+   fails once anything has been allocated. */
+RSStatus rs_set_allocator (RSReallocFunc func, void* data);
+
+/* Enable or disable counting of memory allocations. */
+void rs_set_alloc_stats (int enable);
+
+/* Get memory allocation statistics. */
+void rs_get_alloc_stats (RSAllocStats* st);
+
 
 /**** Key handling (keys.c) ****/
 
 /* Create a new key. */
 RSKey* rs_key_new (void) RS_ATTR_MALLOC;
 
+/* Create a new key belonging to the given context. */
+RSKey* rs_key_new_with_context (RSContext* ctx) RS_ATTR_MALLOC;
+
 /* Free a key. */
 void rs_key_free (RSKey* key);
 
@@ -179,21 +352,42 @@ void rs_key_free (RSKey* key);
 RSStatus rs_read_key_file (RSKey* key, FILE* f,
 			   const char* fname, int verify);
 
+/* Write a prepared key to a file in binary (.rsk) format.  (Keys in
+   this format may be read using rs_read_key_file().) */
+RSStatus rs_write_key_rsk (const RSKey* key, FILE* f);
+
 /* Parse a number written in TI's hexadecimal key format. */
 RSStatus rs_parse_key_value (mpz_t dest, const char* str);
 
+/* Compute all values derived from the private key.  After this, the
+   key is never modified by the signing functions, and may be shared
+   by any number of threads. */
+RSStatus rs_key_prepare (RSKey* key);
+
+/* Compute a fingerprint (SHA-256 hash) of a key's public values. */
+void rs_key_get_fingerprint (const RSKey* key, unsigned char* fp);
+
 
 /**** Program data manipulation (program.c) ****/
 
 /* Create a new program. */
 RSProgram* rs_program_new (void) RS_ATTR_MALLOC;
 
+/* Create a new program belonging to the given context. */
+RSProgram* rs_program_new_with_context (RSContext* ctx) RS_ATTR_MALLOC;
+
 /* Create a new program from an existing data buffer. */
 RSProgram* rs_program_new_with_data (RSCalcType ctype, RSDataType dtype,
 				     void* data, unsigned long length,
 				     unsigned long buffer_size)
   RS_ATTR_MALLOC;
 
+/* Create a copy of a program. */
+RSProgram* rs_program_copy (const RSProgram* prgm) RS_ATTR_MALLOC;
+
+/* Saved hash states */
+typedef struct _RSMidstates RSMidstates;
+
 /* Free program data. */
 void rs_program_free (RSProgram* prgm);
 
@@ -214,17 +408,156 @@ unsigned long rs_program_get_key_id (const RSProgram* prgm) RS_ATTR_PURE;
 RSStatus rs_key_find_for_id (RSKey* key, unsigned long keyid, int publiconly);
 
 
+/**** Key file index and key cache (keystore.c) ****/
+
+/* Key cache structure */
+typedef struct _RSKeyCache RSKeyCache;
+
+/* Rescan the key directories.  (This is done automatically the first
+   time a key is looked up by ID.)  The index is shared by the whole
+   process, and is not thread-safe. */
+RSStatus rs_key_index_refresh (void);
+
+/* Watch the key directories, and rescan them when they change. */
+RSStatus rs_key_index_watch (void);
+
+/* Get a counter that changes every time the index is rescanned. */
+unsigned long rs_key_index_generation (void);
+
+/* Create a new key cache.  A key cache is not thread-safe. */
+RSKeyCache* rs_key_cache_new (RSContext* ctx, unsigned int size)
+  RS_ATTR_MALLOC;
+
+/* Free a key cache and all of its keys. */
+void rs_key_cache_free (RSKeyCache* kc);
+
+/* Add a key to the cache (the cache takes ownership of the key.) */
+const RSKey* rs_key_cache_add (RSKeyCache* kc, RSKey* key);
+
+/* Get the key with the given ID, loading it if necessary. */
+const RSKey* rs_key_cache_find (RSKeyCache* kc, unsigned long keyid,
+				int publiconly);
+
+/* Get the key stored in the given file, loading it if necessary. */
+const RSKey* rs_key_cache_load_file (RSKeyCache* kc, const char* filename);
+
+/* Release a key obtained from the cache. */
+void rs_key_cache_release (RSKeyCache* kc, const RSKey* key);
+
+
+/**** Signature cache (sigcache.c) ****/
+
+/* Open a signature cache file, creating it (with the given number of
+   slots, or 0 for the default) if it doesn't exist. */
+RSSigCache* rs_sig_cache_open (RSContext* ctx, const char* filename,
+			       unsigned long nslots) RS_ATTR_MALLOC;
+
+/* Close a signature cache. */
+void rs_sig_cache_close (RSSigCache* sc);
+
+
+/**** Validation cache (valcache.c) ****/
+
+/* Open a validation cache directory, creating it if necessary. */
+RSValCache* rs_val_cache_open (RSContext* ctx, const char* dir)
+     RS_ATTR_MALLOC;
+
+/* Close a validation cache. */
+void rs_val_cache_close (RSValCache* vc);
+
+/* Look up the result of validating a file.  Returns 0 if the file is
+   unchanged since it was last checked (comparing contents if
+   paranoid is 1, otherwise size and modification time.) */
+int rs_val_cache_lookup (RSValCache* vc, const char* filename,
+			 int paranoid, unsigned long* keyid,
+			 unsigned char* keyfp, RSStatus* verdict);
+
+/* Record the result of validating a file (after looking it up.) */
+int rs_val_cache_store (RSValCache* vc, const char* filename,
+			const RSKey* key, RSStatus verdict);
+
+
+/**** Shared key cache (keyshm.c) ****/
+
+/* Set the directory used to share prepared keys between processes
+   (NULL to disable.)  By default, the RABBITSIGN_KEY_CACHE
+   environment variable is used. */
+RSStatus rs_set_key_shm_dir (const char* dir);
+
+
 /**** Program signing and validation (apps.c) ****/
 
 /* Check/fix program header and data. */
 RSStatus rs_repair_program (RSProgram* prgm, RSRepairFlags flags);
 
 /* Add a signature to the program. */
-RSStatus rs_sign_program (RSProgram* prgm, RSKey* key, int rootnum);
+RSStatus rs_sign_program (RSProgram* prgm, const RSKey* key, int rootnum);
 
 /* Validate program signature. */
 RSStatus rs_validate_program (const RSProgram* prgm, const RSKey* key);
 
+/* Signature schemes */
+typedef enum _RSSigScheme {
+  RS_SIG_RSA   = 0,             /* RSA (TI-73/83+ OS, 68k and SHA-256
+                                   programs) */
+  RS_SIG_RABIN = 1              /* Rabin (TI-73/83+ apps) */
+} RSSigScheme;
+
+/* The digest covered by a program's signature */
+typedef struct _RSDigest {
+  RSSigScheme scheme;            /* Signature scheme */
+  RSKeyType alg;                 /* Hash algorithm */
+  unsigned int length;           /* Length of digest (16 or 32 bytes) */
+  unsigned char value[32];       /* Digest */
+} RSDigest;
+
+/* A signature computed from a digest */
+typedef struct _RSSignature {
+  RSSigScheme scheme;            /* Signature scheme */
+  mpz_t value;                   /* Signature (square root, for Rabin) */
+  int f;                         /* f value (for Rabin signatures) */
+} RSSignature;
+
+/* Compute the digest that will be signed, for a program that has
+   been repaired. */
+RSStatus rs_program_compute_digest (const RSProgram* prgm, RSDigest* digest);
+
+/* Initialize/free a signature structure. */
+void rs_signature_init (RSSignature* sig);
+void rs_signature_clear (RSSignature* sig);
+
+/* Sign a digest.  This may be done in a different thread or process
+   from computing the digest. */
+RSStatus rs_sign_digest (const RSDigest* digest, const RSKey* key,
+			 int rootnum, RSSignature* sig);
+
+/* Sign a digest, using the given context's signature cache rather
+   than that of the key's context. */
+RSStatus rs_sign_digest_with_context (RSContext* ctx,
+				      const RSDigest* digest,
+				      const RSKey* key, int rootnum,
+				      RSSignature* sig);
+
+/* Add a signature (computed from the program's digest) to the
+   program. */
+RSStatus rs_program_attach_signature (RSProgram* prgm,
+				      const RSSignature* sig);
+
+/* One of several ways to sign a program */
+typedef struct _RSSignTarget {
+  const RSKey* key;              /* Signing key */
+  int rootnum;                   /* Root number (for Rabin signatures) */
+  RSProgram* result;             /* Signed program (set by
+                                    rs_sign_program_multi()) */
+  RSStatus status;               /* Result of signing */
+} RSSignTarget;
+
+/* Sign copies of a (repaired) program with several keys and/or root
+   numbers, computing its digest only once.  Returns an error if any
+   target could not be signed. */
+RSStatus rs_sign_program_multi (const RSProgram* prgm,
+				RSSignTarget* targets, int ntargets);
+
 
 /**** TI-73/83+/84+ app signing (app8x.c) ****/
 
@@ -232,7 +565,7 @@ RSStatus rs_validate_program (const RSProgram* prgm, const RSKey* key);
 RSStatus rs_repair_ti8x_app (RSProgram* app, RSRepairFlags flags);
 
 /* Add a signature to a Flash app. */
-RSStatus rs_sign_ti8x_app (RSProgram* app, RSKey* key, int rootnum);
+RSStatus rs_sign_ti8x_app (RSProgram* app, const RSKey* key, int rootnum);
 
 /* Validate Flash app signature. */
 RSStatus rs_validate_ti8x_app (const RSProgram* app, const RSKey* key);
@@ -244,7 +577,7 @@ RSStatus rs_validate_ti8x_app (const RSProgram* app, const RSKey* key);
 RSStatus rs_repair_ti8x_os (RSProgram* os, RSRepairFlags flags);
 
 /* Add a signature to an OS. */
-RSStatus rs_sign_ti8x_os (RSProgram* os, RSKey* key);
+RSStatus rs_sign_ti8x_os (RSProgram* os, const RSKey* key);
 
 /* Validate OS signature. */
 RSStatus rs_validate_ti8x_os (const RSProgram* os, const RSKey* key);
@@ -259,7 +592,7 @@ RSStatus rs_repair_ti9x_app (RSProgram* app, RSRepairFlags flags);
 RSStatus rs_repair_ti9x_os (RSProgram* app, RSRepairFlags flags);
 
 /* Add a signature to a 68k app/OS. */
-RSStatus rs_sign_ti9x_app (RSProgram* app, RSKey* key);
+RSStatus rs_sign_ti9x_app (RSProgram* app, const RSKey* key);
 
 /* Validate app/OS signature. */
 RSStatus rs_validate_ti9x_app (const RSProgram* app, const RSKey* key);
@@ -274,6 +607,11 @@ RSStatus rs_validate_ti9x_app (const RSProgram* app, const RSKey* key);
 RSStatus rs_read_program_file (RSProgram* prgm, FILE* f,
 			       const char* fname, RSInputFlags flags);
 
+/* Read program contents from a block of memory. */
+RSStatus rs_read_program_buffer (RSProgram* prgm,
+				 const unsigned char* data,
+				 unsigned long length, RSInputFlags flags);
+
 
 /**** File output (output.c) ****/
 
@@ -282,6 +620,18 @@ RSStatus rs_write_program_file(const RSProgram* prgm, FILE* f,
 			       int month, int day, int year,
 			       RSOutputFlags flags);
 
+/* Get the number of bytes that will be written. */
+unsigned long rs_program_output_size (const RSProgram* prgm,
+				      RSOutputFlags flags);
+
+/* Write program contents to a block of memory (allocated if *data is
+   NULL.) */
+RSStatus rs_write_program_buffer (const RSProgram* prgm,
+				  unsigned char** data,
+				  unsigned long* length,
+				  int month, int day, int year,
+				  RSOutputFlags flags);
+
 
 /**** Hex file output (output8x.c) ****/
 
@@ -299,6 +649,143 @@ RSStatus rs_write_ti9x_file (const RSProgram* prgm, FILE* f,
 			     RSOutputFlags flags);
 
 
+/**** Hash midstates (midstate.c) ****/
+
+/* Load saved hash states from a file (NULL = none), and keep track of
+   new states whenever the program's digest is computed. */
+RSStatus rs_program_load_midstates (RSProgram* prgm, FILE* f);
+
+/* Save hash states to a file. */
+RSStatus rs_program_save_midstates (const RSProgram* prgm, FILE* f);
+
+
+/**** Signature deltas (delta.c) ****/
+
+/* Write only the differences between the original file and the
+   output file (as rs_write_program_file() would write it.) */
+RSStatus rs_write_program_delta (const RSProgram* prgm, FILE* origfile,
+				 FILE* outfile, int month, int day, int year,
+				 RSOutputFlags flags);
+
+/* Apply a delta to a file in place. */
+RSStatus rs_apply_program_delta (FILE* deltafile, FILE* targetfile,
+				 const char* targetname);
+
+
+/**** Batched file I/O (batchio.c) ****/
+
+/* Batch structure */
+typedef struct _RSBatchIO RSBatchIO;
+
+/* Ways of performing batched I/O */
+typedef enum _RSBatchIOBackend {
+  RS_BATCH_IO_AUTO = 0,		/* Best available */
+  RS_BATCH_IO_URING,		/* Linux io_uring */
+  RS_BATCH_IO_THREADS,		/* Thread pool (pread/pwrite) */
+  RS_BATCH_IO_SYNC		/* One file at a time */
+} RSBatchIOBackend;
+
+/* Result of a completed request */
+typedef struct _RSBatchIOResult {
+  void* tag;			/* Tag given when the request was queued */
+  const char* filename;		/* File name */
+  int write;			/* 0 = read, 1 = write */
+  unsigned char* data;		/* File contents (if read) */
+  unsigned long length;		/* Number of bytes read or written */
+  int error;			/* errno value (0 = success) */
+  void* internal;
+} RSBatchIOResult;
+
+/* Create a new batch (depth = max. number of files in progress, or 0
+   for the default.) */
+RSBatchIO* rs_batch_io_new (RSContext* ctx, RSBatchIOBackend backend,
+			    unsigned int depth) RS_ATTR_MALLOC;
+
+/* Free a batch. */
+void rs_batch_io_free (RSBatchIO* bio);
+
+/* Get the backend used by a batch. */
+RSBatchIOBackend rs_batch_io_backend (const RSBatchIO* bio) RS_ATTR_PURE;
+
+/* Queue a file to be read. */
+RSStatus rs_batch_io_read (RSBatchIO* bio, const char* filename, void* tag);
+
+/* Queue a file to be written (the batch takes ownership of data.) */
+RSStatus rs_batch_io_write (RSBatchIO* bio, const char* filename,
+			    unsigned char* data, unsigned long length,
+			    void* tag);
+
+/* Wait for a request to complete (returns 0 if there are none
+   left.) */
+int rs_batch_io_wait (RSBatchIO* bio, RSBatchIOResult* res);
+
+/* Free the result of a request. */
+void rs_batch_io_release (RSBatchIO* bio, RSBatchIOResult* res);
+
+/* Convert a backend name to a backend (returns 0 if successful.) */
+int rs_batch_io_parse_backend (const char* name, RSBatchIOBackend* backend);
+
+/* Get the name of a backend. */
+const char* rs_batch_io_backend_name (RSBatchIOBackend backend)
+     RS_ATTR_PURE;
+
+
+/**** Remote signing (remote.c) ****/
+
+/* Operations performed by a signing server */
+typedef enum _RSRemoteOp {
+  RS_REMOTE_SIGN             = 1, /* Repair and sign program */
+  RS_REMOTE_VALIDATE         = 2, /* Validate program */
+  RS_REMOTE_SIGN_DIGEST      = 3  /* Sign a digest */
+} RSRemoteOp;
+
+/* Request sent to a signing server */
+typedef struct _RSRemoteRequest {
+  RSRemoteOp op;                 /* Operation */
+  unsigned long keyid;           /* Key ID (0 = use the program's key
+                                    ID) */
+  unsigned int flags;            /* Repair flags */
+  int rootnum;                   /* Root number (for Rabin
+                                    signatures) */
+  int rawmode;                   /* 1 = do not repair program before
+                                    signing */
+  int verbose;                   /* Verbosity level for messages */
+  RSDigest digest;               /* Digest to sign (for
+                                    RS_REMOTE_SIGN_DIGEST) */
+} RSRemoteRequest;
+
+/* Connect to a signing server (returns a socket, or -1 on error.) */
+int rs_remote_connect (const char* path);
+
+/* Create a socket for a signing server to listen on. */
+int rs_remote_listen (const char* path);
+
+/* Close a connection. */
+void rs_remote_close (int fd);
+
+/* Perform an operation on a signing server. */
+RSStatus rs_remote_call (int fd, const RSRemoteRequest* req,
+			 RSProgram* prgm, RSStatus* result);
+
+/* Sign a digest using a signing server. */
+RSStatus rs_remote_sign_digest (int fd, const RSRemoteRequest* req,
+				RSSignature* sig, RSStatus* result);
+
+/* Receive a request from a client. */
+RSStatus rs_remote_read_request (int fd, RSRemoteRequest* req,
+				 RSProgram* prgm);
+
+/* Send a reply to a client. */
+RSStatus rs_remote_write_reply (int fd, RSStatus status,
+				const char* messages,
+				const RSProgram* prgm);
+
+/* Send a reply to an RS_REMOTE_SIGN_DIGEST request. */
+RSStatus rs_remote_write_signature (int fd, RSStatus status,
+				    const char* messages,
+				    const RSSignature* sig);
+
+
 /**** App header/certificate utility functions (header.c) ****/
 
 /* Get length of a header field. */
@@ -325,9 +812,8 @@ unsigned long rs_get_numeric_field (unsigned int type,
 
 
 /**** Error/message logging (error.c) ****/
-  
-typedef void (*RSMessageFunc) (const RSKey*, const RSProgram*,
-			       const char*, void*);
+
+/* (These functions modify the default context.) */
 
 /* Set program name */
 void rs_set_progname (const char* s);
@@ -0,0 +1,506 @@
+/*
+ * RabbitSign - Tools for signing TI graphing calculator software
+ * Copyright (C) 2009 Benjamin Moody
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+# include <string.h>
+#else
+# ifdef HAVE_STRINGS_H
+#  include <strings.h>
+# endif
+#endif
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#ifdef HAVE_SIGNAL_H
+# include <signal.h>
+#endif
+
+#include <sys/socket.h>
+
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
+#include "rabbitsign.h"
+#include "internal.h"
+
+#if !defined(strrchr) && !defined(HAVE_STRRCHR) && defined(HAVE_RINDEX)
+# define strrchr rindex
+#endif
+
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t key_lock = PTHREAD_MUTEX_INITIALIZER;
+# define LOCK_KEYS() pthread_mutex_lock(&key_lock)
+# define UNLOCK_KEYS() pthread_mutex_unlock(&key_lock)
+#else
+# define LOCK_KEYS()
+# define UNLOCK_KEYS()
+#endif
+
+/* Loaded keys.  The cache itself is not thread-safe, so it must
+   only be used while holding the lock; keys obtained from it remain
+   valid until they are released. */
+static RSKeyCache* keycache = NULL;
+
+/* Connection state */
+typedef struct _Connection {
+  int fd;
+  RSContext* ctx;
+  char* log;                    /* Messages to send to client */
+  unsigned long loglength;
+  unsigned long loglength_a;
+} Connection;
+
+static const char* socketpath = NULL;
+
+static const char* getbasename(const char* f)
+{
+  const char *p;
+
+  if ((p = strrchr(f, '/')))
+    f = p + 1;
+
+#if defined(__MSDOS__) || defined(__WIN32__)
+  if ((p = strrchr(f, '\\')))
+    f = p + 1;
+#endif
+
+  return f;
+}
+
+static const char* usage[]={
+  "Usage: %s [options] -s SOCKET\n",
+  "Where options may include:\n",
+  "   -k KEYFILE:  load specified key file (may be used more than once)\n",
+  "   -K NUM:      load key with specified ID (hexadecimal)\n",
+  "   -q:          suppress warning messages\n",
+  "   -s SOCKET:   listen on the specified Unix domain socket\n",
+  "   -v:          be verbose (-vv for even more verbosity)\n",
+  "   --help:      describe options\n",
+  "   --version:   print version info\n",
+  NULL};
+
+/*
+ * Find a key for the given ID, loading it if necessary.
+ */
+static const RSKey* get_key(unsigned long keyid, /* key ID */
+			    int publiconly)	 /* 1 = public key is
+						    sufficient */
+{
+  const RSKey* key;
+
+  LOCK_KEYS();
+  key = rs_key_cache_find(keycache, keyid, publiconly);
+  UNLOCK_KEYS();
+  return key;
+}
+
+/*
+ * Release a key obtained from get_key().
+ */
+static void release_key(const RSKey* key)
+{
+  LOCK_KEYS();
+  rs_key_cache_release(keycache, key);
+  UNLOCK_KEYS();
+}
+
+/*
+ * Save a message to be sent to the client.
+ */
+static void log_message(Connection* conn, /* connection */
+			char type,	  /* 'E' or 'M' */
+			const char* msg)  /* message text */
+{
+  unsigned long n = strlen(msg), length_a;
+  char* p;
+
+  if (conn->loglength + n + 3 > conn->loglength_a) {
+    length_a = conn->loglength + n + 256;
+    p = rs_realloc(conn->log, length_a);
+    if (!p)
+      return;
+    conn->log = p;
+    conn->loglength_a = length_a;
+  }
+
+  p = conn->log + conn->loglength;
+  *p++ = type;
+  memcpy(p, msg, n);
+  p += n;
+  *p++ = '\n';
+  *p = 0;
+  conn->loglength += n + 2;
+}
+
+static void capture_error(const RSKey* key RS_ATTR_UNUSED,
+			  const RSProgram* prgm RS_ATTR_UNUSED,
+			  const char* msg, void* data)
+{
+  log_message(data, 'E', msg);
+}
+
+static void capture_message(const RSKey* key RS_ATTR_UNUSED,
+			    const RSProgram* prgm RS_ATTR_UNUSED,
+			    const char* msg, void* data)
+{
+  log_message(data, 'M', msg);
+}
+
+/*
+ * Process a single request.
+ */
+static int handle_request(const RSRemoteRequest* req, /* request */
+			  RSProgram* prgm,	     /* program */
+			  RSSignature* sig)	     /* signature (for
+							RS_REMOTE_SIGN_DIGEST) */
+{
+  const RSKey* key;
+  unsigned long keyid;
+  int e;
+
+  keyid = req->keyid;
+  if (!keyid)
+    keyid = rs_program_get_key_id(prgm);
+  if (!keyid) {
+    rs_error(NULL, prgm, "unable to determine key ID");
+    return RS_ERR_MISSING_KEY_ID;
+  }
+
+  key = get_key(keyid, (req->op == RS_REMOTE_VALIDATE));
+  if (!key) {
+    rs_error(NULL, prgm, "no key available for ID %lX", keyid);
+    return RS_ERR_KEY_NOT_FOUND;
+  }
+
+  switch (req->op) {
+  case RS_REMOTE_VALIDATE:
+    rs_message(1, NULL, prgm, "validating with key %lX", keyid);
+    e = rs_validate_program(prgm, key);
+    break;
+
+  case RS_REMOTE_SIGN:
+    rs_message(1, NULL, prgm, "signing with key %lX", keyid);
+    if (req->rawmode || !(e = rs_repair_program(prgm, req->flags)))
+      e = rs_sign_program(prgm, key, req->rootnum);
+    break;
+
+  case RS_REMOTE_SIGN_DIGEST:
+    /* A Rabin signature of a value the client has chosen freely is
+       a square root modulo n, which would give away the key; Rabin
+       signatures are only made from a program, so that the hash is
+       computed here. */
+    if (req->digest.scheme != RS_SIG_RSA) {
+      rs_error(NULL, prgm, "refusing to sign a Rabin digest (key %lX)",
+	       keyid);
+      e = RS_ERR_CRITICAL;
+      break;
+    }
+    rs_message(1, NULL, prgm, "signing digest with key %lX", keyid);
+    e = rs_sign_digest_with_context(rs_get_context(key, prgm), &req->digest,
+				    key, req->rootnum, sig);
+    break;
+
+  default:
+    rs_error(NULL, prgm, "unknown request type %d", (int) req->op);
+    e = RS_ERR_CRITICAL;
+    break;
+  }
+
+  release_key(key);
+  return e;
+}
+
+/*
+ * Process requests on a connection until the client disconnects.
+ */
+static void* handle_connection(void* data)
+{
+  Connection* conn = data;
+  RSRemoteRequest req;
+  RSProgram* prgm;
+  RSSignature sig;
+  int e;
+
+  rs_context_set_error_func(conn->ctx, &capture_error, conn);
+  rs_context_set_message_func(conn->ctx, &capture_message, conn);
+
+  while ((prgm = rs_program_new_with_context(conn->ctx))) {
+    conn->loglength = 0;
+    if (conn->log)
+      conn->log[0] = 0;
+
+    if (rs_remote_read_request(conn->fd, &req, prgm) || !req.op) {
+      rs_program_free(prgm);
+      break;
+    }
+
+    rs_context_set_verbose(conn->ctx, req.verbose);
+    rs_signature_init(&sig);
+    e = handle_request(&req, prgm, &sig);
+
+    if (req.op == RS_REMOTE_SIGN_DIGEST)
+      e = rs_remote_write_signature(conn->fd, e, conn->log,
+				    (e ? NULL : &sig));
+    else
+      e = rs_remote_write_reply(conn->fd, e, conn->log,
+				(req.op == RS_REMOTE_SIGN && !e
+				 ? prgm : NULL));
+
+    rs_signature_clear(&sig);
+    rs_program_free(prgm);
+    if (e)
+      break;
+  }
+
+  rs_remote_close(conn->fd);
+  rs_free(conn->log);
+  rs_context_free(conn->ctx);
+  rs_free(conn);
+  return NULL;
+}
+
+#ifdef HAVE_SIGNAL_H
+static void handle_signal(int sig)
+{
+  if (socketpath)
+    unlink(socketpath);
+  signal(sig, SIG_DFL);
+  raise(sig);
+}
+#endif
+
+/*
+ * Load a key file given on the command line.
+ */
+static int load_key_file(const char* filename)
+{
+  RSKey* key;
+  FILE* f;
+  const char* p;
+  char* end;
+
+  if (!(f = fopen(filename, "rb"))) {
+    perror(filename);
+    return 3;
+  }
+
+  key = rs_key_new();
+  if (!key || rs_read_key_file(key, f, filename, 1)) {
+    fclose(f);
+    rs_key_free(key);
+    return 3;
+  }
+  fclose(f);
+
+  /* Key files in Rabin format don't include an ID; use the file
+     name, as rs_key_find_for_id() would. */
+  if (!key->id) {
+    p = getbasename(filename);
+    key->id = strtoul(p, &end, 16);
+    if (end == p || (*end && *end != '.')) {
+      rs_error(key, NULL, "unable to determine key ID");
+      rs_key_free(key);
+      return 3;
+    }
+  }
+
+  rs_key_cache_add(keycache, key);
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  static const char optstring[] = "k:K:qs:v";
+  const char *progname;
+  int i, j, c, fd, cfd;
+  const char* arg;
+  unsigned long keyid;
+  int verbose = 0;
+  Connection* conn;
+#ifdef HAVE_PTHREAD
+  pthread_t thread;
+  pthread_attr_t attr;
+#endif
+
+  progname = getbasename(argv[0]);
+  rs_set_progname(progname);
+
+  if (argc == 1) {
+    fprintf(stderr, usage[0], progname);
+    for (i = 1; usage[i]; i++)
+      fputs(usage[i], stderr);
+    fprintf(stderr, "Report bugs to %s.\n", PACKAGE_BUGREPORT);
+    return 5;
+  }
+
+  /* Parse options (keys are loaded below, once verbosity is known) */
+
+  i = j = 1;
+  while ((c = rs_parse_cmdline(argc, argv, optstring, &i, &j, &arg))) {
+    switch (c) {
+    case RS_CMDLINE_HELP:
+      printf(usage[0], progname);
+      for (i = 1; usage[i]; i++)
+	fputs(usage[i], stdout);
+      printf("Report bugs to %s.\n", PACKAGE_BUGREPORT);
+      return 0;
+
+    case RS_CMDLINE_VERSION:
+      printf("rabbitsignd (%s) %s\n", PACKAGE_NAME, PACKAGE_VERSION);
+      fputs("Copyright (C) 2009 Benjamin Moody\n", stdout);
+      fputs("This program is free software.  ", stdout);
+      fputs("There is NO WARRANTY of any kind.\n", stdout);
+      return 0;
+
+    case 'k':
+      break;
+
+    case 'K':
+      if (!sscanf(arg, "%lx", &keyid)) {
+	fprintf(stderr, "%s: -K: invalid argument %s\n", progname, arg);
+	return 5;
+      }
+      break;
+
+    case 's':
+      socketpath = arg;
+      break;
+
+    case 'v':
+      verbose++;
+      break;
+
+    case 'q':
+      verbose--;
+      break;
+
+    case RS_CMDLINE_FILENAME:
+      fprintf(stderr, "%s: unexpected argument %s\n", progname, arg);
+      return 5;
+
+    case RS_CMDLINE_ERROR:
+      return 5;
+
+    default:
+      fprintf(stderr, "%s: internal error: unknown option -%c\n",
+	      progname, c);
+      abort();
+    }
+  }
+
+  if (!socketpath) {
+    fprintf(stderr, "%s: no socket specified (use -s)\n", progname);
+    return 5;
+  }
+
+  rs_set_verbose(verbose);
+
+  /* Load and prepare keys (these are kept in the cache permanently) */
+
+  keycache = rs_key_cache_new(NULL, 64);
+  if (!keycache)
+    return 4;
+
+  i = j = 1;
+  while ((c = rs_parse_cmdline(argc, argv, optstring, &i, &j, &arg))) {
+    if (c == 'k') {
+      if (load_key_file(arg))
+	return 3;
+    }
+    else if (c == 'K') {
+      sscanf(arg, "%lx", &keyid);
+      if (!rs_key_cache_find(keycache, keyid, 0))
+	return 3;
+    }
+  }
+
+  /* Reload keys from the key directories if they change */
+
+  rs_key_index_watch();
+
+  /* Listen for connections */
+
+  if ((fd = rs_remote_listen(socketpath)) < 0)
+    return 4;
+
+#ifdef HAVE_SIGNAL_H
+# ifdef SIGPIPE
+  signal(SIGPIPE, SIG_IGN);
+# endif
+  signal(SIGINT, &handle_signal);
+  signal(SIGTERM, &handle_signal);
+#endif
+
+#ifdef HAVE_PTHREAD
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+#endif
+
+  rs_message(1, NULL, NULL, "listening on %s", socketpath);
+
+  while (1) {
+    cfd = accept(fd, NULL, NULL);
+    if (cfd < 0) {
+      if (errno == EINTR)
+	continue;
+      rs_error(NULL, NULL, "%s: %s", socketpath, strerror(errno));
+      break;
+    }
+
+    conn = rs_malloc(sizeof(Connection));
+    if (!conn) {
+      rs_remote_close(cfd);
+      continue;
+    }
+    conn->fd = cfd;
+    conn->log = NULL;
+    conn->loglength = conn->loglength_a = 0;
+    if (!(conn->ctx = rs_context_new())) {
+      rs_remote_close(cfd);
+      rs_free(conn);
+      continue;
+    }
+
+#ifdef HAVE_PTHREAD
+    if (pthread_create(&thread, &attr, &handle_connection, conn)) {
+      rs_error(NULL, NULL, "unable to create thread");
+      handle_connection(conn);
+    }
+#else
+    handle_connection(conn);
+#endif
+  }
+
+  rs_remote_close(fd);
+  unlink(socketpath);
+  return 4;
+}
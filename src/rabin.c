@@ -236,41 +236,49 @@ static void applyf(mpz_t res,	  /* mpz to store result */
 }
 
 /*
- * Compute the Rabin signature with a given f.
+ * Compute the Rabin signatures with a given f.
+ *
+ * The square roots modulo p and q are computed only once; each of the
+ * four signatures combines one of the two roots modulo p with one of
+ * the two roots modulo q.  Only the signatures whose bits are set in
+ * roots are computed (and only those elements of res are used.)
  */
-static void rabsigf(mpz_t res,	      /* mpz to store result */
+static void rabsigf(mpz_t* res,	      /* mpzs to store results
+					 (indexed by root number) */
 		    const mpz_t m,    /* MD5 hash */
 		    const mpz_t n,    /* public key */
 		    const mpz_t p,    /* first factor */
 		    const mpz_t q,    /* second factor */
 		    const mpz_t qinv, /* q^(p-2) mod p */
 		    int f,	      /* f (0, 1, 2, 3) */
-		    int rootnum)      /* root number (0, 1, 2, 3) */
+		    unsigned int roots) /* set of root numbers
+					   (1 << rootnum) */
 {
   mpz_t mm;
-  mpz_t r,s;
+  mpz_t r[2], s[2];
+  int i;
 
-  mpz_init(r);
-  mpz_init(s);
+  mpz_init(r[0]);
+  mpz_init(r[1]);
+  mpz_init(s[0]);
+  mpz_init(s[1]);
   mpz_init(mm);
 
   applyf(mm, m, n, f);
 
-  mpz_sqrtm(r, mm, p);
-  mpz_sqrtm(s, mm, q);
-
-  if (rootnum & 1) {
-    mpz_sub(r, p, r);
-  }
+  mpz_sqrtm(r[0], mm, p);
+  mpz_sqrtm(s[0], mm, q);
+  mpz_sub(r[1], p, r[0]);
+  mpz_sub(s[1], q, s[0]);
 
-  if (rootnum & 2) {
-    mpz_sub(s, q, s);
-  }
+  for (i = 0; i < 4; i++)
+    if (roots & (1 << i))
+      mpz_crt(res[i], r[i & 1], s[(i >> 1) & 1], p, q, qinv);
 
-  mpz_crt(res, r, s, p, q, qinv);
-
-  mpz_clear(r);
-  mpz_clear(s);
+  mpz_clear(r[0]);
+  mpz_clear(r[1]);
+  mpz_clear(s[0]);
+  mpz_clear(s[1]);
   mpz_clear(mm);
 }
 
@@ -322,15 +330,44 @@ static const int ftab[36] = {
 };
 
 /*
- * Compute the Rabin signature and the useful value of f.
+ * Compute q^-1 mod p.
  */
-int rs_sign_rabin(mpz_t res,	        /* mpz to store signature */
-		  int* f,	        /* f value chosen */
-		  const mpz_t hash,	/* MD5 hash of app */
-		  int rootnum,		/* root number (0, 1, 2, 3) */
-		  RSKey* key)		/* key structure */
+int rs_rabin_get_qinv(mpz_t res,      /* mpz to store result */
+		      const mpz_t p,  /* first factor */
+		      const mpz_t q)  /* second factor */
 {
   mpz_t mm;
+
+  mpz_init(mm);
+
+#ifndef USE_MPZ_GCDEXT
+  mpz_sub_ui(mm, p, 2);
+  mpz_powm(res, q, mm, p);
+#else
+  mpz_gcdext(mm, res, NULL, q, p);
+  if (mpz_cmp_ui(mm, 1)) {
+    mpz_clear(mm);
+    return RS_ERR_UNSUITABLE_RABIN_KEY;
+  }
+  /* gcdext may give a negative result */
+  mpz_mod(res, res, p);
+#endif
+
+  mpz_clear(mm);
+  return RS_SUCCESS;
+}
+
+/*
+ * Compute a set of Rabin signatures and the useful value of f.
+ */
+static int rabin_sign_roots(mpz_t* res,	      /* mpzs to store signatures
+					 (indexed by root number) */
+			    int* f,	      /* f value chosen */
+			    const mpz_t hash, /* MD5 hash of app */
+			    unsigned int roots, /* set of root numbers */
+			    const RSKey* key) /* key structure */
+{
+  mpz_t mm, qinv;
   int mLp, mLq;
   int pm8, qm8;
 
@@ -345,21 +382,17 @@ int rs_sign_rabin(mpz_t res,	        /* mpz to store signature */
   }
 
   mpz_init(mm);
+  mpz_init(qinv);
 
   /* Calculate q^-1 if necessary */
 
-  if (!mpz_sgn(key->qinv)) {
-#ifndef USE_MPZ_GCDEXT
-    mpz_sub_ui(mm, key->p, 2);
-    mpz_powm(key->qinv, key->q, mm, key->p);
-#else
-    mpz_gcdext(mm, key->qinv, NULL, key->q, key->p);
-    if (mpz_cmp_ui(mm, 1)) {
-      mpz_clear(mm);
-      rs_error(key, NULL, "unable to sign: unsuitable key");
-      return RS_ERR_UNSUITABLE_RABIN_KEY;
-    }
-#endif
+  if (mpz_sgn(key->qinv))
+    mpz_set(qinv, key->qinv);
+  else if (rs_rabin_get_qinv(qinv, key->p, key->q)) {
+    mpz_clear(mm);
+    mpz_clear(qinv);
+    rs_error(key, NULL, "unable to sign: unsuitable key");
+    return RS_ERR_UNSUITABLE_RABIN_KEY;
   }
 
   applyf(mm, hash, key->n, 2);
@@ -372,6 +405,7 @@ int rs_sign_rabin(mpz_t res,	        /* mpz to store signature */
 
   if (pm8 == 1 || qm8 == 1 || (pm8 % 2) == 0 || (qm8 % 2) == 0) {
     mpz_clear(mm);
+    mpz_clear(qinv);
     rs_error(key, NULL, "unable to sign: unsuitable key");
     return RS_ERR_UNSUITABLE_RABIN_KEY;
   }
@@ -383,15 +417,53 @@ int rs_sign_rabin(mpz_t res,	        /* mpz to store signature */
 
   if (*f == 99) {
     mpz_clear(mm);
+    mpz_clear(qinv);
     rs_error(key, NULL, "unable to sign: unsuitable key");
     return RS_ERR_UNSUITABLE_RABIN_KEY;
   }
 
-  rabsigf(res, hash, key->n, key->p, key->q, key->qinv, *f, rootnum);
+  rabsigf(res, hash, key->n, key->p, key->q, qinv, *f, roots);
   mpz_clear(mm);
+  mpz_clear(qinv);
   return RS_SUCCESS;
 }
 
+/*
+ * Compute the Rabin signature and the useful value of f.
+ *
+ * The key is not modified; if q^-1 has not been computed in advance
+ * by rs_key_prepare(), it is computed here and then discarded.
+ */
+int rs_sign_rabin(mpz_t res,	        /* mpz to store signature */
+		  int* f,	        /* f value chosen */
+		  const mpz_t hash,	/* MD5 hash of app */
+		  int rootnum,		/* root number (0, 1, 2, 3) */
+		  const RSKey* key)	/* key structure */
+{
+  mpz_t sigs[4];
+  int e;
+
+  rootnum &= 3;
+  mpz_init(sigs[rootnum]);
+  if (!(e = rabin_sign_roots(sigs, f, hash, 1 << rootnum, key)))
+    mpz_set(res, sigs[rootnum]);
+  mpz_clear(sigs[rootnum]);
+  return e;
+}
+
+/*
+ * Compute all four Rabin signatures (res[0] to res[3], which must be
+ * initialized), and the useful value of f.  This costs little more
+ * than computing one.
+ */
+int rs_sign_rabin_all(mpz_t* res,	/* mpzs to store signatures */
+		      int* f,		/* f value chosen */
+		      const mpz_t hash,	/* MD5 hash of app */
+		      const RSKey* key)	/* key structure */
+{
+  return rabin_sign_roots(res, f, hash, 0xf, key);
+}
+
 /* Check that the given Rabin signature is valid. */
 int rs_validate_rabin (const mpz_t sig,  /* purported signature of app */
 		       int f,		 /* f value */
@@ -0,0 +1,824 @@
+/*
+ * RabbitSign - Tools for signing TI graphing calculator software
+ * Copyright (C) 2009 Benjamin Moody
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+
+#ifdef HAVE_STRING_H
+# include <string.h>
+#else
+# ifdef HAVE_STRINGS_H
+#  include <strings.h>
+# endif
+#endif
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#if defined(HAVE_SYS_SOCKET_H) && defined(HAVE_SYS_UN_H)
+# define RS_REMOTE_SOCKETS
+# ifdef HAVE_SYS_TYPES_H
+#  include <sys/types.h>
+# endif
+# ifdef HAVE_SYS_STAT_H
+#  include <sys/stat.h>
+# endif
+# include <sys/socket.h>
+# include <sys/un.h>
+#endif
+
+#include "rabbitsign.h"
+#include "internal.h"
+
+/*
+ * Protocol
+ *
+ * All integers are sent as 32-bit big-endian values.  Strings and
+ * byte arrays are sent as a length followed by the data.
+ *
+ * Request:
+ *   "RSq1"  op  keyid  flags  rootnum  rawmode  verbose  <program>
+ *
+ * or, for RS_REMOTE_SIGN_DIGEST:
+ *   "RSq1"  op  keyid  flags  rootnum  rawmode  verbose  <digest>
+ *
+ * Reply:
+ *   "RSr1"  status  <messages>  has-program  [<program>]
+ *
+ * or, for RS_REMOTE_SIGN_DIGEST:
+ *   "RSr1"  status  <messages>  has-signature  [<signature>]
+ *
+ * Program:
+ *   calctype  datatype  keytype  version  <filename>  <data>
+ *   <header>  <signature>  npagenums  pagenum ...
+ *
+ * Digest:
+ *   scheme  alg  <value>
+ *
+ * Signature:
+ *   scheme  f  <value>
+ *
+ * (The value of a signature is sent as a little-endian number.)
+ *
+ * The messages string consists of zero or more lines, each beginning
+ * with 'E' (for errors and warnings) or 'M' (for informational
+ * messages.)
+ */
+
+#ifdef RS_REMOTE_SOCKETS
+
+#define REQUEST_MAGIC "RSq1"
+#define REPLY_MAGIC "RSr1"
+
+/* Largest field we are willing to receive */
+#define MAX_FIELD_LENGTH 0x4000000
+
+typedef struct _RSBuffer {
+  RSContext* ctx;
+  unsigned char* data;
+  unsigned long length;
+  unsigned long length_a;
+  int failed;
+} RSBuffer;
+
+static void buf_append(RSBuffer* buf,		  /* buffer */
+		       const void* data,	  /* data to add */
+		       unsigned long length)	  /* length of data */
+{
+  unsigned long length_a;
+  unsigned char* p;
+
+  if (buf->failed)
+    return;
+
+  if (buf->length + length > buf->length_a) {
+    length_a = buf->length + length + 1024;
+    p = rs_ctx_realloc(buf->ctx, buf->data, length_a);
+    if (!p) {
+      buf->failed = 1;
+      return;
+    }
+    buf->data = p;
+    buf->length_a = length_a;
+  }
+
+  if (length)
+    memcpy(buf->data + buf->length, data, length);
+  buf->length += length;
+}
+
+static void buf_put_int(RSBuffer* buf,	      /* buffer */
+			unsigned long value)  /* value to add */
+{
+  unsigned char b[4];
+
+  b[0] = (value >> 24) & 0xff;
+  b[1] = (value >> 16) & 0xff;
+  b[2] = (value >> 8) & 0xff;
+  b[3] = value & 0xff;
+  buf_append(buf, b, 4);
+}
+
+static void buf_put_bytes(RSBuffer* buf,	    /* buffer */
+			  const void* data,	    /* data to add */
+			  unsigned long length)	    /* length of data */
+{
+  buf_put_int(buf, length);
+  buf_append(buf, data, length);
+}
+
+static void buf_put_program(RSBuffer* buf,	      /* buffer */
+			    const RSProgram* prgm)    /* program */
+{
+  int i;
+
+  buf_put_int(buf, prgm->calctype);
+  buf_put_int(buf, prgm->datatype);
+  buf_put_int(buf, prgm->keytype);
+  buf_put_int(buf, prgm->version);
+  if (prgm->filename)
+    buf_put_bytes(buf, prgm->filename, strlen(prgm->filename));
+  else
+    buf_put_int(buf, 0);
+  buf_put_bytes(buf, prgm->data, prgm->length);
+  buf_put_bytes(buf, prgm->header, prgm->header_length);
+  buf_put_bytes(buf, prgm->signature, prgm->signature_length);
+  buf_put_int(buf, prgm->npagenums);
+  for (i = 0; i < prgm->npagenums; i++)
+    buf_put_int(buf, prgm->pagenums[i]);
+}
+
+static void buf_put_mpz(RSBuffer* buf,	     /* buffer */
+			const mpz_t value)   /* value to add */
+{
+  unsigned char* p;
+  size_t n;
+
+  n = (mpz_sizeinbase(value, 2) + 7) / 8;
+  if (!(p = rs_ctx_malloc(buf->ctx, n + 1))) {
+    buf->failed = 1;
+    return;
+  }
+  mpz_export(p, &n, -1, 1, 0, 0, value);
+  if (!mpz_sgn(value))
+    n = 0;
+  buf_put_bytes(buf, p, n);
+  rs_ctx_free(buf->ctx, p);
+}
+
+/*
+ * Write data to a socket.
+ */
+static int write_all(int fd,		      /* socket */
+		     const unsigned char* p,  /* data */
+		     unsigned long length)    /* length of data */
+{
+  long n;
+
+  while (length > 0) {
+    n = write(fd, p, length);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return RS_ERR_FILE_IO;
+    p += n;
+    length -= n;
+  }
+  return RS_SUCCESS;
+}
+
+/*
+ * Read data from a socket.  Returns the number of bytes read (less
+ * than length only if the connection was closed), or -1 on error.
+ */
+static long read_all(int fd,		     /* socket */
+		     unsigned char* p,	     /* buffer */
+		     unsigned long length)   /* length of data */
+{
+  unsigned long count = 0;
+  long n;
+
+  while (count < length) {
+    n = read(fd, p + count, length - count);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return -1;
+    if (n == 0)
+      break;
+    count += n;
+  }
+  return count;
+}
+
+static int read_int(int fd,		     /* socket */
+		    unsigned long* value)    /* value read */
+{
+  unsigned char b[4];
+
+  if (read_all(fd, b, 4) != 4)
+    return RS_ERR_FILE_IO;
+
+  *value = (((unsigned long) b[0] << 24)
+	    | ((unsigned long) b[1] << 16)
+	    | ((unsigned long) b[2] << 8)
+	    | (unsigned long) b[3]);
+  return RS_SUCCESS;
+}
+
+/*
+ * Read a length-prefixed field.  The result is allocated using the
+ * given context, and is always followed by a zero byte (so strings
+ * are terminated.)
+ */
+static int read_bytes(int fd,		      /* socket */
+		      RSContext* ctx,	      /* context for allocation */
+		      unsigned char** data,   /* data read */
+		      unsigned long* length)  /* length of data */
+{
+  unsigned long n;
+  int e;
+
+  *data = NULL;
+  *length = 0;
+
+  if ((e = read_int(fd, &n)))
+    return e;
+  if (n > MAX_FIELD_LENGTH) {
+    rs_ctx_error(ctx, "remote: field too large (%lu bytes)", n);
+    return RS_ERR_FILE_IO;
+  }
+
+  if (!(*data = rs_ctx_malloc(ctx, n + 1)))
+    return RS_ERR_OUT_OF_MEMORY;
+
+  if (read_all(fd, *data, n) != (long) n) {
+    rs_ctx_free(ctx, *data);
+    *data = NULL;
+    return RS_ERR_FILE_IO;
+  }
+
+  (*data)[n] = 0;
+  *length = n;
+  return RS_SUCCESS;
+}
+
+/*
+ * Read a program, replacing the contents of prgm.
+ */
+static int read_program(int fd,		     /* socket */
+			RSProgram* prgm,     /* program to store result */
+			int keepname)	     /* 1 = ignore the received
+						file name */
+{
+  unsigned long v[4], n, i, pg;
+  unsigned char *fname, *data, *header, *sig;
+  unsigned long fnamelen, datalen, headerlen, siglen;
+  unsigned int* pagenums = NULL;
+  int e;
+
+  for (i = 0; i < 4; i++)
+    if ((e = read_int(fd, &v[i])))
+      return e;
+
+  fname = data = header = sig = NULL;
+
+  if ((e = read_bytes(fd, prgm->ctx, &fname, &fnamelen))
+      || (e = read_bytes(fd, prgm->ctx, &data, &datalen))
+      || (e = read_bytes(fd, prgm->ctx, &header, &headerlen))
+      || (e = read_bytes(fd, prgm->ctx, &sig, &siglen))
+      || (e = read_int(fd, &n)))
+    goto fail;
+
+  if (n > MAX_FIELD_LENGTH / 4) {
+    e = RS_ERR_FILE_IO;
+    goto fail;
+  }
+
+  if (n) {
+    if (!(pagenums = rs_ctx_malloc(prgm->ctx, n * sizeof(unsigned int)))) {
+      e = RS_ERR_OUT_OF_MEMORY;
+      goto fail;
+    }
+    for (i = 0; i < n; i++) {
+      if ((e = read_int(fd, &pg)))
+	goto fail;
+      pagenums[i] = pg;
+    }
+  }
+
+  prgm->calctype = v[0];
+  prgm->datatype = v[1];
+  prgm->keytype = v[2];
+  prgm->version = v[3];
+
+  if (!keepname && fnamelen) {
+    rs_ctx_free(prgm->ctx, prgm->filename);
+    prgm->filename = (char*) fname;
+    fname = NULL;
+  }
+  rs_ctx_free(prgm->ctx, fname);
+
+  rs_program_invalidate_header_index(prgm);
+  rs_program_discard_digest(prgm);
+
+  rs_ctx_free(prgm->ctx, prgm->data);
+  prgm->data = data;
+  prgm->length = datalen;
+  prgm->length_a = datalen + 1;
+
+  rs_ctx_free(prgm->ctx, prgm->header);
+  if (headerlen) {
+    prgm->header = header;
+  }
+  else {
+    rs_ctx_free(prgm->ctx, header);
+    prgm->header = NULL;
+  }
+  prgm->header_length = headerlen;
+
+  rs_ctx_free(prgm->ctx, prgm->signature);
+  if (siglen) {
+    prgm->signature = sig;
+  }
+  else {
+    rs_ctx_free(prgm->ctx, sig);
+    prgm->signature = NULL;
+  }
+  prgm->signature_length = siglen;
+
+  rs_ctx_free(prgm->ctx, prgm->pagenums);
+  prgm->pagenums = pagenums;
+  prgm->npagenums = n;
+  return RS_SUCCESS;
+
+ fail:
+  rs_ctx_free(prgm->ctx, fname);
+  rs_ctx_free(prgm->ctx, data);
+  rs_ctx_free(prgm->ctx, header);
+  rs_ctx_free(prgm->ctx, sig);
+  rs_ctx_free(prgm->ctx, pagenums);
+  return e;
+}
+
+/*
+ * Check that the next four bytes match the given magic number.
+ * Returns 1 if the connection was closed cleanly beforehand.
+ */
+static int read_magic(int fd,		     /* socket */
+		      const char* magic)     /* expected value */
+{
+  unsigned char b[4];
+  long n;
+
+  n = read_all(fd, b, 4);
+  if (n == 0)
+    return 1;
+  if (n != 4 || memcmp(b, magic, 4))
+    return RS_ERR_FILE_IO;
+  return RS_SUCCESS;
+}
+
+static int send_buffer(int fd,		     /* socket */
+		       RSBuffer* buf)	     /* data to send */
+{
+  int e;
+
+  if (buf->failed)
+    e = RS_ERR_OUT_OF_MEMORY;
+  else
+    e = write_all(fd, buf->data, buf->length);
+  rs_ctx_free(buf->ctx, buf->data);
+  return e;
+}
+
+/*
+ * Connect to a signing server.
+ */
+int rs_remote_connect(const char* path) /* socket path */
+{
+  struct sockaddr_un addr;
+  int fd;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    rs_error(NULL, NULL, "%s: socket path too long", path);
+    return -1;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+    rs_error(NULL, NULL, "unable to create socket: %s", strerror(errno));
+    return -1;
+  }
+
+  if (connect(fd, (struct sockaddr*) &addr, sizeof(addr))) {
+    rs_error(NULL, NULL, "%s: %s", path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+/*
+ * Create a listening socket for a signing server.
+ *
+ * If a socket already exists at the given path, it is removed (but
+ * other types of files are not.)
+ */
+int rs_remote_listen(const char* path) /* socket path */
+{
+  struct sockaddr_un addr;
+  struct stat st;
+  int fd;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    rs_error(NULL, NULL, "%s: socket path too long", path);
+    return -1;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  if (!stat(path, &st) && S_ISSOCK(st.st_mode))
+    unlink(path);
+
+  if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+    rs_error(NULL, NULL, "unable to create socket: %s", strerror(errno));
+    return -1;
+  }
+
+  if (bind(fd, (struct sockaddr*) &addr, sizeof(addr))
+      || listen(fd, 16)) {
+    rs_error(NULL, NULL, "%s: %s", path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+/*
+ * Close a connection.
+ */
+void rs_remote_close(int fd)
+{
+  if (fd >= 0)
+    close(fd);
+}
+
+/*
+ * Read the common part of a reply, and relay the messages it
+ * contains.
+ */
+static int read_reply(int fd,		      /* connection */
+		      RSContext* ctx,	      /* context for allocation */
+		      const RSProgram* prgm,  /* program (for messages) */
+		      unsigned long* status)  /* status from server */
+{
+  unsigned long msglen;
+  unsigned char *msgs;
+  char *p, *q;
+
+  if (read_magic(fd, REPLY_MAGIC)
+      || read_int(fd, status)
+      || read_bytes(fd, ctx, &msgs, &msglen))
+    return RS_ERR_FILE_IO;
+
+  /* Relay messages */
+  for (p = (char*) msgs; *p; p = q) {
+    if ((q = strchr(p, '\n')))
+      *q++ = 0;
+    else
+      q = p + strlen(p);
+
+    if (p[0] == 'E')
+      rs_relay_message(prgm, 1, p + 1);
+    else if (p[0] == 'M')
+      rs_relay_message(prgm, 0, p + 1);
+  }
+  rs_ctx_free(ctx, msgs);
+  return RS_SUCCESS;
+}
+
+static void put_request(RSBuffer* buf,		     /* buffer */
+			const RSRemoteRequest* req)  /* request */
+{
+  buf_append(buf, REQUEST_MAGIC, 4);
+  buf_put_int(buf, req->op);
+  buf_put_int(buf, req->keyid);
+  buf_put_int(buf, req->flags);
+  buf_put_int(buf, req->rootnum);
+  buf_put_int(buf, req->rawmode);
+  buf_put_int(buf, req->verbose + 1);
+}
+
+static void put_reply(RSBuffer* buf,	       /* buffer */
+		      RSStatus status,	       /* result of operation */
+		      const char* messages)    /* messages to relay */
+{
+  buf_append(buf, REPLY_MAGIC, 4);
+  buf_put_int(buf, (unsigned long) status);
+  if (messages)
+    buf_put_bytes(buf, messages, strlen(messages));
+  else
+    buf_put_int(buf, 0);
+}
+
+/*
+ * Perform an operation on a signing server.
+ *
+ * The program is sent to the server, and (if the operation is
+ * RS_REMOTE_SIGN and succeeds) replaced by the signed program.  Any
+ * messages generated by the server are logged using the program's
+ * context.  The status returned by the server is stored in *result;
+ * the return value indicates whether communication succeeded.
+ */
+int rs_remote_call(int fd,			/* connection */
+		   const RSRemoteRequest* req,	/* request parameters */
+		   RSProgram* prgm,		/* program */
+		   RSStatus* result)		/* status from server */
+{
+  RSContext* ctx = rs_get_context(NULL, prgm);
+  RSBuffer buf;
+  unsigned long status, hasprgm;
+  int e;
+
+  memset(&buf, 0, sizeof(buf));
+  buf.ctx = ctx;
+  put_request(&buf, req);
+  buf_put_program(&buf, prgm);
+
+  if ((e = send_buffer(fd, &buf))) {
+    rs_error(NULL, prgm, "unable to send request to server");
+    return e;
+  }
+
+  if (read_reply(fd, ctx, prgm, &status)) {
+    rs_error(NULL, prgm, "invalid reply from server");
+    return RS_ERR_FILE_IO;
+  }
+
+  if (read_int(fd, &hasprgm)
+      || (hasprgm && (e = read_program(fd, prgm, 1)))) {
+    rs_error(NULL, prgm, "invalid reply from server");
+    return RS_ERR_FILE_IO;
+  }
+
+  *result = (RSStatus) (long) (int) status;
+  return RS_SUCCESS;
+}
+
+/*
+ * Sign a digest (req->digest) using a signing server.
+ *
+ * Only the digest is sent to the server, so the program itself must
+ * be repaired and hashed beforehand (see rs_program_compute_digest()),
+ * and req->keyid must be set.  If the server succeeds, the signature
+ * is stored in sig (which must have been initialized.)  The status
+ * returned by the server is stored in *result; the return value
+ * indicates whether communication succeeded.
+ */
+int rs_remote_sign_digest(int fd,		      /* connection */
+			  const RSRemoteRequest* req, /* request
+							 parameters */
+			  RSSignature* sig,	      /* signature */
+			  RSStatus* result)	      /* status from
+							 server */
+{
+  RSContext* ctx = rs_get_context(NULL, NULL);
+  RSBuffer buf;
+  unsigned long status, hassig, scheme, f, length;
+  unsigned char* value;
+  int e;
+
+  if (req->op != RS_REMOTE_SIGN_DIGEST
+      || req->digest.length > sizeof(req->digest.value)) {
+    rs_error(NULL, NULL, "invalid digest request");
+    return RS_ERR_CRITICAL;
+  }
+
+  memset(&buf, 0, sizeof(buf));
+  buf.ctx = ctx;
+  put_request(&buf, req);
+  buf_put_int(&buf, req->digest.scheme);
+  buf_put_int(&buf, req->digest.alg);
+  buf_put_bytes(&buf, req->digest.value, req->digest.length);
+
+  if ((e = send_buffer(fd, &buf))) {
+    rs_error(NULL, NULL, "unable to send request to server");
+    return e;
+  }
+
+  if (read_reply(fd, ctx, NULL, &status)
+      || read_int(fd, &hassig)
+      || (hassig && (read_int(fd, &scheme)
+		     || read_int(fd, &f)
+		     || read_bytes(fd, ctx, &value, &length)))) {
+    rs_error(NULL, NULL, "invalid reply from server");
+    return RS_ERR_FILE_IO;
+  }
+
+  if (hassig) {
+    sig->scheme = scheme;
+    sig->f = f;
+    mpz_import(sig->value, length, -1, 1, 0, 0, value);
+    rs_ctx_free(ctx, value);
+  }
+
+  *result = (RSStatus) (long) (int) status;
+  return RS_SUCCESS;
+}
+
+/*
+ * Receive a request from a client.
+ *
+ * If the client has closed the connection, req->op is set to zero.
+ */
+int rs_remote_read_request(int fd,		  /* connection */
+			   RSRemoteRequest* req,  /* request parameters */
+			   RSProgram* prgm)	  /* program to store
+						     data */
+{
+  unsigned long v[6], scheme, alg, length;
+  unsigned char* value;
+  int i, e;
+
+  req->op = 0;
+
+  if ((e = read_magic(fd, REQUEST_MAGIC)))
+    return (e == 1 ? RS_SUCCESS : RS_ERR_FILE_IO);
+
+  for (i = 0; i < 6; i++)
+    if (read_int(fd, &v[i]))
+      return RS_ERR_FILE_IO;
+
+  if (v[0] == RS_REMOTE_SIGN_DIGEST) {
+    /* Read digest rather than program */
+    if ((e = read_int(fd, &scheme))
+	|| (e = read_int(fd, &alg))
+	|| (e = read_bytes(fd, prgm->ctx, &value, &length)))
+      return e;
+    if (length > sizeof(req->digest.value)) {
+      rs_ctx_free(prgm->ctx, value);
+      return RS_ERR_FILE_IO;
+    }
+
+    req->digest.scheme = scheme;
+    req->digest.alg = alg;
+    req->digest.length = length;
+    memset(req->digest.value, 0, sizeof(req->digest.value));
+    memcpy(req->digest.value, value, length);
+    rs_ctx_free(prgm->ctx, value);
+  }
+  else if ((e = read_program(fd, prgm, 0))) {
+    return e;
+  }
+
+  req->op = v[0];
+  req->keyid = v[1];
+  req->flags = v[2];
+  req->rootnum = v[3];
+  req->rawmode = v[4];
+  req->verbose = (int) v[5] - 1;
+  return RS_SUCCESS;
+}
+
+/*
+ * Send a reply to a client.
+ */
+int rs_remote_write_reply(int fd,		  /* connection */
+			  RSStatus status,	  /* result of operation */
+			  const char* messages,	  /* messages to relay */
+			  const RSProgram* prgm)  /* program to return
+						     (NULL for none) */
+{
+  RSBuffer buf;
+
+  memset(&buf, 0, sizeof(buf));
+  buf.ctx = prgm ? prgm->ctx : NULL;
+  put_reply(&buf, status, messages);
+
+  if (prgm) {
+    buf_put_int(&buf, 1);
+    buf_put_program(&buf, prgm);
+  }
+  else {
+    buf_put_int(&buf, 0);
+  }
+
+  return send_buffer(fd, &buf);
+}
+
+/*
+ * Send a reply to an RS_REMOTE_SIGN_DIGEST request.
+ */
+int rs_remote_write_signature(int fd,		      /* connection */
+			      RSStatus status,	      /* result of
+							 operation */
+			      const char* messages,   /* messages to
+							 relay */
+			      const RSSignature* sig) /* signature to
+							 return (NULL for
+							 none) */
+{
+  RSBuffer buf;
+
+  memset(&buf, 0, sizeof(buf));
+  put_reply(&buf, status, messages);
+
+  if (sig) {
+    buf_put_int(&buf, 1);
+    buf_put_int(&buf, sig->scheme);
+    buf_put_int(&buf, sig->f);
+    buf_put_mpz(&buf, sig->value);
+  }
+  else {
+    buf_put_int(&buf, 0);
+  }
+
+  return send_buffer(fd, &buf);
+}
+
+#else /* !RS_REMOTE_SOCKETS */
+
+int rs_remote_connect(const char* path)
+{
+  rs_error(NULL, NULL, "%s: Unix domain sockets are not supported", path);
+  return -1;
+}
+
+int rs_remote_listen(const char* path)
+{
+  rs_error(NULL, NULL, "%s: Unix domain sockets are not supported", path);
+  return -1;
+}
+
+void rs_remote_close(int fd RS_ATTR_UNUSED)
+{
+}
+
+int rs_remote_call(int fd RS_ATTR_UNUSED,
+		   const RSRemoteRequest* req RS_ATTR_UNUSED,
+		   RSProgram* prgm RS_ATTR_UNUSED,
+		   RSStatus* result RS_ATTR_UNUSED)
+{
+  return RS_ERR_FILE_IO;
+}
+
+int rs_remote_sign_digest(int fd RS_ATTR_UNUSED,
+			  const RSRemoteRequest* req RS_ATTR_UNUSED,
+			  RSSignature* sig RS_ATTR_UNUSED,
+			  RSStatus* result RS_ATTR_UNUSED)
+{
+  return RS_ERR_FILE_IO;
+}
+
+int rs_remote_read_request(int fd RS_ATTR_UNUSED,
+			   RSRemoteRequest* req RS_ATTR_UNUSED,
+			   RSProgram* prgm RS_ATTR_UNUSED)
+{
+  return RS_ERR_FILE_IO;
+}
+
+int rs_remote_write_reply(int fd RS_ATTR_UNUSED,
+			  RSStatus status RS_ATTR_UNUSED,
+			  const char* messages RS_ATTR_UNUSED,
+			  const RSProgram* prgm RS_ATTR_UNUSED)
+{
+  return RS_ERR_FILE_IO;
+}
+
+int rs_remote_write_signature(int fd RS_ATTR_UNUSED,
+			      RSStatus status RS_ATTR_UNUSED,
+			      const char* messages RS_ATTR_UNUSED,
+			      const RSSignature* sig RS_ATTR_UNUSED)
+{
+  return RS_ERR_FILE_IO;
+}
+
+#endif /* !RS_REMOTE_SOCKETS */
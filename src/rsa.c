@@ -47,10 +47,10 @@
  * Note that there is no way of calculating d without knowing the
  * factors of n; this is a key point in the security of RSA.)
  */
-static int get_exponent(mpz_t res,	/* mpz to store result */
-			mpz_t e,		/* validation exponent */
-			const mpz_t p,  /* first factor */
-			const mpz_t q)  /* second fatctor */
+int rs_rsa_get_exponent(mpz_t res,	    /* mpz to store result */
+			const mpz_t e,	    /* validation exponent */
+			const mpz_t p,	    /* first factor */
+			const mpz_t q)	    /* second factor */
 {
   mpz_t a, b;
   mpz_init(a);
@@ -76,33 +76,84 @@ static int get_exponent(mpz_t res,	/* mpz to store result */
   return RS_SUCCESS;
 }
 
+/*
+ * Compute an RSA signature using the Chinese remainder theorem.
+ *
+ * Rather than computing hash^d mod n directly, we compute
+ *
+ *  s1 = hash^(d mod (p-1)) mod p
+ *  s2 = hash^(d mod (q-1)) mod q
+ *
+ * and combine them as [(s1 - s2) * q^-1 mod p] * q + s2.  The two
+ * exponentiations use numbers half the size of n, so this is roughly
+ * three to four times faster.
+ */
+static void rsa_sign_crt(mpz_t res,	   /* mpz to store signature */
+			 const mpz_t hash, /* MD5 hash of app */
+			 const RSKey* key) /* key structure */
+{
+  mpz_t s1, s2;
+
+  mpz_init(s1);
+  mpz_init(s2);
+
+  mpz_powm(s1, hash, key->dp, key->p);
+  mpz_powm(s2, hash, key->dq, key->q);
+
+  mpz_sub(res, s1, s2);
+  mpz_mul(res, res, key->qinv);
+  mpz_mod(res, res, key->p);
+  mpz_mul(res, res, key->q);
+  mpz_add(res, res, s2);
+
+  mpz_clear(s1);
+  mpz_clear(s2);
+}
+
 /*
  * Compute an RSA signature.
  *
  * This is simply the hash raised to the d-th power mod n (where d is
- * defined above.)
+ * defined above.)  If the key has been prepared with rs_key_prepare(),
+ * the faster CRT form is used instead.  The key itself is never
+ * modified.
  */
 int rs_sign_rsa(mpz_t res,	   /* mpz to store signature */
-		const mpz_t hash, /* MD5 hash of app */
-		RSKey* key)	   /* key structure */
+		const mpz_t hash,  /* MD5 hash of app */
+		const RSKey* key)  /* key structure */
 {
+  mpz_t d;
+
   if (!mpz_sgn(key->n)) {
     rs_error(key, NULL, "unable to sign: public key missing");
     return RS_ERR_MISSING_PUBLIC_KEY;
   }
 
-  if (!mpz_sgn(key->d)) {
-    if (!mpz_sgn(key->p) || !mpz_sgn(key->q)) {
-      rs_error(key, NULL, "unable to sign: private key missing");
-      return RS_ERR_MISSING_PRIVATE_KEY;
-    }
-    if (get_exponent(key->d, key->e, key->p, key->q)) {
-      rs_error(key, NULL, "unable to sign: unsuitable key");
-      return RS_ERR_UNSUITABLE_RSA_KEY;
-    }
+  if (mpz_sgn(key->dp) && mpz_sgn(key->dq) && mpz_sgn(key->qinv)
+      && mpz_sgn(key->p) && mpz_sgn(key->q)) {
+    rsa_sign_crt(res, hash, key);
+    return RS_SUCCESS;
+  }
+
+  if (mpz_sgn(key->d)) {
+    mpz_powm(res, hash, key->d, key->n);
+    return RS_SUCCESS;
+  }
+
+  if (!mpz_sgn(key->p) || !mpz_sgn(key->q)) {
+    rs_error(key, NULL, "unable to sign: private key missing");
+    return RS_ERR_MISSING_PRIVATE_KEY;
+  }
+
+  mpz_init(d);
+  if (rs_rsa_get_exponent(d, key->e, key->p, key->q)) {
+    mpz_clear(d);
+    rs_error(key, NULL, "unable to sign: unsuitable key");
+    return RS_ERR_UNSUITABLE_RSA_KEY;
   }
 
-  mpz_powm(res, hash, key->d, key->n);
+  mpz_powm(res, hash, d, key->n);
+  mpz_clear(d);
   return RS_SUCCESS;
 }
 
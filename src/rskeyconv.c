@@ -0,0 +1,279 @@
+/*
+ * RabbitSign - Tools for signing TI graphing calculator software
+ * Copyright (C) 2009 Benjamin Moody
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+# include <string.h>
+#else
+# ifdef HAVE_STRINGS_H
+#  include <strings.h>
+# endif
+#endif
+
+#include "rabbitsign.h"
+#include "internal.h"
+
+#if !defined(strrchr) && !defined(HAVE_STRRCHR) && defined(HAVE_RINDEX)
+# define strrchr rindex
+#endif
+
+static const char* getbasename(const char* f)
+{
+  const char *p;
+
+  if ((p = strrchr(f, '/')))
+    f = p + 1;
+
+#if defined(__MSDOS__) || defined(__WIN32__)
+  if ((p = strrchr(f, '\\')))
+    f = p + 1;
+#endif
+
+  return f;
+}
+
+static const char* usage[]={
+  "Usage: %s [options] key-file ...\n",
+  "Convert text key files into prepared (.rsk) key files.\n",
+  "Where options may include:\n",
+  "   -K NUM:      set key ID (hexadecimal)\n",
+  "   -o FILE:     write output to FILE (only one input file allowed)\n",
+  "   -q:          suppress warning messages\n",
+  "   -v:          be verbose (-vv for even more verbosity)\n",
+  "   --help:      describe options\n",
+  "   --version:   print version info\n",
+  NULL};
+
+/*
+ * Check that a private key actually works, by signing and validating
+ * a test value.  (The prepared key file will not be checked again
+ * when it is loaded.)
+ */
+static int check_key(const RSKey* key)
+{
+  mpz_t hash, sig;
+  int e = RS_SUCCESS;
+
+  if (!mpz_sgn(key->d))
+    return RS_SUCCESS;
+
+  mpz_init(hash);
+  mpz_init(sig);
+  mpz_set_ui(hash, 0x1234567);
+
+  if (!(e = rs_sign_rsa(sig, hash, key)))
+    e = rs_validate_rsa(sig, hash, key);
+
+  mpz_clear(hash);
+  mpz_clear(sig);
+  return e;
+}
+
+/*
+ * Convert a single key file.
+ */
+static int convert_key(const char* infilename,  /* input file name */
+		       const char* outfilename, /* output file name (NULL
+						   = default) */
+		       unsigned long keyid)	/* key ID (0 = default) */
+{
+  RSKey* key;
+  FILE* f;
+  const char* p;
+  char *end, *tempname;
+  int e;
+
+  if (!(f = fopen(infilename, "rb"))) {
+    perror(infilename);
+    return 4;
+  }
+
+  key = rs_key_new();
+  if (!key || rs_read_key_file(key, f, infilename, 1)) {
+    fclose(f);
+    rs_key_free(key);
+    return 3;
+  }
+  fclose(f);
+
+  /* Key files in Rabin format don't include an ID; use the file
+     name, as rs_key_find_for_id() would. */
+  if (keyid)
+    key->id = keyid;
+  if (!key->id) {
+    p = getbasename(infilename);
+    key->id = strtoul(p, &end, 16);
+    if (end == p || (*end && *end != '.')) {
+      rs_error(key, NULL, "unable to determine key ID (use -K)");
+      rs_key_free(key);
+      return 3;
+    }
+  }
+
+  if ((e = rs_key_prepare(key)) || (e = check_key(key))) {
+    rs_error(key, NULL, "key check failed");
+    rs_key_free(key);
+    return 3;
+  }
+
+  if (outfilename) {
+    tempname = rs_strdup(outfilename);
+  }
+  else {
+    tempname = rs_malloc(strlen(infilename) + 5);
+    if (tempname) {
+      strcpy(tempname, infilename);
+      if ((end = strrchr(tempname, '.')) && !strchr(end, '/'))
+	*end = 0;
+      strcat(tempname, ".rsk");
+    }
+  }
+
+  if (!tempname) {
+    rs_key_free(key);
+    return 4;
+  }
+
+  if (!strcmp(tempname, infilename)) {
+    fprintf(stderr, "%s: input and output files are the same\n",
+	    infilename);
+    rs_free(tempname);
+    rs_key_free(key);
+    return 5;
+  }
+
+  if (!(f = fopen(tempname, "wb"))) {
+    perror(tempname);
+    rs_free(tempname);
+    rs_key_free(key);
+    return 4;
+  }
+
+  e = rs_write_key_rsk(key, f);
+  if (fclose(f) && !e) {
+    perror(tempname);
+    e = RS_ERR_FILE_IO;
+  }
+
+  if (!e)
+    rs_message(1, key, NULL, "wrote key %lX to %s", key->id, tempname);
+  else
+    remove(tempname);
+
+  rs_free(tempname);
+  rs_key_free(key);
+  return (e ? 4 : 0);
+}
+
+int main(int argc, char** argv)
+{
+  static const char optstring[] = "K:o:qv";
+  const char* progname;
+  const char* outfilename = NULL;
+  const char* arg;
+  unsigned long keyid = 0;
+  int verbose = 0;
+  int i, j, c, e, nfiles = 0;
+
+  progname = getbasename(argv[0]);
+  rs_set_progname(progname);
+
+  if (argc == 1) {
+    fprintf(stderr, usage[0], progname);
+    for (i = 1; usage[i]; i++)
+      fputs(usage[i], stderr);
+    fprintf(stderr, "Report bugs to %s.\n", PACKAGE_BUGREPORT);
+    return 5;
+  }
+
+  i = j = 1;
+  while ((c = rs_parse_cmdline(argc, argv, optstring, &i, &j, &arg))) {
+    switch (c) {
+    case RS_CMDLINE_HELP:
+      printf(usage[0], progname);
+      for (i = 1; usage[i]; i++)
+	fputs(usage[i], stdout);
+      printf("Report bugs to %s.\n", PACKAGE_BUGREPORT);
+      return 0;
+
+    case RS_CMDLINE_VERSION:
+      printf("rskeyconv (%s) %s\n", PACKAGE_NAME, PACKAGE_VERSION);
+      fputs("Copyright (C) 2009 Benjamin Moody\n", stdout);
+      fputs("This program is free software.  ", stdout);
+      fputs("There is NO WARRANTY of any kind.\n", stdout);
+      return 0;
+
+    case 'K':
+      if (!sscanf(arg, "%lx", &keyid)) {
+	fprintf(stderr, "%s: -K: invalid argument %s\n", progname, arg);
+	return 5;
+      }
+      break;
+
+    case 'o':
+      outfilename = arg;
+      break;
+
+    case 'v':
+      verbose++;
+      break;
+
+    case 'q':
+      verbose--;
+      break;
+
+    case RS_CMDLINE_FILENAME:
+      nfiles++;
+      break;
+
+    case RS_CMDLINE_ERROR:
+      return 5;
+
+    default:
+      fprintf(stderr, "%s: internal error: unknown option -%c\n",
+	      progname, c);
+      abort();
+    }
+  }
+
+  if (outfilename && nfiles > 1) {
+    fprintf(stderr, "%s: -o cannot be used with more than one file\n",
+	    progname);
+    return 5;
+  }
+
+  rs_set_verbose(verbose);
+
+  i = j = 1;
+  while ((c = rs_parse_cmdline(argc, argv, optstring, &i, &j, &arg))) {
+    if (c == RS_CMDLINE_FILENAME
+	&& (e = convert_key(arg, outfilename, keyid)))
+      return e;
+  }
+
+  return 0;
+}
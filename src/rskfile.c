@@ -0,0 +1,282 @@
+/*
+ * RabbitSign - Tools for signing TI graphing calculator software
+ * Copyright (C) 2009 Benjamin Moody
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+
+#ifdef HAVE_STRING_H
+# include <string.h>
+#else
+# ifdef HAVE_STRINGS_H
+#  include <strings.h>
+# endif
+#endif
+
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP) && defined(HAVE_SYS_STAT_H)
+# define RS_USE_MMAP
+# ifdef HAVE_SYS_TYPES_H
+#  include <sys/types.h>
+# endif
+# include <sys/stat.h>
+# include <sys/mman.h>
+#endif
+
+#include "rabbitsign.h"
+#include "internal.h"
+#include "sha256.h"
+
+/*
+ * Prepared key files
+ *
+ * A prepared (.rsk) key file holds a key together with all of the
+ * values computed by rs_key_prepare(), so that it can be used
+ * without any further computation.  The file is checked when it is
+ * created, and a checksum of its contents is stored at the end, so
+ * the checks done when reading a text key file are not needed.
+ *
+ * All integers are 32-bit big-endian values.  Each key value is
+ * stored as a length followed by the bytes of the number, least
+ * significant first.
+ *
+ *   "RSK1"  keyid  nvalues  <n> <e> <p> <q> <d> <qinv> <dp> <dq>
+ *   SHA-256 of everything before it
+ */
+
+#define RSK_MAGIC "RSK1"
+#define RSK_NVALUES 8
+#define RSK_HASH_SIZE 32
+
+/*
+ * Check whether a block of data looks like a prepared key file.
+ */
+int rs_is_key_rsk(const unsigned char* data,   /* data */
+		  unsigned long length)	       /* length of data */
+{
+  return (length >= 4 && !memcmp(data, RSK_MAGIC, 4));
+}
+
+/*
+ * Read a key from prepared key data.
+ */
+int rs_parse_key_rsk(RSKey* key,		 /* key structure */
+		     const unsigned char* data,	 /* file contents */
+		     unsigned long length,	 /* length of data */
+		     const char* fname)		 /* file name */
+{
+  mpz_t* values[RSK_NVALUES];
+  struct sha256_ctx ctx;
+  unsigned char hash[RSK_HASH_SIZE];
+  unsigned long pos, n, i;
+
+  values[0] = &key->n;
+  values[1] = &key->e;
+  values[2] = &key->p;
+  values[3] = &key->q;
+  values[4] = &key->d;
+  values[5] = &key->qinv;
+  values[6] = &key->dp;
+  values[7] = &key->dq;
+
+  if (fname != key->filename) {
+    rs_ctx_free(key->ctx, key->filename);
+    key->filename = rs_ctx_strdup(key->ctx, fname);
+    if (fname && !key->filename)
+      return RS_ERR_OUT_OF_MEMORY;
+  }
+
+  if (length < 12 + RSK_HASH_SIZE || !rs_is_key_rsk(data, length)) {
+    rs_error(key, NULL, "invalid key file syntax");
+    return RS_ERR_KEY_SYNTAX;
+  }
+
+  length -= RSK_HASH_SIZE;
+  sha256_init_ctx(&ctx);
+  sha256_process_bytes(data, length, &ctx);
+  sha256_finish_ctx(&ctx, hash);
+  if (memcmp(hash, data + length, RSK_HASH_SIZE)) {
+    rs_error(key, NULL, "key file is corrupt (checksum mismatch)");
+    return RS_ERR_INVALID_KEY;
+  }
+
+  if (rs_get_u32(data + 8) != RSK_NVALUES) {
+    rs_error(key, NULL, "unsupported key file version");
+    return RS_ERR_KEY_SYNTAX;
+  }
+
+  key->id = rs_get_u32(data + 4);
+  pos = 12;
+
+  for (i = 0; i < RSK_NVALUES; i++) {
+    if (pos + 4 > length
+	|| (n = rs_get_u32(data + pos)) > length - pos - 4) {
+      rs_error(key, NULL, "invalid key file syntax");
+      return RS_ERR_KEY_SYNTAX;
+    }
+    pos += 4;
+
+    if (n)
+      mpz_import(*values[i], n, -1, 1, 0, 0, data + pos);
+    else
+      mpz_set_ui(*values[i], 0);
+    pos += n;
+  }
+
+  if (!mpz_sgn(key->n) || !mpz_sgn(key->e)) {
+    rs_error(key, NULL, "invalid key file");
+    return RS_ERR_KEY_SYNTAX;
+  }
+
+  rs_message(2, key, NULL, "Loaded prepared key %lX:", key->id);
+  rs_message(2, key, NULL, " n = %ZX", key->n);
+  if (mpz_sgn(key->p))
+    rs_message(2, key, NULL, " p = %ZX", key->p);
+  if (mpz_sgn(key->q))
+    rs_message(2, key, NULL, " q = %ZX", key->q);
+  if (mpz_sgn(key->d))
+    rs_message(2, key, NULL, " d = %ZX", key->d);
+  rs_message(2, key, NULL, " e = %ZX", key->e);
+  return RS_SUCCESS;
+}
+
+/*
+ * Read a key from a prepared key file.
+ *
+ * If possible, the file is mapped into memory rather than read.
+ */
+int rs_read_key_rsk(RSKey* key,	       /* key structure */
+		    FILE* f,	       /* file to read */
+		    const char* fname) /* file name */
+{
+  unsigned char *data, *p;
+  unsigned long length, alloc;
+  size_t n;
+  int e;
+#ifdef RS_USE_MMAP
+  struct stat st;
+  void* map;
+
+  if (ftell(f) == 0 && !fstat(fileno(f), &st) && S_ISREG(st.st_mode)
+      && st.st_size > 0) {
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+    if (map != MAP_FAILED) {
+      e = rs_parse_key_rsk(key, map, st.st_size, fname);
+      munmap(map, st.st_size);
+      return e;
+    }
+  }
+#endif
+
+  data = NULL;
+  length = alloc = 0;
+  do {
+    if (length >= alloc) {
+      alloc = length + 1024;
+      p = rs_ctx_realloc(key->ctx, data, alloc);
+      if (!p) {
+	rs_ctx_free(key->ctx, data);
+	return RS_ERR_OUT_OF_MEMORY;
+      }
+      data = p;
+    }
+    n = fread(data + length, 1, alloc - length, f);
+    length += n;
+  } while (n > 0);
+
+  e = rs_parse_key_rsk(key, data, length, fname);
+  rs_ctx_free(key->ctx, data);
+  return e;
+}
+
+/*
+ * Add a key value to the output buffer.
+ */
+static void add_value(unsigned char* buf,   /* output buffer */
+		      unsigned long* pos,   /* position in buffer */
+		      const mpz_t value)    /* value */
+{
+  size_t count = 0;
+
+  if (mpz_sgn(value))
+    mpz_export(buf + *pos + 4, &count, -1, 1, 0, 0, value);
+
+  rs_put_u32(buf + *pos, count);
+  *pos += 4 + count;
+}
+
+/*
+ * Write a key to a prepared key file.
+ *
+ * The key should be prepared (using rs_key_prepare()) first.  The key
+ * ID must be set.
+ */
+int rs_write_key_rsk(const RSKey* key, /* key structure */
+		     FILE* f)	       /* file to write */
+{
+  const mpz_t* values[RSK_NVALUES];
+  struct sha256_ctx ctx;
+  unsigned char* buf;
+  unsigned long pos, alloc;
+  int i;
+
+  values[0] = &key->n;
+  values[1] = &key->e;
+  values[2] = &key->p;
+  values[3] = &key->q;
+  values[4] = &key->d;
+  values[5] = &key->qinv;
+  values[6] = &key->dp;
+  values[7] = &key->dq;
+
+  if (!mpz_sgn(key->n)) {
+    rs_error(key, NULL, "unable to save key: public key missing");
+    return RS_ERR_MISSING_PUBLIC_KEY;
+  }
+
+  alloc = 12 + RSK_HASH_SIZE;
+  for (i = 0; i < RSK_NVALUES; i++)
+    alloc += 4 + (mpz_sizeinbase(*values[i], 2) + 7) / 8;
+
+  buf = rs_ctx_malloc(key->ctx, alloc);
+  if (!buf)
+    return RS_ERR_OUT_OF_MEMORY;
+
+  memcpy(buf, RSK_MAGIC, 4);
+  rs_put_u32(buf + 4, key->id);
+  rs_put_u32(buf + 8, RSK_NVALUES);
+  pos = 12;
+
+  for (i = 0; i < RSK_NVALUES; i++)
+    add_value(buf, &pos, *values[i]);
+
+  sha256_init_ctx(&ctx);
+  sha256_process_bytes(buf, pos, &ctx);
+  sha256_finish_ctx(&ctx, buf + pos);
+  pos += RSK_HASH_SIZE;
+
+  if (fwrite(buf, 1, pos, f) != pos) {
+    rs_ctx_free(key->ctx, buf);
+    rs_error(key, NULL, "unable to write key file");
+    return RS_ERR_FILE_IO;
+  }
+
+  rs_ctx_free(key->ctx, buf);
+  return RS_SUCCESS;
+}
@@ -0,0 +1,653 @@
+/*
+ * RabbitSign - Tools for signing TI graphing calculator software
+ * Copyright (C) 2009 Benjamin Moody
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <time.h>
+
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+# include <string.h>
+#else
+# ifdef HAVE_STRINGS_H
+#  include <strings.h>
+# endif
+#endif
+
+#ifdef HAVE_SYS_TIME_H
+# include <sys/time.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#if defined(HAVE_DIRENT_H) && defined(HAVE_SYS_STAT_H)
+# define RS_WALK_DIRS
+# ifdef HAVE_SYS_TYPES_H
+#  include <sys/types.h>
+# endif
+# include <sys/stat.h>
+# include <dirent.h>
+#endif
+
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
+#include "rabbitsign.h"
+#include "internal.h"
+
+#if !defined(strrchr) && !defined(HAVE_STRRCHR) && defined(HAVE_RINDEX)
+# define strrchr rindex
+#endif
+
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t key_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+# define LOCK(x) pthread_mutex_lock(&x##_lock)
+# define UNLOCK(x) pthread_mutex_unlock(&x##_lock)
+#else
+# define LOCK(x)
+# define UNLOCK(x)
+#endif
+
+/* Loaded keys (only used while holding key_lock) */
+static RSKeyCache* keycache = NULL;
+
+/* Files to be checked */
+static char** files = NULL;
+static unsigned long nfiles = 0;
+static unsigned long nfiles_a = 0;
+
+/* Files being read (the batch does its own locking) */
+static RSBatchIO* batch = NULL;
+
+/* Worst status so far (only used while holding queue_lock) */
+static int worst = 0;
+
+/* State of a worker thread */
+typedef struct _Worker {
+  RSContext* ctx;
+  char msg[512];		/* last error message */
+  char note[512];		/* last informative message */
+} Worker;
+
+static int verbose = 0;
+
+static const char* getbasename(const char* f)
+{
+  const char *p;
+
+  if ((p = strrchr(f, '/')))
+    f = p + 1;
+
+#if defined(__MSDOS__) || defined(__WIN32__)
+  if ((p = strrchr(f, '\\')))
+    f = p + 1;
+#endif
+
+  return f;
+}
+
+static const char* usage[]={
+  "Usage: %s [options] file-or-directory ...\n",
+  "Check the signatures of all programs in the given files and\n",
+  "directories, and print a report (one JSON object per line.)\n",
+  "Where options may include:\n",
+  "   -j N:        check N files at once (default: number of CPUs)\n",
+  "   -k KEYFILE:  load specified key file (may be used more than once)\n",
+  "   -q:          suppress warning messages\n",
+  "   -v:          be verbose (-vv for even more verbosity)\n",
+  "   --io BACKEND:\n",
+  "                read files using BACKEND (auto, uring, threads, or\n",
+  "                sync)\n",
+  "   --help:      describe options\n",
+  "   --version:   print version info\n",
+  NULL};
+
+/*
+ * Get the current time in microseconds.
+ */
+static double get_time(void)
+{
+#ifdef HAVE_SYS_TIME_H
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return (tv.tv_sec * 1000000.0 + tv.tv_usec);
+#else
+  return (time(NULL) * 1000000.0);
+#endif
+}
+
+/*
+ * Add a file to the list of files to be checked.
+ */
+static int add_file(const char* name) /* file name */
+{
+  char** p;
+
+  if (nfiles >= nfiles_a) {
+    nfiles_a = nfiles * 2 + 64;
+    p = rs_realloc(files, nfiles_a * sizeof(char*));
+    if (!p)
+      return RS_ERR_OUT_OF_MEMORY;
+    files = p;
+  }
+
+  if (!(files[nfiles] = rs_strdup(name)))
+    return RS_ERR_OUT_OF_MEMORY;
+  nfiles++;
+  return RS_SUCCESS;
+}
+
+#ifdef RS_WALK_DIRS
+
+/*
+ * Check whether a file found in a directory looks like a program:
+ * either its name has a known suffix, or it begins like a GraphLink
+ * file or an Intel hex file.
+ */
+static int is_program_file(const char* name) /* file name */
+{
+  const char* ext;
+  char buf[4];
+  FILE* f;
+  int n;
+
+  if ((ext = strrchr(getbasename(name), '.'))
+      && !rs_suffix_to_type(ext + 1, NULL, NULL))
+    return 1;
+
+  if (!(f = fopen(name, "rb")))
+    return 0;
+  n = fread(buf, 1, 4, f);
+  fclose(f);
+
+  return ((n == 4 && !memcmp(buf, "**TI", 4))
+	  || (n >= 1 && buf[0] == ':'));
+}
+
+/*
+ * Add all program files in a directory (and its subdirectories) to
+ * the list.
+ */
+static int scan_dir(const char* dname) /* directory name */
+{
+  DIR* d;
+  struct dirent* de;
+  struct stat st;
+  char* path;
+  int e = RS_SUCCESS;
+
+  if (!(d = opendir(dname))) {
+    perror(dname);
+    return RS_ERR_FILE_IO;
+  }
+
+  while (!e && (de = readdir(d))) {
+    if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+      continue;
+
+    path = rs_malloc(strlen(dname) + strlen(de->d_name) + 2);
+    if (!path) {
+      e = RS_ERR_OUT_OF_MEMORY;
+      break;
+    }
+    strcpy(path, dname);
+    strcat(path, "/");
+    strcat(path, de->d_name);
+
+    if (!stat(path, &st)) {
+      if (S_ISDIR(st.st_mode))
+	e = scan_dir(path);
+      else if (S_ISREG(st.st_mode) && is_program_file(path))
+	e = add_file(path);
+    }
+    rs_free(path);
+  }
+
+  closedir(d);
+  return e;
+}
+
+#endif /* RS_WALK_DIRS */
+
+/*
+ * Add a file or directory named on the command line to the list.
+ * Files named explicitly are always checked.
+ */
+static int add_path(const char* name) /* file or directory name */
+{
+#ifdef RS_WALK_DIRS
+  struct stat st;
+
+  if (!stat(name, &st) && S_ISDIR(st.st_mode))
+    return scan_dir(name);
+#endif
+
+  return add_file(name);
+}
+
+/*
+ * Write a string to the report, in JSON syntax.
+ */
+static void print_json_string(const char* s) /* string */
+{
+  putchar('"');
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\')
+      printf("\\%c", *s);
+    else if ((unsigned char) *s < 0x20)
+      printf("\\u%04x", (unsigned char) *s);
+    else
+      putchar(*s);
+  }
+  putchar('"');
+}
+
+/*
+ * Save the last error message for a file.
+ */
+static void capture_error(const RSKey* key RS_ATTR_UNUSED,
+			  const RSProgram* prgm RS_ATTR_UNUSED,
+			  const char* msg, void* data)
+{
+  Worker* w = data;
+
+  if (!strncmp(msg, "error: ", 7)) {
+    strncpy(w->msg, msg + 7, sizeof(w->msg) - 1);
+    w->msg[sizeof(w->msg) - 1] = 0;
+  }
+}
+
+/*
+ * Save the last informative message for a file (and display it if in
+ * verbose mode.)
+ */
+static void capture_message(const RSKey* key RS_ATTR_UNUSED,
+			    const RSProgram* prgm,
+			    const char* msg, void* data)
+{
+  Worker* w = data;
+
+  strncpy(w->note, msg, sizeof(w->note) - 1);
+  w->note[sizeof(w->note) - 1] = 0;
+
+  if (verbose > 0) {
+    LOCK(output);
+    fprintf(stderr, "%s: %s\n", (prgm && prgm->filename
+				 ? prgm->filename : "rsverify"), msg);
+    UNLOCK(output);
+  }
+}
+
+/*
+ * Check a single file, once it has been read, and print the result.
+ */
+static void verify_file(Worker* w,	       /* worker state */
+			const RSBatchIOResult* res, /* file contents */
+			double t0)	       /* time when we started
+						  waiting for the file */
+{
+  RSProgram* prgm;
+  const RSKey* key;
+  const char* name = res->filename;
+  const char* ext;
+  unsigned long keyid = 0;
+  double t1, t2;
+  int e, status;
+
+  w->msg[0] = w->note[0] = 0;
+  w->ctx->stats.warnings = 0;
+
+  if (!(prgm = rs_program_new_with_context(w->ctx))) {
+    e = RS_ERR_OUT_OF_MEMORY;
+  }
+  else if (res->error) {
+    e = RS_ERR_FILE_IO;
+    strncpy(w->msg, strerror(res->error), sizeof(w->msg) - 1);
+    w->msg[sizeof(w->msg) - 1] = 0;
+  }
+  else if (!(prgm->filename = rs_ctx_strdup(w->ctx, name))) {
+    e = RS_ERR_OUT_OF_MEMORY;
+  }
+  else {
+    if ((ext = strrchr(getbasename(name), '.')))
+      rs_suffix_to_type(ext + 1, &prgm->calctype, &prgm->datatype);
+    e = rs_read_program_buffer(prgm, res->data, res->length,
+			       RS_INPUT_SORTED);
+  }
+
+  t1 = get_time();
+
+  if (!e) {
+    if (!(keyid = rs_program_get_key_id(prgm))) {
+      rs_error(NULL, prgm, "unable to determine key ID");
+      e = RS_ERR_MISSING_KEY_ID;
+    }
+    else {
+      LOCK(key);
+      key = rs_key_cache_find(keycache, keyid, 1);
+      UNLOCK(key);
+
+      if (!key) {
+	rs_error(NULL, prgm, "no key available for ID %lX", keyid);
+	e = RS_ERR_KEY_NOT_FOUND;
+      }
+      else {
+	e = rs_validate_program(prgm, key);
+	LOCK(key);
+	rs_key_cache_release(keycache, key);
+	UNLOCK(key);
+      }
+    }
+  }
+
+  t2 = get_time();
+
+  if (!e)
+    status = 0;
+  else if (e == RS_ERR_FILE_IO || e == RS_ERR_OUT_OF_MEMORY)
+    status = 4;
+  else if (e == RS_ERR_KEY_NOT_FOUND || e == RS_ERR_MISSING_KEY_ID)
+    status = 3;
+  else
+    status = 1;
+
+  LOCK(output);
+  fputs("{\"file\":", stdout);
+  print_json_string(name);
+  if (prgm && prgm->calctype && prgm->datatype)
+    printf(",\"type\":\"%s\"",
+	   rs_type_to_suffix(prgm->calctype, prgm->datatype, 0));
+  else
+    fputs(",\"type\":null", stdout);
+  if (keyid)
+    printf(",\"key\":\"%04lX\"", keyid);
+  else
+    fputs(",\"key\":null", stdout);
+  printf(",\"status\":%d,\"result\":\"%s\",\"message\":",
+	 e, rs_status_to_string(e));
+  print_json_string(e && !w->msg[0] ? w->note : w->msg);
+  printf(",\"warnings\":%lu,\"read_ms\":%.3f,\"verify_ms\":%.3f}\n",
+	 w->ctx->stats.warnings, (t1 - t0) / 1000.0, (t2 - t1) / 1000.0);
+  fflush(stdout);
+  UNLOCK(output);
+
+  rs_program_free(prgm);
+
+  LOCK(queue);
+  if (status > worst)
+    worst = status;
+  UNLOCK(queue);
+}
+
+/*
+ * Check files as they are read, until there are none left.
+ */
+static void* worker_main(void* data)
+{
+  Worker* w = data;
+  RSBatchIOResult res;
+  double t0;
+
+  while (1) {
+    t0 = get_time();
+    if (!rs_batch_io_wait(batch, &res))
+      break;
+    verify_file(w, &res, t0);
+    rs_batch_io_release(batch, &res);
+  }
+
+  return NULL;
+}
+
+/*
+ * Load a key file given on the command line.
+ */
+static int load_key_file(const char* filename)
+{
+  RSKey* key;
+  FILE* f;
+  const char* p;
+  char* end;
+
+  if (!(f = fopen(filename, "rb"))) {
+    perror(filename);
+    return 3;
+  }
+
+  key = rs_key_new();
+  if (!key || rs_read_key_file(key, f, filename, 1)) {
+    fclose(f);
+    rs_key_free(key);
+    return 3;
+  }
+  fclose(f);
+
+  /* Key files in Rabin format don't include an ID; use the file
+     name, as rs_key_find_for_id() would. */
+  if (!key->id) {
+    p = getbasename(filename);
+    key->id = strtoul(p, &end, 16);
+    if (end == p || (*end && *end != '.')) {
+      rs_error(key, NULL, "unable to determine key ID");
+      rs_key_free(key);
+      return 3;
+    }
+  }
+
+  rs_key_cache_add(keycache, key);
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  static const char optstring[] = "j:k:qv";
+  static const RSLongOption longopts[] = {
+    { "io", 1, 'I' },
+    { NULL, 0, 0 }
+  };
+  const char *progname;
+  int i, j, c, e;
+  const char* arg;
+  int nworkers = 0;
+  Worker* workers;
+  RSBatchIOBackend backend = RS_BATCH_IO_AUTO;
+  RSContext* bioctx;
+  unsigned long n;
+#ifdef HAVE_PTHREAD
+  pthread_t* threads;
+  int nthreads;
+#endif
+
+  progname = getbasename(argv[0]);
+  rs_set_progname(progname);
+
+  if (argc == 1) {
+    fprintf(stderr, usage[0], progname);
+    for (i = 1; usage[i]; i++)
+      fputs(usage[i], stderr);
+    fprintf(stderr, "Report bugs to %s.\n", PACKAGE_BUGREPORT);
+    return 5;
+  }
+
+  i = j = 1;
+  while ((c = rs_parse_cmdline_long(argc, argv, optstring, longopts,
+				    &i, &j, &arg))) {
+    switch (c) {
+    case RS_CMDLINE_HELP:
+      printf(usage[0], progname);
+      for (i = 1; usage[i]; i++)
+	fputs(usage[i], stdout);
+      printf("Report bugs to %s.\n", PACKAGE_BUGREPORT);
+      return 0;
+
+    case RS_CMDLINE_VERSION:
+      printf("rsverify (%s) %s\n", PACKAGE_NAME, PACKAGE_VERSION);
+      fputs("Copyright (C) 2009 Benjamin Moody\n", stdout);
+      fputs("This program is free software.  ", stdout);
+      fputs("There is NO WARRANTY of any kind.\n", stdout);
+      return 0;
+
+    case 'j':
+      if (!sscanf(arg, "%d", &nworkers) || nworkers < 1) {
+	fprintf(stderr, "%s: -j: invalid argument %s\n", progname, arg);
+	return 5;
+      }
+      break;
+
+    case 'k':
+      break;
+
+    case 'I':
+      if (rs_batch_io_parse_backend(arg, &backend)) {
+	fprintf(stderr, "%s: --io: unknown backend %s\n", progname, arg);
+	return 5;
+      }
+      break;
+
+    case 'v':
+      verbose++;
+      break;
+
+    case 'q':
+      verbose--;
+      break;
+
+    case RS_CMDLINE_FILENAME:
+      break;
+
+    case RS_CMDLINE_ERROR:
+      return 5;
+
+    default:
+      fprintf(stderr, "%s: internal error: unknown option -%c\n",
+	      progname, c);
+      abort();
+    }
+  }
+
+  rs_set_verbose(verbose);
+
+  keycache = rs_key_cache_new(NULL, 64);
+  if (!keycache)
+    return 4;
+
+  /* Load keys and find files to check */
+
+  i = j = 1;
+  while ((c = rs_parse_cmdline_long(argc, argv, optstring, longopts,
+				    &i, &j, &arg))) {
+    if (c == 'k') {
+      if (load_key_file(arg))
+	return 3;
+    }
+    else if (c == RS_CMDLINE_FILENAME) {
+      if ((e = add_path(arg)) == RS_ERR_OUT_OF_MEMORY)
+	return 4;
+      else if (e)
+	worst = 4;
+    }
+  }
+
+  /* Start reading files (the batch has its own context, since it
+     allocates buffers in whichever thread is reading) */
+
+  if (!(bioctx = rs_context_new())
+      || !(batch = rs_batch_io_new(bioctx, backend, 0)))
+    return 4;
+
+  if (verbose > 0)
+    fprintf(stderr, "%s: reading files using %s\n", progname,
+	    rs_batch_io_backend_name(rs_batch_io_backend(batch)));
+
+  for (n = 0; n < nfiles; n++)
+    if (rs_batch_io_read(batch, files[n], files[n]))
+      return 4;
+
+  /* Check files */
+
+#ifdef HAVE_PTHREAD
+# if defined(HAVE_UNISTD_H) && defined(_SC_NPROCESSORS_ONLN)
+  if (!nworkers)
+    nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+# endif
+  if (nworkers < 1)
+    nworkers = 1;
+  if ((unsigned long) nworkers > nfiles)
+    nworkers = (nfiles ? nfiles : 1);
+#else
+  nworkers = 1;
+#endif
+
+  workers = rs_malloc(nworkers * sizeof(Worker));
+  if (!workers)
+    return 4;
+
+  for (i = 0; i < nworkers; i++) {
+    if (!(workers[i].ctx = rs_context_new()))
+      return 4;
+    rs_context_set_error_func(workers[i].ctx, &capture_error, &workers[i]);
+    rs_context_set_message_func(workers[i].ctx, &capture_message,
+				&workers[i]);
+  }
+
+#ifdef HAVE_PTHREAD
+  threads = rs_malloc(nworkers * sizeof(pthread_t));
+  if (!threads)
+    return 4;
+
+  for (nthreads = 1; nthreads < nworkers; nthreads++) {
+    if (pthread_create(&threads[nthreads], NULL, &worker_main,
+		       &workers[nthreads])) {
+      rs_error(NULL, NULL, "unable to create thread");
+      break;
+    }
+  }
+  worker_main(&workers[0]);
+  for (i = 1; i < nthreads; i++)
+    pthread_join(threads[i], NULL);
+  rs_free(threads);
+#else
+  worker_main(&workers[0]);
+#endif
+
+  for (i = 0; i < nworkers; i++)
+    rs_context_free(workers[i].ctx);
+  rs_free(workers);
+
+  rs_batch_io_free(batch);
+  rs_context_free(bioctx);
+
+  for (i = 0; (unsigned long) i < nfiles; i++)
+    rs_free(files[i]);
+  rs_free(files);
+  rs_key_cache_free(keycache);
+
+  return worst;
+}
@@ -0,0 +1,518 @@
+/*
+ * RabbitSign - Tools for signing TI graphing calculator software
+ * Copyright (C) 2009 Benjamin Moody
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+
+#ifdef HAVE_STRING_H
+# include <string.h>
+#else
+# ifdef HAVE_STRINGS_H
+#  include <strings.h>
+# endif
+#endif
+
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP) && defined(HAVE_SYS_STAT_H) \
+  && defined(HAVE_FCNTL_H) && defined(HAVE_UNISTD_H)
+# define RS_USE_SIG_CACHE
+# ifdef HAVE_SYS_TYPES_H
+#  include <sys/types.h>
+# endif
+# include <sys/stat.h>
+# include <sys/mman.h>
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
+#include "rabbitsign.h"
+#include "internal.h"
+#include "sha256.h"
+
+/*
+ * Signature cache
+ *
+ * Signatures are deterministic: the same digest, signed with the
+ * same key and root number, always produces the same signature.  A
+ * signature cache records the signatures that have been computed,
+ * so that signing an unchanged program again does not require any
+ * bignum arithmetic.
+ *
+ * The cache is a fixed-size hash table stored in a file, which is
+ * mapped into memory by each process using it.  Each slot is
+ * identified by a tag (a SHA-256 hash of the key ID, the key's
+ * public values, the signature type, the root number, and the digest)
+ * and holds the signature, along with a check value computed over
+ * the slot's contents.  Writers lock the file while updating it (and
+ * also hold a mutex, since fcntl locks don't exclude other threads of
+ * the same process), and always clear the check value first and set
+ * it last; readers don't take any locks, and simply ignore slots
+ * whose check value doesn't match.  A signature read from the cache
+ * is always checked against the public key before it is used, so a
+ * damaged or tampered cache file can't cause a bad signature to be
+ * written.
+ *
+ * All integers are big-endian.
+ *
+ *   header:  "RSSC"  version  nslots  slotsize
+ *   slot:    tag[32]  check[8]  siglength[2]  f  0  sig[512]
+ */
+
+#define SC_MAGIC "RSSC"
+#define SC_VERSION 1
+#define SC_HEADER_SIZE 16
+#define SC_TAG_SIZE 32
+#define SC_CHECK_SIZE 8
+#define SC_SIG_MAX 512
+#define SC_SLOT_SIZE (SC_TAG_SIZE + SC_CHECK_SIZE + 4 + SC_SIG_MAX)
+#define SC_PROBES 8
+
+#ifdef RS_USE_SIG_CACHE
+
+struct _RSSigCache {
+  RSContext* ctx;
+  int fd;			/* cache file */
+  int writable;			/* 1 = file opened for writing */
+  unsigned char* map;		/* mapped contents of file */
+  unsigned long mapsize;	/* size of mapping */
+  unsigned long nslots;		/* number of slots */
+#ifdef HAVE_PTHREAD
+  pthread_mutex_t lock;		/* held while writing */
+#endif
+};
+
+#ifdef HAVE_PTHREAD
+# define LOCK(sc) pthread_mutex_lock(&(sc)->lock)
+# define UNLOCK(sc) pthread_mutex_unlock(&(sc)->lock)
+#else
+# define LOCK(sc)
+# define UNLOCK(sc)
+#endif
+
+/*
+ * Lock or unlock the cache file for writing.
+ */
+static int lock_file(int fd,	/* file */
+		     int type)	/* F_WRLCK or F_UNLCK */
+{
+  struct flock lk;
+
+  memset(&lk, 0, sizeof(lk));
+  lk.l_type = type;
+  lk.l_whence = SEEK_SET;
+  return fcntl(fd, (type == F_UNLCK ? F_SETLK : F_SETLKW), &lk);
+}
+
+/*
+ * Write the header of a new cache file.
+ */
+static int init_file(int fd,		    /* file */
+		     unsigned long nslots)  /* number of slots */
+{
+  unsigned char hdr[SC_HEADER_SIZE];
+
+  memcpy(hdr, SC_MAGIC, 4);
+  rs_put_u32(hdr + 4, SC_VERSION);
+  rs_put_u32(hdr + 8, nslots);
+  rs_put_u32(hdr + 12, SC_SLOT_SIZE);
+
+  if (ftruncate(fd, SC_HEADER_SIZE + nslots * SC_SLOT_SIZE))
+    return -1;
+  if (pwrite(fd, hdr, SC_HEADER_SIZE, 0) != SC_HEADER_SIZE)
+    return -1;
+  return 0;
+}
+
+/*
+ * Open a signature cache file, creating it if it doesn't exist.
+ *
+ * If the file needs to be created, it will have room for nslots
+ * signatures (the number of slots of an existing file can't be
+ * changed.)  If the file can't be written, it is opened read-only,
+ * and new signatures will not be added.
+ */
+RSSigCache* rs_sig_cache_open(RSContext* ctx,	     /* context (NULL =
+							default) */
+			      const char* filename,  /* cache file */
+			      unsigned long nslots)  /* number of slots */
+{
+  RSSigCache* sc;
+  struct stat st;
+  void* map;
+  int fd, writable = 1;
+
+  if (!nslots)
+    nslots = 4096;
+
+  if ((fd = open(filename, O_RDWR | O_CREAT, 0666)) < 0) {
+    writable = 0;
+    if ((fd = open(filename, O_RDONLY)) < 0) {
+      rs_ctx_error(ctx, "%s: unable to open signature cache", filename);
+      return NULL;
+    }
+  }
+
+  if (fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+    rs_ctx_error(ctx, "%s: unable to open signature cache", filename);
+    close(fd);
+    return NULL;
+  }
+
+  /* (the lock ensures that we don't see a file that another process
+     is still setting up) */
+  if (writable) {
+    if (lock_file(fd, F_WRLCK)) {
+      rs_ctx_error(ctx, "%s: unable to lock signature cache", filename);
+      close(fd);
+      return NULL;
+    }
+    if (fstat(fd, &st) || (st.st_size == 0 && init_file(fd, nslots))
+	|| fstat(fd, &st)) {
+      rs_ctx_error(ctx, "%s: unable to create signature cache", filename);
+      lock_file(fd, F_UNLCK);
+      close(fd);
+      return NULL;
+    }
+    lock_file(fd, F_UNLCK);
+  }
+
+  if (st.st_size < SC_HEADER_SIZE) {
+    rs_ctx_error(ctx, "%s: invalid signature cache", filename);
+    close(fd);
+    return NULL;
+  }
+
+  map = mmap(NULL, st.st_size,
+	     (writable ? PROT_READ | PROT_WRITE : PROT_READ),
+	     MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    rs_ctx_error(ctx, "%s: unable to map signature cache", filename);
+    close(fd);
+    return NULL;
+  }
+
+  if (memcmp(map, SC_MAGIC, 4)
+      || rs_get_u32((unsigned char*) map + 4) != SC_VERSION
+      || rs_get_u32((unsigned char*) map + 12) != SC_SLOT_SIZE
+      || !(nslots = rs_get_u32((unsigned char*) map + 8))
+      || (SC_HEADER_SIZE + nslots * SC_SLOT_SIZE
+	  > (unsigned long) st.st_size)) {
+    rs_ctx_error(ctx, "%s: invalid signature cache", filename);
+    munmap(map, st.st_size);
+    close(fd);
+    return NULL;
+  }
+
+  if (!(sc = rs_ctx_malloc(ctx, sizeof(RSSigCache)))) {
+    munmap(map, st.st_size);
+    close(fd);
+    return NULL;
+  }
+
+  sc->ctx = ctx;
+  sc->fd = fd;
+  sc->writable = writable;
+  sc->map = map;
+  sc->mapsize = st.st_size;
+  sc->nslots = nslots;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_init(&sc->lock, NULL);
+#endif
+  return sc;
+}
+
+/*
+ * Close a signature cache.
+ */
+void rs_sig_cache_close(RSSigCache* sc) /* signature cache */
+{
+  if (!sc)
+    return;
+
+  munmap(sc->map, sc->mapsize);
+  close(sc->fd);
+#ifdef HAVE_PTHREAD
+  pthread_mutex_destroy(&sc->lock);
+#endif
+  rs_ctx_free(sc->ctx, sc);
+}
+
+/*
+ * Add a number to a hash.
+ */
+static void hash_value(struct sha256_ctx* ctx, /* hash state */
+		       const mpz_t value)      /* value */
+{
+  unsigned char buf[SC_SIG_MAX + 4];
+  size_t count = 0;
+
+  if (mpz_sgn(value) && mpz_sizeinbase(value, 2) <= SC_SIG_MAX * 8)
+    mpz_export(buf + 4, &count, -1, 1, 0, 0, value);
+  rs_put_u32(buf, count);
+  sha256_process_bytes(buf, count + 4, ctx);
+}
+
+/*
+ * Compute the tag identifying a signature.
+ */
+static void get_tag(unsigned char* tag,	       /* buffer for tag */
+		    const RSKey* key,	       /* signing key */
+		    int sigtype,	       /* signature type */
+		    const unsigned char* digest, /* digest */
+		    unsigned int digestlen,    /* length of digest */
+		    int rootnum)	       /* root number */
+{
+  struct sha256_ctx ctx;
+  unsigned char buf[16];
+
+  memcpy(buf, SC_MAGIC, 4);
+  rs_put_u32(buf + 4, key->id);
+  rs_put_u32(buf + 8, sigtype);
+  rs_put_u32(buf + 12, rootnum);
+
+  sha256_init_ctx(&ctx);
+  sha256_process_bytes(buf, 16, &ctx);
+  hash_value(&ctx, key->n);
+  hash_value(&ctx, key->e);
+  rs_put_u32(buf, digestlen);
+  sha256_process_bytes(buf, 4, &ctx);
+  sha256_process_bytes(digest, digestlen, &ctx);
+  sha256_finish_ctx(&ctx, tag);
+}
+
+/*
+ * Compute the check value for a slot.
+ */
+static void get_check(unsigned char* check,	 /* buffer for check */
+		      const unsigned char* slot) /* slot contents */
+{
+  struct sha256_ctx ctx;
+  unsigned char hash[32];
+  unsigned long n;
+
+  n = (slot[SC_TAG_SIZE + SC_CHECK_SIZE] << 8)
+    | slot[SC_TAG_SIZE + SC_CHECK_SIZE + 1];
+  if (n > SC_SIG_MAX)
+    n = SC_SIG_MAX;
+
+  sha256_init_ctx(&ctx);
+  sha256_process_bytes(slot, SC_TAG_SIZE, &ctx);
+  sha256_process_bytes(slot + SC_TAG_SIZE + SC_CHECK_SIZE, 4 + n, &ctx);
+  sha256_finish_ctx(&ctx, hash);
+  memcpy(check, hash, SC_CHECK_SIZE);
+}
+
+static unsigned char* get_slot(const RSSigCache* sc, /* cache */
+			       unsigned long i)	     /* slot number */
+{
+  return sc->map + SC_HEADER_SIZE + (i % sc->nslots) * SC_SLOT_SIZE;
+}
+
+static int slot_is_empty(const unsigned char* slot)
+{
+  int i;
+
+  for (i = 0; i < SC_TAG_SIZE; i++)
+    if (slot[i])
+      return 0;
+  return 1;
+}
+
+/*
+ * Check that a signature read from the cache is valid.
+ */
+static int check_sig(const RSKey* key,		   /* signing key */
+		     int sigtype,		   /* signature type */
+		     const unsigned char* digest, /* digest */
+		     unsigned int digestlen,	   /* length of digest */
+		     const mpz_t sig,		   /* signature */
+		     int f)			   /* f value (for
+						      Rabin) */
+{
+  mpz_t hashv;
+  int e;
+
+  mpz_init(hashv);
+  mpz_import(hashv, digestlen, -1, 1, 0, 0, digest);
+  if (sigtype == RS_SIG_CACHE_RABIN)
+    e = rs_validate_rabin(sig, f, hashv, key);
+  else
+    e = rs_validate_rsa(sig, hashv, key);
+  mpz_clear(hashv);
+  return e;
+}
+
+/*
+ * Look up a signature in the cache.  Returns 0 if found.
+ */
+int rs_sig_cache_lookup(const RSSigCache* sc,	     /* cache */
+			const RSKey* key,	     /* signing key */
+			int sigtype,		     /* signature type */
+			const unsigned char* digest, /* digest */
+			unsigned int digestlen,	     /* length of digest */
+			int rootnum,		     /* root number */
+			mpz_t sig,		     /* signature */
+			int* f)			     /* f value (for
+							Rabin) */
+{
+  unsigned char tag[SC_TAG_SIZE], check[SC_CHECK_SIZE];
+  const unsigned char* slot;
+  unsigned long start, i, n;
+  int fv;
+
+  get_tag(tag, key, sigtype, digest, digestlen, rootnum);
+  start = rs_get_u32(tag);
+
+  for (i = 0; i < SC_PROBES; i++) {
+    slot = get_slot(sc, start + i);
+    if (slot_is_empty(slot))
+      break;
+    if (memcmp(slot, tag, SC_TAG_SIZE))
+      continue;
+
+    get_check(check, slot);
+    if (memcmp(check, slot + SC_TAG_SIZE, SC_CHECK_SIZE))
+      continue;
+
+    slot += SC_TAG_SIZE + SC_CHECK_SIZE;
+    n = (slot[0] << 8) | slot[1];
+    fv = slot[2];
+    if (n)
+      mpz_import(sig, n, -1, 1, 0, 0, slot + 4);
+    else
+      mpz_set_ui(sig, 0);
+
+    if (check_sig(key, sigtype, digest, digestlen, sig, fv)) {
+      rs_warning(key, NULL, "ignoring invalid signature in cache");
+      continue;
+    }
+
+    if (f)
+      *f = fv;
+    rs_message(2, key, NULL, "using cached signature");
+    return 0;
+  }
+
+  return -1;
+}
+
+/*
+ * Add a signature to the cache.
+ */
+void rs_sig_cache_store(RSSigCache* sc,		    /* cache */
+			const RSKey* key,	    /* signing key */
+			int sigtype,		    /* signature type */
+			const unsigned char* digest, /* digest */
+			unsigned int digestlen,	    /* length of digest */
+			int rootnum,		    /* root number */
+			const mpz_t sig,	    /* signature */
+			int f)			    /* f value (for
+						       Rabin) */
+{
+  unsigned char tag[SC_TAG_SIZE], check[SC_CHECK_SIZE];
+  unsigned char *slot, *p;
+  unsigned long start, i;
+  size_t n;
+
+  if (!sc->writable || mpz_sgn(sig) < 0
+      || mpz_sizeinbase(sig, 2) > SC_SIG_MAX * 8)
+    return;
+
+  get_tag(tag, key, sigtype, digest, digestlen, rootnum);
+  start = rs_get_u32(tag);
+
+  LOCK(sc);
+  if (lock_file(sc->fd, F_WRLCK)) {
+    UNLOCK(sc);
+    return;
+  }
+
+  /* Use the first free or matching slot; if there are none, replace
+     the first slot */
+  slot = get_slot(sc, start);
+  for (i = 0; i < SC_PROBES; i++) {
+    p = get_slot(sc, start + i);
+    if (slot_is_empty(p) || !memcmp(p, tag, SC_TAG_SIZE)) {
+      slot = p;
+      break;
+    }
+  }
+
+  memset(slot + SC_TAG_SIZE, 0, SC_CHECK_SIZE);
+  memcpy(slot, tag, SC_TAG_SIZE);
+  n = 0;
+  if (mpz_sgn(sig))
+    mpz_export(slot + SC_TAG_SIZE + SC_CHECK_SIZE + 4, &n, -1, 1, 0, 0, sig);
+  slot[SC_TAG_SIZE + SC_CHECK_SIZE] = (n >> 8) & 0xff;
+  slot[SC_TAG_SIZE + SC_CHECK_SIZE + 1] = n & 0xff;
+  slot[SC_TAG_SIZE + SC_CHECK_SIZE + 2] = f;
+  slot[SC_TAG_SIZE + SC_CHECK_SIZE + 3] = 0;
+
+  get_check(check, slot);
+  memcpy(slot + SC_TAG_SIZE, check, SC_CHECK_SIZE);
+
+  lock_file(sc->fd, F_UNLCK);
+  UNLOCK(sc);
+  rs_message(2, key, NULL, "added signature to cache");
+}
+
+#else /* !RS_USE_SIG_CACHE */
+
+RSSigCache* rs_sig_cache_open(RSContext* ctx,
+			      const char* filename,
+			      unsigned long nslots RS_ATTR_UNUSED)
+{
+  rs_ctx_error(ctx, "%s: signature cache is not supported on this system",
+	       filename);
+  return NULL;
+}
+
+void rs_sig_cache_close(RSSigCache* sc RS_ATTR_UNUSED)
+{
+}
+
+int rs_sig_cache_lookup(const RSSigCache* sc RS_ATTR_UNUSED,
+			const RSKey* key RS_ATTR_UNUSED,
+			int sigtype RS_ATTR_UNUSED,
+			const unsigned char* digest RS_ATTR_UNUSED,
+			unsigned int digestlen RS_ATTR_UNUSED,
+			int rootnum RS_ATTR_UNUSED,
+			mpz_t sig RS_ATTR_UNUSED,
+			int* f RS_ATTR_UNUSED)
+{
+  return -1;
+}
+
+void rs_sig_cache_store(RSSigCache* sc RS_ATTR_UNUSED,
+			const RSKey* key RS_ATTR_UNUSED,
+			int sigtype RS_ATTR_UNUSED,
+			const unsigned char* digest RS_ATTR_UNUSED,
+			unsigned int digestlen RS_ATTR_UNUSED,
+			int rootnum RS_ATTR_UNUSED,
+			const mpz_t sig RS_ATTR_UNUSED,
+			int f RS_ATTR_UNUSED)
+{
+}
+
+#endif /* !RS_USE_SIG_CACHE */
@@ -159,3 +159,101 @@ const char* rs_data_type_to_string(RSDataType datatype)
     return "program";
   }
 }
+
+/*
+ * Get a short name for a status code (for machine-readable output.)
+ */
+const char* rs_status_to_string(RSStatus status)
+{
+  switch (status) {
+  case RS_SUCCESS:
+    return "ok";
+
+  case RS_SIGNATURE_INCORRECT:
+    return "signature-incorrect";
+
+  case RS_ERR_MISSING_PAGE_COUNT:
+    return "missing-page-count";
+
+  case RS_ERR_MISSING_KEY_ID:
+    return "missing-key-id";
+
+  case RS_ERR_MISSING_DATE_STAMP:
+    return "missing-date-stamp";
+
+  case RS_ERR_MISSING_PROGRAM_IMAGE:
+    return "missing-program-image";
+
+  case RS_ERR_MISALIGNED_PROGRAM_IMAGE:
+    return "misaligned-program-image";
+
+  case RS_ERR_INVALID_PROGRAM_DATA:
+    return "invalid-program-data";
+
+  case RS_ERR_INVALID_PROGRAM_SIZE:
+    return "invalid-program-size";
+
+  case RS_ERR_INCORRECT_PAGE_COUNT:
+    return "incorrect-page-count";
+
+  case RS_ERR_FINAL_PAGE_TOO_LONG:
+    return "final-page-too-long";
+
+  case RS_ERR_FIELD_TOO_SMALL:
+    return "field-too-small";
+
+  case RS_ERR_CRITICAL:
+    return "critical";
+
+  case RS_ERR_OUT_OF_MEMORY:
+    return "out-of-memory";
+
+  case RS_ERR_FILE_IO:
+    return "file-io";
+
+  case RS_ERR_HEX_SYNTAX:
+    return "hex-syntax";
+
+  case RS_ERR_UNKNOWN_FILE_FORMAT:
+    return "unknown-file-format";
+
+  case RS_ERR_UNKNOWN_PROGRAM_TYPE:
+    return "unknown-program-type";
+
+  case RS_ERR_MISSING_HEADER:
+    return "missing-header";
+
+  case RS_ERR_MISSING_RABIN_SIGNATURE:
+    return "missing-rabin-signature";
+
+  case RS_ERR_MISSING_RSA_SIGNATURE:
+    return "missing-rsa-signature";
+
+  case RS_ERR_INCORRECT_PROGRAM_SIZE:
+    return "incorrect-program-size";
+
+  case RS_ERR_KEY_NOT_FOUND:
+    return "key-not-found";
+
+  case RS_ERR_KEY_SYNTAX:
+    return "key-syntax";
+
+  case RS_ERR_INVALID_KEY:
+    return "invalid-key";
+
+  case RS_ERR_MISSING_PUBLIC_KEY:
+    return "missing-public-key";
+
+  case RS_ERR_MISSING_PRIVATE_KEY:
+    return "missing-private-key";
+
+  case RS_ERR_UNSUITABLE_RABIN_KEY:
+    return "unsuitable-rabin-key";
+
+  case RS_ERR_UNSUITABLE_RSA_KEY:
+    return "unsuitable-rsa-key";
+
+  default:
+    return "unknown";
+  }
+}
@@ -0,0 +1,442 @@
+/*
+ * RabbitSign - Tools for signing TI graphing calculator software
+ * Copyright (C) 2009 Benjamin Moody
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+
+#ifdef HAVE_STRING_H
+# include <string.h>
+#else
+# ifdef HAVE_STRINGS_H
+#  include <strings.h>
+# endif
+#endif
+
+#if defined(HAVE_SYS_STAT_H) && defined(HAVE_UNISTD_H) \
+  && !defined(__MSDOS__) && !defined(__WIN32__)
+# define RS_USE_VAL_CACHE
+# ifdef HAVE_SYS_TYPES_H
+#  include <sys/types.h>
+# endif
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+#include "rabbitsign.h"
+#include "internal.h"
+#include "sha256.h"
+
+/*
+ * Validation cache
+ *
+ * When the same set of files is checked over and over, most of them
+ * will not have changed since the last time.  The validation cache
+ * is a directory holding one small entry for each file that has been
+ * checked, recording the file's identity (device and inode number),
+ * its size and modification time, a SHA-256 digest of its contents,
+ * the ID and fingerprint of the key used to check it, and the
+ * result.
+ *
+ * Normally, a file is assumed to be unchanged if its size and
+ * modification time are the same as before.  In "paranoid" mode, the
+ * digest of the file is computed and compared instead; this still
+ * saves parsing the file and checking the signature.
+ *
+ * Each entry is written to a temporary file and renamed into place.
+ * All integers are big-endian.
+ *
+ *   "RSVC"  version  dev[8]  ino[8]  size[8]  mtime[8]  mtime_ns
+ *   digest[32]  keyid  keyfp[32]  verdict
+ */
+
+#define VC_MAGIC "RSVC"
+#define VC_VERSION 1
+#define VC_DIGEST_SIZE 32
+#define VC_ENTRY_SIZE (8 + 8 * 4 + 4 + VC_DIGEST_SIZE + 4 \
+		       + VC_DIGEST_SIZE + 4)
+
+typedef struct _RSFileInfo {
+  unsigned long dev[2];
+  unsigned long ino[2];
+  unsigned long size[2];
+  unsigned long mtime[2];
+  unsigned long mtime_ns;
+} RSFileInfo;
+
+#ifdef RS_USE_VAL_CACHE
+
+struct _RSValCache {
+  RSContext* ctx;
+  char* dir;			/* cache directory */
+  int pending;			/* 1 = a file has been looked up */
+  RSFileInfo info;		/* status of that file */
+  int havedigest;		/* 1 = digest has been computed */
+  unsigned char digest[VC_DIGEST_SIZE]; /* digest of that file */
+};
+
+/* Split a value of unknown size into two 32-bit halves */
+#define SPLIT(aaa, vvv) do {				\
+    (aaa)[0] = (sizeof(vvv) > 4				\
+		? (unsigned long) ((vvv) >> 16 >> 16)	\
+		: 0);					\
+    (aaa)[1] = (unsigned long) (vvv) & 0xfffffffful;	\
+  } while (0)
+
+/*
+ * Get the identity, size, and modification time of a file.
+ */
+static int get_file_info(const char* filename, /* file name */
+			 RSFileInfo* info)     /* file info */
+{
+  struct stat st;
+
+  if (stat(filename, &st) || !S_ISREG(st.st_mode))
+    return -1;
+
+  memset(info, 0, sizeof(RSFileInfo));
+  SPLIT(info->dev, st.st_dev);
+  SPLIT(info->ino, st.st_ino);
+  SPLIT(info->size, st.st_size);
+  SPLIT(info->mtime, st.st_mtime);
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+  info->mtime_ns = st.st_mtim.tv_nsec;
+#endif
+  return 0;
+}
+
+static int same_file_info(const RSFileInfo* a,
+			  const RSFileInfo* b)
+{
+  return (a->dev[0] == b->dev[0] && a->dev[1] == b->dev[1]
+	  && a->ino[0] == b->ino[0] && a->ino[1] == b->ino[1]
+	  && a->size[0] == b->size[0] && a->size[1] == b->size[1]
+	  && a->mtime[0] == b->mtime[0] && a->mtime[1] == b->mtime[1]
+	  && a->mtime_ns == b->mtime_ns);
+}
+
+/*
+ * Compute the SHA-256 digest of a file's contents.
+ */
+static int digest_file(const char* filename,  /* file name */
+		       unsigned char* digest) /* buffer for digest */
+{
+  struct sha256_ctx ctx;
+  unsigned char buf[16384];
+  FILE* f;
+  size_t n;
+
+  if (!(f = fopen(filename, "rb")))
+    return -1;
+
+  sha256_init_ctx(&ctx);
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    sha256_process_bytes(buf, n, &ctx);
+
+  if (ferror(f)) {
+    fclose(f);
+    return -1;
+  }
+  fclose(f);
+
+  sha256_finish_ctx(&ctx, digest);
+  return 0;
+}
+
+/*
+ * Get the name of the cache entry for a file.  Entries are named
+ * after the device and inode number, so that a file keeps its entry
+ * when it is modified.
+ */
+static char* entry_name(const RSValCache* vc,	 /* cache */
+			const RSFileInfo* info)	 /* file info */
+{
+  struct sha256_ctx ctx;
+  unsigned char buf[16], hash[32];
+  char* s;
+  int i;
+
+  rs_put_u32(buf, info->dev[0]);
+  rs_put_u32(buf + 4, info->dev[1]);
+  rs_put_u32(buf + 8, info->ino[0]);
+  rs_put_u32(buf + 12, info->ino[1]);
+
+  sha256_init_ctx(&ctx);
+  sha256_process_bytes(buf, 16, &ctx);
+  sha256_finish_ctx(&ctx, hash);
+
+  s = rs_ctx_malloc(vc->ctx, strlen(vc->dir) + 1 + 32 + 24);
+  if (!s)
+    return NULL;
+
+  strcpy(s, vc->dir);
+  strcat(s, "/");
+  for (i = 0; i < 16; i++)
+    sprintf(s + strlen(s), "%02x", hash[i]);
+  return s;
+}
+
+static void put_file_info(unsigned char* p,	   /* buffer */
+			  const RSFileInfo* info)  /* file info */
+{
+  rs_put_u32(p, info->dev[0]);
+  rs_put_u32(p + 4, info->dev[1]);
+  rs_put_u32(p + 8, info->ino[0]);
+  rs_put_u32(p + 12, info->ino[1]);
+  rs_put_u32(p + 16, info->size[0]);
+  rs_put_u32(p + 20, info->size[1]);
+  rs_put_u32(p + 24, info->mtime[0]);
+  rs_put_u32(p + 28, info->mtime[1]);
+  rs_put_u32(p + 32, info->mtime_ns);
+}
+
+static void get_file_info_data(RSFileInfo* info,	/* file info */
+			       const unsigned char* p)	/* buffer */
+{
+  info->dev[0] = rs_get_u32(p);
+  info->dev[1] = rs_get_u32(p + 4);
+  info->ino[0] = rs_get_u32(p + 8);
+  info->ino[1] = rs_get_u32(p + 12);
+  info->size[0] = rs_get_u32(p + 16);
+  info->size[1] = rs_get_u32(p + 20);
+  info->mtime[0] = rs_get_u32(p + 24);
+  info->mtime[1] = rs_get_u32(p + 28);
+  info->mtime_ns = rs_get_u32(p + 32);
+}
+
+/*
+ * Open a validation cache directory, creating it if necessary.
+ */
+RSValCache* rs_val_cache_open(RSContext* ctx,	 /* context (NULL =
+						    default) */
+			      const char* dir)	 /* cache directory */
+{
+  RSValCache* vc;
+  struct stat st;
+
+  mkdir(dir, 0777);
+  if (stat(dir, &st) || !S_ISDIR(st.st_mode)) {
+    rs_ctx_error(ctx, "%s: unable to open validation cache", dir);
+    return NULL;
+  }
+
+  if (!(vc = rs_ctx_malloc(ctx, sizeof(RSValCache))))
+    return NULL;
+
+  vc->ctx = ctx;
+  vc->pending = 0;
+  vc->havedigest = 0;
+  if (!(vc->dir = rs_ctx_strdup(ctx, dir))) {
+    rs_ctx_free(ctx, vc);
+    return NULL;
+  }
+  return vc;
+}
+
+/*
+ * Close a validation cache.
+ */
+void rs_val_cache_close(RSValCache* vc) /* validation cache */
+{
+  if (!vc)
+    return;
+
+  rs_ctx_free(vc->ctx, vc->dir);
+  rs_ctx_free(vc->ctx, vc);
+}
+
+/*
+ * Look up the result of validating a file.
+ *
+ * Returns 0 if the file has not changed since it was last checked;
+ * the ID and fingerprint of the key used, and the result, are then
+ * stored in *keyid, keyfp, and *verdict.  (The caller must check that
+ * the same key would be used now.)
+ *
+ * If paranoid is 1, the file's contents are compared; otherwise, only
+ * its size and modification time are.
+ */
+int rs_val_cache_lookup(RSValCache* vc,		/* validation cache */
+			const char* filename,	/* file name */
+			int paranoid,		/* 1 = compare file
+						   contents */
+			unsigned long* keyid,	/* ID of key used */
+			unsigned char* keyfp,	/* fingerprint of key
+						   used (32 bytes) */
+			RSStatus* verdict)	/* result of validation */
+{
+  unsigned char buf[VC_ENTRY_SIZE];
+  RSFileInfo oldinfo;
+  const unsigned char* p;
+  char* name;
+  FILE* f;
+  size_t n;
+
+  vc->pending = vc->havedigest = 0;
+
+  if (get_file_info(filename, &vc->info))
+    return -1;
+  vc->pending = 1;
+
+  if (!(name = entry_name(vc, &vc->info)))
+    return -1;
+  f = fopen(name, "rb");
+  rs_ctx_free(vc->ctx, name);
+  if (!f)
+    return -1;
+  n = fread(buf, 1, VC_ENTRY_SIZE, f);
+  fclose(f);
+
+  if (n != VC_ENTRY_SIZE || memcmp(buf, VC_MAGIC, 4)
+      || rs_get_u32(buf + 4) != VC_VERSION)
+    return -1;
+
+  p = buf + 8;
+  get_file_info_data(&oldinfo, p);
+  p += 36;
+
+  if (oldinfo.dev[0] != vc->info.dev[0] || oldinfo.dev[1] != vc->info.dev[1]
+      || oldinfo.ino[0] != vc->info.ino[0] || oldinfo.ino[1] != vc->info.ino[1])
+    return -1;
+
+  if (paranoid) {
+    if (digest_file(filename, vc->digest))
+      return -1;
+    vc->havedigest = 1;
+    if (memcmp(p, vc->digest, VC_DIGEST_SIZE))
+      return -1;
+  }
+  else if (!same_file_info(&oldinfo, &vc->info)) {
+    return -1;
+  }
+  p += VC_DIGEST_SIZE;
+
+  *keyid = rs_get_u32(p);
+  memcpy(keyfp, p + 4, VC_DIGEST_SIZE);
+  *verdict = rs_get_u32(p + 4 + VC_DIGEST_SIZE);
+  return 0;
+}
+
+/*
+ * Record the result of validating a file.
+ *
+ * This must be called after rs_val_cache_lookup() for the same file.
+ * If the file has been modified since then, nothing is recorded.
+ */
+int rs_val_cache_store(RSValCache* vc,	      /* validation cache */
+		       const char* filename,  /* file name */
+		       const RSKey* key,      /* key used */
+		       RSStatus verdict)      /* result of validation */
+{
+  unsigned char buf[VC_ENTRY_SIZE];
+  RSFileInfo info;
+  unsigned char* p;
+  char *name, *tempname;
+  FILE* f;
+  int e;
+
+  if (!vc->pending)
+    return RS_SUCCESS;
+  vc->pending = 0;
+
+  if (!vc->havedigest && digest_file(filename, vc->digest))
+    return RS_SUCCESS;
+
+  if (get_file_info(filename, &info) || !same_file_info(&info, &vc->info)) {
+    rs_message(2, key, NULL, "%s: file changed while checking", filename);
+    return RS_SUCCESS;
+  }
+
+  memcpy(buf, VC_MAGIC, 4);
+  rs_put_u32(buf + 4, VC_VERSION);
+  p = buf + 8;
+  put_file_info(p, &info);
+  p += 36;
+  memcpy(p, vc->digest, VC_DIGEST_SIZE);
+  p += VC_DIGEST_SIZE;
+  rs_put_u32(p, key->id);
+  rs_key_get_fingerprint(key, p + 4);
+  rs_put_u32(p + 4 + VC_DIGEST_SIZE, verdict);
+
+  if (!(name = entry_name(vc, &info)))
+    return RS_ERR_OUT_OF_MEMORY;
+  tempname = rs_ctx_malloc(vc->ctx, strlen(name) + 24);
+  if (!tempname) {
+    rs_ctx_free(vc->ctx, name);
+    return RS_ERR_OUT_OF_MEMORY;
+  }
+  sprintf(tempname, "%s.%lu", name, (unsigned long) getpid());
+
+  e = RS_SUCCESS;
+  if (!(f = fopen(tempname, "wb"))) {
+    e = RS_ERR_FILE_IO;
+  }
+  else {
+    if (fwrite(buf, 1, VC_ENTRY_SIZE, f) != VC_ENTRY_SIZE)
+      e = RS_ERR_FILE_IO;
+    if (fclose(f))
+      e = RS_ERR_FILE_IO;
+    if (!e && rename(tempname, name))
+      e = RS_ERR_FILE_IO;
+    if (e)
+      remove(tempname);
+  }
+
+  if (e)
+    rs_warning(key, NULL, "unable to write validation cache entry %s", name);
+
+  rs_ctx_free(vc->ctx, tempname);
+  rs_ctx_free(vc->ctx, name);
+  return e;
+}
+
+#else /* !RS_USE_VAL_CACHE */
+
+RSValCache* rs_val_cache_open(RSContext* ctx,
+			      const char* dir)
+{
+  rs_ctx_error(ctx, "%s: validation cache is not supported on this system",
+	       dir);
+  return NULL;
+}
+
+void rs_val_cache_close(RSValCache* vc RS_ATTR_UNUSED)
+{
+}
+
+int rs_val_cache_lookup(RSValCache* vc RS_ATTR_UNUSED,
+			const char* filename RS_ATTR_UNUSED,
+			int paranoid RS_ATTR_UNUSED,
+			unsigned long* keyid RS_ATTR_UNUSED,
+			unsigned char* keyfp RS_ATTR_UNUSED,
+			RSStatus* verdict RS_ATTR_UNUSED)
+{
+  return -1;
+}
+
+int rs_val_cache_store(RSValCache* vc RS_ATTR_UNUSED,
+		       const char* filename RS_ATTR_UNUSED,
+		       const RSKey* key RS_ATTR_UNUSED,
+		       RSStatus verdict RS_ATTR_UNUSED)
+{
+  return RS_SUCCESS;
+}
+
+#endif /* !RS_USE_VAL_CACHE */
@@ -0,0 +1,150 @@
+/*
+ * Sign a program using a counting allocator, and check that every
+ * block allocated is freed
+ *
+ * Copyright (C) 2009 Benjamin Moody
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Usage: alloctest keyfile program
+ *
+ * Exits with status 0 if the program was signed, every block was
+ * freed, and the allocator could not be changed once in use.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+
+#include "rabbitsign.h"
+
+static unsigned long nallocs = 0, nfrees = 0;
+
+static void* count_realloc(void* ptr, unsigned long count,
+			   void* data RS_ATTR_UNUSED)
+{
+  if (!count) {
+    if (ptr) {
+      nfrees++;
+      free(ptr);
+    }
+    return NULL;
+  }
+  else if (ptr) {
+    return realloc(ptr, count);
+  }
+  else {
+    nallocs++;
+    return malloc(count);
+  }
+}
+
+static void ignore_error(const RSKey* key RS_ATTR_UNUSED,
+			 const RSProgram* prgm RS_ATTR_UNUSED,
+			 const char* msg RS_ATTR_UNUSED,
+			 void* data RS_ATTR_UNUSED)
+{
+}
+
+static int sign_program(const char* keyname, const char* prgmname)
+{
+  RSKey* key;
+  RSProgram* prgm;
+  FILE* f;
+  unsigned char* data = NULL;
+  unsigned long length;
+  int e;
+
+  if (!(key = rs_key_new()))
+    return 1;
+  if (!(prgm = rs_program_new())) {
+    rs_key_free(key);
+    return 1;
+  }
+
+  if (!(f = fopen(keyname, "rb"))) {
+    perror(keyname);
+    e = 1;
+  }
+  else {
+    e = rs_read_key_file(key, f, keyname, 1);
+    fclose(f);
+  }
+
+  if (!e) {
+    if (!(f = fopen(prgmname, "rb"))) {
+      perror(prgmname);
+      e = 1;
+    }
+    else {
+      e = rs_read_program_file(prgm, f, prgmname, 0);
+      fclose(f);
+    }
+  }
+
+  if (!e)
+    e = rs_repair_program(prgm, RS_REMOVE_OLD_SIGNATURE);
+  if (!e)
+    e = rs_sign_program(prgm, key, 0);
+  if (!e)
+    e = rs_write_program_buffer(prgm, &data, &length, 0, 0, 0, 0);
+  if (data)
+    count_realloc(data, 0, NULL);
+
+  rs_program_free(prgm);
+  rs_key_free(key);
+  return e;
+}
+
+int main(int argc, char** argv)
+{
+  int e;
+
+  if (argc < 3) {
+    fprintf(stderr, "usage: %s keyfile program\n", argv[0]);
+    return 2;
+  }
+
+  if (rs_set_allocator(&count_realloc, NULL)) {
+    fprintf(stderr, "unable to set allocator before use\n");
+    return 1;
+  }
+
+  if ((e = sign_program(argv[1], argv[2]))) {
+    fprintf(stderr, "error signing program (%d)\n", e);
+    return 1;
+  }
+
+  rs_context_set_error_func(rs_context_default(), &ignore_error, NULL);
+  if (!rs_set_allocator(NULL, NULL)) {
+    fprintf(stderr, "allocator was changed while in use\n");
+    return 1;
+  }
+
+  printf("%lu blocks allocated, %lu freed\n", nallocs, nfrees);
+  if (!nallocs || nallocs != nfrees) {
+    fprintf(stderr, "allocations and frees do not match\n");
+    return 1;
+  }
+
+  return 0;
+}
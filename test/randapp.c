@@ -29,6 +29,10 @@
 # include <stdlib.h>
 #endif
 
+#if HAVE_STRING_H
+# include <string.h>
+#endif
+
 #include <time.h>
 
 #if HAVE_UNISTD_H
@@ -73,17 +77,61 @@ static const unsigned char appstart[]={0x80,0x0f, 0x00,0x00,0x00,0x00,
 				       0x02,0x0d, 0x04,0xde,0xad,0xbe,0xef,
 				       0x80,0x7F, 0x00,0x00,0x00,0x00};
 
+/* (for a TI-83 Plus OS: key 05, version 1.01; the page count is
+   filled in by write_os_hex) */
+static const unsigned char osheader[]={0x80,0x0f, 0x00,0x00,0x00,0x00,
+				       0x80,0x11, 0x05,
+				       0x80,0x21, 0x01,
+				       0x80,0x31, 0x01,
+				       0x80,0xa1, 0x03,
+				       0x80,0x81, 0x00,
+				       0x80,0x7f, 0x00,0x00,0x00,0x00};
+
+void write_os_hex proto((FILE* f, const unsigned char *data, size_t length));
+
 int main(argc, argv)
      int argc;
      char** argv;
 {
-  unsigned char data[2000];
+  unsigned char* data;
   size_t size, i;
   unsigned int z;
+  unsigned long extra = 0;
 
   srandom(time(NULL) + (100 * getpid()));
 
-  size = sizeof(appstart) + (random() % 1000);
+  /* (randapp -o [extra] generates an OS instead) */
+  if (argc > 1 && !strcmp(argv[1], "-o")) {
+    if (argc > 2)
+      sscanf(argv[2], "%lu", &extra);
+
+    size = 0x4000 + extra + (random() % 1000);
+    data = malloc(size);
+    if (!data) {
+      fprintf(stderr, "randapp: out of memory\n");
+      return 1;
+    }
+
+    for (i=0; i<size; i++)
+      data[i] = random() & 0xff;
+    data[0x56] = 0xff;
+    data[0x57] = 0xa5;
+
+    write_os_hex(stdout, data, size);
+    free(data);
+    return 0;
+  }
+
+  /* (an optional second argument adds that many bytes to the app) */
+  if (argc > 2)
+    sscanf(argv[2], "%lu", &extra);
+
+  size = sizeof(appstart) + extra + (random() % 1000);
+  data = malloc(size + 100);
+  if (!data) {
+    fprintf(stderr, "randapp: out of memory\n");
+    return 1;
+  }
 
   for (i=0; i<sizeof(appstart); i++)
     data[i] = appstart[i];
@@ -113,6 +161,7 @@ int main(argc, argv)
   data[i++] = random() % 4;
 
   write_file_hex(stdout, data, i);
+  free(data);
 
   return 0;
 }
@@ -189,3 +238,31 @@ void write_file_hex(f, data, length)
   write_file_hex_byte(f,&inf,1,0,0,0);	/* end record */
   write_file_hex_byte(f,&inf,-1,0,0,0);	/* flush output */
 }
+
+
+/* Write an OS: the header, then the data */
+
+void write_os_hex(f, data, length)
+     FILE* f;
+     const unsigned char *data;
+     size_t length;
+{
+  size_t i;
+  struct hexinfo inf;
+
+  inf.last_r = inf.last_w = inf.last_a = -1;
+  inf.rec_addr = -1;
+  inf.rec_pos = 0;
+
+  for (i=0;i<sizeof(osheader);i++) {
+    if (i == 20)
+      write_file_hex_byte(f,&inf,0,32,(int)i,(int)((length+0x3fff)>>14));
+    else
+      write_file_hex_byte(f,&inf,0,32,(int)i,osheader[i]);
+  }
+
+  write_file_hex_byte(f,&inf,1,0,0,0);	/* end record */
+  write_file_hex_byte(f,&inf,-1,0,0,0);	/* flush output */
+
+  write_file_hex(f, data, length);
+}
@@ -0,0 +1,83 @@
+/*
+ * Send a request to sign an arbitrary digest to a rabbitsignd server
+ *
+ * Copyright (C) 2009 Benjamin Moody
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Usage: sigreq socket keyid rabin|rsa [rootnum]
+ *
+ * Exits with status 0 if the server returned a signature, 1 if it
+ * refused the request, or 2 if the server could not be reached.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+# include <string.h>
+#else
+# ifdef HAVE_STRINGS_H
+#  include <strings.h>
+# endif
+#endif
+
+#include "rabbitsign.h"
+
+int main(int argc, char** argv)
+{
+  RSRemoteRequest req;
+  RSSignature sig;
+  RSStatus result;
+  unsigned int i;
+  int fd, e;
+
+  if (argc < 4) {
+    fprintf(stderr, "usage: %s socket keyid rabin|rsa [rootnum]\n",
+	    argv[0]);
+    return 2;
+  }
+
+  memset(&req, 0, sizeof(req));
+  req.op = RS_REMOTE_SIGN_DIGEST;
+  req.keyid = strtoul(argv[2], NULL, 16);
+  req.rootnum = (argc > 4 ? atoi(argv[4]) : 0);
+  req.digest.scheme = (strcmp(argv[3], "rabin") ? RS_SIG_RSA
+		       : RS_SIG_RABIN);
+  req.digest.alg = RS_KEY_MD5;
+  req.digest.length = 16;
+  for (i = 0; i < req.digest.length; i++)
+    req.digest.value[i] = 0x11 * i;
+
+  if ((fd = rs_remote_connect(argv[1])) < 0)
+    return 2;
+
+  rs_signature_init(&sig);
+  e = rs_remote_sign_digest(fd, &req, &sig, &result);
+  rs_signature_clear(&sig);
+  rs_remote_close(fd);
+
+  if (e)
+    return 2;
+  return (result ? 1 : 0);
+}
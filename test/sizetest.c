@@ -0,0 +1,187 @@
+/*
+ * Check that rs_program_output_size() matches the output written in
+ * each format
+ *
+ * Copyright (C) 2009 Benjamin Moody
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Usage: sizetest program ...
+ *
+ * For each output format and record size, writes each program to a
+ * file, to a buffer allocated by the library, to a buffer of exactly
+ * the predicted size, and to a buffer one byte too short.  Exits with
+ * status 0 if every length matches the predicted size, and the short
+ * buffer is rejected without being overrun.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+# include <string.h>
+#else
+# ifdef HAVE_STRINGS_H
+#  include <strings.h>
+# endif
+#endif
+
+#include "rabbitsign.h"
+
+static const unsigned int formats[] = {
+  0,
+  RS_OUTPUT_HEX_ONLY,
+  RS_OUTPUT_HEX_ONLY | RS_OUTPUT_APPSIGN,
+  RS_OUTPUT_BINARY,
+  RS_OUTPUT_CONTAINER
+};
+
+static const unsigned int recordsizes[] = { 0, 1, 7, 32, 255 };
+
+static int quiet = 0;
+
+static void show_error(const RSKey* key RS_ATTR_UNUSED,
+		       const RSProgram* prgm RS_ATTR_UNUSED,
+		       const char* msg,
+		       void* data RS_ATTR_UNUSED)
+{
+  if (!quiet)
+    fprintf(stderr, "sizetest: %s\n", msg);
+}
+
+static int check_output(const RSProgram* prgm, /* program */
+			const char* name,      /* program file name */
+			unsigned int flags)    /* output flags */
+{
+  unsigned long size, length;
+  unsigned char *data = NULL, *buf;
+  FILE* f;
+  int e;
+
+  size = rs_program_output_size(prgm, flags);
+
+  /* Write to a file */
+  if (!(f = tmpfile())) {
+    perror("tmpfile");
+    return 1;
+  }
+  if ((e = rs_write_program_file(prgm, f, 1, 1, 2009, flags))) {
+    fclose(f);
+    return e;
+  }
+  length = ftell(f);
+  fclose(f);
+  if (length != size) {
+    fprintf(stderr, "%s (flags %x): wrote %lu bytes to a file,"
+	    " expected %lu\n", name, flags, length, size);
+    return 1;
+  }
+
+  /* Write to a buffer allocated by the library */
+  if ((e = rs_write_program_buffer(prgm, &data, &length,
+				   1, 1, 2009, flags)))
+    return e;
+  free(data);
+  if (length != size) {
+    fprintf(stderr, "%s (flags %x): wrote %lu bytes to a new buffer,"
+	    " expected %lu\n", name, flags, length, size);
+    return 1;
+  }
+
+  /* Write to a buffer of exactly the predicted size, and to one a
+     byte shorter (allocated separately, so that an overrun can be
+     caught by a memory checker) */
+  if (!(buf = malloc(size ? size : 1)))
+    return RS_ERR_OUT_OF_MEMORY;
+  length = size;
+  e = rs_write_program_buffer(prgm, &buf, &length, 1, 1, 2009, flags);
+  free(buf);
+  if (e)
+    return e;
+  if (length != size) {
+    fprintf(stderr, "%s (flags %x): wrote %lu bytes to a buffer,"
+	    " expected %lu\n", name, flags, length, size);
+    return 1;
+  }
+
+  if (size) {
+    if (!(buf = malloc(size - 1 ? size - 1 : 1)))
+      return RS_ERR_OUT_OF_MEMORY;
+    length = size - 1;
+    quiet = 1;
+    e = rs_write_program_buffer(prgm, &buf, &length, 1, 1, 2009, flags);
+    quiet = 0;
+    free(buf);
+    if (!e) {
+      fprintf(stderr, "%s (flags %x): no error writing to a buffer"
+	      " of %lu bytes\n", name, flags, size - 1);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  RSProgram* prgm;
+  FILE* f;
+  unsigned int i, j;
+  int n, e;
+
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s program ...\n", argv[0]);
+    return 2;
+  }
+
+  rs_context_set_error_func(rs_context_default(), &show_error, NULL);
+
+  for (n = 1; n < argc; n++) {
+    if (!(prgm = rs_program_new()))
+      return 1;
+
+    if (!(f = fopen(argv[n], "rb"))) {
+      perror(argv[n]);
+      rs_program_free(prgm);
+      return 1;
+    }
+    e = rs_read_program_file(prgm, f, argv[n], 0);
+    fclose(f);
+
+    for (i = 0; !e && i < sizeof(formats) / sizeof(formats[0]); i++) {
+      for (j = 0; !e && j < sizeof(recordsizes) / sizeof(recordsizes[0]);
+	   j++) {
+	e = check_output(prgm, argv[n],
+			 formats[i] | RS_OUTPUT_RECORD_SIZE(recordsizes[j]));
+      }
+    }
+
+    rs_program_free(prgm);
+    if (e) {
+      fprintf(stderr, "%s: output size test failed (%d)\n", argv[n], e);
+      return 1;
+    }
+  }
+
+  return 0;
+}
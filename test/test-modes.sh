@@ -0,0 +1,462 @@
+#! /bin/sh
+#
+# Check one of rabbitsign's batch or caching modes, by comparing its
+# output with that of signing each file on its own.
+#
+
+if test $# = "0" ; then
+    echo "usage: $0 mode"
+    exit 99
+fi
+
+srcdir=`dirname $0`
+rabbitsign="$TEST_EXEC ../src/rabbitsign"
+
+# Check that two files are identical
+same() {
+    echo "    cmp $1 $2"
+    cmp "$1" "$2" || { echo "$2 differs from $1" ; exit 1 ; }
+}
+
+# Generate random apps mode-1.hex ... mode-N.hex, and sign each one
+# the ordinary way, giving mode-1.app ... mode-N.app
+make_apps() {
+    echo "  Generating and signing $1 random applications..."
+    i=1
+    while test $i -le $1 ; do
+	$TEST_EXEC ./randapp ${2-0104} >mode-$i.hex || { echo "error generating app ($?)" ; exit 1 ; }
+	$rabbitsign -q -r mode-$i.hex -o mode-$i.app || { echo "error signing app ($?)" ; exit 2 ; }
+	i=`expr $i + 1`
+    done
+}
+
+rm -rf mode-*
+
+case $1 in
+    manifest)
+	make_apps 5
+	echo "  Signing the same applications with --manifest..."
+	: >mode-manifest.txt
+	for i in 1 2 3 4 5 ; do
+	    echo "mode-$i.hex mode-$i-m.app - - - r" >>mode-manifest.txt
+	done
+	echo "# comment" >>mode-manifest.txt
+	echo "    ../src/rabbitsign --manifest mode-manifest.txt"
+	$rabbitsign --manifest mode-manifest.txt >/dev/null || { echo "error signing manifest ($?)" ; exit 2 ; }
+	for i in 1 2 3 4 5 ; do
+	    same mode-$i.app mode-$i-m.app
+	done
+	;;
+
+    chain)
+	make_apps 3
+	echo "  Signing each application again, in the same manifest..."
+	: >mode-manifest.txt
+	for i in 1 2 3 ; do
+	    echo "mode-$i.hex mode-$i-c1.app - - - r" >>mode-manifest.txt
+	    echo "mode-$i-c1.app mode-$i-c2.app - - - r" >>mode-manifest.txt
+	    echo "mode-$i-c2.app - - - - r" >>mode-manifest.txt
+	done
+	echo "    ../src/rabbitsign --manifest mode-manifest.txt"
+	$rabbitsign --manifest mode-manifest.txt >/dev/null || { echo "error signing manifest ($?)" ; exit 2 ; }
+	for i in 1 2 3 ; do
+	    same mode-$i.app mode-$i-c1.app
+	    same mode-$i.app mode-$i-c2.app
+	    same mode-$i.app mode-$i-c2-signed.app
+	done
+	;;
+
+    keycache)
+	# (rabbitsign keeps at most 16 keys loaded; use more than that,
+	# and use each key twice, so that keys are evicted and reloaded)
+	test -x ../src/rskeygen || { echo "  rskeygen not built; skipping" ; exit 0 ; }
+	echo "  Generating 20 keys and signing an application with each..."
+	: >mode-manifest.txt
+	for k in 1301 1302 1303 1304 1305 1306 1307 1308 1309 130A \
+		 130B 130C 130D 130E 130F 1310 1311 1312 1313 1314 ; do
+	    $TEST_EXEC ../src/rskeygen --ti >$k.key || { echo "error generating key ($?)" ; exit 1 ; }
+	    $TEST_EXEC ./randapp $k >mode-$k.hex || { echo "error generating app ($?)" ; exit 1 ; }
+	    $rabbitsign -q -r mode-$k.hex -o mode-$k.app || { echo "error signing app ($?)" ; exit 2 ; }
+	    echo "mode-$k.hex mode-$k-m.app - - - r" >>mode-manifest.txt
+	done
+	cat mode-manifest.txt mode-manifest.txt >mode-manifest2.txt
+	echo "  Signing the same applications twice with --manifest..."
+	echo "    ../src/rabbitsign --manifest mode-manifest2.txt"
+	$rabbitsign --manifest mode-manifest2.txt >/dev/null || { echo "error signing manifest ($?)" ; rm -f 13??.key ; exit 2 ; }
+	rm -f 13??.key
+	for k in 1301 1302 1303 1304 1305 1306 1307 1308 1309 130A \
+		 130B 130C 130D 130E 130F 1310 1311 1312 1313 1314 ; do
+	    same mode-$k.app mode-$k-m.app
+	done
+	;;
+
+    keyfiles)
+	make_apps 3
+	cp $srcdir/../keys/0104.key mode-0104.key
+	chmod 644 mode-0104.key
+	echo "  Signing the same applications with a prepared (.rsk) key..."
+	echo "    ../src/rskeyconv -K 0104 -o mode-0104.rsk mode-0104.key"
+	$TEST_EXEC ../src/rskeyconv -K 0104 -o mode-0104.rsk mode-0104.key || { echo "error converting key ($?)" ; exit 1 ; }
+	for i in 1 2 3 ; do
+	    echo "    ../src/rabbitsign -k mode-0104.rsk -r mode-$i.hex -o mode-$i-k.app"
+	    $rabbitsign -q -k mode-0104.rsk -r mode-$i.hex -o mode-$i-k.app || { echo "error signing app ($?)" ; exit 2 ; }
+	    same mode-$i.app mode-$i-k.app
+	done
+	echo "  Signing the same applications using a shared key cache..."
+	for i in 1 2 3 ; do
+	    echo "    RABBITSIGN_KEY_CACHE=mode-cache ../src/rabbitsign -k mode-0104.key -r mode-$i.hex -o mode-$i-s.app"
+	    RABBITSIGN_KEY_CACHE=mode-cache $rabbitsign -q -k mode-0104.key -r mode-$i.hex -o mode-$i-s.app || { echo "error signing app ($?)" ; exit 2 ; }
+	    same mode-$i.app mode-$i-s.app
+	done
+	ls mode-cache/*.rsk >/dev/null 2>&1 || { echo "no entry was added to the key cache" ; exit 1 ; }
+	echo "  Checking that a cache directory others can write to is not used..."
+	rm -rf mode-cache
+	mkdir mode-cache
+	chmod 777 mode-cache
+	echo "    RABBITSIGN_KEY_CACHE=mode-cache ../src/rabbitsign -k mode-0104.key -r mode-1.hex -o mode-1-u.app"
+	RABBITSIGN_KEY_CACHE=mode-cache $rabbitsign -k mode-0104.key -r mode-1.hex -o mode-1-u.app 2>mode-err.txt || { echo "error signing app ($?)" ; exit 2 ; }
+	same mode-1.app mode-1-u.app
+	grep "not private" mode-err.txt >/dev/null || { echo "no warning about the cache directory" ; exit 1 ; }
+	ls mode-cache/*.rsk >/dev/null 2>&1 && { echo "an entry was added to an unsafe key cache" ; exit 1 ; }
+	rm -rf mode-cache
+	;;
+
+    sigcache)
+	make_apps 3
+	echo "  Signing the same applications twice using a signature cache..."
+	for i in 1 2 3 ; do
+	    for j in 1 2 ; do
+		echo "    ../src/rabbitsign -vv --sig-cache mode-sigs -r mode-$i.hex -o mode-$i-c$j.app"
+		$rabbitsign -vv --sig-cache mode-sigs -r mode-$i.hex -o mode-$i-c$j.app 2>mode-err-$j.txt || { echo "error signing app ($?)" ; exit 2 ; }
+		same mode-$i.app mode-$i-c$j.app
+	    done
+	    grep "added signature to cache" mode-err-1.txt >/dev/null || { echo "signature was not added to the cache" ; exit 1 ; }
+	    grep "using cached signature" mode-err-2.txt >/dev/null || { echo "cached signature was not used" ; exit 1 ; }
+	done
+	;;
+
+    valcache)
+	# (the sample app has a valid signature; mode-bad.app is the same
+	# app with one byte of data changed)
+	cp $srcdir/sample-a.app mode-good.app
+	sed '10s/^\(.\{19\}\)./\1E/' mode-good.app >mode-bad.app
+	cmp mode-good.app mode-bad.app >/dev/null && sed '10s/^\(.\{19\}\)./\1F/' mode-good.app >mode-bad.app
+	echo "  Checking the sample application, and a damaged copy..."
+	echo "    ../src/rabbitsign -c mode-good.app"
+	$rabbitsign -c mode-good.app || { echo "error checking app ($?)" ; exit 2 ; }
+	echo "    ../src/rabbitsign -c mode-bad.app"
+	$rabbitsign -c mode-bad.app 2>/dev/null
+	test $? = 1 || { echo "damaged app was not rejected" ; exit 2 ; }
+	echo "  Checking the same applications twice using a validation cache..."
+	for j in 1 2 ; do
+	    echo "    ../src/rabbitsign --cache mode-cache -c mode-good.app"
+	    $rabbitsign --cache mode-cache -c mode-good.app 2>mode-err.txt || { echo "error checking app ($?)" ; exit 2 ; }
+	    echo "    ../src/rabbitsign --cache mode-cache -c mode-bad.app"
+	    $rabbitsign --cache mode-cache -c mode-bad.app 2>mode-err.txt
+	    test $? = 1 || { echo "damaged app was not rejected" ; exit 2 ; }
+	done
+	grep "cached result" mode-err.txt >/dev/null || { echo "cached result was not used" ; exit 1 ; }
+	echo "  Checking that --paranoid notices a change that keeps the modification time..."
+	echo "    ../src/rabbitsign --paranoid --cache mode-cache -c mode-good.app"
+	$rabbitsign --paranoid --cache mode-cache -c mode-good.app || { echo "error checking app ($?)" ; exit 2 ; }
+	touch -r mode-good.app mode-time
+	cat mode-bad.app >mode-good.app
+	touch -r mode-time mode-good.app
+	echo "    ../src/rabbitsign --paranoid --cache mode-cache -c mode-good.app"
+	$rabbitsign --paranoid --cache mode-cache -c mode-good.app 2>/dev/null
+	test $? = 1 || { echo "changed app was not rejected" ; exit 2 ; }
+	;;
+
+    containers)
+	make_apps 3
+	echo "  Signing the same applications by way of containers..."
+	for i in 1 2 3 ; do
+	    echo "    ../src/rabbitsign -r mode-$i.hex -o mode-$i.rsp"
+	    $rabbitsign -q -r mode-$i.hex -o mode-$i.rsp || { echo "error writing container ($?)" ; exit 2 ; }
+	    echo "    ../src/rabbitsign -r mode-$i.rsp -o mode-$i-p.app"
+	    $rabbitsign -q -r mode-$i.rsp -o mode-$i-p.app || { echo "error signing container ($?)" ; exit 2 ; }
+	    same mode-$i.app mode-$i-p.app
+	    echo "    ../src/rabbitsign -vv --trust-digest -r mode-$i.rsp -o mode-$i-t.app"
+	    $rabbitsign -vv --trust-digest -r mode-$i.rsp -o mode-$i-t.app 2>mode-err.txt || { echo "error signing container ($?)" ; exit 2 ; }
+	    same mode-$i.app mode-$i-t.app
+	    grep "using stored digest" mode-err.txt >/dev/null || { echo "stored digest was not used" ; exit 1 ; }
+	done
+	echo "  Checking that a stored digest covering too much data is ignored..."
+	printf '\377\377\377\377' | dd of=mode-1.rsp bs=1 seek=44 conv=notrunc 2>/dev/null
+	echo "    ../src/rabbitsign -vv --trust-digest -r mode-1.rsp -o mode-1-d.app"
+	$rabbitsign -vv --trust-digest -r mode-1.rsp -o mode-1-d.app 2>mode-err.txt || { echo "error signing container ($?)" ; exit 2 ; }
+	same mode-1.app mode-1-d.app
+	grep "using stored digest" mode-err.txt >/dev/null && { echo "invalid stored digest was used" ; exit 1 ; }
+	grep "ignoring stored digest" mode-err.txt >/dev/null || { echo "no warning about the stored digest" ; exit 1 ; }
+	;;
+
+    deltas)
+	make_apps 3
+	echo "  Signing the same applications by way of deltas..."
+	for i in 1 2 3 ; do
+	    for t in hex app ; do
+		# (the delta is in the input file's format; compare it with
+		# signing to a file of that format)
+		test $t = hex && in=mode-$i.hex || in=mode-$i.app
+		echo "    ../src/rabbitsign -r $in -o mode-$i-s.$t"
+		$rabbitsign -q -r $in -o mode-$i-s.$t || { echo "error signing app ($?)" ; exit 2 ; }
+		echo "    ../src/rabbitsign --delta -r $in -o mode-$i-$t.rsd"
+		$rabbitsign -q --delta -r $in -o mode-$i-$t.rsd || { echo "error writing delta ($?)" ; exit 2 ; }
+		cp $in mode-$i-d.$t
+		echo "    ../src/rabbitsign --apply -o mode-$i-d.$t mode-$i-$t.rsd"
+		$rabbitsign --apply -o mode-$i-d.$t mode-$i-$t.rsd || { echo "error applying delta ($?)" ; exit 2 ; }
+		same mode-$i-s.$t mode-$i-d.$t
+	    done
+	done
+	echo "  Signing a large application by way of a delta that adds more than 64k..."
+	$TEST_EXEC ./randapp 0104 100000 >mode-big.hex || { echo "error generating app ($?)" ; exit 1 ; }
+	echo "    ../src/rabbitsign --record-size 1 -r mode-big.hex -o mode-big-s.hex"
+	$rabbitsign -q -p -P --record-size 1 -r mode-big.hex -o mode-big-s.hex || { echo "error signing app ($?)" ; exit 2 ; }
+	echo "    ../src/rabbitsign --delta --record-size 1 -r mode-big.hex -o mode-big.rsd"
+	$rabbitsign -q -p -P --delta --record-size 1 -r mode-big.hex -o mode-big.rsd || { echo "error writing delta ($?)" ; exit 2 ; }
+	cp mode-big.hex mode-big-d.hex
+	echo "    ../src/rabbitsign --apply -o mode-big-d.hex mode-big.rsd"
+	$rabbitsign --apply -o mode-big-d.hex mode-big.rsd || { echo "error applying delta ($?)" ; exit 2 ; }
+	same mode-big-s.hex mode-big-d.hex
+	echo "  Checking that a delta is not applied to the wrong file..."
+	sed '3s/^\(.\{19\}\)./\1E/' mode-1.hex >mode-w.hex
+	cmp mode-1.hex mode-w.hex >/dev/null && sed '3s/^\(.\{19\}\)./\1F/' mode-1.hex >mode-w.hex
+	cp mode-w.hex mode-w0.hex
+	echo "    ../src/rabbitsign --apply -o mode-w.hex mode-1-hex.rsd"
+	$rabbitsign --apply -o mode-w.hex mode-1-hex.rsd 2>/dev/null && { echo "delta was applied to the wrong file" ; exit 1 ; }
+	same mode-w0.hex mode-w.hex
+	;;
+
+    midstates)
+	# (use an app several pages long, so there are some pages to skip)
+	echo "  Generating and signing a large application..."
+	$TEST_EXEC ./randapp 0104 100000 >mode-1.hex || { echo "error generating app ($?)" ; exit 1 ; }
+	$rabbitsign -q -p -P -r mode-1.hex -o mode-1.app || { echo "error signing app ($?)" ; exit 2 ; }
+	echo "  Signing the same application twice with --midstates..."
+	for j in 1 2 ; do
+	    echo "    ../src/rabbitsign -vv -p -P --midstates -r mode-1.hex -o mode-1-m$j.app"
+	    $rabbitsign -vv -p -P --midstates -r mode-1.hex -o mode-1-m$j.app 2>mode-err.txt || { echo "error signing app ($?)" ; exit 2 ; }
+	    same mode-1.app mode-1-m$j.app
+	done
+	grep "resuming hash at page [1-9]" mode-err.txt >/dev/null || { echo "saved hash states were not used" ; exit 1 ; }
+	echo "  Changing one byte in the middle of the application..."
+	n=`wc -l <mode-1.hex`
+	n=`expr $n / 2`
+	sed "${n}s/^\\(.\\{19\\}\\)./\\1E/" mode-1.hex >mode-2.hex
+	cmp mode-1.hex mode-2.hex >/dev/null && sed "${n}s/^\\(.\\{19\\}\\)./\\1F/" mode-1.hex >mode-2.hex
+	cp mode-2.hex mode-1.hex
+	# (the changed record's checksum is wrong, which rabbitsign warns about)
+	$rabbitsign -q -p -P -r mode-1.hex -o mode-1.app 2>/dev/null || { echo "error signing app ($?)" ; exit 2 ; }
+	echo "    ../src/rabbitsign -p -P --midstates -r mode-1.hex -o mode-1-m3.app"
+	$rabbitsign -q -p -P --midstates -r mode-1.hex -o mode-1-m3.app 2>/dev/null || { echo "error signing app ($?)" ; exit 2 ; }
+	same mode-1.app mode-1-m3.app
+	;;
+
+    targets)
+	make_apps 2
+	cp $srcdir/../keys/0104.key mode-0104.key
+	echo "  Signing the same applications with each root number..."
+	for i in 1 2 ; do
+	    for r in 1 2 3 ; do
+		$rabbitsign -q -R $r -r mode-$i.hex -o mode-$i-r$r.app || { echo "error signing app ($?)" ; exit 2 ; }
+	    done
+	    echo "    ../src/rabbitsign -r mode-$i.hex --target ,,mode-$i-t0.app --target 0104,1,mode-$i-t1.app --target mode-0104.key,2,mode-$i-t2.app --target ,3,mode-$i-t3.app"
+	    $rabbitsign -q -r mode-$i.hex --target ,,mode-$i-t0.app \
+		--target 0104,1,mode-$i-t1.app \
+		--target mode-0104.key,2,mode-$i-t2.app \
+		--target ,3,mode-$i-t3.app || { echo "error signing app ($?)" ; exit 2 ; }
+	    same mode-$i.app mode-$i-t0.app
+	    for r in 1 2 3 ; do
+		same mode-$i-r$r.app mode-$i-t$r.app
+	    done
+	done
+	;;
+
+    watch)
+	# (wait up to 30 seconds for rabbitsign to report N files)
+	wait_watch() {
+	    n=0
+	    while test `wc -l <mode-watch.txt` -lt $1 ; do
+		n=`expr $n + 1`
+		test $n -le 30 || { kill -INT $pid ; echo "files not signed in time" ; exit 2 ; }
+		sleep 1
+	    done
+	}
+	test "`uname -s`" = "Linux" || { echo "  --watch not supported; skipping" ; exit 0 ; }
+	( timeout --version ) >/dev/null 2>&1 || { echo "  timeout not found; skipping" ; exit 0 ; }
+	make_apps 3
+	mkdir mode-dir
+	cp mode-1.hex mode-2.hex mode-dir/
+	echo "  Signing the same applications in a watched directory..."
+	echo "    timeout -s INT 120 ../src/rabbitsign -r --watch mode-dir"
+	timeout -s INT 120 $rabbitsign -q -r --watch mode-dir >mode-watch.txt &
+	pid=$!
+	wait_watch 2
+	cp mode-3.hex mode-dir/.mode-3.hex
+	mv mode-dir/.mode-3.hex mode-dir/mode-3.hex
+	wait_watch 3
+	kill -INT $pid
+	wait $pid
+	test `grep -c "^ok" mode-watch.txt` = 3 || { echo "error signing apps" ; cat mode-watch.txt ; exit 2 ; }
+	for i in 1 2 3 ; do
+	    same mode-$i.app mode-dir/signed/mode-$i.app
+	done
+	echo "  Checking that the same files are not signed again on restart..."
+	echo "    timeout -s INT 2 ../src/rabbitsign -r --watch mode-dir"
+	timeout -s INT 2 $rabbitsign -q -r --watch mode-dir >mode-watch.txt
+	test -s mode-watch.txt && { echo "files signed again" ; cat mode-watch.txt ; exit 1 ; }
+	;;
+
+    server)
+	test -x ../src/rabbitsignd || { echo "  rabbitsignd not built; skipping" ; exit 0 ; }
+	make_apps 3
+	echo "  Generating and signing 2 random OSes..."
+	for i in 1 2 ; do
+	    $TEST_EXEC ./randapp -o 20000 >mode-os$i.hex || { echo "error generating OS ($?)" ; exit 1 ; }
+	    $rabbitsign -q -r mode-os$i.hex -o mode-os$i.8xu || { echo "error signing OS ($?)" ; exit 2 ; }
+	done
+	echo "  Starting a signing server..."
+	echo "    ../src/rabbitsignd -K 0104 -K 05 -s mode-sock"
+	$TEST_EXEC ../src/rabbitsignd -q -K 0104 -K 05 -s mode-sock &
+	pid=$!
+	n=0
+	while test ! -S mode-sock ; do
+	    n=`expr $n + 1`
+	    test $n -le 30 || { kill $pid ; echo "server did not start" ; exit 2 ; }
+	    sleep 1
+	done
+	echo "  Signing the same applications using the server..."
+	for i in 1 2 3 ; do
+	    echo "    ../src/rabbitsign --server mode-sock -r mode-$i.hex -o mode-$i-s.app"
+	    $rabbitsign -q --server mode-sock -r mode-$i.hex -o mode-$i-s.app || { kill $pid ; echo "error signing app ($?)" ; exit 2 ; }
+	    same mode-$i.app mode-$i-s.app
+	done
+	echo "  Signing the same OSes using the server..."
+	for i in 1 2 ; do
+	    echo "    ../src/rabbitsign --server mode-sock -r mode-os$i.hex -o mode-os$i-s.8xu"
+	    $rabbitsign -q --server mode-sock -r mode-os$i.hex -o mode-os$i-s.8xu || { kill $pid ; echo "error signing OS ($?)" ; exit 2 ; }
+	    same mode-os$i.8xu mode-os$i-s.8xu
+	    echo "    ../src/rabbitsign --server mode-sock -c mode-os$i-s.8xu"
+	    $rabbitsign -q --server mode-sock -c mode-os$i-s.8xu || { e=$? ; kill $pid ; echo "error validating OS ($e)" ; exit 3 ; }
+	done
+	echo "  Checking that the server refuses to sign a Rabin digest..."
+	for r in 0 1 2 3 ; do
+	    echo "    ./sigreq mode-sock 0104 rabin $r"
+	    $TEST_EXEC ./sigreq mode-sock 0104 rabin $r 2>/dev/null
+	    e=$?
+	    test $e = 1 || { kill $pid ; echo "Rabin digest not refused ($e)" ; exit 1 ; }
+	done
+	echo "    ./sigreq mode-sock 05 rsa"
+	$TEST_EXEC ./sigreq mode-sock 05 rsa || { kill $pid ; echo "error signing RSA digest ($?)" ; exit 2 ; }
+	kill $pid
+	{ wait $pid ; } 2>/dev/null
+	;;
+
+    allocator)
+	make_apps 2
+	cp $srcdir/../keys/0104.key mode-0104.key
+	echo "  Signing applications using a counting allocator..."
+	for i in 1 2 ; do
+	    echo "    ./alloctest mode-0104.key mode-$i.hex"
+	    $TEST_EXEC ./alloctest mode-0104.key mode-$i.hex >/dev/null || { echo "error in allocation test ($?)" ; exit 1 ; }
+	done
+	echo "    ./alloctest mode-0104.key $srcdir/sample-a.app"
+	$TEST_EXEC ./alloctest mode-0104.key $srcdir/sample-a.app >/dev/null || { echo "error in allocation test ($?)" ; exit 1 ; }
+	;;
+
+    outsize)
+	make_apps 2
+	echo "  Generating a random OS..."
+	$TEST_EXEC ./randapp -o 20000 >mode-os.hex || { echo "error generating OS ($?)" ; exit 1 ; }
+	$rabbitsign -q -r mode-1.hex -o mode-1.8xk || { echo "error signing app ($?)" ; exit 2 ; }
+	$rabbitsign -q -r mode-os.hex -o mode-os.8xu || { echo "error signing OS ($?)" ; exit 2 ; }
+	echo "  Comparing predicted and actual output sizes..."
+	for f in mode-1.8xk mode-2.hex mode-os.hex mode-os.8xu $srcdir/sample-a.app ; do
+	    echo "    ./sizetest $f"
+	    $TEST_EXEC ./sizetest $f || { echo "error in output size test ($?)" ; exit 1 ; }
+	done
+	;;
+
+    rsverify)
+	# (check the result reported for each file in a directory)
+	result() {
+	    grep "^{\"file\":\"mode-dir/$1\"," mode-report.txt | grep "\"result\":\"$2\"" >/dev/null \
+		|| { echo "wrong result for $1 (expected $2)" ; cat mode-report.txt ; exit 1 ; }
+	}
+	echo "  Generating and signing a random OS..."
+	$TEST_EXEC ./randapp -o 20000 >mode-os.hex || { echo "error generating OS ($?)" ; exit 1 ; }
+	mkdir mode-dir
+	$rabbitsign -q -r mode-os.hex -o mode-dir/good.8xu || { echo "error signing OS ($?)" ; exit 2 ; }
+	sed '10s/^\(.\{19\}\)./\1A/' mode-dir/good.8xu >mode-dir/bad.8xu
+	cmp mode-dir/good.8xu mode-dir/bad.8xu >/dev/null && sed '10s/^\(.\{19\}\)./\1B/' mode-dir/good.8xu >mode-dir/bad.8xu
+	echo "not a program" >mode-dir/junk.8xk
+	echo "not a program either" >mode-dir/notes.txt
+	echo "  Checking a directory with a valid, a damaged, and an invalid file..."
+	echo "    ../src/rsverify -q mode-dir"
+	$TEST_EXEC ../src/rsverify -q mode-dir >mode-report.txt
+	e=$?
+	test $e = 1 || { echo "wrong exit status ($e)" ; exit 1 ; }
+	result good.8xu ok
+	result bad.8xu signature-incorrect
+	result junk.8xk unknown-file-format
+	test `wc -l <mode-report.txt` = 3 || { echo "wrong number of files checked" ; cat mode-report.txt ; exit 1 ; }
+	echo "  Checking the valid file alone..."
+	echo "    ../src/rsverify -q mode-dir/good.8xu"
+	$TEST_EXEC ../src/rsverify -q mode-dir/good.8xu >mode-report.txt || { echo "error checking OS ($?)" ; exit 1 ; }
+	result good.8xu ok
+	;;
+
+    records)
+	make_apps 2
+	echo "  Generating and signing a random OS..."
+	$TEST_EXEC ./randapp -o 20000 >mode-os.hex || { echo "error generating OS ($?)" ; exit 1 ; }
+	$rabbitsign -q -r mode-os.hex -o mode-os.8xu || { echo "error signing OS ($?)" ; exit 2 ; }
+	echo "  Signing with other record sizes, and reading the results back..."
+	for n in 1 7 255 ; do
+	    for f in 1.hex:1.app 2.hex:2.app os.hex:os.8xu ; do
+		in=mode-${f%%:*}
+		out=mode-${f##*:}
+		sfx=${out##*.}
+		echo "    ../src/rabbitsign --record-size $n -r $in -o mode-r$n.$sfx"
+		$rabbitsign -q --record-size $n -r $in -o mode-r$n.$sfx || { echo "error signing ($?)" ; exit 2 ; }
+		cmp $out mode-r$n.$sfx >/dev/null 2>&1 && { echo "record size $n was not used" ; exit 1 ; }
+		if test $sfx = 8xu ; then
+		    echo "    ../src/rabbitsign -c mode-r$n.$sfx"
+		    $rabbitsign -q -c mode-r$n.$sfx || { echo "error validating ($?)" ; exit 3 ; }
+		fi
+		echo "    ../src/rabbitsign -r mode-r$n.$sfx -o mode-r$n-32.$sfx"
+		$rabbitsign -q -r mode-r$n.$sfx -o mode-r$n-32.$sfx || { echo "error signing ($?)" ; exit 2 ; }
+		same $out mode-r$n-32.$sfx
+	    done
+	done
+	echo "  Checking that invalid record sizes are rejected..."
+	for n in 0 256 ; do
+	    echo "    ../src/rabbitsign --record-size $n -r mode-1.hex -o mode-bad.app"
+	    $rabbitsign -q --record-size $n -r mode-1.hex -o mode-bad.app 2>/dev/null && { echo "record size $n accepted" ; exit 1 ; }
+	    test -f mode-bad.app && { echo "record size $n wrote a file" ; exit 1 ; }
+	done
+	;;
+
+    outputs)
+	make_apps 2
+	echo "  Signing each application to several files at once..."
+	for i in 1 2 ; do
+	    for t in app 8xk rsp ; do
+		$rabbitsign -q -r mode-$i.hex -o mode-$i-1.$t || { echo "error signing app ($?)" ; exit 2 ; }
+	    done
+	    echo "    ../src/rabbitsign -r mode-$i.hex -o mode-$i-m.app -o mode-$i-m.8xk -o mode-$i-m.rsp"
+	    $rabbitsign -q -r mode-$i.hex -o mode-$i-m.app -o mode-$i-m.8xk -o mode-$i-m.rsp || { echo "error signing app ($?)" ; exit 2 ; }
+	    for t in app 8xk rsp ; do
+		same mode-$i-1.$t mode-$i-m.$t
+	    done
+	done
+	;;
+
+    *)
+	echo "unknown mode $1"
+	exit 99
+	;;
+esac
+
+rm -rf mode-*
+exit 0